@@ -37,6 +37,11 @@ void db__msg_store_ref_inc(struct mosquitto_msg_store *store)
 	UNUSED(store);
 }
 
+void db__msg_store_ref_dec(struct mosquitto_msg_store **store)
+{
+	UNUSED(store);
+}
+
 int handle__packet(struct mosquitto *context)
 {
 	UNUSED(context);
@@ -77,6 +82,17 @@ int mux__remove_out(struct mosquitto *mosq)
 	return 0;
 }
 
+void mux__ready_add(struct mosquitto *context)
+{
+	UNUSED(context);
+}
+
+int io_threads__write(struct mosquitto *context)
+{
+	UNUSED(context);
+	return 0;
+}
+
 ssize_t net__read(struct mosquitto *mosq, void *buf, size_t count)
 {
 	UNUSED(mosq);
@@ -93,11 +109,17 @@ ssize_t net__write(struct mosquitto *mosq, const void *buf, size_t count)
 	return 0;
 }
 
-int retain__store(const char *topic, struct mosquitto_msg_store *stored, char **split_topics)
+ssize_t net__writev(struct mosquitto *mosq, const struct iovec *iov, int iovcnt)
+{
+	UNUSED(mosq);
+	UNUSED(iov);
+	UNUSED(iovcnt);
+	return 0;
+}
+
+int retain__store(struct mosquitto_msg_store *stored)
 {
-	UNUSED(topic);
 	UNUSED(stored);
-	UNUSED(split_topics);
 	return 0;
 }
 
@@ -128,6 +150,12 @@ int keepalive__update(struct mosquitto *context)
 	return 0;
 }
 
+void do_disconnect(struct mosquitto *context, int reason)
+{
+	UNUSED(context);
+	UNUSED(reason);
+}
+
 void db__msg_add_to_inflight_stats(struct mosquitto_msg_data *msg_data, struct mosquitto_client_msg *msg)
 {
 	UNUSED(msg_data);
@@ -146,3 +174,34 @@ int session_expiry__add_from_persistence(struct mosquitto *context, time_t expir
 	UNUSED(expiry_time);
 	return 0;
 }
+
+int db__message_remove_by_mid(struct mosquitto *context, enum mosquitto_msg_direction dir, uint16_t mid)
+{
+	UNUSED(context);
+	UNUSED(dir);
+	UNUSED(mid);
+	return 0;
+}
+
+void db__msg_store_compact(void)
+{
+}
+
+int sub__remove(struct mosquitto *context, const char *sub, struct mosquitto__subhier *root, uint8_t *reason)
+{
+	UNUSED(context);
+	UNUSED(sub);
+	UNUSED(root);
+	UNUSED(reason);
+	return 0;
+}
+
+void session_expiry__remove(struct mosquitto *context)
+{
+	UNUSED(context);
+}
+
+void context__add_to_disused(struct mosquitto *context)
+{
+	UNUSED(context);
+}
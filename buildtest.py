@@ -7,6 +7,7 @@ build_variants = [
     'WITH_DOCS',
     'WITH_EC',
     'WITH_EPOLL',
+    'WITH_IO_URING',
     'WITH_MEMORY_TRACKING',
     'WITH_PERSISTENCE',
     'WITH_SHARED_LIBRARIES',
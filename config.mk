@@ -28,7 +28,8 @@ WITH_TLS:=yes
 # This must be disabled if using openssl < 1.0.
 WITH_TLS_PSK:=yes
 
-# Comment out to disable client threading support.
+# Comment out to disable client threading support and the broker password
+# hashing and I/O threads.
 WITH_THREADING:=yes
 
 # Comment out to remove bridge support from the broker. This allow the broker
@@ -98,6 +99,10 @@ WITH_SHARED_LIBRARIES:=yes
 # Build with epoll support.
 WITH_EPOLL:=yes
 
+# Build with io_uring support for network events in the broker. Requires
+# WITH_EPOLL, which is used instead if the kernel doesn't support io_uring.
+WITH_IO_URING:=no
+
 # Build with bundled uthash.h
 WITH_BUNDLED_DEPS:=yes
 
@@ -116,6 +121,9 @@ WITH_CONTROL:=yes
 # Build the broker with the jemalloc allocator
 WITH_JEMALLOC:=no
 
+# Build the broker with zlib support, for compressing bridge message batches.
+WITH_ZLIB:=no
+
 # Build with xtreport capability. This is for debugging purposes and is
 # probably of no particular interest to end users.
 WITH_XTREPORT=no
@@ -256,6 +264,8 @@ endif
 ifeq ($(WITH_THREADING),yes)
 	LIB_LDFLAGS:=$(LIB_LDFLAGS) -pthread
 	LIB_CPPFLAGS:=$(LIB_CPPFLAGS) -DWITH_THREADING
+	BROKER_CPPFLAGS:=$(BROKER_CPPFLAGS) -DWITH_THREADING
+	BROKER_LDFLAGS:=$(BROKER_LDFLAGS) -pthread
 	CLIENT_CPPFLAGS:=$(CLIENT_CPPFLAGS) -DWITH_THREADING
 	STATIC_LIB_DEPS:=$(STATIC_LIB_DEPS) -pthread
 endif
@@ -322,6 +332,11 @@ ifeq ($(WITH_JEMALLOC),yes)
 	BROKER_LDADD:=$(BROKER_LDADD) -ljemalloc
 endif
 
+ifeq ($(WITH_ZLIB),yes)
+	BROKER_CPPFLAGS:=$(BROKER_CPPFLAGS) -DWITH_ZLIB
+	BROKER_LDADD:=$(BROKER_LDADD) -lz
+endif
+
 ifeq ($(WITH_UNIX_SOCKETS),yes)
 	BROKER_CPPFLAGS:=$(BROKER_CPPFLAGS) -DWITH_UNIX_SOCKETS
 	LIB_CPPFLAGS:=$(LIB_CPPFLAGS) -DWITH_UNIX_SOCKETS
@@ -351,6 +366,14 @@ ifeq ($(WITH_EPOLL),yes)
 	endif
 endif
 
+ifeq ($(WITH_IO_URING),yes)
+	ifeq ($(WITH_EPOLL),yes)
+		ifeq ($(UNAME),Linux)
+			BROKER_CPPFLAGS:=$(BROKER_CPPFLAGS) -DWITH_IO_URING
+		endif
+	endif
+endif
+
 ifeq ($(WITH_BUNDLED_DEPS),yes)
 	BROKER_CPPFLAGS:=$(BROKER_CPPFLAGS) -I../deps
 	LIB_CPPFLAGS:=$(LIB_CPPFLAGS) -I../deps
@@ -429,6 +429,20 @@ mosq_EXPORT const char *mosquitto_client_username(const struct mosquitto *client
 mosq_EXPORT int mosquitto_set_username(struct mosquitto *client, const char *username);
 
 
+/* Function: mosquitto_acl_cache_invalidate
+ *
+ * Discard the ACL check results cached for all clients.
+ *
+ * When the acl_cache_size option is set, the broker remembers the result of
+ * ACL checks for each client. A plugin whose access control decisions have
+ * changed, for example because its configuration has been updated at run
+ * time, must call this function so that subsequent checks are passed to the
+ * plugin again. Changes made through <mosquitto_set_username> do not need
+ * this.
+ */
+mosq_EXPORT void mosquitto_acl_cache_invalidate(void);
+
+
 /* =========================================================================
  *
  * Section: Client control
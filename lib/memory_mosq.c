@@ -18,6 +18,8 @@ Contributors:
 
 #include "config.h"
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -162,3 +164,234 @@ char *mosquitto__strdup(const char *s)
 
 	return str;
 }
+
+#ifdef WITH_BROKER
+/* Slab pools.
+ *
+ * Objects are grouped into size classes of MEMORY_SLAB_CLASS_STEP bytes. Each
+ * class allocates slabs of MEMORY_SLAB_OBJECTS objects at a time and hands
+ * out objects from a free list, so creating and freeing an object does not
+ * normally touch malloc. Every object is preceded by a header pointing at its
+ * slab. A slab is released once all of its objects have been freed, apart
+ * from a single empty slab per class that is kept to avoid thrashing.
+ *
+ * Slabs are allocated with mosquitto__malloc(), so they count against
+ * memory_limit in the same way as any other allocation.
+ *
+ * Neither the pools nor the memory tracking counters have any locking. The
+ * broker's password hashing and I/O threads must not allocate or free memory
+ * with any of these functions: they only use memory allocated by the main
+ * thread, and hand it back to the main thread to be freed.
+ */
+
+#define MEMORY_SLAB_CLASS_STEP 64
+#define MEMORY_SLAB_OBJECTS 64
+
+struct mosquitto__slab;
+
+union mosquitto__slab_header{
+	struct mosquitto__slab *slab; /* NULL for objects too large for a pool */
+	union mosquitto__slab_header *next_free;
+	uint64_t align_u64;
+	double align_d;
+};
+
+struct mosquitto__slab_pool{
+	struct mosquitto__slab *partial; /* Slabs with at least one free object */
+	struct mosquitto__slab *empty;
+	size_t stride;
+	unsigned long used;
+	unsigned long slabs;
+};
+
+struct mosquitto__slab{
+	struct mosquitto__slab *prev;
+	struct mosquitto__slab *next;
+	struct mosquitto__slab_pool *pool;
+	union mosquitto__slab_header *free_list;
+	unsigned int used;
+	bool in_partial;
+};
+
+static struct mosquitto__slab_pool slab_pools[MEMORY_SLAB_CLASSES];
+
+
+static void slab__partial_add(struct mosquitto__slab_pool *pool, struct mosquitto__slab *slab)
+{
+	slab->prev = NULL;
+	slab->next = pool->partial;
+	if(pool->partial){
+		pool->partial->prev = slab;
+	}
+	pool->partial = slab;
+	slab->in_partial = true;
+}
+
+
+static void slab__partial_remove(struct mosquitto__slab_pool *pool, struct mosquitto__slab *slab)
+{
+	if(slab->prev){
+		slab->prev->next = slab->next;
+	}else{
+		pool->partial = slab->next;
+	}
+	if(slab->next){
+		slab->next->prev = slab->prev;
+	}
+	slab->prev = NULL;
+	slab->next = NULL;
+	slab->in_partial = false;
+}
+
+
+static struct mosquitto__slab *slab__new(struct mosquitto__slab_pool *pool)
+{
+	struct mosquitto__slab *slab;
+	union mosquitto__slab_header *obj;
+	size_t header_len;
+	int i;
+
+	header_len = (sizeof(struct mosquitto__slab) + sizeof(union mosquitto__slab_header) - 1)
+		/ sizeof(union mosquitto__slab_header) * sizeof(union mosquitto__slab_header);
+
+	slab = (struct mosquitto__slab *)mosquitto__malloc(header_len + pool->stride*MEMORY_SLAB_OBJECTS);
+	if(slab == NULL) return NULL;
+
+	slab->prev = NULL;
+	slab->next = NULL;
+	slab->pool = pool;
+	slab->used = 0;
+	slab->in_partial = false;
+	slab->free_list = NULL;
+	for(i=MEMORY_SLAB_OBJECTS-1; i>=0; i--){
+		obj = (union mosquitto__slab_header *)((uint8_t *)slab + header_len + pool->stride*(size_t)i);
+		obj->next_free = slab->free_list;
+		slab->free_list = obj;
+	}
+	pool->slabs++;
+
+	return slab;
+}
+
+
+void *mosquitto__slab_calloc(size_t size)
+{
+	struct mosquitto__slab_pool *pool;
+	struct mosquitto__slab *slab;
+	union mosquitto__slab_header *obj;
+	size_t class_index;
+
+	class_index = (size + MEMORY_SLAB_CLASS_STEP - 1) / MEMORY_SLAB_CLASS_STEP;
+	if(class_index == 0 || class_index > MEMORY_SLAB_CLASSES){
+		obj = (union mosquitto__slab_header *)mosquitto__calloc(1, sizeof(union mosquitto__slab_header) + size);
+		if(obj == NULL) return NULL;
+		obj->slab = NULL;
+		return &obj[1];
+	}
+	pool = &slab_pools[class_index-1];
+	if(pool->stride == 0){
+		pool->stride = sizeof(union mosquitto__slab_header) + class_index*MEMORY_SLAB_CLASS_STEP;
+	}
+
+	slab = pool->partial;
+	if(slab == NULL){
+		if(pool->empty){
+			slab = pool->empty;
+			pool->empty = NULL;
+		}else{
+			slab = slab__new(pool);
+			if(slab == NULL) return NULL;
+		}
+		slab__partial_add(pool, slab);
+	}
+
+	obj = slab->free_list;
+	slab->free_list = obj->next_free;
+	if(slab->free_list == NULL){
+		slab__partial_remove(pool, slab);
+	}
+	slab->used++;
+	pool->used++;
+
+	obj->slab = slab;
+	memset(&obj[1], 0, pool->stride - sizeof(union mosquitto__slab_header));
+	return &obj[1];
+}
+
+
+void mosquitto__slab_free(void *mem)
+{
+	struct mosquitto__slab_pool *pool;
+	struct mosquitto__slab *slab;
+	union mosquitto__slab_header *obj;
+
+	if(mem == NULL) return;
+
+	obj = &((union mosquitto__slab_header *)mem)[-1];
+	slab = obj->slab;
+	if(slab == NULL){
+		mosquitto__free(obj);
+		return;
+	}
+	pool = slab->pool;
+
+	obj->next_free = slab->free_list;
+	slab->free_list = obj;
+	slab->used--;
+	pool->used--;
+
+	if(slab->used == 0){
+		if(slab->in_partial){
+			slab__partial_remove(pool, slab);
+		}
+		if(pool->empty == NULL){
+			pool->empty = slab;
+		}else{
+			mosquitto__free(slab);
+			pool->slabs--;
+		}
+	}else if(slab->in_partial == false){
+		slab__partial_add(pool, slab);
+	}
+}
+
+
+void memory__slab_stats(int class_index, size_t *size, unsigned long *used, unsigned long *free_count)
+{
+	struct mosquitto__slab_pool *pool;
+
+	pool = &slab_pools[class_index];
+	*size = (size_t)(class_index+1)*MEMORY_SLAB_CLASS_STEP;
+	*used = pool->used;
+	*free_count = pool->slabs*MEMORY_SLAB_OBJECTS - pool->used;
+}
+
+
+/* Release the cached empty slabs. Slabs that still have objects in use are
+ * left alone. */
+void memory__slab_cleanup(void)
+{
+	int i;
+
+	for(i=0; i<MEMORY_SLAB_CLASSES; i++){
+		if(slab_pools[i].empty){
+			mosquitto__free(slab_pools[i].empty);
+			slab_pools[i].empty = NULL;
+			slab_pools[i].slabs--;
+		}
+	}
+}
+
+#else
+
+void *mosquitto__slab_calloc(size_t size)
+{
+	return mosquitto__calloc(1, size);
+}
+
+
+void mosquitto__slab_free(void *mem)
+{
+	mosquitto__free(mem);
+}
+#endif
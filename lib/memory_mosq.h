@@ -38,8 +38,20 @@ unsigned long mosquitto__max_memory_used(void);
 void *mosquitto__realloc(void *ptr, size_t size);
 char *mosquitto__strdup(const char *s);
 
+/* Allocate and free small, fixed size objects that are created and freed at
+ * a high rate. Memory from mosquitto__slab_calloc() must only be freed with
+ * mosquitto__slab_free(). */
+void *mosquitto__slab_calloc(size_t size);
+void mosquitto__slab_free(void *mem);
+
 #ifdef WITH_BROKER
+/* In the broker, all of the functions above must only be called from the main
+ * thread. */
+#define MEMORY_SLAB_CLASSES 8
+
 void memory__set_limit(size_t lim);
+void memory__slab_stats(int class_index, size_t *size, unsigned long *used, unsigned long *free_count);
+void memory__slab_cleanup(void);
 #endif
 
 #endif
@@ -116,6 +116,7 @@ enum mosquitto_client_state {
 	mosq_cs_disused = 19, /* client that has been added to the disused list to be freed */
 	mosq_cs_authenticating = 20, /* Client has sent CONNECT but is still undergoing extended authentication */
 	mosq_cs_reauthenticating = 21, /* Client is undergoing reauthentication and shouldn't do anything else until complete */
+	mosq_cs_delayed_auth = 22, /* Client has sent CONNECT and is waiting for its password to be checked */
 };
 
 enum mosquitto__protocol {
@@ -145,15 +146,19 @@ struct mosquitto__alias{
 	uint16_t alias;
 };
 
-struct session_expiry_list {
-	struct mosquitto *context;
-	struct session_expiry_list *prev;
-	struct session_expiry_list *next;
+/* Broker timer wheel entry. */
+struct mosquitto__timer{
+	struct mosquitto__timer *prev;
+	struct mosquitto__timer *next;
+	struct mosquitto__timer **slot; /* List the timer is linked into, NULL when not armed */
+	void *data;
+	time_t expiry;
 };
 
 struct mosquitto__packet{
 	uint8_t *payload;
 	struct mosquitto__packet *next;
+	struct mosquitto_msg_store *store; /* Broker only: shared PUBLISH payload, sent after payload */
 	uint32_t remaining_mult;
 	uint32_t remaining_length;
 	uint32_t packet_length;
@@ -182,15 +187,10 @@ enum mosquitto__keyform {
 };
 #endif
 
-struct will_delay_list {
-	struct mosquitto *context;
-	struct will_delay_list *prev;
-	struct will_delay_list *next;
-};
-
 struct mosquitto_msg_data{
 #ifdef WITH_BROKER
 	struct mosquitto_client_msg *inflight;
+	struct mosquitto_client_msg *inflight_by_mid; /* Messages in inflight with mid != 0, hashed by mid */
 	struct mosquitto_client_msg *queued;
 	long inflight_bytes;
 	long inflight_bytes12;
@@ -241,7 +241,6 @@ struct mosquitto {
 	struct mosquitto__packet *out_packet;
 	struct mosquitto_message_all *will;
 	struct mosquitto__alias *aliases;
-	struct will_delay_list *will_delay_entry;
 	int alias_count;
 	int out_packet_count;
 	uint32_t will_delay_interval;
@@ -290,9 +289,26 @@ struct mosquitto {
 	bool is_dropping;
 	bool is_bridge;
 	struct mosquitto__bridge *bridge;
+	bool bridge_batch; /* This client may send message batches */
+	uint8_t bridge_batch_compression;
+	bool bridge_loop; /* Messages sent to this client carry their origin */
 	struct mosquitto_msg_data msgs_in;
 	struct mosquitto_msg_data msgs_out;
 	struct mosquitto__acl_user *acl_list;
+	struct mosquitto__acl_node *acl_patterns; /* Pattern ACLs with %c and %u substituted */
+	struct mosquitto__acl_cache_entry *acl_cache;
+	int acl_cache_size;
+	struct mosquitto__auth_job *auth_job;
+	struct mosquitto__io_client *io_client; /* Set if the socket is read and written by an I/O thread */
+	uint8_t *in_unread; /* Read from the socket but not yet handled */
+	size_t in_unread_len;
+	struct mosquitto *write_deferred_next, *write_deferred_prev;
+	bool write_deferred; /* Has packets waiting for packet__write_deferred() */
+	struct mosquitto *read_ready_next, *read_ready_prev;
+	bool read_ready; /* Has input left over from its last read budget */
+	bool read_drained; /* The last read from the socket would have blocked */
+	int read_packets; /* Packets handled since the read budget was reset */
+	size_t read_bytes; /* Bytes read since the read budget was reset */
 	struct mosquitto__listener *listener;
 	struct mosquitto__packet *out_packet_last;
 	struct mosquitto__client_sub **subs;
@@ -355,7 +371,12 @@ struct mosquitto {
 	UT_hash_handle hh_id;
 	UT_hash_handle hh_sock;
 	struct mosquitto *for_free_next;
-	struct session_expiry_list *expiry_list_item;
+	struct mosquitto__timer keepalive_timer;
+	struct mosquitto__timer expiry_timer;
+	struct mosquitto__timer will_delay_timer;
+	uint64_t dest_id; /* Identifies this client in msg_store->dest_ids */
+	struct mosquitto__retain_cursor *retain_cursors; /* Retained messages still to send for new subscriptions */
+	struct mosquitto__spill *spill; /* Outgoing messages waiting on disk */
 	uint16_t remote_port;
 #endif
 	uint32_t events;
@@ -74,6 +74,7 @@ Contributors:
 #include "memory_mosq.h"
 #include "mqtt_protocol.h"
 #include "net_mosq.h"
+#include "packet_mosq.h"
 #include "time_mosq.h"
 #include "util_mosq.h"
 
@@ -210,6 +211,25 @@ int net__socket_close(struct mosquitto *mosq)
 #endif
 
 	assert(mosq);
+#ifdef WITH_BROKER
+	if(mosq->io_client){
+		io_threads__remove(mosq);
+	}
+	if(mosq->write_deferred){
+		/* Anything queued before the disconnect, such as a CONNACK or
+		 * DISCONNECT giving the reason, should still be sent. */
+		packet__write_deferred_remove(mosq);
+		packet__write(mosq);
+		/* Writing may have registered the socket for events again. */
+		mux__delete(mosq);
+	}
+	/* Input left over from this connection must not be handled as if it
+	 * came from a later one. */
+	mux__ready_remove(mosq);
+	mosquitto__free(mosq->in_unread);
+	mosq->in_unread = NULL;
+	mosq->in_unread_len = 0;
+#endif
 #ifdef WITH_TLS
 #ifdef WITH_WEBSOCKETS
 	if(!mosq->wsi)
@@ -717,6 +737,9 @@ static int net__init_ssl_ctx(struct mosquitto *mosq)
 			/* Use even less memory per SSL connection. */
 			SSL_CTX_set_mode(mosq->ssl_ctx, SSL_MODE_RELEASE_BUFFERS);
 #endif
+			/* A retried write may come from a different buffer, see
+			 * net__writev(). */
+			SSL_CTX_set_mode(mosq->ssl_ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 
 #if !defined(OPENSSL_NO_ENGINE)
 		if(mosq->tls_engine){
@@ -1025,6 +1048,62 @@ ssize_t net__write(struct mosquitto *mosq, const void *buf, size_t count)
 }
 
 
+#ifndef WIN32
+#if defined(WITH_TLS) && defined(WITH_BROKER)
+/* Small packets for a TLS connection are copied into this buffer so they can
+ * be sent with one SSL_write() call. The buffer is shared by all clients, so
+ * a retried SSL_write() may see a different buffer address to the first
+ * attempt, and more data if more packets have been queued since.
+ * SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER is set on the SSL_CTX to allow this. */
+static uint8_t tls_write_buf[16384];
+#endif
+
+/* Gather write. TLS connections write as much as fits in tls_write_buf in the
+ * broker, or only the first buffer otherwise. Callers must cope with short
+ * writes in any case. */
+ssize_t net__writev(struct mosquitto *mosq, const struct iovec *iov, int iovcnt)
+{
+	struct msghdr msg;
+#if defined(WITH_TLS) && defined(WITH_BROKER)
+	size_t len = 0, count;
+	int i;
+#endif
+
+	assert(mosq);
+	assert(iovcnt > 0);
+
+#ifdef WITH_TLS
+	if(mosq->ssl){
+#  ifdef WITH_BROKER
+		/* Whether the data is copied must only depend on the first buffer,
+		 * which is the same when the write is retried. The number of buffers
+		 * may have grown in the meantime. */
+		if(iov[0].iov_len < sizeof(tls_write_buf)){
+			for(i=0; i<iovcnt && len < sizeof(tls_write_buf); i++){
+				count = iov[i].iov_len;
+				if(count > sizeof(tls_write_buf) - len){
+					count = sizeof(tls_write_buf) - len;
+				}
+				memcpy(&tls_write_buf[len], iov[i].iov_base, count);
+				len += count;
+			}
+			return net__write(mosq, tls_write_buf, len);
+		}
+#  endif
+		return net__write(mosq, iov[0].iov_base, iov[0].iov_len);
+	}
+#endif
+
+	errno = 0;
+	memset(&msg, 0, sizeof(struct msghdr));
+	msg.msg_iov = (struct iovec *)iov;
+	msg.msg_iovlen = (size_t)iovcnt;
+
+	return sendmsg(mosq->sock, &msg, MSG_NOSIGNAL);
+}
+#endif
+
+
 int net__socket_nonblock(mosq_sock_t *sock)
 {
 #ifndef WIN32
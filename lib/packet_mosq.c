@@ -37,6 +37,7 @@ Contributors:
 #include "packet_mosq.h"
 #include "read_handle.h"
 #include "util_mosq.h"
+#include "utlist.h"
 #ifdef WITH_BROKER
 #  include "sys_tree.h"
 #  include "send_mosq.h"
@@ -47,10 +48,12 @@ Contributors:
 #  define G_PUB_MSGS_SENT_INC(A)
 #endif
 
+
 int packet__alloc(struct mosquitto__packet *packet)
 {
 	uint8_t remaining_bytes[5], byte;
 	uint32_t remaining_length;
+	uint32_t alloc_length;
 	int i;
 
 	assert(packet);
@@ -70,10 +73,17 @@ int packet__alloc(struct mosquitto__packet *packet)
 	}while(remaining_length > 0 && packet->remaining_count < 5);
 	if(packet->remaining_count == 5) return MOSQ_ERR_PAYLOAD_SIZE;
 	packet->packet_length = packet->remaining_length + 1 + (uint8_t)packet->remaining_count;
+	alloc_length = packet->packet_length;
+#ifdef WITH_BROKER
+	if(packet->store){
+		/* The payload is written straight from the message store. */
+		alloc_length -= packet->store->payloadlen;
+	}
+#endif
 #ifdef WITH_WEBSOCKETS
-	packet->payload = mosquitto__malloc(sizeof(uint8_t)*packet->packet_length + LWS_PRE);
+	packet->payload = mosquitto__malloc(sizeof(uint8_t)*alloc_length + LWS_PRE);
 #else
-	packet->payload = (uint8_t*)mosquitto__malloc(sizeof(uint8_t)*packet->packet_length);
+	packet->payload = (uint8_t*)mosquitto__malloc(sizeof(uint8_t)*alloc_length);
 #endif
 	if(!packet->payload) return MOSQ_ERR_NOMEM;
 
@@ -97,6 +107,11 @@ void packet__cleanup(struct mosquitto__packet *packet)
 	packet->remaining_length = 0;
 	mosquitto__free(packet->payload);
 	packet->payload = NULL;
+#ifdef WITH_BROKER
+	if(packet->store){
+		db__msg_store_ref_dec(&packet->store);
+	}
+#endif
 	packet->to_process = 0;
 	packet->pos = 0;
 }
@@ -120,7 +135,7 @@ void packet__cleanup_all_no_locks(struct mosquitto *mosq)
 		}
 
 		packet__cleanup(packet);
-		mosquitto__free(packet);
+		mosquitto__slab_free(packet);
 	}
 	mosq->out_packet_count = 0;
 
@@ -139,6 +154,47 @@ void packet__cleanup_all(struct mosquitto *mosq)
 }
 
 
+#ifdef WITH_BROKER
+/* Packets queued for a client are not written straight away, but when
+ * packet__write_deferred() is called before the broker next waits for network
+ * events. Everything queued for the client while handling one round of events
+ * can then be sent with a single write. */
+static void packet__write_defer(struct mosquitto *mosq)
+{
+	if(mosq->write_deferred == false){
+		mosq->write_deferred = true;
+		DL_APPEND2(db.write_deferred, mosq, write_deferred_prev, write_deferred_next);
+	}
+}
+
+
+void packet__write_deferred_remove(struct mosquitto *mosq)
+{
+	if(mosq->write_deferred){
+		DL_DELETE2(db.write_deferred, mosq, write_deferred_prev, write_deferred_next);
+		mosq->write_deferred = false;
+	}
+}
+
+
+void packet__write_deferred(void)
+{
+	struct mosquitto *mosq;
+	int rc;
+
+	while(db.write_deferred){
+		mosq = db.write_deferred;
+		packet__write_deferred_remove(mosq);
+
+		rc = packet__write(mosq);
+		if(rc && rc != MOSQ_ERR_NO_CONN){
+			do_disconnect(mosq, rc);
+		}
+	}
+}
+#endif
+
+
 int packet__queue(struct mosquitto *mosq, struct mosquitto__packet *packet)
 {
 #ifndef WITH_BROKER
@@ -165,12 +221,13 @@ int packet__queue(struct mosquitto *mosq, struct mosquitto__packet *packet)
 	if(mosq->wsi){
 		lws_callback_on_writable(mosq->wsi);
 		return MOSQ_ERR_SUCCESS;
-	}else{
-		return packet__write(mosq);
 	}
-#  else
-	return packet__write(mosq);
 #  endif
+	if(mosq->out_packet_count >= PACKET_WRITE_BATCH){
+		return packet__write(mosq);
+	}
+	packet__write_defer(mosq);
+	return MOSQ_ERR_SUCCESS;
 #else
 
 	/* Write a single byte to sockpairW (connected to sockpairR) to break out
@@ -208,71 +265,113 @@ int packet__check_oversize(struct mosquitto *mosq, uint32_t remaining_length)
 }
 
 
-int packet__write(struct mosquitto *mosq)
+#ifdef WIN32
+static ssize_t packet__write_chunk(struct mosquitto *mosq)
+{
+	struct mosquitto__packet *packet = mosq->current_out_packet;
+#  ifdef WITH_BROKER
+	uint32_t head_length;
+
+	if(packet->store){
+		head_length = packet->packet_length - packet->store->payloadlen;
+		if(packet->pos >= head_length){
+			return net__write(mosq, &((uint8_t *)packet->store->payload)[packet->pos - head_length], packet->to_process);
+		}
+		return net__write(mosq, &(packet->payload[packet->pos]), head_length - packet->pos);
+	}
+#  endif
+	return net__write(mosq, &(packet->payload[packet->pos]), packet->to_process);
+}
+#else
+/* Add the unwritten part of packet to iov. Returns the number of iov entries
+ * used, which is at most two. */
+static int packet__write_iov(struct mosquitto__packet *packet, struct iovec *iov, size_t *bytes)
+{
+	uint32_t head_length = packet->packet_length;
+	int iovcnt = 0;
+
+#  ifdef WITH_BROKER
+	if(packet->store){
+		head_length -= packet->store->payloadlen;
+	}
+#  endif
+	if(packet->pos < head_length){
+		iov[iovcnt].iov_base = &(packet->payload[packet->pos]);
+		iov[iovcnt].iov_len = head_length - packet->pos;
+		*bytes += iov[iovcnt].iov_len;
+		iovcnt++;
+	}
+#  ifdef WITH_BROKER
+	if(packet->store && packet->store->payloadlen > 0){
+		if(packet->pos > head_length){
+			iov[iovcnt].iov_base = &((uint8_t *)packet->store->payload)[packet->pos - head_length];
+		}else{
+			iov[iovcnt].iov_base = packet->store->payload;
+		}
+		iov[iovcnt].iov_len = packet->to_process - (iovcnt?iov[0].iov_len:0);
+		*bytes += iov[iovcnt].iov_len;
+		iovcnt++;
+	}
+#  endif
+	return iovcnt;
+}
+
+
+/* Fill iov, which must have room for PACKET_WRITE_BATCH*2 entries, with as
+ * much as should be written of current_out_packet and the packets queued
+ * behind it with a single call. Returns the number of entries used. */
+int packet__write_gather(struct mosquitto *mosq, struct iovec *iov)
 {
-	ssize_t write_length;
 	struct mosquitto__packet *packet;
-	enum mosquitto_client_state state;
+	int iovcnt;
+	size_t bytes = 0;
 
-	if(!mosq) return MOSQ_ERR_INVAL;
-	if(mosq->sock == INVALID_SOCKET) return MOSQ_ERR_NO_CONN;
+	iovcnt = packet__write_iov(mosq->current_out_packet, iov, &bytes);
 
-	pthread_mutex_lock(&mosq->current_out_packet_mutex);
 	pthread_mutex_lock(&mosq->out_packet_mutex);
-	if(mosq->out_packet && !mosq->current_out_packet){
-		mosq->current_out_packet = mosq->out_packet;
-		mosq->out_packet = mosq->out_packet->next;
-		if(!mosq->out_packet){
-			mosq->out_packet_last = NULL;
-		}
-		mosq->out_packet_count--;
+	packet = mosq->out_packet;
+	while(packet && iovcnt <= PACKET_WRITE_BATCH*2 - 2 && bytes < PACKET_WRITE_BYTES){
+		iovcnt += packet__write_iov(packet, &iov[iovcnt], &bytes);
+		packet = packet->next;
 	}
 	pthread_mutex_unlock(&mosq->out_packet_mutex);
 
-#ifdef WITH_BROKER
-	if(mosq->current_out_packet){
-	   mux__add_out(mosq);
-	}
+	return iovcnt;
+}
+
+
+static ssize_t packet__write_chunk(struct mosquitto *mosq)
+{
+	struct iovec iov[PACKET_WRITE_BATCH*2];
+	int iovcnt;
+
+	iovcnt = packet__write_gather(mosq, iov);
+	return net__writev(mosq, iov, iovcnt);
+}
 #endif
 
-	state = mosquitto__get_state(mosq);
-	if(state == mosq_cs_connect_pending){
-		pthread_mutex_unlock(&mosq->current_out_packet_mutex);
-		return MOSQ_ERR_SUCCESS;
-	}
+
+/* Account for written bytes of current_out_packet and the packets queued
+ * behind it, freeing each packet once all of it has been written. Returns 1 if
+ * the client has disconnected, in which case nothing more must be written. */
+static int packet__write_advance(struct mosquitto *mosq, size_t written)
+{
+	uint32_t count;
+	struct mosquitto__packet *packet;
 
 	while(mosq->current_out_packet){
 		packet = mosq->current_out_packet;
 
-		while(packet->to_process > 0){
-			write_length = net__write(mosq, &(packet->payload[packet->pos]), packet->to_process);
-			if(write_length > 0){
-				G_BYTES_SENT_INC(write_length);
-				packet->to_process -= (uint32_t)write_length;
-				packet->pos += (uint32_t)write_length;
-			}else{
-#ifdef WIN32
-				errno = WSAGetLastError();
-#endif
-				if(errno == EAGAIN || errno == COMPAT_EWOULDBLOCK
-#ifdef WIN32
-						|| errno == WSAENOTCONN
-#endif
-						){
-					pthread_mutex_unlock(&mosq->current_out_packet_mutex);
-					return MOSQ_ERR_SUCCESS;
-				}else{
-					pthread_mutex_unlock(&mosq->current_out_packet_mutex);
-					switch(errno){
-						case COMPAT_ECONNRESET:
-							return MOSQ_ERR_CONN_LOST;
-						case COMPAT_EINTR:
-							return MOSQ_ERR_SUCCESS;
-						default:
-							return MOSQ_ERR_ERRNO;
-					}
-				}
-			}
+		if(written < packet->to_process){
+			count = (uint32_t)written;
+		}else{
+			count = packet->to_process;
+		}
+		packet->to_process -= count;
+		packet->pos += count;
+		written -= count;
+		if(packet->to_process > 0){
+			return 0;
 		}
 
 		G_MSGS_SENT_INC(1);
@@ -296,8 +395,8 @@ int packet__write(struct mosquitto *mosq)
 		}else if(((packet->command)&0xF0) == CMD_DISCONNECT){
 			do_client_disconnect(mosq, MOSQ_ERR_SUCCESS, NULL);
 			packet__cleanup(packet);
-			mosquitto__free(packet);
-			return MOSQ_ERR_SUCCESS;
+			mosquitto__slab_free(packet);
+			return 1;
 #endif
 		}else if(((packet->command)&0xF0) == CMD_PUBLISH){
 			G_PUB_MSGS_SENT_INC(1);
@@ -316,7 +415,7 @@ int packet__write(struct mosquitto *mosq)
 		pthread_mutex_unlock(&mosq->out_packet_mutex);
 
 		packet__cleanup(packet);
-		mosquitto__free(packet);
+		mosquitto__slab_free(packet);
 
 #ifdef WITH_BROKER
 		mosq->next_msg_out = db.now_s + mosq->keepalive;
@@ -326,6 +425,79 @@ int packet__write(struct mosquitto *mosq)
 		pthread_mutex_unlock(&mosq->msgtime_mutex);
 #endif
 	}
+	return 0;
+}
+
+
+int packet__write(struct mosquitto *mosq)
+{
+	ssize_t write_length;
+	enum mosquitto_client_state state;
+
+	if(!mosq) return MOSQ_ERR_INVAL;
+	if(mosq->sock == INVALID_SOCKET) return MOSQ_ERR_NO_CONN;
+
+	pthread_mutex_lock(&mosq->current_out_packet_mutex);
+	pthread_mutex_lock(&mosq->out_packet_mutex);
+	if(mosq->out_packet && !mosq->current_out_packet){
+		mosq->current_out_packet = mosq->out_packet;
+		mosq->out_packet = mosq->out_packet->next;
+		if(!mosq->out_packet){
+			mosq->out_packet_last = NULL;
+		}
+		mosq->out_packet_count--;
+	}
+	pthread_mutex_unlock(&mosq->out_packet_mutex);
+
+#ifdef WITH_BROKER
+	if(mosq->io_client){
+		pthread_mutex_unlock(&mosq->current_out_packet_mutex);
+		return io_threads__write(mosq);
+	}
+	if(mosq->current_out_packet){
+	   mux__add_out(mosq);
+	}
+#endif
+
+	state = mosquitto__get_state(mosq);
+	if(state == mosq_cs_connect_pending){
+		pthread_mutex_unlock(&mosq->current_out_packet_mutex);
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	while(mosq->current_out_packet){
+		/* A single write may cover this packet and some of those queued
+		 * after it. */
+		write_length = packet__write_chunk(mosq);
+		if(write_length > 0){
+			G_BYTES_SENT_INC(write_length);
+		}else{
+#ifdef WIN32
+			errno = WSAGetLastError();
+#endif
+			if(errno == EAGAIN || errno == COMPAT_EWOULDBLOCK
+#ifdef WIN32
+					|| errno == WSAENOTCONN
+#endif
+					){
+				pthread_mutex_unlock(&mosq->current_out_packet_mutex);
+				return MOSQ_ERR_SUCCESS;
+			}else{
+				pthread_mutex_unlock(&mosq->current_out_packet_mutex);
+				switch(errno){
+					case COMPAT_ECONNRESET:
+						return MOSQ_ERR_CONN_LOST;
+					case COMPAT_EINTR:
+						return MOSQ_ERR_SUCCESS;
+					default:
+						return MOSQ_ERR_ERRNO;
+				}
+			}
+		}
+		if(packet__write_advance(mosq, (size_t)write_length)){
+			return MOSQ_ERR_SUCCESS;
+		}
+	}
 #ifdef WITH_BROKER
 	if (mosq->current_out_packet == NULL) {
 		mux__remove_out(mosq);
@@ -336,6 +508,315 @@ int packet__write(struct mosquitto *mosq)
 }
 
 
+#ifdef WITH_BROKER
+/* Account for bytes written by a client's I/O thread, see io_threads.c. */
+void packet__write_done(struct mosquitto *mosq, size_t written)
+{
+	G_BYTES_SENT_INC(written);
+	pthread_mutex_lock(&mosq->current_out_packet_mutex);
+	packet__write_advance(mosq, written);
+	pthread_mutex_unlock(&mosq->current_out_packet_mutex);
+}
+#endif
+
+
+#ifdef WITH_BROKER
+/* Incoming data is read from the socket in chunks of up to this size, and as
+ * many packets as are complete in the chunk are handled before reading again.
+ * The broker is single threaded, so one buffer is shared by all clients. Any
+ * part of a packet that is left at the end of the chunk is kept in the
+ * client's in_packet. */
+#define PACKET_READ_BUF_SIZE 16384
+static uint8_t read_buf[PACKET_READ_BUF_SIZE];
+
+
+static int packet__read_error(struct mosquitto *mosq, ssize_t read_length)
+{
+	if(read_length == 0){
+		return MOSQ_ERR_CONN_LOST; /* EOF */
+	}
+#ifdef WIN32
+	errno = WSAGetLastError();
+#endif
+	if(errno == EAGAIN || errno == COMPAT_EWOULDBLOCK){
+		mosq->read_drained = true;
+		if(mosq->in_packet.to_process > 1000){
+			/* Update last_msg_in time if more than 1000 bytes left to
+			 * receive. Helps when receiving large messages.
+			 * This is an arbitrary limit, but with some consideration.
+			 * If a client can't send 1000 bytes in a second it
+			 * probably shouldn't be using a 1 second keep alive. */
+			keepalive__update(mosq);
+		}
+		return MOSQ_ERR_SUCCESS;
+	}else{
+		switch(errno){
+			case COMPAT_ECONNRESET:
+				return MOSQ_ERR_CONN_LOST;
+			case COMPAT_EINTR:
+				return MOSQ_ERR_SUCCESS;
+			default:
+				return MOSQ_ERR_ERRNO;
+		}
+	}
+}
+
+
+/* Called once the fixed header of in_packet has been read. */
+static int packet__read_header_complete(struct mosquitto *mosq)
+{
+	switch(mosq->in_packet.command & 0xF0){
+		case CMD_CONNECT:
+			if(mosq->in_packet.remaining_length > 100000){ /* Arbitrary limit, make configurable */
+				return MOSQ_ERR_MALFORMED_PACKET;
+			}
+			break;
+
+		case CMD_PUBACK:
+		case CMD_PUBREC:
+		case CMD_PUBREL:
+		case CMD_PUBCOMP:
+		case CMD_UNSUBACK:
+			if(mosq->protocol != mosq_p_mqtt5 && mosq->in_packet.remaining_length != 2){
+				return MOSQ_ERR_MALFORMED_PACKET;
+			}
+			break;
+
+		case CMD_PINGREQ:
+		case CMD_PINGRESP:
+			if(mosq->in_packet.remaining_length != 0){
+				return MOSQ_ERR_MALFORMED_PACKET;
+			}
+			break;
+
+		case CMD_DISCONNECT:
+			if(mosq->protocol != mosq_p_mqtt5 && mosq->in_packet.remaining_length != 0){
+				return MOSQ_ERR_MALFORMED_PACKET;
+			}
+			break;
+	}
+
+	if(db.config->max_packet_size > 0 && mosq->in_packet.remaining_length+1 > db.config->max_packet_size){
+		if(mosq->protocol == mosq_p_mqtt5){
+			send__disconnect(mosq, MQTT_RC_PACKET_TOO_LARGE, NULL);
+		}
+		return MOSQ_ERR_OVERSIZE_PACKET;
+	}
+
+	if(mosq->in_packet.remaining_length > 0){
+		/* The extra byte is always zero, so a PUBLISH payload at the end of
+		 * the packet can be used as a zero terminated message payload
+		 * without being copied. */
+		mosq->in_packet.payload = (uint8_t*)mosquitto__malloc(mosq->in_packet.remaining_length+1);
+		if(!mosq->in_packet.payload){
+			return MOSQ_ERR_NOMEM;
+		}
+		mosq->in_packet.payload[mosq->in_packet.remaining_length] = 0;
+		mosq->in_packet.to_process = mosq->in_packet.remaining_length;
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static int packet__read_complete(struct mosquitto *mosq)
+{
+	int rc;
+
+	mosq->in_packet.pos = 0;
+	mosq->read_packets++;
+	G_MSGS_RECEIVED_INC(1);
+	if(((mosq->in_packet.command)&0xF0) == CMD_PUBLISH){
+		G_PUB_MSGS_RECEIVED_INC(1);
+	}
+	rc = handle__packet(mosq);
+
+	/* Free data and reset values */
+	packet__cleanup(&mosq->in_packet);
+
+	keepalive__update(mosq);
+	return rc;
+}
+
+
+/* Keep data that has been read from the socket but can't be handled yet. */
+static int packet__read_keep(struct mosquitto *mosq, const uint8_t *buf, size_t len)
+{
+	mosq->in_unread = mosquitto__malloc(len);
+	if(mosq->in_unread == NULL){
+		return MOSQ_ERR_NOMEM;
+	}
+	memcpy(mosq->in_unread, buf, len);
+	mosq->in_unread_len = len;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Handle the packets in buf, which has been read from the socket. Complete
+ * packets are handled in turn, and a trailing incomplete packet is kept in
+ * in_packet. */
+static int packet__read_buf(struct mosquitto *mosq, const uint8_t *buf, size_t len)
+{
+	uint8_t byte;
+	size_t count;
+	int rc;
+
+	while(len > 0){
+		if(!mosq->in_packet.command){
+			byte = *buf;
+			buf++;
+			len--;
+			mosq->in_packet.command = byte;
+			/* Clients must send CONNECT as their first command. */
+			if(!(mosq->bridge) && mosquitto__get_state(mosq) == mosq_cs_connected && (byte&0xF0) != CMD_CONNECT){
+				return MOSQ_ERR_PROTOCOL;
+			}
+		}
+		/* remaining_count is the number of bytes that the remaining_length
+		 * parameter occupied in this incoming packet. It has three states:
+		 *   0 means that we haven't read any remaining_length bytes
+		 *   <0 means we have read some remaining_length bytes but haven't finished
+		 *   >0 means we have finished reading the remaining_length bytes.
+		 */
+		if(mosq->in_packet.remaining_count <= 0){
+			do{
+				if(len == 0){
+					return MOSQ_ERR_SUCCESS;
+				}
+				byte = *buf;
+				buf++;
+				len--;
+				mosq->in_packet.remaining_count--;
+				/* Max 4 bytes length for remaining length as defined by protocol.
+				 * Anything more likely means a broken/malicious client.
+				 */
+				if(mosq->in_packet.remaining_count < -4){
+					return MOSQ_ERR_MALFORMED_PACKET;
+				}
+				mosq->in_packet.remaining_length += (byte & 127) * mosq->in_packet.remaining_mult;
+				mosq->in_packet.remaining_mult *= 128;
+			}while((byte & 128) != 0);
+			/* We have finished reading remaining_length, so make remaining_count
+			 * positive. */
+			mosq->in_packet.remaining_count = (int8_t)(mosq->in_packet.remaining_count * -1);
+
+			rc = packet__read_header_complete(mosq);
+			if(rc) return rc;
+		}
+		if(mosq->in_packet.to_process > 0){
+			count = len;
+			if(count > mosq->in_packet.to_process){
+				count = mosq->in_packet.to_process;
+			}
+			memcpy(&mosq->in_packet.payload[mosq->in_packet.pos], buf, count);
+			buf += count;
+			len -= count;
+			mosq->in_packet.to_process -= (uint32_t)count;
+			mosq->in_packet.pos += (uint32_t)count;
+			if(mosq->in_packet.to_process > 0){
+				return MOSQ_ERR_SUCCESS;
+			}
+		}
+
+		rc = packet__read_complete(mosq);
+		if(rc) return rc;
+
+		if(mosq->sock == INVALID_SOCKET){
+			/* Disconnected by the packet just handled */
+			return MOSQ_ERR_SUCCESS;
+		}
+		if(len > 0 && mosquitto__get_state(mosq) == mosq_cs_delayed_auth){
+			/* Nothing more may be handled until the client is authorised,
+			 * but the data has already been read from the socket. */
+			return packet__read_keep(mosq, buf, len);
+		}
+		if(len > 0 && db.config->max_read_packets > 0 && mosq->read_packets >= db.config->max_read_packets){
+			/* The client has used its packet budget, the rest is handled
+			 * from the ready list. */
+			rc = packet__read_keep(mosq, buf, len);
+			if(rc) return rc;
+			mux__ready_add(mosq);
+			return MOSQ_ERR_SUCCESS;
+		}
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int packet__read(struct mosquitto *mosq)
+{
+	ssize_t read_length;
+	uint8_t *unread;
+	int rc;
+
+	if(!mosq){
+		return MOSQ_ERR_INVAL;
+	}
+	if(mosq->sock == INVALID_SOCKET){
+		return MOSQ_ERR_NO_CONN;
+	}
+	if(mosquitto__get_state(mosq) == mosq_cs_connect_pending){
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	if(mosq->in_unread){
+		/* Data read before reading from the client was paused */
+		unread = mosq->in_unread;
+		mosq->in_unread = NULL;
+		rc = packet__read_buf(mosq, unread, mosq->in_unread_len);
+		mosquitto__free(unread);
+		return rc;
+	}
+	if(mosq->io_client){
+		/* The socket is read by the client's I/O thread, which passes what it
+		 * reads to packet__read_data(). */
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	if(mosq->in_packet.to_process >= PACKET_READ_BUF_SIZE){
+		/* Large packets are read straight into the packet rather than going
+		 * through read_buf. */
+		read_length = net__read(mosq, &(mosq->in_packet.payload[mosq->in_packet.pos]), mosq->in_packet.to_process);
+		if(read_length <= 0){
+			return packet__read_error(mosq, read_length);
+		}
+		G_BYTES_RECEIVED_INC(read_length);
+		mosq->read_drained = false;
+		mosq->read_bytes += (size_t)read_length;
+		mosq->in_packet.to_process -= (uint32_t)read_length;
+		mosq->in_packet.pos += (uint32_t)read_length;
+		if(mosq->in_packet.to_process > 0){
+			return MOSQ_ERR_SUCCESS;
+		}
+		return packet__read_complete(mosq);
+	}
+
+	read_length = net__read(mosq, read_buf, sizeof(read_buf));
+	if(read_length <= 0){
+		return packet__read_error(mosq, read_length);
+	}
+	G_BYTES_RECEIVED_INC(read_length);
+	mosq->read_drained = false;
+	mosq->read_bytes += (size_t)read_length;
+
+	return packet__read_buf(mosq, read_buf, (size_t)read_length);
+}
+
+
+/* Handle data read from the client's socket by its I/O thread. read_length
+ * and errno are the result of the read. */
+int packet__read_data(struct mosquitto *mosq, const uint8_t *buf, ssize_t read_length)
+{
+	if(read_length <= 0){
+		return packet__read_error(mosq, read_length);
+	}
+	G_BYTES_RECEIVED_INC(read_length);
+	mosq->read_bytes += (size_t)read_length;
+
+	return packet__read_buf(mosq, buf, (size_t)read_length);
+}
+
+#else
+
 int packet__read(struct mosquitto *mosq)
 {
 	uint8_t byte;
@@ -373,13 +854,6 @@ int packet__read(struct mosquitto *mosq)
 		read_length = net__read(mosq, &byte, 1);
 		if(read_length == 1){
 			mosq->in_packet.command = byte;
-#ifdef WITH_BROKER
-			G_BYTES_RECEIVED_INC(1);
-			/* Clients must send CONNECT as their first command. */
-			if(!(mosq->bridge) && state == mosq_cs_connected && (byte&0xF0) != CMD_CONNECT){
-				return MOSQ_ERR_PROTOCOL;
-			}
-#endif
 		}else{
 			if(read_length == 0){
 				return MOSQ_ERR_CONN_LOST; /* EOF */
@@ -422,7 +896,6 @@ int packet__read(struct mosquitto *mosq)
 					return MOSQ_ERR_MALFORMED_PACKET;
 				}
 
-				G_BYTES_RECEIVED_INC(1);
 				mosq->in_packet.remaining_length += (byte & 127) * mosq->in_packet.remaining_mult;
 				mosq->in_packet.remaining_mult *= 128;
 			}else{
@@ -450,47 +923,7 @@ int packet__read(struct mosquitto *mosq)
 		 * positive. */
 		mosq->in_packet.remaining_count = (int8_t)(mosq->in_packet.remaining_count * -1);
 
-#ifdef WITH_BROKER
-		switch(mosq->in_packet.command & 0xF0){
-			case CMD_CONNECT:
-				if(mosq->in_packet.remaining_length > 100000){ /* Arbitrary limit, make configurable */
-					return MOSQ_ERR_MALFORMED_PACKET;
-				}
-				break;
-
-			case CMD_PUBACK:
-			case CMD_PUBREC:
-			case CMD_PUBREL:
-			case CMD_PUBCOMP:
-			case CMD_UNSUBACK:
-				if(mosq->protocol != mosq_p_mqtt5 && mosq->in_packet.remaining_length != 2){
-					return MOSQ_ERR_MALFORMED_PACKET;
-				}
-				break;
-
-			case CMD_PINGREQ:
-			case CMD_PINGRESP:
-				if(mosq->in_packet.remaining_length != 0){
-					return MOSQ_ERR_MALFORMED_PACKET;
-				}
-				break;
-
-			case CMD_DISCONNECT:
-				if(mosq->protocol != mosq_p_mqtt5 && mosq->in_packet.remaining_length != 0){
-					return MOSQ_ERR_MALFORMED_PACKET;
-				}
-				break;
-		}
-
-		if(db.config->max_packet_size > 0 && mosq->in_packet.remaining_length+1 > db.config->max_packet_size){
-			if(mosq->protocol == mosq_p_mqtt5){
-				send__disconnect(mosq, MQTT_RC_PACKET_TOO_LARGE, NULL);
-			}
-			return MOSQ_ERR_OVERSIZE_PACKET;
-		}
-#else
 		/* FIXME - client case for incoming message received from broker too large */
-#endif
 		if(mosq->in_packet.remaining_length > 0){
 			mosq->in_packet.payload = (uint8_t*)mosquitto__malloc(mosq->in_packet.remaining_length*sizeof(uint8_t));
 			if(!mosq->in_packet.payload){
@@ -502,7 +935,6 @@ int packet__read(struct mosquitto *mosq)
 	while(mosq->in_packet.to_process>0){
 		read_length = net__read(mosq, &(mosq->in_packet.payload[mosq->in_packet.pos]), mosq->in_packet.to_process);
 		if(read_length > 0){
-			G_BYTES_RECEIVED_INC(read_length);
 			mosq->in_packet.to_process -= (uint32_t)read_length;
 			mosq->in_packet.pos += (uint32_t)read_length;
 		}else{
@@ -516,13 +948,9 @@ int packet__read(struct mosquitto *mosq)
 					 * This is an arbitrary limit, but with some consideration.
 					 * If a client can't send 1000 bytes in a second it
 					 * probably shouldn't be using a 1 second keep alive. */
-#ifdef WITH_BROKER
-					keepalive__update(mosq);
-#else
 					pthread_mutex_lock(&mosq->msgtime_mutex);
 					mosq->last_msg_in = mosquitto_time();
 					pthread_mutex_unlock(&mosq->msgtime_mutex);
-#endif
 				}
 				return MOSQ_ERR_SUCCESS;
 			}else{
@@ -540,23 +968,15 @@ int packet__read(struct mosquitto *mosq)
 
 	/* All data for this packet is read. */
 	mosq->in_packet.pos = 0;
-#ifdef WITH_BROKER
-	G_MSGS_RECEIVED_INC(1);
-	if(((mosq->in_packet.command)&0xF0) == CMD_PUBLISH){
-		G_PUB_MSGS_RECEIVED_INC(1);
-	}
-#endif
 	rc = handle__packet(mosq);
 
 	/* Free data and reset values */
 	packet__cleanup(&mosq->in_packet);
 
-#ifdef WITH_BROKER
-	keepalive__update(mosq);
-#else
 	pthread_mutex_lock(&mosq->msgtime_mutex);
 	mosq->last_msg_in = mosquitto_time();
 	pthread_mutex_unlock(&mosq->msgtime_mutex);
-#endif
 	return rc;
 }
+
+#endif
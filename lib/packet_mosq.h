@@ -18,9 +18,18 @@ Contributors:
 #ifndef PACKET_MOSQ_H
 #define PACKET_MOSQ_H
 
+#ifndef WIN32
+#  include <sys/uio.h>
+#endif
+
 #include "mosquitto_internal.h"
 #include "mosquitto.h"
 
+/* At most this many packets, or not much more than this many bytes, are sent
+ * with a single write. */
+#define PACKET_WRITE_BATCH 32
+#define PACKET_WRITE_BYTES 65536
+
 int packet__alloc(struct mosquitto__packet *packet);
 void packet__cleanup(struct mosquitto__packet *packet);
 void packet__cleanup_all(struct mosquitto *mosq);
@@ -48,5 +57,14 @@ unsigned int packet__varint_bytes(uint32_t word);
 
 int packet__write(struct mosquitto *mosq);
 int packet__read(struct mosquitto *mosq);
+#ifdef WITH_BROKER
+void packet__write_deferred(void);
+void packet__write_deferred_remove(struct mosquitto *mosq);
+void packet__write_done(struct mosquitto *mosq, size_t written);
+int packet__read_data(struct mosquitto *mosq, const uint8_t *buf, ssize_t read_length);
+#  ifndef WIN32
+int packet__write_gather(struct mosquitto *mosq, struct iovec *iov);
+#  endif
+#endif
 
 #endif
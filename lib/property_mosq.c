@@ -163,7 +163,7 @@ int property__read_all(int command, struct mosquitto__packet *packet, mosquitto_
 	/* The order of properties must be preserved for some types, so keep the
 	 * same order for all */
 	while(proplen > 0){
-		p = (mosquitto_property*) mosquitto__calloc(1, sizeof(mosquitto_property));
+		p = (mosquitto_property*)mosquitto__slab_calloc(sizeof(mosquitto_property));
 		if(!p){
 			mosquitto_property_free_all(properties);
 			return MOSQ_ERR_NOMEM;
@@ -171,7 +171,7 @@ int property__read_all(int command, struct mosquitto__packet *packet, mosquitto_
 
 		rc = property__read(packet, &proplen, p);
 		if(rc){
-			mosquitto__free(p);
+			mosquitto__slab_free(p);
 			mosquitto_property_free_all(properties);
 			return rc;
 		}
@@ -240,7 +240,7 @@ void property__free(mosquitto_property **property)
 			break;
 	}
 
-	free(*property);
+	mosquitto__slab_free(*property);
 	*property = NULL;
 }
 
@@ -726,7 +726,7 @@ int mosquitto_property_add_byte(mosquitto_property **proplist, int identifier, u
 		return MOSQ_ERR_INVAL;
 	}
 
-	prop = (mosquitto_property*) mosquitto__calloc(1, sizeof(mosquitto_property));
+	prop = (mosquitto_property*)mosquitto__slab_calloc(sizeof(mosquitto_property));
 	if(!prop) return MOSQ_ERR_NOMEM;
 
 	prop->client_generated = true;
@@ -750,7 +750,7 @@ int mosquitto_property_add_int16(mosquitto_property **proplist, int identifier,
 		return MOSQ_ERR_INVAL;
 	}
 
-	prop = (mosquitto_property*)mosquitto__calloc(1, sizeof(mosquitto_property));
+	prop = (mosquitto_property*)mosquitto__slab_calloc(sizeof(mosquitto_property));
 	if(!prop) return MOSQ_ERR_NOMEM;
 
 	prop->client_generated = true;
@@ -775,7 +775,7 @@ int mosquitto_property_add_int32(mosquitto_property **proplist, int identifier,
 		return MOSQ_ERR_INVAL;
 	}
 
-	prop = (mosquitto_property*)mosquitto__calloc(1, sizeof(mosquitto_property));
+	prop = (mosquitto_property*)mosquitto__slab_calloc(sizeof(mosquitto_property));
 	if(!prop) return MOSQ_ERR_NOMEM;
 
 	prop->client_generated = true;
@@ -794,7 +794,7 @@ int mosquitto_property_add_varint(mosquitto_property **proplist, int identifier,
 	if(!proplist || value > 268435455) return MOSQ_ERR_INVAL;
 	if(identifier != MQTT_PROP_SUBSCRIPTION_IDENTIFIER) return MOSQ_ERR_INVAL;
 
-	prop = (mosquitto_property*)mosquitto__calloc(1, sizeof(mosquitto_property));
+	prop = (mosquitto_property*)mosquitto__slab_calloc(sizeof(mosquitto_property));
 	if(!prop) return MOSQ_ERR_NOMEM;
 
 	prop->client_generated = true;
@@ -817,7 +817,7 @@ int mosquitto_property_add_binary(mosquitto_property **proplist, int identifier,
 		return MOSQ_ERR_INVAL;
 	}
 
-	prop = (mosquitto_property*)mosquitto__calloc(1, sizeof(mosquitto_property));
+	prop = (mosquitto_property*)mosquitto__slab_calloc(sizeof(mosquitto_property));
 	if(!prop) return MOSQ_ERR_NOMEM;
 
 	prop->client_generated = true;
@@ -826,7 +826,7 @@ int mosquitto_property_add_binary(mosquitto_property **proplist, int identifier,
 	if(len){
 		prop->value.bin.v = (char*)mosquitto__malloc(len);
 		if(!prop->value.bin.v){
-			mosquitto__free(prop);
+			mosquitto__slab_free(prop);
 			return MOSQ_ERR_NOMEM;
 		}
 
@@ -861,7 +861,7 @@ int mosquitto_property_add_string(mosquitto_property **proplist, int identifier,
 		return MOSQ_ERR_INVAL;
 	}
 
-	prop = (mosquitto_property*)mosquitto__calloc(1, sizeof(mosquitto_property));
+	prop = (mosquitto_property*)mosquitto__slab_calloc(sizeof(mosquitto_property));
 	if(!prop) return MOSQ_ERR_NOMEM;
 
 	prop->client_generated = true;
@@ -869,7 +869,7 @@ int mosquitto_property_add_string(mosquitto_property **proplist, int identifier,
 	if(value && slen > 0){
 		prop->value.s.v = mosquitto__strdup(value);
 		if(!prop->value.s.v){
-			mosquitto__free(prop);
+			mosquitto__slab_free(prop);
 			return MOSQ_ERR_NOMEM;
 		}
 		prop->value.s.len = (uint16_t)slen;
@@ -895,7 +895,7 @@ int mosquitto_property_add_string_pair(mosquitto_property **proplist, int identi
 		if(mosquitto_validate_utf8(value, (int)slen_value)) return MOSQ_ERR_MALFORMED_UTF8;
 	}
 
-	prop = (mosquitto_property*)mosquitto__calloc(1, sizeof(mosquitto_property));
+	prop = (mosquitto_property*)mosquitto__slab_calloc(sizeof(mosquitto_property));
 	if(!prop) return MOSQ_ERR_NOMEM;
 
 	prop->client_generated = true;
@@ -904,7 +904,7 @@ int mosquitto_property_add_string_pair(mosquitto_property **proplist, int identi
 	if(name){
 		prop->name.v = mosquitto__strdup(name);
 		if(!prop->name.v){
-			mosquitto__free(prop);
+			mosquitto__slab_free(prop);
 			return MOSQ_ERR_NOMEM;
 		}
 		prop->name.len = (uint16_t)strlen(name);
@@ -914,7 +914,7 @@ int mosquitto_property_add_string_pair(mosquitto_property **proplist, int identi
 		prop->value.s.v = mosquitto__strdup(value);
 		if(!prop->value.s.v){
 			mosquitto__free(prop->name.v);
-			mosquitto__free(prop);
+			mosquitto__slab_free(prop);
 			return MOSQ_ERR_NOMEM;
 		}
 		prop->value.s.len = (uint16_t)strlen(value);
@@ -1196,7 +1196,7 @@ int mosquitto_property_copy_all(mosquitto_property **dest, const mosquitto_prope
 	*dest = NULL;
 
 	while(src){
-		pnew = (mosquitto_property*)calloc(1, sizeof(mosquitto_property));
+		pnew = (mosquitto_property*)mosquitto__slab_calloc(sizeof(mosquitto_property));
 		if(!pnew){
 			mosquitto_property_free_all(dest);
 			return MOSQ_ERR_NOMEM;
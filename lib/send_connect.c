@@ -95,7 +95,7 @@ int send__connect(struct mosquitto *mosq, uint16_t keepalive, bool clean_session
 		return MOSQ_ERR_INVAL;
 	}
 
-	packet = (struct mosquitto__packet*)mosquitto__calloc(1, sizeof(struct mosquitto__packet));
+	packet = (struct mosquitto__packet*)mosquitto__slab_calloc(sizeof(struct mosquitto__packet));
 	if(!packet) return MOSQ_ERR_NOMEM;
 
 	if(clientid){
@@ -122,7 +122,7 @@ int send__connect(struct mosquitto *mosq, uint16_t keepalive, bool clean_session
 	 * username before checking password. */
 	if(mosq->protocol == mosq_p_mqtt31 || mosq->protocol == mosq_p_mqtt311){
 		if(password != NULL && username == NULL){
-			mosquitto__free(packet);
+			mosquitto__slab_free(packet);
 			return MOSQ_ERR_INVAL;
 		}
 	}
@@ -138,7 +138,7 @@ int send__connect(struct mosquitto *mosq, uint16_t keepalive, bool clean_session
 	packet->remaining_length = headerlen + payloadlen;
 	rc = packet__alloc(packet);
 	if(rc){
-		mosquitto__free(packet);
+		mosquitto__slab_free(packet);
 		return rc;
 	}
 
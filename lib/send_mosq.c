@@ -124,7 +124,7 @@ int send__command_with_mid(struct mosquitto *mosq, uint8_t command, uint16_t mid
 	int rc;
 
 	assert(mosq);
-	packet = (struct mosquitto__packet*)mosquitto__calloc(1, sizeof(struct mosquitto__packet));
+	packet = (struct mosquitto__packet*)mosquitto__slab_calloc(sizeof(struct mosquitto__packet));
 	if(!packet) return MOSQ_ERR_NOMEM;
 
 	packet->command = command;
@@ -145,7 +145,7 @@ int send__command_with_mid(struct mosquitto *mosq, uint8_t command, uint16_t mid
 
 	rc = packet__alloc(packet);
 	if(rc){
-		mosquitto__free(packet);
+		mosquitto__slab_free(packet);
 		return rc;
 	}
 
@@ -170,7 +170,7 @@ int send__simple_command(struct mosquitto *mosq, uint8_t command)
 	int rc;
 
 	assert(mosq);
-	packet = (struct mosquitto__packet*)mosquitto__calloc(1, sizeof(struct mosquitto__packet));
+	packet = (struct mosquitto__packet*)mosquitto__slab_calloc(sizeof(struct mosquitto__packet));
 	if(!packet) return MOSQ_ERR_NOMEM;
 
 	packet->command = command;
@@ -178,7 +178,7 @@ int send__simple_command(struct mosquitto *mosq, uint8_t command)
 
 	rc = packet__alloc(packet);
 	if(rc){
-		mosquitto__free(packet);
+		mosquitto__slab_free(packet);
 		return rc;
 	}
 
@@ -21,6 +21,8 @@ Contributors:
 #include "mosquitto.h"
 #include "property_mosq.h"
 
+struct mosquitto_msg_store;
+
 int send__simple_command(struct mosquitto *mosq, uint8_t command);
 int send__command_with_mid(struct mosquitto *mosq, uint8_t command, uint16_t mid, bool dup, uint8_t reason_code, const mosquitto_property *properties);
 int send__real_publish(struct mosquitto *mosq, uint16_t mid, const char *topic, uint32_t payloadlen, const void *payload, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, const mosquitto_property *store_props, uint32_t expiry_interval);
@@ -32,6 +34,9 @@ int send__pingresp(struct mosquitto *mosq);
 int send__puback(struct mosquitto *mosq, uint16_t mid, uint8_t reason_code, const mosquitto_property *properties);
 int send__pubcomp(struct mosquitto *mosq, uint16_t mid, const mosquitto_property *properties);
 int send__publish(struct mosquitto *mosq, uint16_t mid, const char *topic, uint32_t payloadlen, const void *payload, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, const mosquitto_property *store_props, uint32_t expiry_interval);
+#ifdef WITH_BROKER
+int send__publish_stored(struct mosquitto *mosq, uint16_t mid, struct mosquitto_msg_store *stored, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, uint32_t expiry_interval);
+#endif
 int send__pubrec(struct mosquitto *mosq, uint16_t mid, uint8_t reason_code, const mosquitto_property *properties);
 int send__pubrel(struct mosquitto *mosq, uint16_t mid, const mosquitto_property *properties);
 int send__subscribe(struct mosquitto *mosq, int *mid, int topic_count, char *const *const topic, int topic_qos, const mosquitto_property *properties);
@@ -39,19 +39,21 @@ Contributors:
 #include "send_mosq.h"
 
 
-int send__publish(struct mosquitto *mosq, uint16_t mid, const char *topic, uint32_t payloadlen, const void *payload, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, const mosquitto_property *store_props, uint32_t expiry_interval)
+static int send__real_publish_stored(struct mosquitto *mosq, uint16_t mid, const char *topic, uint32_t payloadlen, const void *payload, struct mosquitto_msg_store *stored, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, const mosquitto_property *store_props, uint32_t expiry_interval);
+
+
+static int send__publish_internal(struct mosquitto *mosq, uint16_t mid, const char *topic, uint32_t payloadlen, const void *payload, struct mosquitto_msg_store *stored, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, const mosquitto_property *store_props, uint32_t expiry_interval)
 {
 #ifdef WITH_BROKER
 	size_t len;
 #ifdef WITH_BRIDGE
-	int i;
-	struct mosquitto__bridge_topic *cur_topic;
-	bool match;
-	int rc;
 	char *mapped_topic = NULL;
-	char *topic_temp = NULL;
+	char origin[BRIDGE_ORIGIN_LEN_MAX];
+	mosquitto_property origin_prop;
 #endif
 #endif
+	int rc;
+
 	assert(mosq);
 
 #if defined(WITH_BROKER) && defined(WITH_WEBSOCKETS)
@@ -75,53 +77,13 @@ int send__publish(struct mosquitto *mosq, uint16_t mid, const char *topic, uint3
 		}
 	}
 #ifdef WITH_BRIDGE
-	if(mosq->bridge && mosq->bridge->topics && mosq->bridge->topic_remapping){
-		for(i=0; i<mosq->bridge->topic_count; i++){
-			cur_topic = &mosq->bridge->topics[i];
-			if((cur_topic->direction == bd_both || cur_topic->direction == bd_out)
-					&& (cur_topic->remote_prefix || cur_topic->local_prefix)){
-				/* Topic mapping required on this topic if the message matches */
-
-				rc = mosquitto_topic_matches_sub(cur_topic->local_topic, topic, &match);
-				if(rc){
-					return rc;
-				}
-				if(match){
-					mapped_topic = mosquitto__strdup(topic);
-					if(!mapped_topic) return MOSQ_ERR_NOMEM;
-					if(cur_topic->local_prefix){
-						/* This prefix needs removing. */
-						if(!strncmp(cur_topic->local_prefix, mapped_topic, strlen(cur_topic->local_prefix))){
-							topic_temp = mosquitto__strdup(mapped_topic+strlen(cur_topic->local_prefix));
-							mosquitto__free(mapped_topic);
-							if(!topic_temp){
-								return MOSQ_ERR_NOMEM;
-							}
-							mapped_topic = topic_temp;
-						}
-					}
-
-					if(cur_topic->remote_prefix){
-						/* This prefix needs adding. */
-						len = strlen(mapped_topic) + strlen(cur_topic->remote_prefix)+1;
-						topic_temp = mosquitto__malloc(len+1);
-						if(!topic_temp){
-							mosquitto__free(mapped_topic);
-							return MOSQ_ERR_NOMEM;
-						}
-						snprintf(topic_temp, len, "%s%s", cur_topic->remote_prefix, mapped_topic);
-						topic_temp[len] = '\0';
-						mosquitto__free(mapped_topic);
-						mapped_topic = topic_temp;
-					}
-					log__printf(NULL, MOSQ_LOG_DEBUG, "Sending PUBLISH to %s (d%d, q%d, r%d, m%d, '%s', ... (%ld bytes))", SAFE_PRINT(mosq->id), dup, qos, retain, mid, mapped_topic, (long)payloadlen);
-					G_PUB_BYTES_SENT_INC(payloadlen);
-					rc =  send__real_publish(mosq, mid, mapped_topic, payloadlen, payload, qos, retain, dup, cmsg_props, store_props, expiry_interval);
-					mosquitto__free(mapped_topic);
-					return rc;
-				}
-			}
-		}
+	rc = bridge__remap_topic_out(mosq, &topic, &mapped_topic);
+	if(rc){
+		return rc;
+	}
+	if(bridge__loop_property(mosq, stored, &origin_prop, origin, sizeof(origin))){
+		origin_prop.next = (mosquitto_property *)cmsg_props;
+		cmsg_props = &origin_prop;
 	}
 #endif
 	log__printf(NULL, MOSQ_LOG_DEBUG, "Sending PUBLISH to %s (d%d, q%d, r%d, m%d, '%s', ... (%ld bytes))", SAFE_PRINT(mosq->id), dup, qos, retain, mid, topic, (long)payloadlen);
@@ -130,11 +92,38 @@ int send__publish(struct mosquitto *mosq, uint16_t mid, const char *topic, uint3
 	log__printf(mosq, MOSQ_LOG_DEBUG, "Client %s sending PUBLISH (d%d, q%d, r%d, m%d, '%s', ... (%ld bytes))", SAFE_PRINT(mosq->id), dup, qos, retain, mid, topic, (long)payloadlen);
 #endif
 
-	return send__real_publish(mosq, mid, topic, payloadlen, payload, qos, retain, dup, cmsg_props, store_props, expiry_interval);
+	rc = send__real_publish_stored(mosq, mid, topic, payloadlen, payload, stored, qos, retain, dup, cmsg_props, store_props, expiry_interval);
+#if defined(WITH_BROKER) && defined(WITH_BRIDGE)
+	mosquitto__free(mapped_topic);
+#endif
+	return rc;
+}
+
+
+int send__publish(struct mosquitto *mosq, uint16_t mid, const char *topic, uint32_t payloadlen, const void *payload, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, const mosquitto_property *store_props, uint32_t expiry_interval)
+{
+	return send__publish_internal(mosq, mid, topic, payloadlen, payload, NULL, qos, retain, dup, cmsg_props, store_props, expiry_interval);
+}
+
+
+#ifdef WITH_BROKER
+/* Send a PUBLISH for a message held in the message store. Large payloads are
+ * not copied, the packet instead holds a reference to the store and the
+ * payload is written directly from it. */
+int send__publish_stored(struct mosquitto *mosq, uint16_t mid, struct mosquitto_msg_store *stored, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, uint32_t expiry_interval)
+{
+	return send__publish_internal(mosq, mid, stored->topic, stored->payloadlen, stored->payload, stored, qos, retain, dup, cmsg_props, stored->properties, expiry_interval);
 }
+#endif
 
 
 int send__real_publish(struct mosquitto *mosq, uint16_t mid, const char *topic, uint32_t payloadlen, const void *payload, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, const mosquitto_property *store_props, uint32_t expiry_interval)
+{
+	return send__real_publish_stored(mosq, mid, topic, payloadlen, payload, NULL, qos, retain, dup, cmsg_props, store_props, expiry_interval);
+}
+
+
+static int send__real_publish_stored(struct mosquitto *mosq, uint16_t mid, const char *topic, uint32_t payloadlen, const void *payload, struct mosquitto_msg_store *stored, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, const mosquitto_property *store_props, uint32_t expiry_interval)
 {
 	struct mosquitto__packet *packet = NULL;
 	unsigned int packetlen;
@@ -182,15 +171,29 @@ int send__real_publish(struct mosquitto *mosq, uint16_t mid, const char *topic,
 		return MOSQ_ERR_OVERSIZE_PACKET;
 	}
 
-	packet = (struct mosquitto__packet*)mosquitto__calloc(1, sizeof(struct mosquitto__packet));
+	packet = (struct mosquitto__packet*)mosquitto__slab_calloc(sizeof(struct mosquitto__packet));
 	if(!packet) return MOSQ_ERR_NOMEM;
 
 	packet->mid = mid;
 	packet->command = (uint8_t)(CMD_PUBLISH | (uint8_t)((dup&0x1)<<3) | (uint8_t)(qos<<1) | retain);
 	packet->remaining_length = packetlen;
+#ifdef WITH_BROKER
+	if(stored && payloadlen >= SHARED_PAYLOAD_MIN
+#  ifdef WITH_WEBSOCKETS
+			&& !mosq->wsi
+#  endif
+			){
+
+		packet->store = stored;
+		db__msg_store_ref_inc(packet->store);
+	}
+#else
+	UNUSED(stored);
+#endif
 	rc = packet__alloc(packet);
 	if(rc){
-		mosquitto__free(packet);
+		packet__cleanup(packet);
+		mosquitto__slab_free(packet);
 		return rc;
 	}
 	/* Variable header (topic string) */
@@ -213,7 +216,11 @@ int send__real_publish(struct mosquitto *mosq, uint16_t mid, const char *topic,
 	}
 
 	/* Payload */
-	if(payloadlen){
+	if(payloadlen
+#ifdef WITH_BROKER
+			&& !packet->store
+#endif
+			){
 		packet__write_bytes(packet, payload, payloadlen);
 	}
 
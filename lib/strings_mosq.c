@@ -63,6 +63,8 @@ const char *mosquitto_strerror(int mosq_errno)
 			return "This feature is not supported.";
 		case MOSQ_ERR_AUTH:
 			return "Authorisation failed.";
+		case MOSQ_ERR_AUTH_DELAYED:
+			return "Authorisation delayed.";
 		case MOSQ_ERR_ACL_DENIED:
 			return "Access denied by ACL.";
 		case MOSQ_ERR_UNKNOWN:
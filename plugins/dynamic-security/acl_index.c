@@ -0,0 +1,389 @@
+/*
+Copyright (c) 2022 Roger Light <roger@atchoo.org>
+
+All rights reserved. This program and the accompanying materials
+are made available under the terms of the Eclipse Public License 2.0
+and Eclipse Distribution License v1.0 which accompany this distribution.
+
+The Eclipse Public License is available at
+   https://www.eclipse.org/legal/epl-2.0/
+and the Eclipse Distribution License is available at
+  http://www.eclipse.org/org/documents/edl-v10.php.
+
+SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+
+Contributors:
+   Roger Light - initial implementation and documentation.
+*/
+
+/* Merged ACL index.
+ *
+ * An ACL check walks the client roles, then the roles of each group the
+ * client is in, and within each role the ACLs of the requested type in
+ * priority order, stopping at the first ACL that matches. Rather than doing
+ * that walk for every message, the ACLs of each type for a client are merged
+ * into a ranked ACL topic tree from src/acl_tree.c, with each ACL's position
+ * in the walk as its rank. Literal subscribe and unsubscribe ACLs are kept in
+ * a hash instead, as they only ever match the same topic.
+ *
+ * Indexes depend only on the ordered list of roles, so clients with the
+ * same roles and groups share an index. Any change to roles, role lists or
+ * group lists invalidates every index, and each is rebuilt when next used.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <uthash.h>
+
+#include "acl_tree.h"
+#include "dynamic_security.h"
+#include "mosquitto.h"
+#include "mosquitto_broker.h"
+#include "mosquitto_plugin.h"
+
+#define ACL_INDEX_PUB_C_SEND 0
+#define ACL_INDEX_PUB_C_RECV 1
+#define ACL_INDEX_SUBSCRIBE 2
+#define ACL_INDEX_UNSUBSCRIBE 3
+#define ACL_INDEX_TYPES 4
+
+struct dynsec__acl_literal{
+	UT_hash_handle hh;
+	char *topic;
+	struct mosquitto__acl_rule rule;
+};
+
+struct dynsec__acl_index{
+	UT_hash_handle hh;
+	char *key;
+	size_t key_len;
+	struct mosquitto__acl_node *root[ACL_INDEX_TYPES];
+	struct dynsec__acl_literal *subscribe_literal;
+	struct dynsec__acl_literal *unsubscribe_literal;
+	unsigned long generation;
+	int ref_count;
+	bool shared;
+};
+
+/* Indexes for the current generation, by role list */
+static struct dynsec__acl_index *local_indexes = NULL;
+static unsigned long acl_generation = 0;
+
+
+/* ################################################################
+ * #
+ * # Index building
+ * #
+ * ################################################################ */
+
+static int acl_index__literal_add(struct dynsec__acl_literal **literals, const char *topic, int rank, bool allow)
+{
+	struct dynsec__acl_literal *literal;
+
+	HASH_FIND(hh, *literals, topic, strlen(topic), literal);
+	if(literal) return MOSQ_ERR_SUCCESS;
+
+	literal = mosquitto_calloc(1, sizeof(struct dynsec__acl_literal));
+	if(literal == NULL) return MOSQ_ERR_NOMEM;
+	literal->topic = mosquitto_strdup(topic);
+	if(literal->topic == NULL){
+		mosquitto_free(literal);
+		return MOSQ_ERR_NOMEM;
+	}
+	literal->rule.rank = rank;
+	literal->rule.deny = !allow;
+	HASH_ADD_KEYPTR(hh, *literals, literal->topic, strlen(literal->topic), literal);
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static int acl_index__add_publish(struct dynsec__acl_index *index, int type, struct dynsec__acl *acls, int *rank)
+{
+	struct dynsec__acl *acl, *acl_tmp = NULL;
+
+	HASH_ITER(hh, acls, acl, acl_tmp){
+		(*rank)++;
+		/* An invalid topic never matched with mosquitto_topic_matches_sub() */
+		if(mosquitto_sub_topic_check(acl->topic) != MOSQ_ERR_SUCCESS) continue;
+		if(acl_tree__add_ranked(&index->root[type], acl->topic, *rank, !acl->allow)){
+			return MOSQ_ERR_NOMEM;
+		}
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static int acl_index__add_subscribe(struct dynsec__acl_index *index, int type, struct dynsec__acl_literal **literals,
+		struct dynsec__acl *literal_acls, struct dynsec__acl *pattern_acls, int *rank)
+{
+	struct dynsec__acl *acl, *acl_tmp = NULL;
+
+	/* Only one literal ACL in a role can match a topic, and it is checked
+	 * before the pattern ACLs of the same role. */
+	(*rank)++;
+	HASH_ITER(hh, literal_acls, acl, acl_tmp){
+		if(acl_index__literal_add(literals, acl->topic, *rank, acl->allow)){
+			return MOSQ_ERR_NOMEM;
+		}
+	}
+	HASH_ITER(hh, pattern_acls, acl, acl_tmp){
+		(*rank)++;
+		/* Pattern ACLs loaded from the config file aren't validated, but the
+		 * tree treats a "#" that isn't the last level as literal, as
+		 * sub_acl_check() does. */
+		if(acl_tree__add_ranked(&index->root[type], acl->topic, *rank, !acl->allow)){
+			return MOSQ_ERR_NOMEM;
+		}
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static int acl_index__add_rolelist(struct dynsec__acl_index *index, struct dynsec__rolelist *base_rolelist, int *rank)
+{
+	struct dynsec__rolelist *rolelist, *rolelist_tmp = NULL;
+	struct dynsec__role *role;
+
+	HASH_ITER(hh, base_rolelist, rolelist, rolelist_tmp){
+		role = rolelist->role;
+		if(acl_index__add_publish(index, ACL_INDEX_PUB_C_SEND, role->acls.publish_c_send, &rank[ACL_INDEX_PUB_C_SEND])
+				|| acl_index__add_publish(index, ACL_INDEX_PUB_C_RECV, role->acls.publish_c_recv, &rank[ACL_INDEX_PUB_C_RECV])
+				|| acl_index__add_subscribe(index, ACL_INDEX_SUBSCRIBE, &index->subscribe_literal,
+					role->acls.subscribe_literal, role->acls.subscribe_pattern, &rank[ACL_INDEX_SUBSCRIBE])
+				|| acl_index__add_subscribe(index, ACL_INDEX_UNSUBSCRIBE, &index->unsubscribe_literal,
+					role->acls.unsubscribe_literal, role->acls.unsubscribe_pattern, &rank[ACL_INDEX_UNSUBSCRIBE])
+				){
+
+			return MOSQ_ERR_NOMEM;
+		}
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static void acl_index__free_literals(struct dynsec__acl_literal **literals)
+{
+	struct dynsec__acl_literal *literal, *literal_tmp = NULL;
+
+	HASH_ITER(hh, *literals, literal, literal_tmp){
+		HASH_DELETE(hh, *literals, literal);
+		mosquitto_free(literal->topic);
+		mosquitto_free(literal);
+	}
+}
+
+
+static void acl_index__free(struct dynsec__acl_index *index)
+{
+	int i;
+
+	if(index->shared){
+		HASH_DELETE(hh, local_indexes, index);
+	}
+	for(i=0; i<ACL_INDEX_TYPES; i++){
+		acl_tree__free(&index->root[i]);
+	}
+	acl_index__free_literals(&index->subscribe_literal);
+	acl_index__free_literals(&index->unsubscribe_literal);
+	mosquitto_free(index->key);
+	mosquitto_free(index);
+}
+
+
+/* The key is the names of the roles in check order, each followed by '\0'. */
+static char *acl_index__key(struct dynsec__rolelist **rolelists, int count, size_t *key_len)
+{
+	struct dynsec__rolelist *rolelist, *rolelist_tmp = NULL;
+	size_t len = 0, slen;
+	char *key;
+	int i;
+
+	for(i=0; i<count; i++){
+		HASH_ITER(hh, rolelists[i], rolelist, rolelist_tmp){
+			len += strlen(rolelist->role->rolename) + 1;
+		}
+	}
+	key = mosquitto_malloc(len+1);
+	if(key == NULL) return NULL;
+
+	len = 0;
+	for(i=0; i<count; i++){
+		HASH_ITER(hh, rolelists[i], rolelist, rolelist_tmp){
+			slen = strlen(rolelist->role->rolename) + 1;
+			memcpy(&key[len], rolelist->role->rolename, slen);
+			len += slen;
+		}
+	}
+	*key_len = len;
+	return key;
+}
+
+
+static struct dynsec__acl_index *acl_index__get(struct dynsec__acl_index **slot, struct dynsec__rolelist **rolelists, int count)
+{
+	struct dynsec__acl_index *index;
+	int rank[ACL_INDEX_TYPES] = {0, 0, 0, 0};
+	char *key;
+	size_t key_len;
+	int i;
+
+	dynsec_acl_index__release(slot);
+
+	key = acl_index__key(rolelists, count, &key_len);
+	if(key == NULL) return NULL;
+
+	HASH_FIND(hh, local_indexes, key, key_len, index);
+	if(index){
+		mosquitto_free(key);
+		index->ref_count++;
+		*slot = index;
+		return index;
+	}
+
+	index = mosquitto_calloc(1, sizeof(struct dynsec__acl_index));
+	if(index == NULL){
+		mosquitto_free(key);
+		return NULL;
+	}
+	index->key = key;
+	index->key_len = key_len;
+	index->generation = acl_generation;
+	for(i=0; i<count; i++){
+		if(acl_index__add_rolelist(index, rolelists[i], rank)){
+			acl_index__free(index);
+			return NULL;
+		}
+	}
+
+	HASH_ADD_KEYPTR(hh, local_indexes, index->key, index->key_len, index);
+	index->shared = true;
+	index->ref_count = 1;
+	*slot = index;
+
+	return index;
+}
+
+
+/* ################################################################
+ * #
+ * # Index use
+ * #
+ * ################################################################ */
+
+struct dynsec__acl_index *dynsec_acl_index__client(struct dynsec__client *client)
+{
+	struct dynsec__grouplist *grouplist, *grouplist_tmp = NULL;
+	struct dynsec__rolelist **rolelists;
+	struct dynsec__acl_index *index;
+	int count = 1;
+
+	if(client->acl_index && client->acl_index->generation == acl_generation){
+		return client->acl_index;
+	}
+
+	count += (int)HASH_COUNT(client->grouplist);
+	rolelists = mosquitto_malloc(sizeof(struct dynsec__rolelist *)*(size_t)count);
+	if(rolelists == NULL) return NULL;
+
+	count = 0;
+	rolelists[count++] = client->rolelist;
+	HASH_ITER(hh, client->grouplist, grouplist, grouplist_tmp){
+		rolelists[count++] = grouplist->group->rolelist;
+	}
+
+	index = acl_index__get(&client->acl_index, rolelists, count);
+	mosquitto_free(rolelists);
+
+	return index;
+}
+
+
+struct dynsec__acl_index *dynsec_acl_index__group(struct dynsec__group *group)
+{
+	if(group->acl_index && group->acl_index->generation == acl_generation){
+		return group->acl_index;
+	}
+
+	return acl_index__get(&group->acl_index, &group->rolelist, 1);
+}
+
+
+static void acl_index__check_subscribe(const struct dynsec__acl_index *index, int type, struct dynsec__acl_literal *literals, const char *sub, struct mosquitto__acl_rule *best)
+{
+	struct dynsec__acl_literal *literal;
+
+	HASH_FIND(hh, literals, sub, strlen(sub), literal);
+	if(literal){
+		acl_tree__rule_best(best, &literal->rule);
+	}
+	acl_tree__find_sub(index->root[type], sub, best);
+}
+
+
+/* Returns MOSQ_ERR_SUCCESS or MOSQ_ERR_ACL_DENIED according to the first
+ * matching ACL, or MOSQ_ERR_NOT_FOUND if no ACL matches. */
+int dynsec_acl_index__check(const struct dynsec__acl_index *index, int access, const char *topic)
+{
+	struct mosquitto__acl_rule best;
+
+	memset(&best, 0, sizeof(best));
+	switch(access){
+		case MOSQ_ACL_WRITE: /* Client to broker */
+			acl_tree__find(index->root[ACL_INDEX_PUB_C_SEND], topic, &best);
+			break;
+		case MOSQ_ACL_READ:
+			acl_tree__find(index->root[ACL_INDEX_PUB_C_RECV], topic, &best);
+			break;
+		case MOSQ_ACL_SUBSCRIBE:
+			acl_index__check_subscribe(index, ACL_INDEX_SUBSCRIBE, index->subscribe_literal, topic, &best);
+			break;
+		case MOSQ_ACL_UNSUBSCRIBE:
+			acl_index__check_subscribe(index, ACL_INDEX_UNSUBSCRIBE, index->unsubscribe_literal, topic, &best);
+			break;
+		default:
+			break;
+	}
+
+	if(best.rank == 0){
+		return MOSQ_ERR_NOT_FOUND;
+	}else if(best.deny){
+		return MOSQ_ERR_ACL_DENIED;
+	}else{
+		return MOSQ_ERR_SUCCESS;
+	}
+}
+
+
+/* ################################################################
+ * #
+ * # Index lifetime
+ * #
+ * ################################################################ */
+
+void dynsec_acl_index__release(struct dynsec__acl_index **index)
+{
+	if(*index){
+		(*index)->ref_count--;
+		if((*index)->ref_count == 0){
+			acl_index__free(*index);
+		}
+		*index = NULL;
+	}
+}
+
+
+/* Call when anything that affects the result of an ACL check changes. Indexes
+ * still in use are freed when they are next used or their owner is freed. */
+void dynsec_acl_index__invalidate(void)
+{
+	struct dynsec__acl_index *index, *index_tmp = NULL;
+
+	acl_generation++;
+	HASH_ITER(hh, local_indexes, index, index_tmp){
+		HASH_DELETE(hh, local_indexes, index);
+		index->shared = false;
+	}
+}
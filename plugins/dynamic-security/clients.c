@@ -82,6 +82,7 @@ static void client__free_item(struct dynsec__client *client)
 	}
 	dynsec_rolelist__cleanup(&client->rolelist);
 	dynsec__remove_client_from_all_groups(client->username);
+	dynsec_acl_index__release(&client->acl_index);
 	mosquitto_free(client->text_name);
 	mosquitto_free(client->text_description);
 	mosquitto_free(client->clientid);
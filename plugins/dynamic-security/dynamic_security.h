@@ -54,6 +54,8 @@ Contributors:
  * #
  * ################################################################ */
 
+struct dynsec__acl_index;
+
 struct dynsec__clientlist{
 	UT_hash_handle hh;
 	struct dynsec__client *client;
@@ -78,6 +80,7 @@ struct dynsec__client{
 	struct mosquitto_pw pw;
 	struct dynsec__rolelist *rolelist;
 	struct dynsec__grouplist *grouplist;
+	struct dynsec__acl_index *acl_index;
 	char *username;
 	char *clientid;
 	char *text_name;
@@ -89,6 +92,7 @@ struct dynsec__group{
 	UT_hash_handle hh;
 	struct dynsec__rolelist *rolelist;
 	struct dynsec__clientlist *clientlist;
+	struct dynsec__acl_index *acl_index; /* Used when this is the anonymous group */
 	char *groupname;
 	char *text_name;
 	char *text_description;
@@ -152,6 +156,19 @@ int dynsec__acl_check_callback(int event, void *event_data, void *userdata);
 bool sub_acl_check(const char *acl, const char *sub);
 
 
+/* ################################################################
+ * #
+ * # ACL Index Functions
+ * #
+ * ################################################################ */
+
+int dynsec_acl_index__check(const struct dynsec__acl_index *index, int access, const char *topic);
+struct dynsec__acl_index *dynsec_acl_index__client(struct dynsec__client *client);
+struct dynsec__acl_index *dynsec_acl_index__group(struct dynsec__group *group);
+void dynsec_acl_index__invalidate(void);
+void dynsec_acl_index__release(struct dynsec__acl_index **index);
+
+
 /* ################################################################
  * #
  * # Auth Functions
@@ -113,6 +113,7 @@ int dynsec_grouplist__add(struct dynsec__grouplist **base_grouplist, struct dyns
 	grouplist->group = group;
 	grouplist->priority = priority;
 	HASH_ADD_KEYPTR_INORDER(hh, *base_grouplist, grouplist->group->groupname, strlen(grouplist->group->groupname), grouplist, dynsec_grouplist__cmp);
+	dynsec_acl_index__invalidate();
 
 	return MOSQ_ERR_SUCCESS;
 }
@@ -126,6 +127,7 @@ void dynsec_grouplist__cleanup(struct dynsec__grouplist **base_grouplist)
 		HASH_DELETE(hh, *base_grouplist, grouplist);
 		mosquitto_free(grouplist);
 	}
+	dynsec_acl_index__invalidate();
 }
 
 
@@ -137,5 +139,6 @@ void dynsec_grouplist__remove(struct dynsec__grouplist **base_grouplist, struct
 	if(grouplist){
 		HASH_DELETE(hh, *base_grouplist, grouplist);
 		mosquitto_free(grouplist);
+		dynsec_acl_index__invalidate();
 	}
 }
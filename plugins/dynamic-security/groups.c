@@ -106,6 +106,7 @@ static void group__free_item(struct dynsec__group *group)
 	mosquitto_free(group->text_description);
 	mosquitto_free(group->groupname);
 	dynsec_rolelist__cleanup(&group->rolelist);
+	dynsec_acl_index__release(&group->acl_index);
 	mosquitto_free(group);
 }
 
@@ -577,14 +577,20 @@ int dynsec__handle_control(cJSON *j_responses, struct mosquitto *context, cJSON
 	cJSON *aiter;
 	char *command;
 	char *correlation_data = NULL;
+	bool changed = false;
 
 	cJSON_ArrayForEach(aiter, commands){
 		if(cJSON_IsObject(aiter)){
 			if(json_get_string(aiter, "command", &command, false) == MOSQ_ERR_SUCCESS){
 				if(json_get_string(aiter, "correlationData", &correlation_data, true) != MOSQ_ERR_SUCCESS){
 					dynsec__command_reply(j_responses, context, command, "Invalid correlationData data type.", NULL);
+					if(changed) mosquitto_acl_cache_invalidate();
 					return MOSQ_ERR_INVAL;
 				}
+				/* Anything other than a get or list may change access */
+				if(strncasecmp(command, "get", 3) && strncasecmp(command, "list", 4)){
+					changed = true;
+				}
 
 				/* Plugin */
 				if(!strcasecmp(command, "setDefaultACLAccess")){
@@ -671,5 +677,8 @@ int dynsec__handle_control(cJSON *j_responses, struct mosquitto *context, cJSON
 		}
 	}
 
+	if(changed){
+		mosquitto_acl_cache_invalidate();
+	}
 	return rc;
 }
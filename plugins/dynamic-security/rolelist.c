@@ -56,6 +56,7 @@ static void dynsec_rolelist__free_item(struct dynsec__rolelist **base_rolelist,
 	HASH_DELETE(hh, *base_rolelist, rolelist);
 	mosquitto_free(rolelist->rolename);
 	mosquitto_free(rolelist);
+	dynsec_acl_index__invalidate();
 }
 
 void dynsec_rolelist__cleanup(struct dynsec__rolelist **base_rolelist)
@@ -128,6 +129,7 @@ static int dynsec_rolelist__add(struct dynsec__rolelist **base_rolelist, struct
 			return MOSQ_ERR_NOMEM;
 		}
 		HASH_ADD_KEYPTR_INORDER(hh, *base_rolelist, role->rolename, strlen(role->rolename), rolelist, rolelist_cmp);
+		dynsec_acl_index__invalidate();
 		return MOSQ_ERR_SUCCESS;
 	}
 }
@@ -66,6 +66,7 @@ static void role__free_acl(struct dynsec__acl **acl, struct dynsec__acl *item)
 	HASH_DELETE(hh, *acl, item);
 	mosquitto_free(item->topic);
 	mosquitto_free(item);
+	dynsec_acl_index__invalidate();
 }
 
 static void role__free_all_acls(struct dynsec__acl **acl)
@@ -247,6 +248,7 @@ static int dynsec_roles__acl_load(cJSON *j_acls, const char *key, struct dynsec_
 		}
 
 		HASH_ADD_KEYPTR_INORDER(hh, *acllist, acl->topic, strlen(acl->topic), acl, insert_acl_cmp);
+		dynsec_acl_index__invalidate();
 	}
 
 	return 0;
@@ -676,6 +678,7 @@ int dynsec_roles__process_add_acl(cJSON *j_responses, struct mosquitto *context,
 	json_get_bool(command, "allow", &acl->allow, true, false);
 
 	HASH_ADD_KEYPTR_INORDER(hh, *acllist, acl->topic, strlen(acl->topic), acl, insert_acl_cmp);
+	dynsec_acl_index__invalidate();
 	dynsec__config_save();
 	dynsec__command_reply(j_responses, context, "addRoleACL", NULL, correlation_data);
 
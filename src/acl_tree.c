@@ -0,0 +1,354 @@
+/*
+Copyright (c) 2022 Roger Light <roger@atchoo.org>
+
+All rights reserved. This program and the accompanying materials
+are made available under the terms of the Eclipse Public License 2.0
+and Eclipse Distribution License v1.0 which accompany this distribution.
+
+The Eclipse Public License is available at
+   https://www.eclipse.org/legal/epl-2.0/
+and the Eclipse Distribution License is available at
+  http://www.eclipse.org/org/documents/edl-v10.php.
+
+SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+
+Contributors:
+   Roger Light - initial implementation and documentation.
+*/
+
+/* Topic tree of ACL rules.
+ *
+ * Each rule topic is added one level per node, with "+" levels kept in a
+ * separate child rather than in the hash of literal children, and a trailing
+ * "#" recorded on the node of the level before it. Matching a topic is then
+ * a single walk of the tree with no allocation, following at most the
+ * literal child and the "+" child at each level.
+ *
+ * Rules are combined in one of two ways, and a tree should only be built
+ * with one of them:
+ *
+ * acl_tree__add() gives the same result as checking a list of rules in which
+ * "deny" rules come first, which is how the default ACL lists are ordered: if
+ * any deny rule matches access is denied, otherwise access is granted if any
+ * matching rule allows it.
+ *
+ * acl_tree__add_ranked() gives each rule a rank, and a match finds the
+ * matching rule with the lowest rank, which is the one a walk through the
+ * rules in rank order would have stopped at. This is used for bridge topic
+ * remapping and for the dynamic security plugin's ACLs.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "acl_tree.h"
+#include "mosquitto.h"
+#include "mosquitto_broker.h"
+#include "mosquitto_plugin.h"
+
+
+struct acl_tree__match{
+	struct mosquitto__acl_rule result;
+	bool ranked;
+	bool done;
+};
+
+
+static struct mosquitto__acl_node *acl_tree__child_add(struct mosquitto__acl_node *node, const char *topic, size_t len)
+{
+	struct mosquitto__acl_node *child;
+
+	if(len == 1 && topic[0] == '+'){
+		if(node->plus == NULL){
+			node->plus = mosquitto_calloc(1, sizeof(struct mosquitto__acl_node));
+		}
+		return node->plus;
+	}
+
+	HASH_FIND(hh, node->children, topic, len, child);
+	if(child) return child;
+
+	child = mosquitto_calloc(1, sizeof(struct mosquitto__acl_node));
+	if(child == NULL) return NULL;
+	child->topic = mosquitto_malloc(len+1);
+	if(child->topic == NULL){
+		mosquitto_free(child);
+		return NULL;
+	}
+	memcpy(child->topic, topic, len);
+	child->topic[len] = '\0';
+	HASH_ADD_KEYPTR(hh, node->children, child->topic, len, child);
+
+	return child;
+}
+
+
+int acl_tree__init(struct mosquitto__acl_node **root)
+{
+	if(*root == NULL){
+		*root = mosquitto_calloc(1, sizeof(struct mosquitto__acl_node));
+		if(*root == NULL) return MOSQ_ERR_NOMEM;
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Returns the rule of the tree that topic should be recorded in, creating
+ * nodes as needed. A "#" that isn't the last level is treated as a literal
+ * level, so an invalid topic like that never matches anything, as with
+ * mosquitto_topic_matches_sub(). */
+static struct mosquitto__acl_rule *acl_tree__rule_add(struct mosquitto__acl_node **root, const char *topic)
+{
+	struct mosquitto__acl_node *node;
+	const char *end;
+	size_t len;
+
+	if(acl_tree__init(root)) return NULL;
+
+	node = *root;
+	while(topic){
+		end = strchr(topic, '/');
+		if(end){
+			len = (size_t)(end - topic);
+		}else{
+			len = strlen(topic);
+			if(len == 1 && topic[0] == '#'){
+				return &node->multi;
+			}
+		}
+		node = acl_tree__child_add(node, topic, len);
+		if(node == NULL) return NULL;
+
+		topic = end?end+1:NULL;
+	}
+	return &node->rule;
+}
+
+
+/* Add a rule for topic, which should be a valid subscription topic. An access
+ * of MOSQ_ACL_NONE adds a deny rule. */
+int acl_tree__add(struct mosquitto__acl_node **root, const char *topic, int access)
+{
+	struct mosquitto__acl_rule *rule;
+
+	rule = acl_tree__rule_add(root, topic);
+	if(rule == NULL) return MOSQ_ERR_NOMEM;
+
+	if(access == MOSQ_ACL_NONE){
+		rule->deny = true;
+	}else{
+		rule->access |= access;
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Add a rule for topic with the given rank, which must be greater than 0. If
+ * the same topic already has a rule, the one with the lower rank is kept. */
+int acl_tree__add_ranked(struct mosquitto__acl_node **root, const char *topic, int rank, bool deny)
+{
+	struct mosquitto__acl_rule *rule;
+
+	rule = acl_tree__rule_add(root, topic);
+	if(rule == NULL) return MOSQ_ERR_NOMEM;
+
+	if(rule->rank == 0 || rank < rule->rank){
+		rule->rank = rank;
+		rule->deny = deny;
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Keep whichever of best and rule has the lowest rank. */
+void acl_tree__rule_best(struct mosquitto__acl_rule *best, const struct mosquitto__acl_rule *rule)
+{
+	if(rule->rank && (best->rank == 0 || rule->rank < best->rank)){
+		*best = *rule;
+	}
+}
+
+
+static void acl_tree__match_rule(struct acl_tree__match *match, const struct mosquitto__acl_rule *rule)
+{
+	if(match->ranked){
+		acl_tree__rule_best(&match->result, rule);
+	}else{
+		match->result.access |= rule->access;
+		if(rule->deny){
+			/* Nothing else can change the result */
+			match->result.deny = true;
+			match->done = true;
+		}
+	}
+}
+
+
+/* Matches a topic in the same way as mosquitto_topic_matches_sub(). topic is
+ * the remainder of the topic starting at the level below node, or NULL if
+ * node is the last level. */
+static void acl_tree__match(const struct mosquitto__acl_node *node, const char *topic, bool root, struct acl_tree__match *match)
+{
+	struct mosquitto__acl_node *child;
+	const char *end;
+	size_t len;
+	bool wildcards;
+
+	/* Wildcards at the first level don't match topics beginning with $ */
+	wildcards = !(root && topic && topic[0] == '$');
+
+	if(wildcards){
+		/* "foo/#" matches "foo" as well as everything below it */
+		acl_tree__match_rule(match, &node->multi);
+		if(match->done) return;
+	}
+
+	if(topic == NULL){
+		acl_tree__match_rule(match, &node->rule);
+		return;
+	}
+
+	end = strchr(topic, '/');
+	if(end){
+		len = (size_t)(end - topic);
+	}else{
+		len = strlen(topic);
+	}
+
+	HASH_FIND(hh, node->children, topic, len, child);
+	if(child){
+		acl_tree__match(child, end?end+1:NULL, false, match);
+		if(match->done) return;
+	}
+	if(wildcards && node->plus){
+		acl_tree__match(node->plus, end?end+1:NULL, false, match);
+	}
+}
+
+
+/* For trees built with acl_tree__add(). Returns MOSQ_ERR_ACL_DENIED if a deny
+ * rule matches topic, MOSQ_ERR_SUCCESS if a matching rule allows any of the
+ * requested access, or MOSQ_ERR_NOT_FOUND if no rule decides. */
+int acl_tree__check(const struct mosquitto__acl_node *root, const char *topic, int access)
+{
+	struct acl_tree__match match;
+
+	if(root == NULL || topic == NULL || topic[0] == '\0'){
+		return MOSQ_ERR_NOT_FOUND;
+	}
+
+	memset(&match, 0, sizeof(match));
+	acl_tree__match(root, topic, true, &match);
+
+	if(match.result.deny){
+		return MOSQ_ERR_ACL_DENIED;
+	}else if(match.result.access & access){
+		return MOSQ_ERR_SUCCESS;
+	}else{
+		return MOSQ_ERR_NOT_FOUND;
+	}
+}
+
+
+/* For trees built with acl_tree__add_ranked(). Sets *best to the lowest
+ * ranked rule matching topic, if it has a lower rank than *best already
+ * does. A rank of 0 in *best means no rule. */
+void acl_tree__find(const struct mosquitto__acl_node *root, const char *topic, struct mosquitto__acl_rule *best)
+{
+	struct acl_tree__match match;
+
+	if(root == NULL || topic == NULL || topic[0] == '\0'){
+		return;
+	}
+
+	memset(&match, 0, sizeof(match));
+	match.ranked = true;
+	match.result = *best;
+	acl_tree__match(root, topic, true, &match);
+	*best = match.result;
+}
+
+
+/* Matches a subscription, in the same way as sub_acl_check() in the dynamic
+ * security plugin. The subscription is the range [sub, sub_end) with any
+ * trailing "#" level removed, and sub_hash says whether there was one. */
+static void acl_tree__match_sub(const struct mosquitto__acl_node *node, const char *sub, const char *sub_end, bool sub_hash, struct mosquitto__acl_rule *best)
+{
+	struct mosquitto__acl_node *child;
+	const char *end;
+	size_t len;
+
+	/* A rule ending in "#" matches any subscription with at least as many
+	 * levels, including those ending in "#". */
+	acl_tree__rule_best(best, &node->multi);
+	if(sub == NULL){
+		if(sub_hash == false){
+			acl_tree__rule_best(best, &node->rule);
+		}
+		return;
+	}
+
+	end = memchr(sub, '/', (size_t)(sub_end - sub));
+	if(end){
+		len = (size_t)(end - sub);
+	}else{
+		len = (size_t)(sub_end - sub);
+	}
+
+	HASH_FIND(hh, node->children, sub, len, child);
+	if(child){
+		acl_tree__match_sub(child, end?end+1:NULL, sub_end, sub_hash, best);
+	}
+	if(node->plus){
+		acl_tree__match_sub(node->plus, end?end+1:NULL, sub_end, sub_hash, best);
+	}
+}
+
+
+/* As acl_tree__find(), but for a subscription being checked against rules
+ * that are themselves subscription patterns. */
+void acl_tree__find_sub(const struct mosquitto__acl_node *root, const char *sub, struct mosquitto__acl_rule *best)
+{
+	size_t len;
+	bool sub_hash = false;
+
+	if(root == NULL || sub == NULL){
+		return;
+	}
+
+	len = strlen(sub);
+	if(len == 1 && sub[0] == '#'){
+		len = 0;
+		sub_hash = true;
+	}else if(len > 1 && sub[len-2] == '/' && sub[len-1] == '#'){
+		len -= 2;
+		sub_hash = true;
+	}
+	acl_tree__match_sub(root, sub, sub+len, sub_hash, best);
+}
+
+
+static void acl_tree__free_node(struct mosquitto__acl_node *node)
+{
+	struct mosquitto__acl_node *child, *child_tmp;
+
+	HASH_ITER(hh, node->children, child, child_tmp){
+		HASH_DELETE(hh, node->children, child);
+		acl_tree__free_node(child);
+	}
+	if(node->plus){
+		acl_tree__free_node(node->plus);
+	}
+	mosquitto_free(node->topic);
+	mosquitto_free(node);
+}
+
+
+void acl_tree__free(struct mosquitto__acl_node **root)
+{
+	if(*root){
+		acl_tree__free_node(*root);
+		*root = NULL;
+	}
+}
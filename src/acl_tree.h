@@ -0,0 +1,53 @@
+/*
+Copyright (c) 2022 Roger Light <roger@atchoo.org>
+
+All rights reserved. This program and the accompanying materials
+are made available under the terms of the Eclipse Public License 2.0
+and Eclipse Distribution License v1.0 which accompany this distribution.
+
+The Eclipse Public License is available at
+   https://www.eclipse.org/legal/epl-2.0/
+and the Eclipse Distribution License is available at
+  http://www.eclipse.org/org/documents/edl-v10.php.
+
+SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+
+Contributors:
+   Roger Light - initial implementation and documentation.
+*/
+
+#ifndef ACL_TREE_H
+#define ACL_TREE_H
+
+#include <stdbool.h>
+#include <uthash.h>
+
+/* Also built into the dynamic security plugin, so this must not depend on
+ * broker internals. */
+
+struct mosquitto__acl_rule{
+	int access; /* Access allowed, for trees built with acl_tree__add() */
+	int rank; /* For trees built with acl_tree__add_ranked(), or 0 */
+	bool deny;
+};
+
+/* A level of an ACL topic tree, see acl_tree.c */
+struct mosquitto__acl_node{
+	UT_hash_handle hh;
+	struct mosquitto__acl_node *children;
+	struct mosquitto__acl_node *plus;
+	char *topic;
+	struct mosquitto__acl_rule rule; /* Rules ending at this level */
+	struct mosquitto__acl_rule multi; /* Rules ending in "#" below this level */
+};
+
+int acl_tree__init(struct mosquitto__acl_node **root);
+int acl_tree__add(struct mosquitto__acl_node **root, const char *topic, int access);
+int acl_tree__add_ranked(struct mosquitto__acl_node **root, const char *topic, int rank, bool deny);
+int acl_tree__check(const struct mosquitto__acl_node *root, const char *topic, int access);
+void acl_tree__rule_best(struct mosquitto__acl_rule *best, const struct mosquitto__acl_rule *rule);
+void acl_tree__find(const struct mosquitto__acl_node *root, const char *topic, struct mosquitto__acl_rule *best);
+void acl_tree__find_sub(const struct mosquitto__acl_node *root, const char *sub, struct mosquitto__acl_rule *best);
+void acl_tree__free(struct mosquitto__acl_node **root);
+
+#endif
@@ -57,19 +57,153 @@ Contributors:
 static void bridge__backoff_step(struct mosquitto *context);
 static void bridge__backoff_reset(struct mosquitto *context);
 
+static char *bridge__stream_string(const char *str, int stream)
+{
+	char *stream_str;
+	size_t len;
+
+	len = strlen(str) + 12;
+	stream_str = mosquitto__malloc(len);
+	if(stream_str){
+		snprintf(stream_str, len, "%s.%d", str, stream);
+	}
+	return stream_str;
+}
+
+
+static void bridge__stream_free(struct mosquitto__bridge *bridge)
+{
+	mosquitto__free(bridge->name);
+	mosquitto__free(bridge->remote_clientid);
+	mosquitto__free(bridge->remote_username);
+	mosquitto__free(bridge->remote_password);
+	mosquitto__free(bridge->local_clientid);
+	mosquitto__free(bridge->local_username);
+	mosquitto__free(bridge->local_password);
+	mosquitto__free(bridge->first_clientid);
+	mosquitto__free(bridge);
+}
+
+
+/* Each extra connection of a bridge has its own copy of the bridge, so that it
+ * reconnects and backs off independently of the others. The copy has its own
+ * name and client ids, and its own copies of the strings that are freed along
+ * with its context. Everything else is shared with the configured bridge. */
+static struct mosquitto__bridge *bridge__stream_new(struct mosquitto__bridge *bridge, int stream)
+{
+	struct mosquitto__bridge *copy;
+
+	copy = mosquitto__malloc(sizeof(struct mosquitto__bridge));
+	if(!copy) return NULL;
+
+	memcpy(copy, bridge, sizeof(struct mosquitto__bridge));
+	copy->stream = stream;
+	copy->primary_retry = 0;
+	copy->primary_retry_sock = INVALID_SOCKET;
+	/* Connection state notifications are for the bridge as a whole, and are
+	 * sent by the first connection only. */
+	copy->notifications = false;
+	copy->batch_buf = NULL;
+	copy->batch_buf_size = 0;
+	copy->batch_len = 0;
+	copy->batch_count = 0;
+
+	copy->name = bridge__stream_string(bridge->name, stream+1);
+	copy->remote_clientid = bridge__stream_string(bridge->remote_clientid, stream+1);
+	copy->local_clientid = bridge__stream_string(bridge->local_clientid, stream+1);
+	copy->first_clientid = mosquitto__strdup(bridge->local_clientid);
+	copy->remote_username = bridge->remote_username?mosquitto__strdup(bridge->remote_username):NULL;
+	copy->remote_password = bridge->remote_password?mosquitto__strdup(bridge->remote_password):NULL;
+	copy->local_username = bridge->local_username?mosquitto__strdup(bridge->local_username):NULL;
+	copy->local_password = bridge->local_password?mosquitto__strdup(bridge->local_password):NULL;
+
+	if(!copy->name || !copy->remote_clientid || !copy->local_clientid || !copy->first_clientid
+			|| (bridge->remote_username && !copy->remote_username)
+			|| (bridge->remote_password && !copy->remote_password)
+			|| (bridge->local_username && !copy->local_username)
+			|| (bridge->local_password && !copy->local_password)){
+
+		bridge__stream_free(copy);
+		return NULL;
+	}
+	return copy;
+}
+
+
 void bridge__start_all(void)
 {
-	int i;
+	struct mosquitto__bridge *bridge;
+	int i, j;
 
 	for(i=0; i<db.config->bridge_count; i++){
-		if(bridge__new(&(db.config->bridges[i])) > 0){
-			log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Unable to connect to bridge %s.",
-					db.config->bridges[i].name);
+		for(j=0; j<db.config->bridges[i].connections; j++){
+			if(j == 0){
+				bridge = &(db.config->bridges[i]);
+			}else{
+				bridge = bridge__stream_new(&(db.config->bridges[i]), j);
+				if(!bridge){
+					log__printf(NULL, MOSQ_LOG_ERR, "Error: Out of memory.");
+					break;
+				}
+			}
+			if(bridge__new(bridge) > 0){
+				log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Unable to connect to bridge %s.",
+						bridge->name);
+			}
 		}
 	}
 }
 
 
+/* FNV-1a hash of a topic. */
+static uint64_t bridge__topic_hash(const char *topic)
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	while(*topic){
+		hash ^= (uint8_t)*topic;
+		hash *= 1099511628211ULL;
+		topic++;
+	}
+	return hash;
+}
+
+
+/* Map a topic to one of a bridge's connections, using the jump consistent
+ * hash of Lamping and Veach. If the number of connections is changed, only
+ * the topics that must move to the new connections do so. */
+static int bridge__topic_stream(const char *topic, int connections)
+{
+	uint64_t key;
+	int64_t b = -1, j = 0;
+
+	key = bridge__topic_hash(topic);
+	while(j < connections){
+		b = j;
+		key = key * 2862933555777941757ULL + 1;
+		j = (int64_t)((double)(b + 1) * ((double)(1LL << 31) / (double)((key >> 33) + 1)));
+	}
+	return (int)b;
+}
+
+
+/* Whether an outgoing message should be sent on this connection of a bridge.
+ * When a bridge has more than one connection, all messages for a topic are
+ * sent on the same connection so they stay in order. */
+bool bridge__stream_accepts(struct mosquitto__bridge *bridge, const struct mosquitto_msg_store *stored)
+{
+	if(bridge->connections < 2){
+		return true;
+	}
+	if(bridge->stream > 0 && stored->source_id && !strcmp(stored->source_id, bridge->first_clientid)){
+		/* Received from the remote broker by the first connection, which
+		 * has the incoming subscriptions. */
+		return false;
+	}
+	return bridge__topic_stream(stored->topic, bridge->connections) == bridge->stream;
+}
+
+
 int bridge__new(struct mosquitto__bridge *bridge)
 {
 	struct mosquitto *new_context = NULL;
@@ -295,6 +429,7 @@ int bridge__connect_step2(struct mosquitto *context)
 
 int bridge__connect_step3(struct mosquitto *context)
 {
+	mosquitto_property *properties = NULL;
 	int rc;
 
 	rc = net__socket_connect_step3(context, context->bridge->addresses[context->bridge->cur_address].address);
@@ -316,7 +451,18 @@ int bridge__connect_step3(struct mosquitto *context)
 		context->bridge->primary_retry = db.now_s + 5;
 	}
 
-	rc = send__connect(context, context->keepalive, context->clean_start, NULL);
+	rc = bridge__batch_request(context, &properties);
+	if(rc == MOSQ_ERR_SUCCESS){
+		rc = bridge__loop_request(context, &properties);
+	}
+	if(rc){
+		mosquitto_property_free_all(&properties);
+		mux__delete(context);
+		net__socket_close(context);
+		return rc;
+	}
+	rc = send__connect(context, context->keepalive, context->clean_start, properties);
+	mosquitto_property_free_all(&properties);
 	if(rc == MOSQ_ERR_SUCCESS){
 		return MOSQ_ERR_SUCCESS;
 	}else if(rc == MOSQ_ERR_ERRNO && errno == ENOTCONN){
@@ -338,6 +484,7 @@ int bridge__connect_step3(struct mosquitto *context)
 
 int bridge__connect(struct mosquitto *context)
 {
+	mosquitto_property *properties = NULL;
 	int rc, rc2;
 	int i;
 	char *notification_topic = NULL;
@@ -458,7 +605,14 @@ int bridge__connect(struct mosquitto *context)
 
 	HASH_ADD(hh_sock, db.contexts_by_sock, sock, sizeof(context->sock), context);
 
-	rc2 = send__connect(context, context->keepalive, context->clean_start, NULL);
+	rc2 = bridge__batch_request(context, &properties);
+	if(rc2 == MOSQ_ERR_SUCCESS){
+		rc2 = bridge__loop_request(context, &properties);
+	}
+	if(rc2 == MOSQ_ERR_SUCCESS){
+		rc2 = send__connect(context, context->keepalive, context->clean_start, properties);
+	}
+	mosquitto_property_free_all(&properties);
 	if(rc2 == MOSQ_ERR_SUCCESS){
 		return rc;
 	}else if(rc2 == MOSQ_ERR_ERRNO && errno == ENOTCONN){
@@ -528,7 +682,11 @@ int bridge__on_connect(struct mosquitto *context)
 		}
 	}
 	for(i=0; i<context->bridge->topic_count; i++){
-		if(context->bridge->topics[i].direction == bd_in || context->bridge->topics[i].direction == bd_both){
+		/* Only the first connection subscribes on the remote broker, otherwise
+		 * incoming messages would be received once per connection. */
+		if((context->bridge->topics[i].direction == bd_in || context->bridge->topics[i].direction == bd_both)
+				&& context->bridge->stream == 0){
+
 			if(context->bridge->topics[i].qos > context->max_qos){
 				sub_opts = context->max_qos;
 			}else{
@@ -628,6 +786,11 @@ void bridge__cleanup(struct mosquitto *context)
 		context->ssl_ctx = NULL;
 	}
 #endif
+	bridge__batch_free(context->bridge);
+	if(context->bridge->stream > 0){
+		bridge__stream_free(context->bridge);
+		context->bridge = NULL;
+	}
 }
 
 
@@ -638,14 +801,14 @@ void bridge__packet_cleanup(struct mosquitto *context)
 
 	if(context->current_out_packet){
 		packet__cleanup(context->current_out_packet);
-		mosquitto__free(context->current_out_packet);
+		mosquitto__slab_free(context->current_out_packet);
 		context->current_out_packet = NULL;
 	}
     while(context->out_packet){
 		packet__cleanup(context->out_packet);
 		packet = context->out_packet;
 		context->out_packet = context->out_packet->next;
-		mosquitto__free(packet);
+		mosquitto__slab_free(packet);
 	}
 	context->out_packet = NULL;
 	context->out_packet_last = NULL;
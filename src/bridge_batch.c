@@ -0,0 +1,746 @@
+/*
+Copyright (c) 2022 Roger Light <roger@atchoo.org>
+
+All rights reserved. This program and the accompanying materials
+are made available under the terms of the Eclipse Public License 2.0
+and Eclipse Distribution License v1.0 which accompany this distribution.
+
+The Eclipse Public License is available at
+   https://www.eclipse.org/legal/epl-2.0/
+and the Eclipse Distribution License is available at
+  http://www.eclipse.org/org/documents/edl-v10.php.
+
+SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+
+Contributors:
+   Roger Light - initial implementation and documentation.
+*/
+
+/* Bridge message batches.
+ *
+ * A bridge with bridge_batch_size set asks the remote broker to accept
+ * batches by adding a "mosquitto-batch" user property to its MQTT v5 CONNECT,
+ * with the compression it would like to use as the value. A broker that
+ * accepts batches on that listener, with allow_bridge_batches, replies with
+ * the same user property in its CONNACK, giving the compression it will
+ * accept. Any other broker ignores the property, and the bridge carries on
+ * sending messages individually.
+ *
+ * Once batches have been accepted, outgoing QoS 0 and 1 messages that have no
+ * properties are not queued for the bridge, but are added to a batch buffer
+ * instead. The buffer is turned into a single message on BRIDGE_BATCH_TOPIC
+ * once it reaches bridge_batch_size bytes, and at the end of each pass of the
+ * main loop. That message is queued in the usual way, at QoS 1 if any of the
+ * messages it holds were QoS 1, so the whole batch is acknowledged, resent
+ * and persisted as one message.
+ *
+ * A batch payload is a header of:
+ *   uint8  format version, currently 1
+ *   uint8  compression, enum mosquitto__batch_compression
+ *   uint32 length of the uncompressed messages
+ * followed by the, possibly compressed, messages, each of which is:
+ *   uint8  flags: QoS in bits 0-1, retain in bit 2, origin present in bit 3
+ *   uint16 topic length, topic
+ *   uint32 payload length, payload
+ *   uint16 origin length, origin, only if bit 3 of flags is set
+ * with all integers big endian. The origin is the loop detection origin of
+ * the message, see bridge_loop.c.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <utlist.h>
+
+#ifdef WITH_ZLIB
+#  include <zlib.h>
+#endif
+
+#include "mosquitto_broker_internal.h"
+#include "memory_mosq.h"
+#include "mqtt_protocol.h"
+#include "property_mosq.h"
+#include "util_mosq.h"
+
+#ifdef WITH_BRIDGE
+
+#define BATCH_VERSION 1
+#define BATCH_HEADER_LEN 6
+#define BATCH_RECORD_HEADER_LEN 7
+#define BATCH_FLAG_ORIGIN 0x08
+/* Room for the PUBLISH header and topic when checking against the maximum
+ * packet size of the remote broker. */
+#define BATCH_PACKET_OVERHEAD 64
+
+
+static const char *bridge__batch_compression_name(enum mosquitto__batch_compression compression)
+{
+	switch(compression){
+		case mosq_bc_zlib:
+			return "zlib";
+		case mosq_bc_none:
+		default:
+			return "none";
+	}
+}
+
+
+static void bridge__batch_write_uint16(uint8_t *buf, uint16_t value)
+{
+	buf[0] = (uint8_t)((value >> 8) & 0xFF);
+	buf[1] = (uint8_t)(value & 0xFF);
+}
+
+
+static void bridge__batch_write_uint32(uint8_t *buf, uint32_t value)
+{
+	buf[0] = (uint8_t)((value >> 24) & 0xFF);
+	buf[1] = (uint8_t)((value >> 16) & 0xFF);
+	buf[2] = (uint8_t)((value >> 8) & 0xFF);
+	buf[3] = (uint8_t)(value & 0xFF);
+}
+
+
+static uint16_t bridge__batch_read_uint16(const uint8_t *buf)
+{
+	return (uint16_t)((buf[0] << 8) + buf[1]);
+}
+
+
+static uint32_t bridge__batch_read_uint32(const uint8_t *buf)
+{
+	return ((uint32_t)buf[0] << 24) + ((uint32_t)buf[1] << 16) + ((uint32_t)buf[2] << 8) + buf[3];
+}
+
+
+/* ======================================================================
+ * Sending, on the bridge
+ * ====================================================================== */
+
+/* Add the user property asking for batches to the CONNECT for a bridge. */
+int bridge__batch_request(struct mosquitto *context, mosquitto_property **properties)
+{
+	struct mosquitto__bridge *bridge = context->bridge;
+
+	bridge->batch_active = false;
+	if(bridge->batch_size == 0){
+		return MOSQ_ERR_SUCCESS;
+	}
+	if(context->protocol != mosq_p_mqtt5){
+		log__printf(NULL, MOSQ_LOG_NOTICE, "Bridge %s not using message batches, they need bridge_protocol_version mqttv50.", bridge->name);
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	return mosquitto_property_add_string_pair(properties, MQTT_PROP_USER_PROPERTY,
+			BRIDGE_BATCH_PROPERTY, bridge__batch_compression_name(bridge->batch_compression));
+}
+
+
+/* Can a batch queued for the bridge be sent on the current connection? */
+static bool bridge__batch_sendable(struct mosquitto__bridge *bridge, const struct mosquitto_msg_store *stored)
+{
+	const uint8_t *payload = stored->payload;
+
+	if(!bridge->batch_active || stored->payloadlen < BATCH_HEADER_LEN){
+		return false;
+	}
+	return payload[1] == mosq_bc_none || payload[1] == bridge->batch_active_compression;
+}
+
+
+/* Batches still queued from an earlier connection, or restored from the
+ * persistence database, can only be sent if the remote broker accepts them on
+ * this connection. The messages in them can't be sent individually instead,
+ * because their topics have already been remapped for the remote broker, so
+ * the batches are dropped. */
+static void bridge__batch_drop_unsendable(struct mosquitto *context)
+{
+	struct mosquitto_client_msg *cmsg, *cmsg_tmp;
+	int dropped = 0;
+
+	DL_FOREACH_SAFE(context->msgs_out.inflight, cmsg, cmsg_tmp){
+		if(cmsg->store && !strcmp(cmsg->store->topic, BRIDGE_BATCH_TOPIC)
+				&& !bridge__batch_sendable(context->bridge, cmsg->store)){
+
+			db__message_remove_outgoing(context, cmsg, true);
+			dropped++;
+		}
+	}
+	DL_FOREACH_SAFE(context->msgs_out.queued, cmsg, cmsg_tmp){
+		if(cmsg->store && !strcmp(cmsg->store->topic, BRIDGE_BATCH_TOPIC)
+				&& !bridge__batch_sendable(context->bridge, cmsg->store)){
+
+			db__message_remove_outgoing(context, cmsg, false);
+			dropped++;
+		}
+	}
+
+	if(dropped){
+		log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Bridge %s dropped %d queued message batches, the remote broker does not accept them.",
+				context->bridge->name, dropped);
+		/* Recount what is left, and move queued messages into the free
+		 * inflight slots. */
+		db__message_reconnect_reset(context);
+	}
+}
+
+
+/* Check whether the remote broker accepted batches in its CONNACK. */
+void bridge__batch_on_connack(struct mosquitto *context, const mosquitto_property *properties)
+{
+	struct mosquitto__bridge *bridge = context->bridge;
+	const mosquitto_property *p;
+
+	if(bridge->batch_size == 0){
+		return;
+	}
+
+	for(p=properties; p; p=p->next){
+		if(p->identifier == MQTT_PROP_USER_PROPERTY && !strcmp(p->name.v, BRIDGE_BATCH_PROPERTY)){
+			if(!strcmp(p->value.s.v, "none")){
+				bridge->batch_active = true;
+				bridge->batch_active_compression = mosq_bc_none;
+			}else if(!strcmp(p->value.s.v, "zlib") && bridge->batch_compression == mosq_bc_zlib){
+				bridge->batch_active = true;
+				bridge->batch_active_compression = mosq_bc_zlib;
+			}
+			break;
+		}
+	}
+
+	if(bridge->batch_active){
+		log__printf(NULL, MOSQ_LOG_NOTICE, "Bridge %s sending messages in batches, compression %s.",
+				bridge->name, bridge__batch_compression_name(bridge->batch_active_compression));
+	}else{
+		log__printf(NULL, MOSQ_LOG_NOTICE, "Bridge %s remote broker does not accept message batches.",
+				bridge->name);
+	}
+	bridge__batch_drop_unsendable(context);
+}
+
+
+static uint32_t bridge__batch_limit(struct mosquitto *context)
+{
+	uint32_t limit = context->bridge->batch_size;
+
+	if(context->maximum_packet_size && context->maximum_packet_size < limit + BATCH_HEADER_LEN + BATCH_PACKET_OVERHEAD){
+		if(context->maximum_packet_size > BATCH_HEADER_LEN + BATCH_PACKET_OVERHEAD){
+			limit = context->maximum_packet_size - BATCH_HEADER_LEN - BATCH_PACKET_OVERHEAD;
+		}else{
+			limit = 0;
+		}
+	}
+	return limit;
+}
+
+
+/* Should this outgoing message go in a batch rather than being queued? Only
+ * messages with no properties are batched, and large messages that would fill
+ * a batch on their own are sent individually. */
+bool bridge__batch_accepts(struct mosquitto *context, const struct mosquitto_msg_store *stored, uint8_t qos, const mosquitto_property *properties)
+{
+	struct mosquitto__bridge *bridge = context->bridge;
+
+	if(!bridge->batch_active
+			|| context->sock == INVALID_SOCKET
+			|| mosquitto__get_state(context) != mosq_cs_active
+			|| qos > 1
+			|| properties
+			|| stored->properties
+			|| stored->message_expiry_time){
+
+		return false;
+	}
+
+	return (uint64_t)stored->payloadlen + strlen(stored->topic) + BATCH_RECORD_HEADER_LEN <= bridge__batch_limit(context);
+}
+
+
+int bridge__batch_add(struct mosquitto *context, const struct mosquitto_msg_store *stored, uint8_t qos, bool retain)
+{
+	struct mosquitto__bridge *bridge = context->bridge;
+	const char *topic = stored->topic;
+	char *topic_buf;
+	const char *origin = NULL;
+	char origin_buf[BRIDGE_ORIGIN_LEN_MAX];
+	uint8_t *buf;
+	size_t topic_len, origin_len, record_len, buf_size;
+	int rc;
+
+	rc = bridge__remap_topic_out(context, &topic, &topic_buf);
+	if(rc) return rc;
+
+	topic_len = strlen(topic);
+	origin_len = bridge__loop_origin(context, stored, &origin, origin_buf, sizeof(origin_buf));
+	if(topic_len > UINT16_MAX || origin_len > UINT16_MAX){
+		mosquitto__free(topic_buf);
+		return MOSQ_ERR_INVAL;
+	}
+	record_len = BATCH_RECORD_HEADER_LEN + topic_len + stored->payloadlen;
+	if(origin_len){
+		record_len += 2 + origin_len;
+	}
+
+	if(bridge->batch_len > 0 && bridge->batch_len + record_len > bridge__batch_limit(context)){
+		rc = bridge__batch_flush(context);
+		if(rc){
+			mosquitto__free(topic_buf);
+			return rc;
+		}
+	}
+
+	if(bridge->batch_len + record_len > bridge->batch_buf_size){
+		buf_size = bridge->batch_buf_size*2;
+		if(buf_size < bridge->batch_len + record_len){
+			buf_size = bridge->batch_len + record_len;
+		}
+		buf = mosquitto__realloc(bridge->batch_buf, buf_size);
+		if(buf == NULL){
+			mosquitto__free(topic_buf);
+			return MOSQ_ERR_NOMEM;
+		}
+		bridge->batch_buf = buf;
+		bridge->batch_buf_size = buf_size;
+	}
+
+	if(qos > context->max_qos){
+		qos = context->max_qos;
+	}
+	if(!context->retain_available){
+		retain = false;
+	}
+
+	buf = &bridge->batch_buf[bridge->batch_len];
+	buf[0] = (uint8_t)(qos | (retain?0x04:0x00) | (origin_len?BATCH_FLAG_ORIGIN:0x00));
+	bridge__batch_write_uint16(&buf[1], (uint16_t)topic_len);
+	memcpy(&buf[3], topic, topic_len);
+	bridge__batch_write_uint32(&buf[3+topic_len], stored->payloadlen);
+	if(stored->payloadlen){
+		memcpy(&buf[BATCH_RECORD_HEADER_LEN+topic_len], stored->payload, stored->payloadlen);
+	}
+	if(origin_len){
+		buf = &buf[BATCH_RECORD_HEADER_LEN+topic_len+stored->payloadlen];
+		bridge__batch_write_uint16(buf, (uint16_t)origin_len);
+		memcpy(&buf[2], origin, origin_len);
+	}
+	bridge->batch_len += record_len;
+	bridge->batch_count++;
+	if(qos > bridge->batch_qos){
+		bridge->batch_qos = qos;
+	}
+
+	log__printf(NULL, MOSQ_LOG_DEBUG, "Adding PUBLISH to batch for %s (q%d, r%d, '%s', ... (%ld bytes))",
+			context->id, qos, retain, topic, (long)stored->payloadlen);
+	mosquitto__free(topic_buf);
+
+	if(bridge->batch_len >= bridge__batch_limit(context)){
+		return bridge__batch_flush(context);
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Turn the batch buffer into a message and queue it for the bridge. */
+int bridge__batch_flush(struct mosquitto *context)
+{
+	struct mosquitto__bridge *bridge = context->bridge;
+	struct mosquitto_msg_store *stored;
+	enum mosquitto__batch_compression compression = mosq_bc_none;
+	uint8_t *payload;
+	size_t payload_size;
+	uint32_t payloadlen;
+	uint16_t mid = 0;
+	uint8_t qos;
+	int count;
+	int rc;
+
+	if(bridge->batch_len == 0){
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	payload_size = bridge->batch_len;
+#ifdef WITH_ZLIB
+	if(bridge->batch_active_compression == mosq_bc_zlib){
+		if(compressBound((uLong)bridge->batch_len) > payload_size){
+			payload_size = compressBound((uLong)bridge->batch_len);
+		}
+	}
+#endif
+	/* The store payload is always zero terminated, hence the extra byte */
+	payload = mosquitto__malloc(BATCH_HEADER_LEN + payload_size + 1);
+	if(payload == NULL){
+		return MOSQ_ERR_NOMEM;
+	}
+
+#ifdef WITH_ZLIB
+	if(bridge->batch_active_compression == mosq_bc_zlib){
+		uLongf compressed_len = (uLongf)payload_size;
+
+		if(compress2(&payload[BATCH_HEADER_LEN], &compressed_len, bridge->batch_buf, (uLong)bridge->batch_len, Z_DEFAULT_COMPRESSION) == Z_OK
+				&& compressed_len < bridge->batch_len){
+
+			compression = mosq_bc_zlib;
+			payloadlen = (uint32_t)(BATCH_HEADER_LEN + compressed_len);
+		}
+	}
+#endif
+	if(compression == mosq_bc_none){
+		memcpy(&payload[BATCH_HEADER_LEN], bridge->batch_buf, bridge->batch_len);
+		payloadlen = (uint32_t)(BATCH_HEADER_LEN + bridge->batch_len);
+	}
+	payload[0] = BATCH_VERSION;
+	payload[1] = (uint8_t)compression;
+	bridge__batch_write_uint32(&payload[2], (uint32_t)bridge->batch_len);
+	payload[payloadlen] = 0;
+
+	log__printf(NULL, MOSQ_LOG_DEBUG, "Sending batch of %d messages to %s (%ld bytes, %ld on the wire)",
+			bridge->batch_count, context->id, (long)bridge->batch_len, (long)payloadlen);
+
+	qos = bridge->batch_qos;
+	count = bridge->batch_count;
+	bridge->batch_len = 0;
+	bridge->batch_count = 0;
+	bridge->batch_qos = 0;
+
+	stored = mosquitto__slab_calloc(sizeof(struct mosquitto_msg_store));
+	if(stored == NULL){
+		mosquitto__free(payload);
+		return MOSQ_ERR_NOMEM;
+	}
+	stored->topic = mosquitto__strdup(BRIDGE_BATCH_TOPIC);
+	if(stored->topic == NULL){
+		mosquitto__free(payload);
+		db__msg_store_free(stored);
+		return MOSQ_ERR_NOMEM;
+	}
+	stored->payload = payload;
+	stored->payloadlen = payloadlen;
+	stored->qos = qos;
+	stored->retain = false;
+
+	rc = db__message_store(context, stored, 0, 0, mosq_mo_broker);
+	if(rc) return rc;
+
+	if(qos > 0){
+		mid = mosquitto__mid_generate(context);
+	}
+
+	db__msg_store_ref_inc(stored);
+	bridge->batch_store = stored;
+	rc = db__message_insert(context, mid, mosq_md_out, qos, false, stored, NULL, true);
+	bridge->batch_store = NULL;
+	db__msg_store_ref_dec(&stored);
+
+	if(rc == 2){
+		/* Dropped because of a full queue, this isn't an error, but it
+		 * loses every message in the batch. */
+		log__printf(NULL, MOSQ_LOG_NOTICE, "Dropped batch of %d messages for bridge %s, queue full.",
+				count, bridge->name);
+		rc = MOSQ_ERR_SUCCESS;
+	}
+	return rc;
+}
+
+
+/* Called once per pass of the main loop, so messages don't wait in a batch
+ * for longer than it takes to handle the current network events. */
+void bridge__batch_flush_all(void)
+{
+	struct mosquitto *context;
+	int i;
+
+	for(i=0; i<db.bridge_count; i++){
+		context = db.bridges[i];
+		if(context && context->bridge && context->bridge->batch_len > 0){
+			if(bridge__batch_flush(context)){
+				log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to send message batch for bridge %s.", context->bridge->name);
+			}
+		}
+	}
+}
+
+
+void bridge__batch_free(struct mosquitto__bridge *bridge)
+{
+	mosquitto__free(bridge->batch_buf);
+	bridge->batch_buf = NULL;
+	bridge->batch_buf_size = 0;
+	bridge->batch_len = 0;
+	bridge->batch_count = 0;
+	bridge->batch_qos = 0;
+}
+
+
+/* ======================================================================
+ * Receiving, from a bridge client
+ * ====================================================================== */
+
+/* A client has asked, with a CONNECT user property, to send batches. This is
+ * only agreed to on listeners with allow_bridge_batches set, because
+ * unpacking a batch costs more than handling the PUBLISH it arrived in. */
+void bridge__batch_offer(struct mosquitto *context, const char *value)
+{
+	if(context->listener == NULL || context->listener->allow_bridge_batches == false){
+		return;
+	}
+
+	if(!strcmp(value, "none")){
+		context->bridge_batch = true;
+		context->bridge_batch_compression = mosq_bc_none;
+	}else if(!strcmp(value, "zlib")){
+		context->bridge_batch = true;
+#ifdef WITH_ZLIB
+		context->bridge_batch_compression = mosq_bc_zlib;
+#else
+		context->bridge_batch_compression = mosq_bc_none;
+#endif
+	}
+}
+
+
+int bridge__batch_connack_properties(struct mosquitto *context, mosquitto_property **properties)
+{
+	if(!context->bridge_batch){
+		return MOSQ_ERR_SUCCESS;
+	}
+	return mosquitto_property_add_string_pair(properties, MQTT_PROP_USER_PROPERTY,
+			BRIDGE_BATCH_PROPERTY, bridge__batch_compression_name(context->bridge_batch_compression));
+}
+
+
+/* Handle one message from a batch in the same way as handle__publish() would
+ * handle it as a PUBLISH. Messages that would be refused are dropped, because
+ * the batch is acknowledged as a whole. */
+static int bridge__batch_receive_one(struct mosquitto *context, uint8_t flags, const char *topic, uint16_t topic_len, const uint8_t *payload, uint32_t payloadlen, const char *origin, uint16_t origin_len)
+{
+	struct mosquitto_msg_store *msg;
+	size_t mount_len = 0;
+	int rc;
+
+	if(mosquitto_validate_utf8(topic, (int)topic_len)){
+		return MOSQ_ERR_MALFORMED_PACKET;
+	}
+	if(origin_len && !bridge__loop_trusted(context)){
+		origin_len = 0;
+	}
+	if(origin_len && bridge__loop_seen(origin, origin_len)){
+		log__printf(NULL, MOSQ_LOG_DEBUG, "Dropped looping batched PUBLISH from %s (%ld bytes).", context->id, (long)payloadlen);
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	msg = mosquitto__slab_calloc(sizeof(struct mosquitto_msg_store));
+	if(msg == NULL){
+		return MOSQ_ERR_NOMEM;
+	}
+	msg->qos = flags & 0x03;
+	if(msg->qos > context->max_qos){
+		msg->qos = context->max_qos;
+	}
+	msg->retain = (flags & 0x04) && db.config->retain_available;
+
+	if(context->listener && context->listener->mount_point){
+		mount_len = strlen(context->listener->mount_point);
+	}
+	msg->topic = mosquitto__malloc(mount_len + topic_len + 1);
+	if(msg->topic == NULL){
+		db__msg_store_free(msg);
+		return MOSQ_ERR_NOMEM;
+	}
+	if(mount_len){
+		memcpy(msg->topic, context->listener->mount_point, mount_len);
+	}
+	memcpy(&msg->topic[mount_len], topic, topic_len);
+	msg->topic[mount_len + topic_len] = '\0';
+
+	if(origin_len){
+		msg->bridge_origin = mosquitto__malloc((size_t)origin_len + 1);
+		if(msg->bridge_origin == NULL){
+			db__msg_store_free(msg);
+			return MOSQ_ERR_NOMEM;
+		}
+		memcpy(msg->bridge_origin, origin, origin_len);
+		msg->bridge_origin[origin_len] = '\0';
+	}
+
+	if(mosquitto_pub_topic_check(msg->topic) != MOSQ_ERR_SUCCESS
+			|| !strncmp(msg->topic, "$CONTROL/", 9)){
+
+		log__printf(NULL, MOSQ_LOG_DEBUG, "Dropped batched PUBLISH from %s with invalid topic '%s'.", context->id, msg->topic);
+		db__msg_store_free(msg);
+		return MOSQ_ERR_SUCCESS;
+	}
+	if(db.config->message_size_limit && payloadlen > db.config->message_size_limit){
+		log__printf(NULL, MOSQ_LOG_DEBUG, "Dropped too large batched PUBLISH from %s (q%d, r%d, '%s', ... (%ld bytes))", context->id, msg->qos, msg->retain, msg->topic, (long)payloadlen);
+		db__msg_store_free(msg);
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	/* The payload is always zero terminated, hence the extra byte */
+	msg->payload = mosquitto__malloc(payloadlen + 1);
+	if(msg->payload == NULL){
+		db__msg_store_free(msg);
+		return MOSQ_ERR_NOMEM;
+	}
+	if(payloadlen){
+		memcpy(msg->payload, payload, payloadlen);
+	}
+	((uint8_t *)msg->payload)[payloadlen] = 0;
+	msg->payloadlen = payloadlen;
+
+	rc = mosquitto_acl_check(context, msg->topic, msg->payloadlen, msg->payload, msg->qos, msg->retain, MOSQ_ACL_WRITE);
+	if(rc == MOSQ_ERR_SUCCESS){
+		rc = plugin__handle_message(context, msg);
+	}
+	if(rc == MOSQ_ERR_ACL_DENIED){
+		log__printf(NULL, MOSQ_LOG_DEBUG,
+				"Denied batched PUBLISH from %s (q%d, r%d, '%s', ... (%ld bytes))",
+				context->id, msg->qos, msg->retain, msg->topic, (long)msg->payloadlen);
+		db__msg_store_free(msg);
+		return MOSQ_ERR_SUCCESS;
+	}else if(rc != MOSQ_ERR_SUCCESS){
+		db__msg_store_free(msg);
+		return rc;
+	}
+
+	log__printf(NULL, MOSQ_LOG_DEBUG, "Received batched PUBLISH from %s (q%d, r%d, '%s', ... (%ld bytes))",
+			context->id, msg->qos, msg->retain, msg->topic, (long)msg->payloadlen);
+
+	if(sub__topic_levels(msg) == MOSQ_ERR_NOMEM){
+		db__msg_store_free(msg);
+		return MOSQ_ERR_NOMEM;
+	}
+	rc = db__message_store(context, msg, 0, 0, mosq_mo_client);
+	if(rc) return rc;
+
+	rc = sub__messages_queue(context->id, msg->topic, msg->qos, msg->retain, &msg);
+	if(rc == MOSQ_ERR_NO_SUBSCRIBERS){
+		rc = MOSQ_ERR_SUCCESS;
+	}
+	return rc;
+}
+
+
+#ifdef WITH_ZLIB
+/* The largest uncompressed batch that will be accepted. */
+static uint32_t bridge__batch_receive_limit(void)
+{
+	if(db.config->max_packet_size){
+		return db.config->max_packet_size;
+	}
+	return BRIDGE_BATCH_MAX_SIZE;
+}
+#endif
+
+
+/* Handle the payload of a PUBLISH on BRIDGE_BATCH_TOPIC from a client that has
+ * been allowed to send batches. Returns MOSQ_ERR_MALFORMED_PACKET if the batch
+ * can't be decoded, in which case any messages before the fault have already
+ * been handled. */
+int bridge__batch_receive(struct mosquitto *context, const uint8_t *payload, uint32_t payloadlen)
+{
+	const uint8_t *data;
+	uint8_t *data_buf = NULL;
+	uint32_t data_len, pos, record_len, record_payloadlen;
+	uint16_t topic_len, origin_len;
+	int count = 0;
+	int rc = MOSQ_ERR_SUCCESS;
+
+	if(payloadlen < BATCH_HEADER_LEN || payload[0] != BATCH_VERSION){
+		return MOSQ_ERR_MALFORMED_PACKET;
+	}
+	data_len = bridge__batch_read_uint32(&payload[2]);
+
+	switch(payload[1]){
+		case mosq_bc_none:
+			if(data_len != payloadlen - BATCH_HEADER_LEN){
+				return MOSQ_ERR_MALFORMED_PACKET;
+			}
+			data = &payload[BATCH_HEADER_LEN];
+			break;
+
+#ifdef WITH_ZLIB
+		case mosq_bc_zlib:
+			{
+				uLongf uncompressed_len = data_len;
+
+				/* The length comes from the client, so limit it before
+				 * allocating anything. A sending broker keeps its batches
+				 * within the same limit. */
+				if(data_len == 0 || data_len > bridge__batch_receive_limit()){
+					log__printf(NULL, MOSQ_LOG_NOTICE, "Message batch from %s too large (%lu bytes).", context->id, (unsigned long)data_len);
+					return MOSQ_ERR_MALFORMED_PACKET;
+				}
+				data_buf = mosquitto__malloc(data_len);
+				if(data_buf == NULL){
+					return MOSQ_ERR_NOMEM;
+				}
+				if(uncompress(data_buf, &uncompressed_len, &payload[BATCH_HEADER_LEN], payloadlen - BATCH_HEADER_LEN) != Z_OK
+						|| uncompressed_len != data_len){
+
+					mosquitto__free(data_buf);
+					return MOSQ_ERR_MALFORMED_PACKET;
+				}
+				data = data_buf;
+			}
+			break;
+#endif
+
+		default:
+			return MOSQ_ERR_MALFORMED_PACKET;
+	}
+
+	pos = 0;
+	while(pos < data_len){
+		if(data_len - pos < BATCH_RECORD_HEADER_LEN){
+			rc = MOSQ_ERR_MALFORMED_PACKET;
+			break;
+		}
+		topic_len = bridge__batch_read_uint16(&data[pos+1]);
+		if(data_len - pos - BATCH_RECORD_HEADER_LEN < topic_len){
+			rc = MOSQ_ERR_MALFORMED_PACKET;
+			break;
+		}
+		record_payloadlen = bridge__batch_read_uint32(&data[pos+3+topic_len]);
+		if(data_len - pos - BATCH_RECORD_HEADER_LEN - topic_len < record_payloadlen
+				|| (data[pos] & 0x03) == 3){
+
+			rc = MOSQ_ERR_MALFORMED_PACKET;
+			break;
+		}
+		record_len = BATCH_RECORD_HEADER_LEN + topic_len + record_payloadlen;
+		origin_len = 0;
+		if(data[pos] & BATCH_FLAG_ORIGIN){
+			if(data_len - pos - record_len < 2){
+				rc = MOSQ_ERR_MALFORMED_PACKET;
+				break;
+			}
+			origin_len = bridge__batch_read_uint16(&data[pos+record_len]);
+			if(origin_len == 0 || data_len - pos - record_len - 2 < origin_len){
+				rc = MOSQ_ERR_MALFORMED_PACKET;
+				break;
+			}
+		}
+
+		rc = bridge__batch_receive_one(context, data[pos],
+				(const char *)&data[pos+3], topic_len,
+				&data[pos+BATCH_RECORD_HEADER_LEN+topic_len], record_payloadlen,
+				(const char *)&data[pos+record_len+2], origin_len);
+		if(rc) break;
+
+		pos += record_len;
+		if(origin_len){
+			pos += 2 + (uint32_t)origin_len;
+		}
+		count++;
+	}
+	mosquitto__free(data_buf);
+
+	if(rc == MOSQ_ERR_MALFORMED_PACKET){
+		log__printf(NULL, MOSQ_LOG_NOTICE, "Invalid message batch from %s, %d messages handled.", context->id, count);
+	}else{
+		log__printf(NULL, MOSQ_LOG_DEBUG, "Received batch of %d messages from %s.", count, context->id);
+	}
+	return rc;
+}
+
+#endif
@@ -0,0 +1,299 @@
+/*
+Copyright (c) 2022 Roger Light <roger@atchoo.org>
+
+All rights reserved. This program and the accompanying materials
+are made available under the terms of the Eclipse Public License 2.0
+and Eclipse Distribution License v1.0 which accompany this distribution.
+
+The Eclipse Public License is available at
+   https://www.eclipse.org/legal/epl-2.0/
+and the Eclipse Distribution License is available at
+  http://www.eclipse.org/org/documents/edl-v10.php.
+
+SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+
+Contributors:
+   Roger Light - initial implementation and documentation.
+*/
+
+/* Bridge loop detection.
+ *
+ * With bridge_loop_cache_size set, each message sent over an MQTT v5 bridge
+ * carries a "mosquitto-origin" user property of "<broker id>:<message id>",
+ * where the broker id is chosen at random when the broker starts and the
+ * message id is the db_id of the message on the broker it was first
+ * published to. A message received with the property keeps the same value
+ * when it is bridged on to other brokers, but the property is removed from
+ * the message itself, so ordinary subscribers never see it.
+ *
+ * A bridge asks the remote broker to add the property to the messages it
+ * sends back over the bridge by including the same user property, with the
+ * broker id as its value, in its CONNECT. Messages sent to all other clients
+ * are left as they are.
+ *
+ * The property is only trusted from the remote end of our own bridges and
+ * from clients on listeners with allow_bridge_origin set. Anyone else could
+ * use it to have messages dropped, so it is removed from their messages
+ * without being looked at, and asking for it in a CONNECT is ignored.
+ *
+ * Each broker keeps a fixed size cache of the fingerprints of the origins it
+ * has recently seen. A message that comes back to the broker it started on,
+ * or that has already arrived over another path, is dropped before it
+ * reaches the subscription tree. The cache is set associative: each
+ * fingerprint can only be held in one bucket of BRIDGE_LOOP_WAYS entries, and
+ * the oldest entry in a full bucket is replaced, so it needs no allocation
+ * after startup.
+ */
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mosquitto_broker_internal.h"
+#include "memory_mosq.h"
+#include "mqtt_protocol.h"
+#include "property_mosq.h"
+#include "util_mosq.h"
+
+#ifdef WITH_BRIDGE
+
+#define BRIDGE_LOOP_WAYS 4
+#define BRIDGE_ORIGIN_ID_LEN 16
+
+static uint64_t *loop_cache = NULL;
+static uint8_t *loop_cache_next = NULL;
+static uint32_t loop_cache_mask = 0;
+static char loop_origin_id[BRIDGE_ORIGIN_ID_LEN+1];
+
+
+int bridge__loop_init(void)
+{
+	uint8_t id[BRIDGE_ORIGIN_ID_LEN/2];
+	uint32_t buckets = 1;
+	bool trusted_listener = false;
+	int i;
+
+	if(db.config->bridge_loop_cache_size <= 0){
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	while((int64_t)buckets*BRIDGE_LOOP_WAYS < db.config->bridge_loop_cache_size){
+		buckets *= 2;
+	}
+	loop_cache = mosquitto__calloc(buckets*BRIDGE_LOOP_WAYS, sizeof(uint64_t));
+	loop_cache_next = mosquitto__calloc(buckets, sizeof(uint8_t));
+	if(loop_cache == NULL || loop_cache_next == NULL){
+		bridge__loop_cleanup();
+		return MOSQ_ERR_NOMEM;
+	}
+	loop_cache_mask = buckets - 1;
+
+	if(util__random_bytes(id, (int)sizeof(id))){
+		bridge__loop_cleanup();
+		return MOSQ_ERR_UNKNOWN;
+	}
+	for(i=0; i<(int)sizeof(id); i++){
+		snprintf(&loop_origin_id[i*2], 3, "%02x", id[i]);
+	}
+
+	log__printf(NULL, MOSQ_LOG_INFO, "Bridge loop detection enabled, broker id %s, remembering %u messages.",
+			loop_origin_id, buckets*BRIDGE_LOOP_WAYS);
+
+	for(i=0; i<db.config->listener_count; i++){
+		if(db.config->listeners[i].allow_bridge_origin){
+			trusted_listener = true;
+			break;
+		}
+	}
+	if(trusted_listener == false){
+		log__printf(NULL, MOSQ_LOG_WARNING, "Warning: bridge_loop_cache_size is set but no listener has allow_bridge_origin set, so loops through bridges that connect to this broker will not be detected.");
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+void bridge__loop_cleanup(void)
+{
+	mosquitto__free(loop_cache);
+	loop_cache = NULL;
+	mosquitto__free(loop_cache_next);
+	loop_cache_next = NULL;
+	loop_cache_mask = 0;
+}
+
+
+/* Add the user property asking for messages to be tagged with their origin
+ * to the CONNECT for a bridge. */
+int bridge__loop_request(struct mosquitto *context, mosquitto_property **properties)
+{
+	if(loop_cache == NULL || context->protocol != mosq_p_mqtt5){
+		return MOSQ_ERR_SUCCESS;
+	}
+	return mosquitto_property_add_string_pair(properties, MQTT_PROP_USER_PROPERTY,
+			BRIDGE_ORIGIN_PROPERTY, loop_origin_id);
+}
+
+
+/* Can the origin of messages from this client be trusted? */
+bool bridge__loop_trusted(struct mosquitto *context)
+{
+	return context->bridge
+		|| (context->listener && context->listener->allow_bridge_origin);
+}
+
+
+/* A client has asked, with a CONNECT user property, for the messages sent to
+ * it to carry their origin. */
+void bridge__loop_offer(struct mosquitto *context)
+{
+	context->bridge_loop = bridge__loop_trusted(context);
+}
+
+
+static uint64_t bridge__loop_fingerprint(const char *origin, size_t len)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	size_t i;
+
+	for(i=0; i<len; i++){
+		hash ^= (uint8_t)origin[i];
+		hash *= 1099511628211ULL;
+	}
+	/* 0 marks an empty cache entry */
+	return hash?hash:1;
+}
+
+
+/* Has a message with this origin been seen before? The origin is recorded
+ * as seen if not. */
+bool bridge__loop_seen(const char *origin, size_t len)
+{
+	uint64_t fingerprint;
+	uint64_t *bucket;
+	uint32_t b;
+	int i;
+
+	if(loop_cache == NULL){
+		return false;
+	}
+
+	if(len > BRIDGE_ORIGIN_ID_LEN && origin[BRIDGE_ORIGIN_ID_LEN] == ':'
+			&& !memcmp(origin, loop_origin_id, BRIDGE_ORIGIN_ID_LEN)){
+
+		/* Our own message has come back to us */
+		return true;
+	}
+
+	fingerprint = bridge__loop_fingerprint(origin, len);
+	b = (uint32_t)(fingerprint & loop_cache_mask);
+	bucket = &loop_cache[b*BRIDGE_LOOP_WAYS];
+	for(i=0; i<BRIDGE_LOOP_WAYS; i++){
+		if(bucket[i] == fingerprint){
+			return true;
+		}
+	}
+	bucket[loop_cache_next[b]] = fingerprint;
+	loop_cache_next[b] = (uint8_t)((loop_cache_next[b] + 1) % BRIDGE_LOOP_WAYS);
+	return false;
+}
+
+
+/* Check an incoming message for the origin property. The property is moved
+ * out of the message properties into msg->bridge_origin, so it is only ever
+ * sent on to other bridges. If the client isn't trusted the property is
+ * removed and ignored. Returns true if the message has been seen before and
+ * should be dropped. */
+bool bridge__loop_check(struct mosquitto *context, struct mosquitto_msg_store *msg)
+{
+	mosquitto_property *p, *p_prev = NULL;
+	bool trusted;
+
+	trusted = bridge__loop_trusted(context);
+	if(trusted && loop_cache == NULL){
+		return false;
+	}
+
+	p = msg->properties;
+	while(p){
+		if(p->identifier == MQTT_PROP_USER_PROPERTY && !strcmp(p->name.v, BRIDGE_ORIGIN_PROPERTY)){
+			if(p_prev){
+				p_prev->next = p->next;
+			}else{
+				msg->properties = p->next;
+			}
+			p->next = NULL;
+			if(trusted){
+				mosquitto__free(msg->bridge_origin);
+				msg->bridge_origin = p->value.s.v;
+				p->value.s.v = NULL;
+				mosquitto_property_free_all(&p);
+
+				return bridge__loop_seen(msg->bridge_origin, strlen(msg->bridge_origin));
+			}
+			mosquitto_property_free_all(&p);
+			p = p_prev?p_prev->next:msg->properties;
+			continue;
+		}
+		p_prev = p;
+		p = p->next;
+	}
+	return false;
+}
+
+
+/* Fill in the origin of a message that is about to be sent to a bridge, in
+ * buf if the message started on this broker. Returns the length of the
+ * origin, or 0 if the message should not be tagged. */
+size_t bridge__loop_origin(struct mosquitto *context, const struct mosquitto_msg_store *stored, const char **origin, char *buf, size_t buflen)
+{
+	int len;
+
+	if(loop_cache == NULL
+			|| (context->bridge == NULL && !context->bridge_loop)
+			|| stored == NULL
+			|| !strcmp(stored->topic, BRIDGE_BATCH_TOPIC)){
+
+		return 0;
+	}
+
+	if(stored->bridge_origin){
+		*origin = stored->bridge_origin;
+		return strlen(stored->bridge_origin);
+	}
+	len = snprintf(buf, buflen, "%s:%" PRIx64, loop_origin_id, stored->db_id);
+	if(len < 0 || (size_t)len >= buflen){
+		return 0;
+	}
+	*origin = buf;
+	return (size_t)len;
+}
+
+
+/* Make the user property that carries the origin of a message sent to an
+ * MQTT v5 bridge. The property refers to the strings it is given, so it is
+ * only valid while the message is being sent. */
+bool bridge__loop_property(struct mosquitto *context, const struct mosquitto_msg_store *stored, mosquitto_property *prop, char *buf, size_t buflen)
+{
+	const char *origin = NULL;
+	size_t len;
+
+	if(context->protocol != mosq_p_mqtt5){
+		return false;
+	}
+	len = bridge__loop_origin(context, stored, &origin, buf, buflen);
+	if(len == 0 || len > UINT16_MAX){
+		return false;
+	}
+
+	memset(prop, 0, sizeof(mosquitto_property));
+	prop->identifier = MQTT_PROP_USER_PROPERTY;
+	prop->name.v = (char *)BRIDGE_ORIGIN_PROPERTY;
+	prop->name.len = (uint16_t)strlen(BRIDGE_ORIGIN_PROPERTY);
+	prop->value.s.v = (char *)origin;
+	prop->value.s.len = (uint16_t)len;
+	return true;
+}
+
+#endif
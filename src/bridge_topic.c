@@ -16,13 +16,45 @@ Contributors:
    Roger Light - initial implementation and documentation.
 */
 
+/* Bridge topic remapping.
+ *
+ * The remote_topic of each remapped "in" or "both" topic, and the local_topic
+ * of each remapped "out" or "both" topic, are added to a per-bridge ACL topic
+ * tree ranked by configuration order, so the topic that applies to a message
+ * is found without matching against every configured topic.
+ */
+
 #include "config.h"
 
+#include <string.h>
+
 #include "mosquitto.h"
 #include "mosquitto_broker_internal.h"
 #include "memory_mosq.h"
 
 #ifdef WITH_BRIDGE
+/* Returns the first configured bridge topic in the tree matching topic, or
+ * NULL if there is none. */
+static struct mosquitto__bridge_topic *bridge__remap_find(struct mosquitto__bridge *bridge, const struct mosquitto__acl_node *root, const char *topic)
+{
+	struct mosquitto__acl_rule best;
+
+	memset(&best, 0, sizeof(best));
+	acl_tree__find(root, topic, &best);
+	if(best.rank == 0){
+		return NULL;
+	}
+	return &bridge->topics[best.rank-1];
+}
+
+
+void bridge__remap_free(struct mosquitto__bridge *bridge)
+{
+	acl_tree__free(&bridge->remap_in);
+	acl_tree__free(&bridge->remap_out);
+}
+
+
 static int bridge__create_remap_topic(const char *prefix, const char *topic, char **remap_topic)
 {
 	size_t len;
@@ -181,64 +213,119 @@ int bridge__add_topic(struct mosquitto__bridge *bridge, const char *topic, enum
 		return MOSQ_ERR_INVAL;
 	}
 
+	if(local_prefix || remote_prefix){
+		if(cur_topic->local_prefix){
+			cur_topic->local_prefix_len = strlen(cur_topic->local_prefix);
+		}
+		if(cur_topic->remote_prefix){
+			cur_topic->remote_prefix_len = strlen(cur_topic->remote_prefix);
+		}
+		if(direction == bd_in || direction == bd_both){
+			if(acl_tree__add_ranked(&bridge->remap_in, cur_topic->remote_topic, bridge->topic_count, false)){
+				log__printf(NULL, MOSQ_LOG_ERR, "Error: Out of memory.");
+				return MOSQ_ERR_NOMEM;
+			}
+		}
+		if(direction == bd_out || direction == bd_both){
+			if(acl_tree__add_ranked(&bridge->remap_out, cur_topic->local_topic, bridge->topic_count, false)){
+				log__printf(NULL, MOSQ_LOG_ERR, "Error: Out of memory.");
+				return MOSQ_ERR_NOMEM;
+			}
+		}
+	}
+
 	return MOSQ_ERR_SUCCESS;
 }
 
 
+/* Map a topic received from the remote broker to the local topic. The remote
+ * prefix is removed in place, and a new string is only allocated if a local
+ * prefix must be added. */
 int bridge__remap_topic_in(struct mosquitto *context, char **topic)
 {
 	struct mosquitto__bridge_topic *cur_topic;
 	char *topic_temp;
-	int i;
+	size_t offset = 0;
 	size_t len;
-	int rc;
-	bool match;
-
-	if(context->bridge && context->bridge->topics && context->bridge->topic_remapping){
-		for(i=0; i<context->bridge->topic_count; i++){
-			cur_topic = &context->bridge->topics[i];
-			if((cur_topic->direction == bd_both || cur_topic->direction == bd_in)
-					&& (cur_topic->remote_prefix || cur_topic->local_prefix)){
-
-				/* Topic mapping required on this topic if the message matches */
-
-				rc = mosquitto_topic_matches_sub(cur_topic->remote_topic, *topic, &match);
-				if(rc){
-					mosquitto__free(*topic);
-					return rc;
-				}
-				if(match){
-					if(cur_topic->remote_prefix){
-						/* This prefix needs removing. */
-						if(!strncmp(cur_topic->remote_prefix, *topic, strlen(cur_topic->remote_prefix))){
-							topic_temp = mosquitto__strdup((*topic)+strlen(cur_topic->remote_prefix));
-							if(!topic_temp){
-								mosquitto__free(*topic);
-								return MOSQ_ERR_NOMEM;
-							}
-							mosquitto__free(*topic);
-							*topic = topic_temp;
-						}
-					}
-
-					if(cur_topic->local_prefix){
-						/* This prefix needs adding. */
-						len = strlen(*topic) + strlen(cur_topic->local_prefix)+1;
-						topic_temp = mosquitto__malloc(len+1);
-						if(!topic_temp){
-							mosquitto__free(*topic);
-							return MOSQ_ERR_NOMEM;
-						}
-						snprintf(topic_temp, len, "%s%s", cur_topic->local_prefix, *topic);
-						topic_temp[len] = '\0';
-
-						mosquitto__free(*topic);
-						*topic = topic_temp;
-					}
-					break;
-				}
-			}
+
+	if(context->bridge == NULL || context->bridge->remap_in == NULL){
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	cur_topic = bridge__remap_find(context->bridge, context->bridge->remap_in, *topic);
+	if(cur_topic == NULL){
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	if(cur_topic->remote_prefix
+			&& !strncmp(cur_topic->remote_prefix, *topic, cur_topic->remote_prefix_len)){
+
+		/* This prefix needs removing. */
+		offset = cur_topic->remote_prefix_len;
+	}
+	len = strlen((*topic)+offset);
+
+	if(cur_topic->local_prefix){
+		/* This prefix needs adding. */
+		topic_temp = mosquitto__malloc(cur_topic->local_prefix_len + len + 1);
+		if(!topic_temp){
+			mosquitto__free(*topic);
+			return MOSQ_ERR_NOMEM;
+		}
+		memcpy(topic_temp, cur_topic->local_prefix, cur_topic->local_prefix_len);
+		memcpy(topic_temp+cur_topic->local_prefix_len, (*topic)+offset, len+1);
+
+		mosquitto__free(*topic);
+		*topic = topic_temp;
+	}else if(offset){
+		memmove(*topic, (*topic)+offset, len+1);
+	}
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Map a local topic to the topic to use on the remote broker. On return
+ * *topic points to the mapped topic. If the local prefix only needs removing
+ * this points into the original topic, otherwise if a remote prefix must be
+ * added the mapped topic is allocated in *topic_buf, which the caller must
+ * free. */
+int bridge__remap_topic_out(struct mosquitto *context, const char **topic, char **topic_buf)
+{
+	struct mosquitto__bridge_topic *cur_topic;
+	size_t offset = 0;
+	size_t len;
+
+	*topic_buf = NULL;
+
+	if(context->bridge == NULL || context->bridge->remap_out == NULL){
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	cur_topic = bridge__remap_find(context->bridge, context->bridge->remap_out, *topic);
+	if(cur_topic == NULL){
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	if(cur_topic->local_prefix
+			&& !strncmp(cur_topic->local_prefix, *topic, cur_topic->local_prefix_len)){
+
+		/* This prefix needs removing. */
+		offset = cur_topic->local_prefix_len;
+	}
+
+	if(cur_topic->remote_prefix){
+		/* This prefix needs adding. */
+		len = strlen((*topic)+offset);
+		*topic_buf = mosquitto__malloc(cur_topic->remote_prefix_len + len + 1);
+		if(*topic_buf == NULL){
+			return MOSQ_ERR_NOMEM;
 		}
+		memcpy(*topic_buf, cur_topic->remote_prefix, cur_topic->remote_prefix_len);
+		memcpy((*topic_buf)+cur_topic->remote_prefix_len, (*topic)+offset, len+1);
+		*topic = *topic_buf;
+	}else{
+		*topic = (*topic)+offset;
 	}
 
 	return MOSQ_ERR_SUCCESS;
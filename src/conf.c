@@ -155,6 +155,8 @@ static void config__init_reload(struct mosquitto__config *config)
 
 	config->autosave_interval = 1800;
 	config->autosave_on_changes = false;
+	config->autosave_background = false;
+	config->bridge_loop_cache_size = 0;
 	mosquitto__free(config->clientid_prefixes);
 	config->connection_messages = true;
 	config->clientid_prefixes = NULL;
@@ -191,19 +193,30 @@ static void config__init_reload(struct mosquitto__config *config)
 	config->max_packet_size = 0;
 	config->max_inflight_messages = 20;
 	config->max_queued_messages = 1000;
+	config->acl_cache_size = 0;
 	config->max_inflight_bytes = 0;
 	config->max_queued_bytes = 0;
+	config->max_read_bytes = 262144;
+	config->max_read_packets = 100;
+	config->password_cache_timeout = 0;
+	config->password_hash_threads = 0;
+	config->io_threads = 0;
 	config->persistence = false;
+	config->persistence_journal = false;
 	mosquitto__free(config->persistence_location);
 	config->persistence_location = NULL;
 	mosquitto__free(config->persistence_file);
 	config->persistence_file = NULL;
 	config->persistent_client_expiration = 0;
 	config->queue_qos0_messages = false;
+	config->queue_spill_max_bytes = 1073741824;
+	config->queue_spill_segment_size = 16777216;
 	config->retain_available = true;
 	config->set_tcp_nodelay = false;
 	config->sys_interval = 10;
 	config->upgrade_outgoing_qos = false;
+	config->use_io_uring = false;
+	config->epoll_edge_triggered = false;
 
 	config__cleanup_plugins(config);
 }
@@ -262,6 +275,7 @@ void config__cleanup(struct mosquitto__config *config)
 	mosquitto__free(config->security_options.password_file);
 	mosquitto__free(config->security_options.psk_file);
 	mosquitto__free(config->pid_file);
+	mosquitto__free(config->queue_spill_dir);
 	mosquitto__free(config->user);
 	mosquitto__free(config->log_timestamp_format);
 	if(config->listeners){
@@ -329,6 +343,7 @@ void config__cleanup(struct mosquitto__config *config)
 				}
 				mosquitto__free(config->bridges[i].topics);
 			}
+			bridge__remap_free(&config->bridges[i]);
 			mosquitto__free(config->bridges[i].notification_topic);
 #ifdef WITH_TLS
 			mosquitto__free(config->bridges[i].tls_version);
@@ -440,6 +455,8 @@ int config__parse_args(struct mosquitto__config *config, int argc, char *argv[])
 			|| config->default_listener.use_subject_as_username
 #endif
 			|| config->default_listener.use_username_as_clientid
+			|| config->default_listener.allow_bridge_batches
+			|| config->default_listener.allow_bridge_origin
 			|| config->default_listener.host
 			|| config->default_listener.port
 			|| config->default_listener.max_connections != -1
@@ -483,6 +500,8 @@ int config__parse_args(struct mosquitto__config *config, int argc, char *argv[])
 		config->listeners[config->listener_count-1].sock_count = 0;
 		config->listeners[config->listener_count-1].client_count = 0;
 		config->listeners[config->listener_count-1].use_username_as_clientid = config->default_listener.use_username_as_clientid;
+		config->listeners[config->listener_count-1].allow_bridge_batches = config->default_listener.allow_bridge_batches;
+		config->listeners[config->listener_count-1].allow_bridge_origin = config->default_listener.allow_bridge_origin;
 		config->listeners[config->listener_count-1].max_qos = config->default_listener.max_qos;
 		config->listeners[config->listener_count-1].max_topic_alias = config->default_listener.max_topic_alias;
 #ifdef WITH_TLS
@@ -540,16 +559,19 @@ static void config__copy(struct mosquitto__config *src, struct mosquitto__config
 
 	mosquitto__free(dest->security_options.password_file);
 	dest->security_options.password_file = src->security_options.password_file;
+	dest->password_cache_timeout = src->password_cache_timeout;
 
 	mosquitto__free(dest->security_options.psk_file);
 	dest->security_options.psk_file = src->security_options.psk_file;
 
 
+	dest->acl_cache_size = src->acl_cache_size;
 	dest->allow_duplicate_messages = src->allow_duplicate_messages;
 
 
 	dest->autosave_interval = src->autosave_interval;
 	dest->autosave_on_changes = src->autosave_on_changes;
+	dest->autosave_background = src->autosave_background;
 
 	mosquitto__free(dest->clientid_prefixes);
 	dest->clientid_prefixes = src->clientid_prefixes;
@@ -583,6 +605,8 @@ static void config__copy(struct mosquitto__config *src, struct mosquitto__config
 
 
 	dest->queue_qos0_messages = src->queue_qos0_messages;
+	dest->queue_spill_max_bytes = src->queue_spill_max_bytes;
+	dest->queue_spill_segment_size = src->queue_spill_segment_size;
 	dest->sys_interval = src->sys_interval;
 	dest->upgrade_outgoing_qos = src->upgrade_outgoing_qos;
 
@@ -764,7 +788,11 @@ static int config__read_file_core(struct mosquitto__config *config, bool reload,
 			}
 			token = strtok_r((*buf), " ", &saveptr);
 			if(token){
-				if(!strcmp(token, "acl_file")){
+				if(!strcmp(token, "acl_cache_size")){
+					if(conf__parse_int(&token, "acl_cache_size", &tmp_int, saveptr)) return MOSQ_ERR_INVAL;
+					if(tmp_int < 0) tmp_int = 0;
+					config->acl_cache_size = tmp_int;
+				}else if(!strcmp(token, "acl_file")){
 					conf__set_cur_security_options(config, cur_listener, &cur_security_options);
 					if(reload){
 						mosquitto__free(cur_security_options->acl_file);
@@ -829,6 +857,20 @@ static int config__read_file_core(struct mosquitto__config *config, bool reload,
 				}else if(!strcmp(token, "allow_anonymous")){
 					conf__set_cur_security_options(config, cur_listener, &cur_security_options);
 					if(conf__parse_bool(&token, "allow_anonymous", (bool *)&cur_security_options->allow_anonymous, saveptr)) return MOSQ_ERR_INVAL;
+				}else if(!strcmp(token, "allow_bridge_batches")){
+#ifdef WITH_BRIDGE
+					if(reload) continue; /* Listeners not valid for reloading. */
+					if(conf__parse_bool(&token, "allow_bridge_batches", &cur_listener->allow_bridge_batches, saveptr)) return MOSQ_ERR_INVAL;
+#else
+					log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Bridge support not available.");
+#endif
+				}else if(!strcmp(token, "allow_bridge_origin")){
+#ifdef WITH_BRIDGE
+					if(reload) continue; /* Listeners not valid for reloading. */
+					if(conf__parse_bool(&token, "allow_bridge_origin", &cur_listener->allow_bridge_origin, saveptr)) return MOSQ_ERR_INVAL;
+#else
+					log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Bridge support not available.");
+#endif
 				}else if(!strcmp(token, "allow_duplicate_messages")){
 					log__printf(NULL, MOSQ_LOG_NOTICE, "The 'allow_duplicate_messages' option is now deprecated and will be removed in a future version. The behaviour will default to true.");
 					if(conf__parse_bool(&token, "allow_duplicate_messages", &config->allow_duplicate_messages, saveptr)) return MOSQ_ERR_INVAL;
@@ -914,6 +956,8 @@ static int config__read_file_core(struct mosquitto__config *config, bool reload,
 					}else{
 						cur_security_options->auto_id_prefix_len = 0;
 					}
+				}else if(!strcmp(token, "autosave_background")){
+					if(conf__parse_bool(&token, "autosave_background", &config->autosave_background, saveptr)) return MOSQ_ERR_INVAL;
 				}else if(!strcmp(token, "autosave_interval")){
 					if(conf__parse_int(&token, "autosave_interval", &config->autosave_interval, saveptr)) return MOSQ_ERR_INVAL;
 					if(config->autosave_interval < 0) config->autosave_interval = 0;
@@ -973,6 +1017,51 @@ static int config__read_file_core(struct mosquitto__config *config, bool reload,
 					if(conf__parse_string(&token, "bridge_alpn", &cur_bridge->tls_alpn, saveptr)) return MOSQ_ERR_INVAL;
 #else
 					log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Bridge and/or TLS support not available.");
+#endif
+				}else if(!strcmp(token, "bridge_batch_compression")){
+#if defined(WITH_BRIDGE)
+					if(reload) continue; /* Bridges not valid for reloading. */
+					if(!cur_bridge){
+						log__printf(NULL, MOSQ_LOG_ERR, "Error: Invalid bridge configuration.");
+						return MOSQ_ERR_INVAL;
+					}
+					token = strtok_r(NULL, " ", &saveptr);
+					if(token){
+						if(!strcmp(token, "none")){
+							cur_bridge->batch_compression = mosq_bc_none;
+						}else if(!strcmp(token, "zlib")){
+#ifdef WITH_ZLIB
+							cur_bridge->batch_compression = mosq_bc_zlib;
+#else
+							log__printf(NULL, MOSQ_LOG_ERR, "Error: zlib support not available.");
+							return MOSQ_ERR_INVAL;
+#endif
+						}else{
+							log__printf(NULL, MOSQ_LOG_ERR, "Error: Invalid bridge_batch_compression value (%s).", token);
+							return MOSQ_ERR_INVAL;
+						}
+					}else{
+						log__printf(NULL, MOSQ_LOG_ERR, "Error: Empty bridge_batch_compression value in configuration.");
+						return MOSQ_ERR_INVAL;
+					}
+#else
+					log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Bridge support not available.");
+#endif
+				}else if(!strcmp(token, "bridge_batch_size")){
+#if defined(WITH_BRIDGE)
+					if(reload) continue; /* Bridges not valid for reloading. */
+					if(!cur_bridge){
+						log__printf(NULL, MOSQ_LOG_ERR, "Error: Invalid bridge configuration.");
+						return MOSQ_ERR_INVAL;
+					}
+					if(conf__parse_int(&token, "bridge_batch_size", &tmp_int, saveptr)) return MOSQ_ERR_INVAL;
+					if(tmp_int < 0 || tmp_int > BRIDGE_BATCH_MAX_SIZE){
+						log__printf(NULL, MOSQ_LOG_ERR, "Error: Invalid bridge_batch_size value (%d).", tmp_int);
+						return MOSQ_ERR_INVAL;
+					}
+					cur_bridge->batch_size = (uint32_t)tmp_int;
+#else
+					log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Bridge support not available.");
 #endif
 				}else if(!strcmp(token, "bridge_bind_address")){
 #if defined(WITH_BRIDGE) && defined(WITH_TLS)
@@ -1018,6 +1107,21 @@ static int config__read_file_core(struct mosquitto__config *config, bool reload,
 					if(conf__parse_string(&token, "bridge_certfile", &cur_bridge->tls_certfile, saveptr)) return MOSQ_ERR_INVAL;
 #else
 					log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Bridge and/or TLS support not available.");
+#endif
+				}else if(!strcmp(token, "bridge_connections")){
+#if defined(WITH_BRIDGE)
+					if(reload) continue; /* Bridges not valid for reloading. */
+					if(!cur_bridge){
+						log__printf(NULL, MOSQ_LOG_ERR, "Error: Invalid bridge configuration.");
+						return MOSQ_ERR_INVAL;
+					}
+					if(conf__parse_int(&token, "bridge_connections", &cur_bridge->connections, saveptr)) return MOSQ_ERR_INVAL;
+					if(cur_bridge->connections < 1){
+						log__printf(NULL, MOSQ_LOG_ERR, "Error: Invalid bridge_connections value (%d).", cur_bridge->connections);
+						return MOSQ_ERR_INVAL;
+					}
+#else
+					log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Bridge support not available.");
 #endif
 				}else if(!strcmp(token, "bridge_identity")){
 #if defined(WITH_BRIDGE) && defined(FINAL_WITH_TLS_PSK)
@@ -1099,6 +1203,18 @@ static int config__read_file_core(struct mosquitto__config *config, bool reload,
 					if(conf__parse_string(&token, "bridge_keyfile", &cur_bridge->tls_keyfile, saveptr)) return MOSQ_ERR_INVAL;
 #else
 					log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Bridge and/or TLS support not available.");
+#endif
+				}else if(!strcmp(token, "bridge_loop_cache_size")){
+#ifdef WITH_BRIDGE
+					if(reload) continue; /* The cache is created at startup only */
+					if(conf__parse_int(&token, "bridge_loop_cache_size", &tmp_int, saveptr)) return MOSQ_ERR_INVAL;
+					if(tmp_int < 0 || tmp_int > 16777216){
+						log__printf(NULL, MOSQ_LOG_ERR, "Error: Invalid bridge_loop_cache_size value (%d).", tmp_int);
+						return MOSQ_ERR_INVAL;
+					}
+					config->bridge_loop_cache_size = tmp_int;
+#else
+					log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Bridge support not available.");
 #endif
 				}else if(!strcmp(token, "bridge_protocol_version")){
 #ifdef WITH_BRIDGE
@@ -1279,6 +1395,7 @@ static int config__read_file_core(struct mosquitto__config *config, bool reload,
 						cur_bridge->primary_retry_sock = INVALID_SOCKET;
 						cur_bridge->outgoing_retain = true;
 						cur_bridge->clean_start_local = -1;
+						cur_bridge->connections = 1;
 					}else{
 						log__printf(NULL, MOSQ_LOG_ERR, "Error: Empty connection value in configuration.");
 						return MOSQ_ERR_INVAL;
@@ -1301,6 +1418,13 @@ static int config__read_file_core(struct mosquitto__config *config, bool reload,
 					if(conf__parse_string(&token, "dhparamfile", &cur_listener->dhparamfile, saveptr)) return MOSQ_ERR_INVAL;
 #else
 					log__printf(NULL, MOSQ_LOG_WARNING, "Warning: TLS support not available.");
+#endif
+				}else if(!strcmp(token, "epoll_edge_triggered")){
+#ifdef WITH_EPOLL
+					if(reload) continue; /* The event loop is chosen at startup only */
+					if(conf__parse_bool(&token, "epoll_edge_triggered", &config->epoll_edge_triggered, saveptr)) return MOSQ_ERR_INVAL;
+#else
+					log__printf(NULL, MOSQ_LOG_WARNING, "Warning: epoll support not available.");
 #endif
 				}else if(!strcmp(token, "http_dir")){
 #ifdef WITH_WEBSOCKETS
@@ -1354,6 +1478,11 @@ static int config__read_file_core(struct mosquitto__config *config, bool reload,
 						mosquitto__free(files);
 						if(rc) return rc; /* This returns if config__read_file() fails above */
 					}
+				}else if(!strcmp(token, "io_threads")){
+					if(reload) continue; /* Threads are started at startup only */
+					if(conf__parse_int(&token, "io_threads", &tmp_int, saveptr)) return MOSQ_ERR_INVAL;
+					if(tmp_int < 0) tmp_int = 0;
+					config->io_threads = tmp_int;
 				}else if(!strcmp(token, "keepalive_interval")){
 #ifdef WITH_BRIDGE
 					if(reload) continue; /* FIXME */
@@ -1695,6 +1824,14 @@ static int config__read_file_core(struct mosquitto__config *config, bool reload,
 					if(conf__parse_int(&token, "max_queued_messages", &tmp_int, saveptr)) return MOSQ_ERR_INVAL;
 					if(tmp_int < 0) tmp_int = 0;
 					config->max_queued_messages = tmp_int;
+				}else if(!strcmp(token, "max_read_bytes")){
+					if(conf__parse_int(&token, "max_read_bytes", &tmp_int, saveptr)) return MOSQ_ERR_INVAL;
+					if(tmp_int < 0) tmp_int = 0;
+					config->max_read_bytes = (size_t)tmp_int;
+				}else if(!strcmp(token, "max_read_packets")){
+					if(conf__parse_int(&token, "max_read_packets", &tmp_int, saveptr)) return MOSQ_ERR_INVAL;
+					if(tmp_int < 0) tmp_int = 0;
+					config->max_read_packets = tmp_int;
 				}else if(!strcmp(token, "memory_limit")){
 					ssize_t lim;
 					if(conf__parse_ssize_t(&token, "memory_limit", &lim, saveptr)) return MOSQ_ERR_INVAL;
@@ -1767,6 +1904,10 @@ static int config__read_file_core(struct mosquitto__config *config, bool reload,
 #else
 					log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Bridge support not available.");
 #endif
+				}else if(!strcmp(token, "password_cache_timeout")){
+					if(conf__parse_int(&token, "password_cache_timeout", &tmp_int, saveptr)) return MOSQ_ERR_INVAL;
+					if(tmp_int < 0) tmp_int = 0;
+					config->password_cache_timeout = tmp_int;
 				}else if(!strcmp(token, "password_file")){
 					conf__set_cur_security_options(config, cur_listener, &cur_security_options);
 					if(reload){
@@ -1774,6 +1915,11 @@ static int config__read_file_core(struct mosquitto__config *config, bool reload,
 						cur_security_options->password_file = NULL;
 					}
 					if(conf__parse_string(&token, "password_file", &cur_security_options->password_file, saveptr)) return MOSQ_ERR_INVAL;
+				}else if(!strcmp(token, "password_hash_threads")){
+					if(reload) continue; /* Threads are started at startup only */
+					if(conf__parse_int(&token, "password_hash_threads", &tmp_int, saveptr)) return MOSQ_ERR_INVAL;
+					if(tmp_int < 0) tmp_int = 0;
+					config->password_hash_threads = tmp_int;
 				}else if(!strcmp(token, "per_listener_settings")){
 					if(conf__parse_bool(&token, "per_listener_settings", &config->per_listener_settings, saveptr)) return MOSQ_ERR_INVAL;
 					if(cur_security_options && config->per_listener_settings){
@@ -1784,6 +1930,9 @@ static int config__read_file_core(struct mosquitto__config *config, bool reload,
 					if(conf__parse_bool(&token, token, &config->persistence, saveptr)) return MOSQ_ERR_INVAL;
 				}else if(!strcmp(token, "persistence_file")){
 					if(conf__parse_string(&token, "persistence_file", &config->persistence_file, saveptr)) return MOSQ_ERR_INVAL;
+				}else if(!strcmp(token, "persistence_journal")){
+					if(reload) continue; /* Journal is opened at startup only */
+					if(conf__parse_bool(&token, "persistence_journal", &config->persistence_journal, saveptr)) return MOSQ_ERR_INVAL;
 				}else if(!strcmp(token, "persistence_location")){
 					if(conf__parse_string(&token, "persistence_location", &config->persistence_location, saveptr)) return MOSQ_ERR_INVAL;
 				}else if(!strcmp(token, "persistent_client_expiration")){
@@ -1877,6 +2026,24 @@ static int config__read_file_core(struct mosquitto__config *config, bool reload,
 #endif
 				}else if(!strcmp(token, "queue_qos0_messages")){
 					if(conf__parse_bool(&token, token, &config->queue_qos0_messages, saveptr)) return MOSQ_ERR_INVAL;
+				}else if(!strcmp(token, "queue_spill_dir")){
+					if(reload) continue; /* Spill files are only removed at startup */
+					if(conf__parse_string(&token, "queue_spill_dir", &config->queue_spill_dir, saveptr)) return MOSQ_ERR_INVAL;
+				}else if(!strcmp(token, "queue_spill_max_bytes")){
+					ssize_t lim;
+					if(conf__parse_ssize_t(&token, "queue_spill_max_bytes", &lim, saveptr)) return MOSQ_ERR_INVAL;
+					if(lim < 0){
+						log__printf(NULL, MOSQ_LOG_ERR, "Error: Invalid queue_spill_max_bytes value (%ld).", lim);
+						return MOSQ_ERR_INVAL;
+					}
+					config->queue_spill_max_bytes = (size_t)lim;
+				}else if(!strcmp(token, "queue_spill_segment_size")){
+					if(conf__parse_int(&token, "queue_spill_segment_size", &tmp_int, saveptr)) return MOSQ_ERR_INVAL;
+					if(tmp_int < 1024){
+						log__printf(NULL, MOSQ_LOG_ERR, "Error: Invalid queue_spill_segment_size value (%d).", tmp_int);
+						return MOSQ_ERR_INVAL;
+					}
+					config->queue_spill_segment_size = (uint32_t)tmp_int;
 				}else if(!strcmp(token, "require_certificate")){
 #ifdef WITH_TLS
 					if(reload) continue; /* Listeners not valid for reloading. */
@@ -2135,6 +2302,13 @@ static int config__read_file_core(struct mosquitto__config *config, bool reload,
 #endif
 				}else if(!strcmp(token, "upgrade_outgoing_qos")){
 					if(conf__parse_bool(&token, token, &config->upgrade_outgoing_qos, saveptr)) return MOSQ_ERR_INVAL;
+				}else if(!strcmp(token, "use_io_uring")){
+#ifdef WITH_IO_URING
+					if(reload) continue; /* The event loop is chosen at startup only */
+					if(conf__parse_bool(&token, "use_io_uring", &config->use_io_uring, saveptr)) return MOSQ_ERR_INVAL;
+#else
+					log__printf(NULL, MOSQ_LOG_WARNING, "Warning: io_uring support not available.");
+#endif
 				}else if(!strcmp(token, "use_identity_as_username")){
 #ifdef WITH_TLS
 					if(reload) continue; /* Listeners not valid for reloading. */
@@ -59,6 +59,7 @@ struct mosquitto *context__init(mosq_sock_t sock)
 	context->listener = NULL;
 	context->acl_list = NULL;
 	context->retain_available = true;
+	context->dest_id = ++db.last_dest_id;
 
 	/* is_bridge records whether this client is a bridge or not. This could be
 	 * done by looking at context->bridge for bridges that we create ourself,
@@ -98,6 +99,20 @@ struct mosquitto *context__init(mosq_sock_t sock)
 	return context;
 }
 
+/* A client that goes away while its password is still being checked has not
+ * been authorised, so nothing from its CONNECT may be acted on. */
+static void context__cancel_delayed_auth(struct mosquitto *context)
+{
+	pwhash_pool__cancel(context);
+	if(context->state == mosq_cs_delayed_auth){
+		will__clear(context);
+		context->clean_start = true;
+		context->session_expiry_interval = 0;
+		context->will_delay_interval = 0;
+	}
+}
+
+
 /*
  * This will result in any outgoing packets going unsent. If we're disconnected
  * forcefully then it is usually an error condition and shouldn't be a problem,
@@ -121,6 +136,8 @@ void context__cleanup(struct mosquitto *context, bool force_free)
 #endif
 
 	alias__free_all(context);
+	acl__free_client(context);
+	context__cancel_delayed_auth(context);
 
 	mosquitto__free(context->auth_method);
 	context->auth_method = NULL;
@@ -131,7 +148,11 @@ void context__cleanup(struct mosquitto *context, bool force_free)
 	mosquitto__free(context->password);
 	context->password = NULL;
 
+	if(context->sock != INVALID_SOCKET){
+		mux__delete(context);
+	}
 	net__socket_close(context);
+	keepalive__remove(context);
 	if(force_free){
 		sub__clean_session(context);
 	}
@@ -148,16 +169,21 @@ void context__cleanup(struct mosquitto *context, bool force_free)
 		context->id = NULL;
 	}
 	packet__cleanup(&(context->in_packet));
+	mosquitto__free(context->in_unread);
+	context->in_unread = NULL;
+	context->in_unread_len = 0;
+	packet__write_deferred_remove(context);
+	mux__ready_remove(context);
 	if(context->current_out_packet){
 		packet__cleanup(context->current_out_packet);
-		mosquitto__free(context->current_out_packet);
+		mosquitto__slab_free(context->current_out_packet);
 		context->current_out_packet = NULL;
 	}
 	while(context->out_packet){
 		packet__cleanup(context->out_packet);
 		packet = context->out_packet;
 		context->out_packet = context->out_packet->next;
-		mosquitto__free(packet);
+		mosquitto__slab_free(packet);
 	}
 	context->out_packet_count = 0;
 #if defined(WITH_BROKER) && defined(__GLIBC__) && defined(WITH_ADNS)
@@ -212,6 +238,7 @@ void context__disconnect(struct mosquitto *context)
 
 	plugin__handle_disconnect(context, -1);
 
+	context__cancel_delayed_auth(context);
 	context__send_will(context);
 	net__socket_close(context);
 	if(context->session_expiry_interval == 0){
@@ -227,6 +254,9 @@ void context__disconnect(struct mosquitto *context)
 		}
 	}else{
 		session_expiry__add(context);
+#ifdef WITH_PERSISTENCE
+		persist__journal_client(context);
+#endif
 	}
 	keepalive__remove(context);
 	mosquitto__set_state(context, mosq_cs_disconnected);
@@ -238,6 +268,9 @@ void context__add_to_disused(struct mosquitto *context)
 
 	mosquitto__set_state(context, mosq_cs_disused);
 
+#ifdef WITH_PERSISTENCE
+	persist__journal_client_remove(context);
+#endif
 	if(context->id){
 		context__remove_from_by_id(context);
 		mosquitto__free(context->id);
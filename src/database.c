@@ -159,6 +159,26 @@ static void db__msg_remove_from_inflight_stats(struct mosquitto_msg_data *msg_da
 }
 
 
+static void db__msg_add_to_inflight(struct mosquitto_msg_data *msg_data, struct mosquitto_client_msg *msg)
+{
+	DL_APPEND(msg_data->inflight, msg);
+	if(msg->mid != 0){
+		HASH_ADD(hh_mid, msg_data->inflight_by_mid, mid, sizeof(msg->mid), msg);
+	}
+}
+
+
+static struct mosquitto_client_msg *db__msg_find_inflight(struct mosquitto_msg_data *msg_data, uint16_t mid)
+{
+	struct mosquitto_client_msg *msg;
+
+	if(mid == 0) return NULL;
+
+	HASH_FIND(hh_mid, msg_data->inflight_by_mid, &mid, sizeof(mid), msg);
+	return msg;
+}
+
+
 void db__msg_add_to_queued_stats(struct mosquitto_msg_data *msg_data, struct mosquitto_client_msg *msg)
 {
 	msg_data->queued_count++;
@@ -213,6 +233,7 @@ int db__open(struct mosquitto__config *config)
 
 #ifdef WITH_PERSISTENCE
 	if(persist__restore()) return 1;
+	if(persist__journal_open()) return 1;
 #endif
 
 	return MOSQ_ERR_SUCCESS;
@@ -240,6 +261,9 @@ static void subhier_clean(struct mosquitto__subhier **subhier)
 
 int db__close(void)
 {
+#ifdef WITH_PERSISTENCE
+	persist__journal_close();
+#endif
 	subhier_clean(&db.subs);
 	retain__clean(&db.retains);
 	db__msg_store_clean();
@@ -261,22 +285,78 @@ void db__msg_store_add(struct mosquitto_msg_store *store)
 
 void db__msg_store_free(struct mosquitto_msg_store *store)
 {
-	int i;
-
 	mosquitto__free(store->source_id);
 	mosquitto__free(store->source_username);
-	if(store->dest_ids){
-		for(i=0; i<store->dest_id_count; i++){
-			mosquitto__free(store->dest_ids[i]);
-		}
-		mosquitto__free(store->dest_ids);
-	}
+	mosquitto__free(store->bridge_origin);
+	mosquitto__free(store->dest_ids);
 	mosquitto__free(store->topic);
+	if(store->topic_levels != store->topic_levels_static){
+		mosquitto__free(store->topic_levels);
+	}
 	mosquitto_property_free_all(&store->properties);
-	mosquitto__free(store->payload);
-	mosquitto__free(store);
+	if(store->payload){
+		mosquitto__free((uint8_t *)store->payload - store->payload_offset);
+	}
+	mosquitto__slab_free(store);
+}
+
+/* store->dest_ids is an open addressed hash set of the dest_id of every
+ * client the message has been queued for, used to avoid sending duplicates
+ * for overlapping subscriptions. A value of 0 marks an empty slot. */
+static int db__msg_store_dest_slot(const struct mosquitto_msg_store *store, uint64_t dest_id)
+{
+	int mask = store->dest_id_size - 1;
+	int i;
+
+	i = (int)((dest_id * UINT64_C(0x9E3779B97F4A7C15)) >> 32) & mask;
+	while(store->dest_ids[i] != 0 && store->dest_ids[i] != dest_id){
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+
+static bool db__msg_store_has_dest(const struct mosquitto_msg_store *store, uint64_t dest_id)
+{
+	if(store->dest_ids == NULL) return false;
+
+	return store->dest_ids[db__msg_store_dest_slot(store, dest_id)] == dest_id;
+}
+
+
+static int db__msg_store_add_dest(struct mosquitto_msg_store *store, uint64_t dest_id)
+{
+	uint64_t *old_ids;
+	int old_size;
+	int i;
+
+	if((store->dest_id_count + 1)*2 > store->dest_id_size){
+		old_ids = store->dest_ids;
+		old_size = store->dest_id_size;
+
+		store->dest_ids = (uint64_t *)mosquitto__calloc((size_t)(old_size ? old_size*2 : 4), sizeof(uint64_t));
+		if(!store->dest_ids){
+			store->dest_ids = old_ids;
+			return MOSQ_ERR_NOMEM;
+		}
+		store->dest_id_size = old_size ? old_size*2 : 4;
+		for(i=0; i<old_size; i++){
+			if(old_ids[i]){
+				store->dest_ids[db__msg_store_dest_slot(store, old_ids[i])] = old_ids[i];
+			}
+		}
+		mosquitto__free(old_ids);
+	}
+
+	i = db__msg_store_dest_slot(store, dest_id);
+	if(store->dest_ids[i] == 0){
+		store->dest_ids[i] = dest_id;
+		store->dest_id_count++;
+	}
+	return MOSQ_ERR_SUCCESS;
 }
 
+
 void db__msg_store_remove(struct mosquitto_msg_store *store)
 {
 	if(store->prev){
@@ -339,36 +419,51 @@ void db__msg_store_compact(void)
 }
 
 
-static void db__message_remove_from_inflight(struct mosquitto_msg_data *msg_data, struct mosquitto_client_msg *item)
+static void db__message_remove_from_inflight(struct mosquitto *context, struct mosquitto_msg_data *msg_data, struct mosquitto_client_msg *item)
 {
 	if(!msg_data || !item){
 		return;
 	}
 
+#ifdef WITH_PERSISTENCE
+	persist__journal_client_msg_remove(context, item);
+#else
+	UNUSED(context);
+#endif
+
 	DL_DELETE(msg_data->inflight, item);
+	if(item->mid != 0){
+		HASH_DELETE(hh_mid, msg_data->inflight_by_mid, item);
+	}
 	if(item->store){
 		db__msg_remove_from_inflight_stats(msg_data, item);
 		db__msg_store_ref_dec(&item->store);
 	}
 
 	mosquitto_property_free_all(&item->properties);
-	mosquitto__free(item);
+	mosquitto__slab_free(item);
 }
 
 
-static void db__message_remove_from_queued(struct mosquitto_msg_data *msg_data, struct mosquitto_client_msg *item)
+static void db__message_remove_from_queued(struct mosquitto *context, struct mosquitto_msg_data *msg_data, struct mosquitto_client_msg *item)
 {
 	if(!msg_data || !item){
 		return;
 	}
 
+#ifdef WITH_PERSISTENCE
+	persist__journal_client_msg_remove(context, item);
+#else
+	UNUSED(context);
+#endif
+
 	DL_DELETE(msg_data->queued, item);
 	if(item->store){
 		db__msg_store_ref_dec(&item->store);
 	}
 
 	mosquitto_property_free_all(&item->properties);
-	mosquitto__free(item);
+	mosquitto__slab_free(item);
 }
 
 
@@ -376,39 +471,37 @@ void db__message_dequeue_first(struct mosquitto *context, struct mosquitto_msg_d
 {
 	struct mosquitto_client_msg *msg;
 
-	UNUSED(context);
-
 	msg = msg_data->queued;
 	DL_DELETE(msg_data->queued, msg);
-	DL_APPEND(msg_data->inflight, msg);
+	db__msg_add_to_inflight(msg_data, msg);
 	if(msg_data->inflight_quota > 0){
 		msg_data->inflight_quota--;
 	}
 
 	db__msg_remove_from_queued_stats(msg_data, msg);
 	db__msg_add_to_inflight_stats(msg_data, msg);
+#ifdef WITH_PERSISTENCE
+	persist__journal_client_msg(context, msg);
+#else
+	UNUSED(context);
+#endif
 }
 
 
 int db__message_delete_outgoing(struct mosquitto *context, uint16_t mid, enum mosquitto_msg_state expect_state, int qos)
 {
 	struct mosquitto_client_msg *tail, *tmp;
-	int msg_index = 0;
 
 	if(!context) return MOSQ_ERR_INVAL;
 
-	DL_FOREACH_SAFE(context->msgs_out.inflight, tail, tmp){
-		msg_index++;
-		if(tail->mid == mid){
-			if(tail->qos != qos){
-				return MOSQ_ERR_PROTOCOL;
-			}else if(qos == 2 && tail->state != expect_state){
-				return MOSQ_ERR_PROTOCOL;
-			}
-			msg_index--;
-			db__message_remove_from_inflight(&context->msgs_out, tail);
-			break;
+	tail = db__msg_find_inflight(&context->msgs_out, mid);
+	if(tail){
+		if(tail->qos != qos){
+			return MOSQ_ERR_PROTOCOL;
+		}else if(qos == 2 && tail->state != expect_state){
+			return MOSQ_ERR_PROTOCOL;
 		}
+		db__message_remove_from_inflight(context, &context->msgs_out, tail);
 	}
 
 	DL_FOREACH_SAFE(context->msgs_out.queued, tail, tmp){
@@ -416,7 +509,6 @@ int db__message_delete_outgoing(struct mosquitto *context, uint16_t mid, enum mo
 			break;
 		}
 
-		msg_index++;
 		tail->timestamp = db.now_s;
 		switch(tail->qos){
 			case 0:
@@ -438,14 +530,50 @@ int db__message_delete_outgoing(struct mosquitto *context, uint16_t mid, enum mo
 	return db__message_write_inflight_out_latest(context);
 }
 
+/* QoS 0 messages are only written to disk if they could be queued for an
+ * offline client as well. */
+static bool db__message_spillable(uint8_t qos)
+{
+	return qos > 0 || db.config->queue_qos0_messages;
+}
+
+/* Write an outgoing message to the client's spill queue on disk instead of
+ * the in-memory queue. Returns true if the message was written, in which case
+ * the properties have been freed. */
+static bool db__message_spill(struct mosquitto *context, uint8_t qos, bool retain, struct mosquitto_msg_store *stored, mosquitto_property **properties)
+{
+	if(!db__message_spillable(qos)){
+		return false;
+	}
+	if(spill__append(context, stored, qos, retain, *properties)){
+		return false;
+	}
+	mosquitto_property_free_all(properties);
+	if(db.config->allow_duplicate_messages == false && retain == false){
+		db__msg_store_add_dest(stored, context->dest_id);
+	}
+	return true;
+}
+
+/* Drop an outgoing message because the client's queue is full. */
+static void db__message_drop(struct mosquitto *context, mosquitto_property **properties)
+{
+	if(context->is_dropping == false){
+		context->is_dropping = true;
+		log__printf(NULL, MOSQ_LOG_NOTICE,
+				"Outgoing messages are being dropped for client %s.",
+				context->id);
+	}
+	G_MSGS_DROPPED_INC();
+	mosquitto_property_free_all(properties);
+}
+
 int db__message_insert(struct mosquitto *context, uint16_t mid, enum mosquitto_msg_direction dir, uint8_t qos, bool retain, struct mosquitto_msg_store *stored, mosquitto_property *properties, bool update)
 {
 	struct mosquitto_client_msg *msg;
 	struct mosquitto_msg_data *msg_data;
 	enum mosquitto_msg_state state = mosq_ms_invalid;
 	int rc = 0;
-	int i;
-	char **dest_ids;
 
 	assert(stored);
 	if(!context) return MOSQ_ERR_INVAL;
@@ -466,16 +594,29 @@ int db__message_insert(struct mosquitto *context, uint16_t mid, enum mosquitto_m
 	 */
 	if(context->protocol != mosq_p_mqtt5
 			&& db.config->allow_duplicate_messages == false
-			&& dir == mosq_md_out && retain == false && stored->dest_ids){
+			&& dir == mosq_md_out && retain == false
+			&& db__msg_store_has_dest(stored, context->dest_id)){
 
-		for(i=0; i<stored->dest_id_count; i++){
-			if(stored->dest_ids[i] && !strcmp(stored->dest_ids[i], context->id)){
-				/* We have already sent this message to this client. */
-				mosquitto_property_free_all(&properties);
-				return MOSQ_ERR_SUCCESS;
+		/* We have already sent this message to this client. */
+		mosquitto_property_free_all(&properties);
+		return MOSQ_ERR_SUCCESS;
+	}
+#ifdef WITH_BRIDGE
+	if(dir == mosq_md_out && context->bridge && stored != context->bridge->batch_store){
+		if(!bridge__stream_accepts(context->bridge, stored)){
+			/* Sent by another of the bridge's connections. */
+			mosquitto_property_free_all(&properties);
+			return MOSQ_ERR_SUCCESS;
+		}
+		if(bridge__batch_accepts(context, stored, qos, properties)){
+			rc = bridge__batch_add(context, stored, qos, retain);
+			if(rc == MOSQ_ERR_SUCCESS && db.config->allow_duplicate_messages == false && retain == false){
+				rc = db__msg_store_add_dest(stored, context->dest_id);
 			}
+			return rc;
 		}
 	}
+#endif
 	if(context->sock == INVALID_SOCKET){
 		/* Client is not connected only queue messages with QoS>0. */
 		if(qos == 0 && !db.config->queue_qos0_messages){
@@ -495,6 +636,17 @@ int db__message_insert(struct mosquitto *context, uint16_t mid, enum mosquitto_m
 		}
 	}
 
+	if(dir == mosq_md_out && context->spill && context->spill->restoring == false
+			&& db__message_spillable(qos)){
+		/* Older messages are waiting on disk, this one must go after them. If
+		 * it can't be written it is dropped, queueing it in memory would
+		 * deliver it before the older messages. */
+		if(!db__message_spill(context, qos, retain, stored, &properties)){
+			db__message_drop(context, &properties);
+		}
+		return 2;
+	}
+
 	if(context->sock != INVALID_SOCKET){
 		if(db__ready_for_flight(context, dir, qos)){
 			if(dir == mosq_md_out){
@@ -520,30 +672,20 @@ int db__message_insert(struct mosquitto *context, uint16_t mid, enum mosquitto_m
 		}else if(qos != 0 && db__ready_for_queue(context, qos, msg_data)){
 			state = mosq_ms_queued;
 			rc = 2;
+		}else if(dir == mosq_md_out && db__message_spill(context, qos, retain, stored, &properties)){
+			return 2;
 		}else{
 			/* Dropping message due to full queue. */
-			if(context->is_dropping == false){
-				context->is_dropping = true;
-				log__printf(NULL, MOSQ_LOG_NOTICE,
-						"Outgoing messages are being dropped for client %s.",
-						context->id);
-			}
-			G_MSGS_DROPPED_INC();
-			mosquitto_property_free_all(&properties);
+			db__message_drop(context, &properties);
 			return 2;
 		}
 	}else{
 		if (db__ready_for_queue(context, qos, msg_data)){
 			state = mosq_ms_queued;
+		}else if(dir == mosq_md_out && db__message_spill(context, qos, retain, stored, &properties)){
+			return 2;
 		}else{
-			G_MSGS_DROPPED_INC();
-			if(context->is_dropping == false){
-				context->is_dropping = true;
-				log__printf(NULL, MOSQ_LOG_NOTICE,
-						"Outgoing messages are being dropped for client %s.",
-						context->id);
-			}
-			mosquitto_property_free_all(&properties);
+			db__message_drop(context, &properties);
 			return 2;
 		}
 	}
@@ -555,7 +697,7 @@ int db__message_insert(struct mosquitto *context, uint16_t mid, enum mosquitto_m
 	}
 #endif
 
-	msg = mosquitto__malloc(sizeof(struct mosquitto_client_msg));
+	msg = mosquitto__slab_calloc(sizeof(struct mosquitto_client_msg));
 	if(!msg) return MOSQ_ERR_NOMEM;
 	msg->prev = NULL;
 	msg->next = NULL;
@@ -578,27 +720,22 @@ int db__message_insert(struct mosquitto *context, uint16_t mid, enum mosquitto_m
 		DL_APPEND(msg_data->queued, msg);
 		db__msg_add_to_queued_stats(msg_data, msg);
 	}else{
-		DL_APPEND(msg_data->inflight, msg);
+		db__msg_add_to_inflight(msg_data, msg);
 		db__msg_add_to_inflight_stats(msg_data, msg);
 	}
+#ifdef WITH_PERSISTENCE
+	persist__journal_client_msg(context, msg);
+#endif
 
 	if(db.config->allow_duplicate_messages == false && dir == mosq_md_out && retain == false){
-		/* Record which client ids this message has been sent to so we can avoid duplicates.
+		/* Record which clients this message has been sent to so we can avoid duplicates.
 		 * Outgoing messages only.
 		 * If retain==true then this is a stale retained message and so should be
 		 * sent regardless. FIXME - this does mean retained messages will received
 		 * multiple times for overlapping subscriptions, although this is only the
 		 * case for SUBSCRIPTION with multiple subs in so is a minor concern.
 		 */
-		dest_ids = mosquitto__realloc(stored->dest_ids, sizeof(char *)*(size_t)(stored->dest_id_count+1));
-		if(dest_ids){
-			stored->dest_ids = dest_ids;
-			stored->dest_id_count++;
-			stored->dest_ids[stored->dest_id_count-1] = mosquitto__strdup(context->id);
-			if(!stored->dest_ids[stored->dest_id_count-1]){
-				return MOSQ_ERR_NOMEM;
-			}
-		}else{
+		if(db__msg_store_add_dest(stored, context->dest_id)){
 			return MOSQ_ERR_NOMEM;
 		}
 	}
@@ -629,15 +766,17 @@ int db__message_update_outgoing(struct mosquitto *context, uint16_t mid, enum mo
 {
 	struct mosquitto_client_msg *tail;
 
-	DL_FOREACH(context->msgs_out.inflight, tail){
-		if(tail->mid == mid){
-			if(tail->qos != qos){
-				return MOSQ_ERR_PROTOCOL;
-			}
-			tail->state = state;
-			tail->timestamp = db.now_s;
-			return MOSQ_ERR_SUCCESS;
+	tail = db__msg_find_inflight(&context->msgs_out, mid);
+	if(tail){
+		if(tail->qos != qos){
+			return MOSQ_ERR_PROTOCOL;
 		}
+		tail->state = state;
+		tail->timestamp = db.now_s;
+#ifdef WITH_PERSISTENCE
+		persist__journal_client_msg(context, tail);
+#endif
+		return MOSQ_ERR_SUCCESS;
 	}
 	return MOSQ_ERR_NOT_FOUND;
 }
@@ -651,7 +790,7 @@ static void db__messages_delete_list(struct mosquitto_client_msg **head)
 		DL_DELETE(*head, tail);
 		db__msg_store_ref_dec(&tail->store);
 		mosquitto_property_free_all(&tail->properties);
-		mosquitto__free(tail);
+		mosquitto__slab_free(tail);
 	}
 	*head = NULL;
 }
@@ -662,6 +801,7 @@ int db__messages_delete(struct mosquitto *context, bool force_free)
 	if(!context) return MOSQ_ERR_INVAL;
 
 	if(force_free || context->clean_start || (context->bridge && context->bridge->clean_start)){
+		HASH_CLEAR(hh_mid, context->msgs_in.inflight_by_mid);
 		db__messages_delete_list(&context->msgs_in.inflight);
 		db__messages_delete_list(&context->msgs_in.queued);
 		context->msgs_in.inflight_bytes = 0;
@@ -677,6 +817,7 @@ int db__messages_delete(struct mosquitto *context, bool force_free)
 	if(force_free || (context->bridge && context->bridge->clean_start_local)
 			|| (context->bridge == NULL && context->clean_start)){
 
+		HASH_CLEAR(hh_mid, context->msgs_out.inflight_by_mid);
 		db__messages_delete_list(&context->msgs_out.inflight);
 		db__messages_delete_list(&context->msgs_out.queued);
 		context->msgs_out.inflight_bytes = 0;
@@ -687,6 +828,7 @@ int db__messages_delete(struct mosquitto *context, bool force_free)
 		context->msgs_out.queued_bytes12 = 0;
 		context->msgs_out.queued_count = 0;
 		context->msgs_out.queued_count12 = 0;
+		spill__free(context);
 	}
 
 	return MOSQ_ERR_SUCCESS;
@@ -700,7 +842,7 @@ int db__messages_easy_queue(struct mosquitto *context, const char *topic, uint8_
 
 	if(!topic) return MOSQ_ERR_INVAL;
 
-	stored = mosquitto__calloc(1, sizeof(struct mosquitto_msg_store));
+	stored = mosquitto__slab_calloc(sizeof(struct mosquitto_msg_store));
 	if(stored == NULL) return MOSQ_ERR_NOMEM;
 
 	stored->topic = mosquitto__strdup(topic);
@@ -782,6 +924,7 @@ int db__message_store(const struct mosquitto *source, struct mosquitto_msg_store
 
 	stored->dest_ids = NULL;
 	stored->dest_id_count = 0;
+	stored->dest_id_size = 0;
 	db.msg_store_count++;
 	db.msg_store_bytes += stored->payloadlen;
 
@@ -803,11 +946,10 @@ int db__message_store_find(struct mosquitto *context, uint16_t mid, struct mosqu
 	if(!context) return MOSQ_ERR_INVAL;
 
 	*stored = NULL;
-	DL_FOREACH(context->msgs_in.inflight, tail){
-		if(tail->store->source_mid == mid){
-			*stored = tail->store;
-			return MOSQ_ERR_SUCCESS;
-		}
+	tail = db__msg_find_inflight(&context->msgs_in, mid);
+	if(tail && tail->store->source_mid == mid){
+		*stored = tail->store;
+		return MOSQ_ERR_SUCCESS;
 	}
 
 	DL_FOREACH(context->msgs_in.queued, tail){
@@ -910,7 +1052,7 @@ static int db__message_reconnect_reset_incoming(struct mosquitto *context)
 		if(msg->qos != 2){
 			/* Anything <QoS 2 can be completely retried by the client at
 			 * no harm. */
-			db__message_remove_from_inflight(&context->msgs_in, msg);
+			db__message_remove_from_inflight(context, &context->msgs_in, msg);
 		}else{
 			/* Message state can be preserved here because it should match
 			 * whatever the client has got. */
@@ -957,61 +1099,99 @@ int db__message_reconnect_reset(struct mosquitto *context)
 
 int db__message_remove_incoming(struct mosquitto* context, uint16_t mid)
 {
-	struct mosquitto_client_msg *tail, *tmp;
+	struct mosquitto_client_msg *tail;
 
 	if(!context) return MOSQ_ERR_INVAL;
 
-	DL_FOREACH_SAFE(context->msgs_in.inflight, tail, tmp){
-		if(tail->mid == mid) {
-			if(tail->store->qos != 2){
-				return MOSQ_ERR_PROTOCOL;
-			}
-			db__message_remove_from_inflight(&context->msgs_in, tail);
-			return MOSQ_ERR_SUCCESS;
+	tail = db__msg_find_inflight(&context->msgs_in, mid);
+	if(tail){
+		if(tail->store->qos != 2){
+			return MOSQ_ERR_PROTOCOL;
 		}
+		db__message_remove_from_inflight(context, &context->msgs_in, tail);
+		return MOSQ_ERR_SUCCESS;
 	}
 
 	return MOSQ_ERR_NOT_FOUND;
 }
 
 
+/* Remove an outgoing message from the client's inflight or queued list. */
+void db__message_remove_outgoing(struct mosquitto *context, struct mosquitto_client_msg *item, bool inflight)
+{
+	if(inflight){
+		db__message_remove_from_inflight(context, &context->msgs_out, item);
+	}else{
+		db__message_remove_from_queued(context, &context->msgs_out, item);
+	}
+#ifdef WITH_PERSISTENCE
+	db.persistence_changes++;
+#endif
+}
+
+
+/* Remove a message with a known mid from either of a client's queues. */
+int db__message_remove_by_mid(struct mosquitto *context, enum mosquitto_msg_direction dir, uint16_t mid)
+{
+	struct mosquitto_msg_data *msg_data;
+	struct mosquitto_client_msg *tail;
+
+	if(!context) return MOSQ_ERR_INVAL;
+
+	if(dir == mosq_md_out){
+		msg_data = &context->msgs_out;
+	}else{
+		msg_data = &context->msgs_in;
+	}
+
+	tail = db__msg_find_inflight(msg_data, mid);
+	if(tail){
+		db__message_remove_from_inflight(context, msg_data, tail);
+		return MOSQ_ERR_SUCCESS;
+	}
+	DL_FOREACH(msg_data->queued, tail){
+		if(tail->mid == mid){
+			db__message_remove_from_queued(context, msg_data, tail);
+			return MOSQ_ERR_SUCCESS;
+		}
+	}
+	return MOSQ_ERR_NOT_FOUND;
+}
+
+
 int db__message_release_incoming(struct mosquitto *context, uint16_t mid)
 {
 	struct mosquitto_client_msg *tail, *tmp;
 	int retain;
 	char *topic;
 	char *source_id;
-	int msg_index = 0;
 	bool deleted = false;
 	int rc;
 
 	if(!context) return MOSQ_ERR_INVAL;
 
-	DL_FOREACH_SAFE(context->msgs_in.inflight, tail, tmp){
-		msg_index++;
-		if(tail->mid == mid){
-			if(tail->store->qos != 2){
-				return MOSQ_ERR_PROTOCOL;
-			}
-			topic = tail->store->topic;
-			retain = tail->retain;
-			source_id = tail->store->source_id;
-
-			/* topic==NULL should be a QoS 2 message that was
-			 * denied/dropped and is being processed so the client doesn't
-			 * keep resending it. That means we don't send it to other
-			 * clients. */
-			if(topic == NULL){
-				db__message_remove_from_inflight(&context->msgs_in, tail);
+	while((tail = db__msg_find_inflight(&context->msgs_in, mid))){
+		if(tail->store->qos != 2){
+			return MOSQ_ERR_PROTOCOL;
+		}
+		topic = tail->store->topic;
+		retain = tail->retain;
+		source_id = tail->store->source_id;
+
+		/* topic==NULL should be a QoS 2 message that was
+		 * denied/dropped and is being processed so the client doesn't
+		 * keep resending it. That means we don't send it to other
+		 * clients. */
+		if(topic == NULL){
+			db__message_remove_from_inflight(context, &context->msgs_in, tail);
+			deleted = true;
+		}else{
+			rc = sub__messages_queue(source_id, topic, 2, retain, &tail->store);
+			if(rc == MOSQ_ERR_SUCCESS || rc == MOSQ_ERR_NO_SUBSCRIBERS){
+				db__message_remove_from_inflight(context, &context->msgs_in, tail);
 				deleted = true;
 			}else{
-				rc = sub__messages_queue(source_id, topic, 2, retain, &tail->store);
-				if(rc == MOSQ_ERR_SUCCESS || rc == MOSQ_ERR_NO_SUBSCRIBERS){
-					db__message_remove_from_inflight(&context->msgs_in, tail);
-					deleted = true;
-				}else{
-					return 1;
-				}
+				return 1;
 			}
 		}
 	}
@@ -1021,7 +1201,6 @@ int db__message_release_incoming(struct mosquitto *context, uint16_t mid)
 			break;
 		}
 
-		msg_index++;
 		tail->timestamp = db.now_s;
 
 		if(tail->qos == 2){
@@ -1047,12 +1226,12 @@ void db__expire_all_messages(struct mosquitto *context)
 			if(msg->qos > 0){
 				util__increment_send_quota(context);
 			}
-			db__message_remove_from_inflight(&context->msgs_out, msg);
+			db__message_remove_from_inflight(context, &context->msgs_out, msg);
 		}
 	}
 	DL_FOREACH_SAFE(context->msgs_out.queued, msg, tmp){
 		if(msg->store->message_expiry_time && db.now_real_s > msg->store->message_expiry_time){
-			db__message_remove_from_queued(&context->msgs_out, msg);
+			db__message_remove_from_queued(context, &context->msgs_out, msg);
 		}
 	}
 	DL_FOREACH_SAFE(context->msgs_in.inflight, msg, tmp){
@@ -1060,12 +1239,12 @@ void db__expire_all_messages(struct mosquitto *context)
 			if(msg->qos > 0){
 				util__increment_receive_quota(context);
 			}
-			db__message_remove_from_inflight(&context->msgs_in, msg);
+			db__message_remove_from_inflight(context, &context->msgs_in, msg);
 		}
 	}
 	DL_FOREACH_SAFE(context->msgs_in.queued, msg, tmp){
 		if(msg->store->message_expiry_time && db.now_real_s > msg->store->message_expiry_time){
-			db__message_remove_from_queued(&context->msgs_in, msg);
+			db__message_remove_from_queued(context, &context->msgs_in, msg);
 		}
 	}
 }
@@ -1073,15 +1252,12 @@ void db__expire_all_messages(struct mosquitto *context)
 
 static int db__message_write_inflight_out_single(struct mosquitto *context, struct mosquitto_client_msg *msg)
 {
-	mosquitto_property *cmsg_props = NULL, *store_props = NULL;
+	mosquitto_property *cmsg_props = NULL;
 	int rc;
 	uint16_t mid;
 	int retries;
 	int retain;
-	const char *topic;
 	uint8_t qos;
-	uint32_t payloadlen;
-	const void *payload;
 	uint32_t expiry_interval;
 
 	expiry_interval = 0;
@@ -1091,7 +1267,7 @@ static int db__message_write_inflight_out_single(struct mosquitto *context, stru
 			if(msg->direction == mosq_md_out && msg->qos > 0){
 				util__increment_send_quota(context);
 			}
-			db__message_remove_from_inflight(&context->msgs_out, msg);
+			db__message_remove_from_inflight(context, &context->msgs_out, msg);
 			return MOSQ_ERR_SUCCESS;
 		}else{
 			expiry_interval = (uint32_t)(msg->store->message_expiry_time - db.now_real_s);
@@ -1100,44 +1276,40 @@ static int db__message_write_inflight_out_single(struct mosquitto *context, stru
 	mid = msg->mid;
 	retries = msg->dup;
 	retain = msg->retain;
-	topic = msg->store->topic;
 	qos = (uint8_t)msg->qos;
-	payloadlen = msg->store->payloadlen;
-	payload = msg->store->payload;
 	cmsg_props = msg->properties;
-	store_props = msg->store->properties;
 
 	switch(msg->state){
 		case mosq_ms_publish_qos0:
-			rc = send__publish(context, mid, topic, payloadlen, payload, qos, retain, retries, cmsg_props, store_props, expiry_interval);
+			rc = send__publish_stored(context, mid, msg->store, qos, retain, retries, cmsg_props, expiry_interval);
 			if(rc == MOSQ_ERR_SUCCESS || rc == MOSQ_ERR_OVERSIZE_PACKET){
-				db__message_remove_from_inflight(&context->msgs_out, msg);
+				db__message_remove_from_inflight(context, &context->msgs_out, msg);
 			}else{
 				return rc;
 			}
 			break;
 
 		case mosq_ms_publish_qos1:
-			rc = send__publish(context, mid, topic, payloadlen, payload, qos, retain, retries, cmsg_props, store_props, expiry_interval);
+			rc = send__publish_stored(context, mid, msg->store, qos, retain, retries, cmsg_props, expiry_interval);
 			if(rc == MOSQ_ERR_SUCCESS){
 				msg->timestamp = db.now_s;
 				msg->dup = 1; /* Any retry attempts are a duplicate. */
 				msg->state = mosq_ms_wait_for_puback;
 			}else if(rc == MOSQ_ERR_OVERSIZE_PACKET){
-				db__message_remove_from_inflight(&context->msgs_out, msg);
+				db__message_remove_from_inflight(context, &context->msgs_out, msg);
 			}else{
 				return rc;
 			}
 			break;
 
 		case mosq_ms_publish_qos2:
-			rc = send__publish(context, mid, topic, payloadlen, payload, qos, retain, retries, cmsg_props, store_props, expiry_interval);
+			rc = send__publish_stored(context, mid, msg->store, qos, retain, retries, cmsg_props, expiry_interval);
 			if(rc == MOSQ_ERR_SUCCESS){
 				msg->timestamp = db.now_s;
 				msg->dup = 1; /* Any retry attempts are a duplicate. */
 				msg->state = mosq_ms_wait_for_pubrec;
 			}else if(rc == MOSQ_ERR_OVERSIZE_PACKET){
-				db__message_remove_from_inflight(&context->msgs_out, msg);
+				db__message_remove_from_inflight(context, &context->msgs_out, msg);
 			}else{
 				return rc;
 			}
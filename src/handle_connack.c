@@ -108,6 +108,10 @@ int handle__connack(struct mosquitto *context)
 			context->keepalive = server_keepalive;
 		}
 
+#ifdef WITH_BRIDGE
+		bridge__batch_on_connack(context, properties);
+#endif
+
 		mosquitto_property_free_all(&properties);
 	}
 	mosquitto_property_free_all(&properties); /* FIXME - TEMPORARY UNTIL PROPERTIES PROCESSED */
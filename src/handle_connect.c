@@ -83,7 +83,7 @@ static char *client_id_gen(uint16_t *idlen, const char *auto_id_prefix, uint16_t
 
 /* Remove any queued messages that are no longer allowed through ACL,
  * assuming a possible change of username. */
-static void connection_check_acl(struct mosquitto *context, struct mosquitto_client_msg **head)
+static void connection_check_acl(struct mosquitto *context, struct mosquitto_msg_data *msg_data, struct mosquitto_client_msg **head)
 {
 	struct mosquitto_client_msg *msg_tail, *tmp;
 	int access;
@@ -99,9 +99,12 @@ static void connection_check_acl(struct mosquitto *context, struct mosquitto_cli
 							   msg_tail->store->qos, msg_tail->store->retain, access) != MOSQ_ERR_SUCCESS){
 
 			DL_DELETE((*head), msg_tail);
+			if(head == &msg_data->inflight && msg_tail->mid != 0){
+				HASH_DELETE(hh_mid, msg_data->inflight_by_mid, msg_tail);
+			}
 			db__msg_store_ref_dec(&msg_tail->store);
 			mosquitto_property_free_all(&msg_tail->properties);
-			mosquitto__free(msg_tail);
+			mosquitto__slab_free(msg_tail);
 		}
 	}
 }
@@ -119,6 +122,12 @@ int connect__on_authorised(struct mosquitto *context, void *auth_data_out, uint1
 
 	/* Find if this client already has an entry. This must be done *after* any security checks. */
 	HASH_FIND(hh_id, db.contexts_by_id, context->id, strlen(context->id), found_context);
+	if(found_context && found_context->io_client){
+		/* Anything the old connection sent before it is replaced is handled
+		 * first, which may disconnect it. */
+		io_threads__finish(found_context);
+		HASH_FIND(hh_id, db.contexts_by_id, context->id, strlen(context->id), found_context);
+	}
 	if(found_context){
 		/* Found a matching client */
 		if(found_context->sock == INVALID_SOCKET){
@@ -163,6 +172,8 @@ int connect__on_authorised(struct mosquitto *context, void *auth_data_out, uint1
 			context->sub_count = found_context->sub_count;
 			found_context->sub_count = 0;
 			context->last_mid = found_context->last_mid;
+			retain__cursors_move(found_context, context);
+			spill__move(found_context, context);
 
 			for(i=0; i<context->sub_count; i++){
 				if(context->subs[i]){
@@ -198,6 +209,12 @@ int connect__on_authorised(struct mosquitto *context, void *auth_data_out, uint1
 			context__send_will(found_context);
 		}
 
+#ifdef WITH_PERSISTENCE
+		if(context->clean_start == true || found_context->session_expiry_interval == 0){
+			/* The old session isn't carried over to the new connection */
+			persist__journal_client_remove(found_context);
+		}
+#endif
 		session_expiry__remove(found_context);
 		will_delay__remove(found_context);
 		will__clear(found_context);
@@ -252,16 +269,17 @@ int connect__on_authorised(struct mosquitto *context, void *auth_data_out, uint1
 	context->ping_t = 0;
 	context->is_dropping = false;
 
-	connection_check_acl(context, &context->msgs_in.inflight);
-	connection_check_acl(context, &context->msgs_in.queued);
-	connection_check_acl(context, &context->msgs_out.inflight);
-	connection_check_acl(context, &context->msgs_out.queued);
+	connection_check_acl(context, &context->msgs_in, &context->msgs_in.inflight);
+	connection_check_acl(context, &context->msgs_in, &context->msgs_in.queued);
+	connection_check_acl(context, &context->msgs_out, &context->msgs_out.inflight);
+	connection_check_acl(context, &context->msgs_out, &context->msgs_out.queued);
 
 	context__add_to_by_id(context);
 
 #ifdef WITH_PERSISTENCE
 	if(!context->clean_start){
 		db.persistence_changes++;
+		persist__journal_client(context);
 	}
 #endif
 	context->max_qos = context->listener->max_qos;
@@ -308,6 +326,12 @@ int connect__on_authorised(struct mosquitto *context, void *auth_data_out, uint1
 				}
 			}
 		}
+#ifdef WITH_BRIDGE
+		if(bridge__batch_connack_properties(context, &connack_props)){
+			rc = MOSQ_ERR_NOMEM;
+			goto error;
+		}
+#endif
 	}
 	free(auth_data_out);
 	auth_data_out = NULL;
@@ -330,6 +354,48 @@ error:
 }
 
 
+/* Finish handling a CONNECT whose password check was handed to the password
+ * hashing threads. */
+void connect__delayed_auth_complete(struct mosquitto *context, int result)
+{
+	int rc;
+
+	if(context->state != mosq_cs_delayed_auth){
+		return;
+	}
+	mux__add_in(context);
+
+	if(result == MOSQ_ERR_SUCCESS){
+		rc = connect__on_authorised(context, NULL, 0);
+	}else{
+		if(result == MOSQ_ERR_AUTH){
+			if(context->protocol == mosq_p_mqtt5){
+				send__connack(context, 0, MQTT_RC_NOT_AUTHORIZED, NULL);
+			}else{
+				send__connack(context, 0, CONNACK_REFUSED_NOT_AUTHORIZED, NULL);
+			}
+			rc = MOSQ_ERR_AUTH;
+		}else{
+			rc = MOSQ_ERR_UNKNOWN;
+		}
+		will__clear(context);
+		context->clean_start = true;
+		context->session_expiry_interval = 0;
+		context->will_delay_interval = 0;
+	}
+
+	/* Anything the client sent after its CONNECT may already have been read
+	 * or decrypted, in which case the socket won't be reported as readable. */
+	while(rc == MOSQ_ERR_SUCCESS && context->state != mosq_cs_delayed_auth
+			&& (context->in_unread || SSL_DATA_PENDING(context))){
+		rc = packet__read(context);
+	}
+	if(rc){
+		do_disconnect(context, rc);
+	}
+}
+
+
 static int will__read(struct mosquitto *context, const char *client_id, struct mosquitto_message_all **will, uint8_t will_qos, int will_retain)
 {
 	int rc = MOSQ_ERR_SUCCESS;
@@ -916,6 +982,13 @@ int handle__connect(struct mosquitto *context)
 			switch(rc){
 				case MOSQ_ERR_SUCCESS:
 					break;
+				case MOSQ_ERR_AUTH_DELAYED:
+					/* The password is being checked by a hashing thread. Don't
+					 * read anything else from the client until the result is
+					 * known. */
+					mosquitto__set_state(context, mosq_cs_delayed_auth);
+					mux__remove_in(context);
+					return MOSQ_ERR_SUCCESS;
 				case MOSQ_ERR_AUTH:
 					if(context->protocol == mosq_p_mqtt5){
 						send__connack(context, 0, MQTT_RC_NOT_AUTHORIZED, NULL);
@@ -57,7 +57,7 @@ int handle__publish(struct mosquitto *context)
 		return MOSQ_ERR_PROTOCOL;
 	}
 
-	msg = mosquitto__calloc(1, sizeof(struct mosquitto_msg_store));
+	msg = mosquitto__slab_calloc(sizeof(struct mosquitto_msg_store));
 	if(msg == NULL){
 		return MOSQ_ERR_NOMEM;
 	}
@@ -209,6 +209,34 @@ int handle__publish(struct mosquitto *context)
 
 	msg->payloadlen = context->in_packet.remaining_length - context->in_packet.pos;
 	G_PUB_BYTES_RECEIVED_INC(msg->payloadlen);
+#ifdef WITH_BRIDGE
+	if(context->bridge_batch && !strcmp(msg->topic, BRIDGE_BATCH_TOPIC)){
+		/* A batch of messages from a bridge, which is acknowledged as a whole */
+		uint8_t batch_qos = msg->qos;
+
+		db__msg_store_free(msg);
+		if(batch_qos == 2){
+			return MOSQ_ERR_PROTOCOL;
+		}
+
+		rc = bridge__batch_receive(context, &context->in_packet.payload[context->in_packet.pos], context->in_packet.remaining_length - context->in_packet.pos);
+		if(rc == MOSQ_ERR_MALFORMED_PACKET){
+			reason_code = MQTT_RC_PAYLOAD_FORMAT_INVALID;
+		}else if(rc){
+			return rc;
+		}
+		if(batch_qos == 1){
+			util__decrement_receive_quota(context);
+			return send__puback(context, mid, reason_code, NULL);
+		}
+		return MOSQ_ERR_SUCCESS;
+	}
+	if(bridge__loop_check(context, msg)){
+		log__printf(NULL, MOSQ_LOG_DEBUG, "Dropped looping PUBLISH from %s (d%d, q%d, r%d, m%d, '%s', ... (%ld bytes))", context->id, dup, msg->qos, msg->retain, msg->source_mid, msg->topic, (long)msg->payloadlen);
+		reason_code = MQTT_RC_NO_MATCHING_SUBSCRIBERS;
+		goto process_bad_message;
+	}
+#endif
 	if(context->listener && context->listener->mount_point){
 		len = strlen(context->listener->mount_point) + strlen(msg->topic) + 1;
 		topic_mount = mosquitto__malloc(len+1);
@@ -229,18 +257,13 @@ int handle__publish(struct mosquitto *context)
 			reason_code = MQTT_RC_PACKET_TOO_LARGE;
 			goto process_bad_message;
 		}
-		msg->payload = mosquitto__malloc(msg->payloadlen+1);
-		if(msg->payload == NULL){
-			db__msg_store_free(msg);
-			return MOSQ_ERR_NOMEM;
-		}
-		/* Ensure payload is always zero terminated, this is the reason for the extra byte above */
-		((uint8_t *)msg->payload)[msg->payloadlen] = 0;
-
-		if(packet__read_bytes(&context->in_packet, msg->payload, msg->payloadlen)){
-			db__msg_store_free(msg);
-			return MOSQ_ERR_MALFORMED_PACKET;
-		}
+		/* The payload runs to the end of the packet, and the packet buffer
+		 * has a zero byte after its end, so the store takes over the packet
+		 * buffer rather than copying the payload out of it. */
+		msg->payload = &context->in_packet.payload[context->in_packet.pos];
+		msg->payload_offset = context->in_packet.pos;
+		context->in_packet.payload = NULL;
+		context->in_packet.pos = context->in_packet.remaining_length;
 	}
 
 	/* Check for topic access */
@@ -307,6 +330,12 @@ int handle__publish(struct mosquitto *context)
 				|| db__ready_for_queue(context, msg->qos, &context->msgs_in)){
 
 			dup = 0;
+			/* Split the topic once, it is reused by the subscription match
+			 * and the retain store. */
+			if(sub__topic_levels(msg) == MOSQ_ERR_NOMEM){
+				db__msg_store_free(msg);
+				return MOSQ_ERR_NOMEM;
+			}
 			rc = db__message_store(context, msg, message_expiry_interval, 0, mosq_mo_client);
 			if(rc) return rc;
 		}else{
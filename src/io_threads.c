@@ -0,0 +1,1048 @@
+/*
+Copyright (c) 2022 Roger Light <roger@atchoo.org>
+
+All rights reserved. This program and the accompanying materials
+are made available under the terms of the Eclipse Public License 2.0
+and Eclipse Distribution License v1.0 which accompany this distribution.
+
+The Eclipse Public License is available at
+   https://www.eclipse.org/legal/epl-2.0/
+and the Eclipse Distribution License is available at
+  http://www.eclipse.org/org/documents/edl-v10.php.
+
+SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+
+Contributors:
+   Roger Light - initial implementation and documentation.
+*/
+
+/* Client I/O threads.
+ *
+ * When io_threads is set, reading from and writing to the sockets of plain
+ * TCP clients is shared between that many threads, each with its own epoll
+ * instance. Clients are given to the threads in turn as they connect. The
+ * packets are still handled on the main thread, so nothing else in the broker
+ * is shared with the threads.
+ *
+ * The main thread asks for a client's socket to be read, or for the packets
+ * at the front of its queue to be written, by putting the client in its
+ * thread's inbox. The thread does the read or write, waiting for the socket
+ * to become ready first if need be, then puts the client on its results list.
+ * io_threads__process() deals with the results from the main loop. The thread
+ * wakes the main loop through mux__wakeup() for anything that the main thread
+ * is waiting for; a write that leaves nothing more to send is only collected
+ * the next time round the loop. Each client has at most one read and
+ * one write in progress. The next read is only asked for once everything that
+ * has been read has been handled, so the read budget works as it does without
+ * the threads, and the next write once the last one has finished.
+ *
+ * Before a client is taken over by a new connection, io_threads__finish()
+ * handles whatever the old connection has already sent, as would have
+ * happened on the main thread.
+ *
+ * The threads only ever use a client's socket with io_mutex held, and skip
+ * clients that have been closed. A closed client is handed back to the main
+ * thread to be freed once its thread can no longer have any reference to it,
+ * so memory is only ever freed on the main thread.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+#ifdef WITH_EPOLL
+#  include <sys/epoll.h>
+#endif
+#ifndef WIN32
+#  include <unistd.h>
+#endif
+
+#include "mosquitto_broker_internal.h"
+#include "memory_mosq.h"
+#include "net_mosq.h"
+#include "packet_mosq.h"
+#include "utlist.h"
+
+#if defined(WITH_THREADING) && defined(WITH_EPOLL)
+
+/* The rest of the broker is single threaded and uses the no-op versions of
+ * these from dummypthread.h. */
+#undef pthread_create
+#undef pthread_join
+#undef pthread_cancel
+#undef pthread_testcancel
+#undef pthread_mutex_init
+#undef pthread_mutex_destroy
+#undef pthread_mutex_lock
+#undef pthread_mutex_unlock
+#include <pthread.h>
+
+#define IO_THREAD_READ_BUF_SIZE 16384
+#define IO_THREAD_MAX_EVENTS 100
+
+struct io_thread;
+
+struct mosquitto__io_client{
+	struct mosquitto__io_client *inbox_next, *inbox_prev;
+	struct mosquitto__io_client *result_next, *result_prev;
+	struct mosquitto__io_client *dead_next;
+	struct io_thread *thread;
+	struct mosquitto *context;
+	mosq_sock_t sock;
+	/* Only used by the main thread */
+	bool paused; /* Reading has been stopped by io_threads__remove_in() */
+	bool read_busy; /* A read has been asked for and its result not handled */
+	bool write_busy; /* A write has been asked for and its result not handled */
+	/* Protected by list_mutex */
+	bool in_inbox;
+	bool in_results;
+	bool want_read;
+	bool want_write;
+	bool write_more; /* More has been queued since the write was asked for */
+	bool read_done;
+	bool write_done;
+	ssize_t read_length;
+	int read_errno;
+	int write_errno;
+	/* Protected by io_mutex */
+	bool closed;
+	bool registered;
+	bool reading;
+	bool writing;
+	bool read_blocked;
+	bool write_blocked;
+	size_t written;
+	int iov_index;
+	int iovcnt;
+	struct iovec iov[PACKET_WRITE_BATCH*2];
+	uint8_t read_buf[IO_THREAD_READ_BUF_SIZE];
+};
+
+struct io_thread{
+	pthread_t thread;
+	int epollfd;
+	int wakeup_pipe[2];
+	pthread_mutex_t io_mutex; /* Held while a client's socket is being used */
+	pthread_mutex_t list_mutex; /* Taken after io_mutex, if both are needed */
+	struct mosquitto__io_client *inbox;
+	struct mosquitto__io_client *results;
+	struct mosquitto__io_client *dead; /* Closed, may still be referenced */
+	struct mosquitto__io_client *released; /* Closed, ready to be freed */
+	bool woken; /* The main loop has been woken to collect the results */
+	bool stop;
+};
+
+static struct io_thread *threads = NULL;
+static int thread_count = 0;
+static int next_thread = 0;
+/* Closed clients, passed to their threads by io_threads__process() */
+static struct mosquitto__io_client *detached = NULL;
+
+
+/* Must be called with list_mutex held. Results that the main thread isn't
+ * waiting for are collected the next time round the main loop, without waking
+ * it. */
+static void io_thread__result_add(struct io_thread *thread, struct mosquitto__io_client *client, bool urgent, bool *wake)
+{
+	if(client->in_results == false){
+		client->in_results = true;
+		DL_APPEND2(thread->results, client, result_prev, result_next);
+	}
+	if(urgent && thread->woken == false){
+		thread->woken = true;
+		*wake = true;
+	}
+}
+
+
+static void io_thread__read(struct io_thread *thread, struct mosquitto__io_client *client, bool *wake)
+{
+	ssize_t len;
+	int err;
+
+	do{
+		len = read(client->sock, client->read_buf, sizeof(client->read_buf));
+	}while(len < 0 && errno == EINTR);
+	err = errno;
+
+	if(len < 0 && (err == EAGAIN || err == COMPAT_EWOULDBLOCK)){
+		client->read_blocked = true;
+		return;
+	}
+	client->reading = false;
+	client->read_blocked = false;
+
+	pthread_mutex_lock(&thread->list_mutex);
+	client->read_done = true;
+	client->read_length = len;
+	client->read_errno = err;
+	io_thread__result_add(thread, client, true, wake);
+	pthread_mutex_unlock(&thread->list_mutex);
+}
+
+
+static void io_thread__write(struct io_thread *thread, struct mosquitto__io_client *client, bool *wake)
+{
+	ssize_t len;
+	int err = 0;
+
+	while(client->iov_index < client->iovcnt){
+		len = writev(client->sock, &client->iov[client->iov_index], client->iovcnt - client->iov_index);
+		if(len < 0){
+			if(errno == EINTR){
+				continue;
+			}else if(errno == EAGAIN || errno == COMPAT_EWOULDBLOCK){
+				client->write_blocked = true;
+				return;
+			}
+			err = errno;
+			break;
+		}
+		client->written += (size_t)len;
+		while(client->iov_index < client->iovcnt && (size_t)len >= client->iov[client->iov_index].iov_len){
+			len -= (ssize_t)client->iov[client->iov_index].iov_len;
+			client->iov_index++;
+		}
+		if(len > 0){
+			client->iov[client->iov_index].iov_base = (uint8_t *)client->iov[client->iov_index].iov_base + len;
+			client->iov[client->iov_index].iov_len -= (size_t)len;
+		}
+	}
+	client->writing = false;
+	client->write_blocked = false;
+
+	pthread_mutex_lock(&thread->list_mutex);
+	client->write_done = true;
+	client->write_errno = err;
+	io_thread__result_add(thread, client, err || client->write_more, wake);
+	pthread_mutex_unlock(&thread->list_mutex);
+}
+
+
+/* Wait for the socket to become ready for whatever couldn't be done straight
+ * away. Sockets are registered with EPOLLONESHOT, so a socket that has been
+ * reported has to be armed again before it is reported again. */
+static void io_thread__arm(struct io_thread *thread, struct mosquitto__io_client *client, bool *wake)
+{
+	struct epoll_event ev;
+	int rc;
+	int err;
+
+	memset(&ev, 0, sizeof(struct epoll_event));
+	if(client->reading && client->read_blocked){
+		ev.events |= EPOLLIN;
+	}
+	if(client->writing && client->write_blocked){
+		ev.events |= EPOLLOUT;
+	}
+	if(ev.events == 0){
+		return;
+	}
+	ev.events |= EPOLLONESHOT;
+	ev.data.ptr = client;
+
+	if(client->registered){
+		rc = epoll_ctl(thread->epollfd, EPOLL_CTL_MOD, client->sock, &ev);
+	}else{
+		rc = epoll_ctl(thread->epollfd, EPOLL_CTL_ADD, client->sock, &ev);
+		if(rc == 0){
+			client->registered = true;
+		}
+	}
+	if(rc){
+		/* Report the failure as the result of whatever was waiting. */
+		err = errno;
+		pthread_mutex_lock(&thread->list_mutex);
+		if(client->reading){
+			client->reading = false;
+			client->read_done = true;
+			client->read_length = -1;
+			client->read_errno = err;
+		}
+		if(client->writing){
+			client->writing = false;
+			client->write_done = true;
+			client->write_errno = err;
+		}
+		io_thread__result_add(thread, client, true, wake);
+		pthread_mutex_unlock(&thread->list_mutex);
+	}
+}
+
+
+static void io_thread__handle(struct io_thread *thread, struct mosquitto__io_client *client, uint32_t events, bool *wake)
+{
+	if(client->reading && (events & (EPOLLIN | EPOLLERR | EPOLLHUP))){
+		io_thread__read(thread, client, wake);
+	}
+	if(client->writing && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))){
+		io_thread__write(thread, client, wake);
+	}
+	io_thread__arm(thread, client, wake);
+}
+
+
+/* Carry out the requests in the inbox. Returns true if the thread should
+ * stop. */
+static bool io_thread__inbox_run(struct io_thread *thread, bool *wake)
+{
+	struct mosquitto__io_client *client;
+	bool want_read, want_write;
+	bool stop;
+
+	while(1){
+		pthread_mutex_lock(&thread->io_mutex);
+		pthread_mutex_lock(&thread->list_mutex);
+		stop = thread->stop;
+		client = thread->inbox;
+		if(client){
+			DL_DELETE2(thread->inbox, client, inbox_prev, inbox_next);
+			client->in_inbox = false;
+			want_read = client->want_read;
+			want_write = client->want_write;
+			client->want_read = false;
+			client->want_write = false;
+		}
+		pthread_mutex_unlock(&thread->list_mutex);
+
+		if(client == NULL || stop){
+			pthread_mutex_unlock(&thread->io_mutex);
+			return stop;
+		}
+		if(client->closed == false){
+			if(want_read){
+				client->reading = true;
+				io_thread__read(thread, client, wake);
+			}
+			if(want_write){
+				client->writing = true;
+				io_thread__write(thread, client, wake);
+			}
+			io_thread__arm(thread, client, wake);
+		}
+		pthread_mutex_unlock(&thread->io_mutex);
+	}
+}
+
+
+/* The memory functions aren't thread safe, so closed clients are freed by
+ * the main thread in io_threads__process(). */
+static void io_thread__dead_release(struct io_thread *thread)
+{
+	struct mosquitto__io_client *client;
+
+	pthread_mutex_lock(&thread->list_mutex);
+	while(thread->dead){
+		client = thread->dead;
+		thread->dead = client->dead_next;
+		client->dead_next = thread->released;
+		thread->released = client;
+	}
+	pthread_mutex_unlock(&thread->list_mutex);
+}
+
+
+static void *io_thread__run(void *userdata)
+{
+	struct io_thread *thread = userdata;
+	struct epoll_event events[IO_THREAD_MAX_EVENTS];
+	struct mosquitto__io_client *client;
+	char buf[64];
+	int event_count;
+	int i;
+	bool wake;
+
+	while(1){
+		event_count = epoll_wait(thread->epollfd, events, IO_THREAD_MAX_EVENTS, -1);
+		wake = false;
+
+		for(i=0; i<event_count; i++){
+			client = events[i].data.ptr;
+			if(client == NULL){
+				while(read(thread->wakeup_pipe[0], buf, sizeof(buf)) > 0){
+				}
+			}else{
+				pthread_mutex_lock(&thread->io_mutex);
+				if(client->closed == false){
+					io_thread__handle(thread, client, events[i].events, &wake);
+				}
+				pthread_mutex_unlock(&thread->io_mutex);
+			}
+		}
+		if(io_thread__inbox_run(thread, &wake)){
+			break;
+		}
+		/* The events above may refer to closed clients, so they can only be
+		 * released now. */
+		io_thread__dead_release(thread);
+
+		if(wake){
+			mux__wakeup();
+		}
+	}
+
+	return NULL;
+}
+
+
+static void io_thread__wakeup(struct io_thread *thread)
+{
+	char c = 0;
+
+	if(write(thread->wakeup_pipe[1], &c, 1)){
+		/* Nothing to do */
+	}
+}
+
+
+static void io_thread__close(struct io_thread *thread)
+{
+	int i;
+
+	if(thread->epollfd != -1){
+		close(thread->epollfd);
+		thread->epollfd = -1;
+	}
+	for(i=0; i<2; i++){
+		if(thread->wakeup_pipe[i] != -1){
+			close(thread->wakeup_pipe[i]);
+			thread->wakeup_pipe[i] = -1;
+		}
+	}
+}
+
+
+static int io_thread__start(struct io_thread *thread)
+{
+	struct epoll_event ev;
+
+	thread->wakeup_pipe[0] = -1;
+	thread->wakeup_pipe[1] = -1;
+	thread->epollfd = epoll_create(IO_THREAD_MAX_EVENTS);
+	if(thread->epollfd == -1 || pipe(thread->wakeup_pipe)){
+		io_thread__close(thread);
+		return MOSQ_ERR_ERRNO;
+	}
+	if(net__socket_nonblock(&thread->wakeup_pipe[0]) || net__socket_nonblock(&thread->wakeup_pipe[1])){
+		/* net__socket_nonblock() closes the socket on failure */
+		io_thread__close(thread);
+		return MOSQ_ERR_ERRNO;
+	}
+
+	memset(&ev, 0, sizeof(struct epoll_event));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if(epoll_ctl(thread->epollfd, EPOLL_CTL_ADD, thread->wakeup_pipe[0], &ev) == -1){
+		io_thread__close(thread);
+		return MOSQ_ERR_ERRNO;
+	}
+
+	pthread_mutex_init(&thread->io_mutex, NULL);
+	pthread_mutex_init(&thread->list_mutex, NULL);
+	if(pthread_create(&thread->thread, NULL, io_thread__run, thread)){
+		pthread_mutex_destroy(&thread->list_mutex);
+		pthread_mutex_destroy(&thread->io_mutex);
+		io_thread__close(thread);
+		return MOSQ_ERR_ERRNO;
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int io_threads__init(void)
+{
+	int i;
+
+	if(db.config->io_threads == 0){
+		return MOSQ_ERR_SUCCESS;
+	}
+	if(mux__wakeup_sock() == INVALID_SOCKET || mux__using_uring()){
+		/* The main loop would never find out that a thread had finished
+		 * reading or writing. With io_uring there is nothing to gain. */
+		log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Unable to start I/O threads, clients will be read and written on the main thread.");
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	threads = mosquitto__calloc((size_t)db.config->io_threads, sizeof(struct io_thread));
+	if(threads == NULL){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Out of memory.");
+		return MOSQ_ERR_NOMEM;
+	}
+
+	for(i=0; i<db.config->io_threads; i++){
+		if(io_thread__start(&threads[i])){
+			log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Unable to start I/O thread: %s.", strerror(errno));
+			break;
+		}
+		thread_count++;
+	}
+	if(thread_count > 0){
+		log__printf(NULL, MOSQ_LOG_INFO, "Started %d I/O thread%s.", thread_count, thread_count==1?"":"s");
+	}
+	next_thread = 0;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static void io_threads__free_list(struct mosquitto__io_client *list)
+{
+	struct mosquitto__io_client *client;
+
+	while(list){
+		client = list;
+		list = list->dead_next;
+		mosquitto__free(client);
+	}
+}
+
+
+void io_threads__cleanup(void)
+{
+	struct mosquitto *context, *ctxt_tmp;
+	int i;
+
+	if(threads == NULL){
+		return;
+	}
+
+	for(i=0; i<thread_count; i++){
+		pthread_mutex_lock(&threads[i].list_mutex);
+		threads[i].stop = true;
+		pthread_mutex_unlock(&threads[i].list_mutex);
+		io_thread__wakeup(&threads[i]);
+	}
+	for(i=0; i<thread_count; i++){
+		pthread_join(threads[i].thread, NULL);
+	}
+
+	/* Clients that are still connected are read and written on the main
+	 * thread from now on. */
+	HASH_ITER(hh_sock, db.contexts_by_sock, context, ctxt_tmp){
+		io_threads__remove(context);
+	}
+	io_threads__free_list(detached);
+	detached = NULL;
+
+	for(i=0; i<thread_count; i++){
+		io_threads__free_list(threads[i].dead);
+		io_threads__free_list(threads[i].released);
+		pthread_mutex_destroy(&threads[i].list_mutex);
+		pthread_mutex_destroy(&threads[i].io_mutex);
+		io_thread__close(&threads[i]);
+	}
+	mosquitto__free(threads);
+	threads = NULL;
+	thread_count = 0;
+}
+
+
+/* Give a newly accepted client to one of the threads. TLS clients are left on
+ * the main thread. */
+void io_threads__add(struct mosquitto *context)
+{
+	struct mosquitto__io_client *client;
+
+	if(thread_count == 0){
+		return;
+	}
+#ifdef WITH_TLS
+	if(context->ssl){
+		return;
+	}
+#endif
+
+	client = mosquitto__calloc(1, sizeof(struct mosquitto__io_client));
+	if(client == NULL){
+		/* The client is read and written on the main thread instead. */
+		return;
+	}
+	client->context = context;
+	client->sock = context->sock;
+	client->thread = &threads[next_thread];
+	client->paused = true;
+	next_thread = (next_thread + 1) % thread_count;
+
+	context->io_client = client;
+}
+
+
+/* Take a client back from its thread, before its socket is closed. Anything
+ * still to be written is then written on the main thread. A read that has
+ * finished but not been handled is dropped, see io_threads__finish(). */
+int io_threads__remove(struct mosquitto *context)
+{
+	struct mosquitto__io_client *client = context->io_client;
+	struct io_thread *thread;
+	struct epoll_event ev;
+
+	if(client == NULL){
+		return MOSQ_ERR_SUCCESS;
+	}
+	thread = client->thread;
+
+	pthread_mutex_lock(&thread->io_mutex);
+	client->closed = true;
+	if(client->registered){
+		memset(&ev, 0, sizeof(struct epoll_event));
+		epoll_ctl(thread->epollfd, EPOLL_CTL_DEL, client->sock, &ev);
+	}
+	pthread_mutex_lock(&thread->list_mutex);
+	if(client->in_inbox){
+		DL_DELETE2(thread->inbox, client, inbox_prev, inbox_next);
+		client->in_inbox = false;
+	}
+	if(client->in_results){
+		DL_DELETE2(thread->results, client, result_prev, result_next);
+		client->in_results = false;
+	}
+	pthread_mutex_unlock(&thread->list_mutex);
+	pthread_mutex_unlock(&thread->io_mutex);
+
+	context->io_client = NULL;
+	if(client->write_busy){
+		/* Part of the packets may have been written already. */
+		packet__write_done(context, client->written);
+	}
+	if(context->current_out_packet || context->out_packet){
+		/* Send what is left, such as a CONNACK or DISCONNECT giving the
+		 * reason for closing the connection, as net__socket_close() does
+		 * for other clients. */
+		packet__write(context);
+	}
+
+	/* The main thread may still be handling data in the client's read_buf,
+	 * and the thread may still have an event for the client, so it is passed
+	 * to the thread at the next io_threads__process() and freed once the
+	 * thread has released it. */
+	client->dead_next = detached;
+	detached = client;
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static void io_threads__submit(struct mosquitto__io_client *client, bool want_read, bool want_write)
+{
+	struct io_thread *thread = client->thread;
+	bool wake = false;
+
+	pthread_mutex_lock(&thread->list_mutex);
+	if(want_read){
+		client->want_read = true;
+	}
+	if(want_write){
+		client->want_write = true;
+		client->write_more = false;
+	}
+	if(client->in_inbox == false){
+		if(thread->inbox == NULL){
+			wake = true;
+		}
+		client->in_inbox = true;
+		DL_APPEND2(thread->inbox, client, inbox_prev, inbox_next);
+	}
+	pthread_mutex_unlock(&thread->list_mutex);
+
+	if(wake){
+		io_thread__wakeup(thread);
+	}
+}
+
+
+/* Ask for the client's socket to be read, unless reading is paused or a read
+ * is already in progress. */
+int io_threads__read(struct mosquitto *context)
+{
+	struct mosquitto__io_client *client = context->io_client;
+
+	if(client == NULL || client->paused || client->read_busy){
+		return MOSQ_ERR_SUCCESS;
+	}
+	client->read_busy = true;
+	io_threads__submit(client, true, false);
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Ask for as much of current_out_packet and the packets queued behind it as
+ * fits in a single write to be written. If a write is already in progress,
+ * the rest is written once it has finished. */
+int io_threads__write(struct mosquitto *context)
+{
+	struct mosquitto__io_client *client = context->io_client;
+	struct io_thread *thread = client->thread;
+
+	if(client->write_busy){
+		/* The thread must wake the main loop when it has finished, so this
+		 * isn't left waiting. */
+		pthread_mutex_lock(&thread->list_mutex);
+		client->write_more = true;
+		pthread_mutex_unlock(&thread->list_mutex);
+		return MOSQ_ERR_SUCCESS;
+	}
+	if(context->current_out_packet == NULL){
+		return MOSQ_ERR_SUCCESS;
+	}
+	client->iovcnt = packet__write_gather(context, client->iov);
+	client->iov_index = 0;
+	client->written = 0;
+	client->write_busy = true;
+	io_threads__submit(client, false, true);
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int io_threads__add_in(struct mosquitto *context)
+{
+	context->io_client->paused = false;
+	return io_threads__read(context);
+}
+
+
+/* A read that is already in progress still completes, and what it reads is
+ * kept until reading is started again. */
+int io_threads__remove_in(struct mosquitto *context)
+{
+	context->io_client->paused = true;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Waiting for the socket to become writable is up to the thread. */
+int io_threads__add_out(struct mosquitto *context)
+{
+	UNUSED(context);
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int io_threads__remove_out(struct mosquitto *context)
+{
+	UNUSED(context);
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Add data read by the thread to whatever is already waiting to be handled. */
+static int io_threads__keep(struct mosquitto *context, const uint8_t *buf, size_t len)
+{
+	uint8_t *unread;
+
+	unread = mosquitto__realloc(context->in_unread, context->in_unread_len + len);
+	if(unread == NULL){
+		return MOSQ_ERR_NOMEM;
+	}
+	memcpy(&unread[context->in_unread_len], buf, len);
+	context->in_unread = unread;
+	context->in_unread_len += len;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static int io_threads__write_complete(struct mosquitto__io_client *client, int err)
+{
+	struct mosquitto *context = client->context;
+
+	if(err){
+		errno = err;
+		return err == COMPAT_ECONNRESET ? MOSQ_ERR_CONN_LOST : MOSQ_ERR_ERRNO;
+	}
+	client->write_busy = false;
+	packet__write_done(context, client->written);
+
+	/* Start on whatever has been queued in the meantime */
+	return packet__write(context);
+}
+
+
+static int io_threads__read_complete(struct mosquitto__io_client *client, ssize_t read_length, int err)
+{
+	struct mosquitto *context = client->context;
+	int rc;
+
+	client->read_busy = false;
+	if(read_length > 0 && (client->paused || context->in_unread)){
+		rc = io_threads__keep(context, client->read_buf, (size_t)read_length);
+		if(rc == MOSQ_ERR_SUCCESS && client->paused == false){
+			mux__ready_add(context);
+		}
+		return rc;
+	}
+
+	context->read_packets = 0;
+	context->read_bytes = 0;
+	errno = err;
+	rc = packet__read_data(context, client->read_buf, read_length);
+	if(rc){
+		return rc;
+	}
+	if(context->io_client == client && context->in_unread == NULL){
+		io_threads__read(context);
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Handle anything that the client's thread has read, or can read now, before
+ * the client is taken over by a new connection. Without the threads, the old
+ * connection would have been read first, because its data arrived before the
+ * new connection's CONNECT. The client may be disconnected as a result. */
+void io_threads__finish(struct mosquitto *context)
+{
+	struct mosquitto__io_client *client;
+	struct io_thread *thread;
+	ssize_t read_length = 0;
+	int read_errno;
+	bool read_done;
+	int rc;
+
+	while(context->io_client && context->io_client->read_busy){
+		client = context->io_client;
+		thread = client->thread;
+		read_done = false;
+		read_errno = 0;
+
+		/* With io_mutex held the thread isn't using the socket or read_buf. */
+		pthread_mutex_lock(&thread->io_mutex);
+		pthread_mutex_lock(&thread->list_mutex);
+		if(client->read_done){
+			read_done = true;
+			read_length = client->read_length;
+			read_errno = client->read_errno;
+			client->read_done = false;
+			if(client->in_results && client->write_done == false){
+				DL_DELETE2(thread->results, client, result_prev, result_next);
+				client->in_results = false;
+			}
+		}else{
+			do{
+				read_length = read(client->sock, client->read_buf, sizeof(client->read_buf));
+			}while(read_length < 0 && errno == EINTR);
+			read_errno = errno;
+
+			if(read_length >= 0 || (read_errno != EAGAIN && read_errno != COMPAT_EWOULDBLOCK)){
+				/* The read asked for has been done here instead. */
+				read_done = true;
+				client->want_read = false;
+				client->reading = false;
+				client->read_blocked = false;
+				if(client->in_inbox && client->want_write == false){
+					DL_DELETE2(thread->inbox, client, inbox_prev, inbox_next);
+					client->in_inbox = false;
+				}
+			}
+		}
+		pthread_mutex_unlock(&thread->list_mutex);
+		pthread_mutex_unlock(&thread->io_mutex);
+
+		if(read_done == false){
+			/* Nothing more has been sent */
+			return;
+		}
+		rc = io_threads__read_complete(client, read_length, read_errno);
+		if(rc && context->io_client == client){
+			do_disconnect(context, rc);
+		}
+		if(read_length <= 0){
+			return;
+		}
+	}
+}
+
+
+/* Handle what the listener's clients have already sent, so that clients that
+ * have closed their connection no longer count towards max_connections. */
+void io_threads__finish_listener(struct mosquitto__listener *listener)
+{
+	struct mosquitto *context, *ctxt_tmp;
+	unsigned int sock_count;
+	bool changed;
+
+	if(thread_count == 0){
+		return;
+	}
+	do{
+		changed = false;
+		sock_count = HASH_CNT(hh_sock, db.contexts_by_sock);
+		HASH_ITER(hh_sock, db.contexts_by_sock, context, ctxt_tmp){
+			if(context->listener == listener && context->io_client){
+				io_threads__finish(context);
+				if(HASH_CNT(hh_sock, db.contexts_by_sock) != sock_count){
+					/* Start again, ctxt_tmp may have been removed */
+					changed = true;
+					break;
+				}
+			}
+		}
+	}while(changed);
+}
+
+
+/* Handle the results of the reads and writes that the threads have finished. */
+void io_threads__process(void)
+{
+	struct mosquitto__io_client *client;
+	struct mosquitto__io_client *released;
+	struct io_thread *thread;
+	bool read_done, write_done;
+	ssize_t read_length;
+	int read_errno, write_errno;
+	int count;
+	int i;
+	int rc;
+
+	if(thread_count == 0){
+		return;
+	}
+
+	while(detached){
+		client = detached;
+		detached = client->dead_next;
+		thread = client->thread;
+		pthread_mutex_lock(&thread->list_mutex);
+		client->dead_next = thread->dead;
+		thread->dead = client;
+		pthread_mutex_unlock(&thread->list_mutex);
+	}
+
+	for(i=0; i<thread_count; i++){
+		thread = &threads[i];
+
+		pthread_mutex_lock(&thread->list_mutex);
+		released = thread->released;
+		thread->released = NULL;
+		pthread_mutex_unlock(&thread->list_mutex);
+		io_threads__free_list(released);
+
+		/* Clients that finish again while these are being handled wait for
+		 * the next call. */
+		pthread_mutex_lock(&thread->list_mutex);
+		thread->woken = false;
+		DL_COUNT2(thread->results, client, count, result_next);
+		pthread_mutex_unlock(&thread->list_mutex);
+
+		while(count > 0){
+			count--;
+
+			pthread_mutex_lock(&thread->list_mutex);
+			client = thread->results;
+			if(client){
+				DL_DELETE2(thread->results, client, result_prev, result_next);
+				client->in_results = false;
+				read_done = client->read_done;
+				read_length = client->read_length;
+				read_errno = client->read_errno;
+				write_done = client->write_done;
+				write_errno = client->write_errno;
+				client->read_done = false;
+				client->write_done = false;
+			}
+			pthread_mutex_unlock(&thread->list_mutex);
+			if(client == NULL){
+				break;
+			}
+
+			/* Reads are handled first, so a write error doesn't lose what
+			 * the client sent before going away. */
+			rc = MOSQ_ERR_SUCCESS;
+			if(read_done){
+				rc = io_threads__read_complete(client, read_length, read_errno);
+			}
+			if(rc == MOSQ_ERR_SUCCESS && write_done && client->context->io_client == client){
+				rc = io_threads__write_complete(client, write_errno);
+			}
+			if(rc && client->context->io_client == client){
+				do_disconnect(client->context, rc);
+			}
+		}
+	}
+}
+
+#else
+
+int io_threads__init(void)
+{
+	if(db.config->io_threads > 0){
+		log__printf(NULL, MOSQ_LOG_WARNING, "Warning: I/O threads are not available, clients will be read and written on the main thread.");
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+void io_threads__cleanup(void)
+{
+}
+
+
+void io_threads__add(struct mosquitto *context)
+{
+	UNUSED(context);
+}
+
+
+int io_threads__remove(struct mosquitto *context)
+{
+	UNUSED(context);
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int io_threads__read(struct mosquitto *context)
+{
+	UNUSED(context);
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int io_threads__write(struct mosquitto *context)
+{
+	UNUSED(context);
+	return MOSQ_ERR_NOT_SUPPORTED;
+}
+
+
+int io_threads__add_in(struct mosquitto *context)
+{
+	UNUSED(context);
+	return MOSQ_ERR_NOT_SUPPORTED;
+}
+
+
+int io_threads__remove_in(struct mosquitto *context)
+{
+	UNUSED(context);
+	return MOSQ_ERR_NOT_SUPPORTED;
+}
+
+
+int io_threads__add_out(struct mosquitto *context)
+{
+	UNUSED(context);
+	return MOSQ_ERR_NOT_SUPPORTED;
+}
+
+
+int io_threads__remove_out(struct mosquitto *context)
+{
+	UNUSED(context);
+	return MOSQ_ERR_NOT_SUPPORTED;
+}
+
+
+void io_threads__finish(struct mosquitto *context)
+{
+	UNUSED(context);
+}
+
+
+void io_threads__finish_listener(struct mosquitto__listener *listener)
+{
+	UNUSED(listener);
+}
+
+
+void io_threads__process(void)
+{
+}
+
+#endif
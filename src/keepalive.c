@@ -21,13 +21,36 @@ Contributors:
 #include "mosquitto_broker_internal.h"
 
 
-static time_t last_keepalive_check = 0;
+/* Keepalive deadlines are held in a timer wheel so only clients that are
+ * actually due are looked at. Receiving a packet only updates last_msg_in,
+ * the deadline is moved forward lazily when the timer fires. */
+static struct mosquitto__timer_wheel keepalive_wheel;
+static bool keepalive_wheel_init = false;
 
-/* FIXME - this is the prototype for the future tree/trie based keepalive check implementation. */
 
+static time_t keepalive__expiry(struct mosquitto *context)
+{
+	return context->last_msg_in + (time_t)(context->keepalive)*3/2;
+}
+
+
+/* Called when a connection is accepted, with the default keepalive, so
+ * sockets that never send a CONNECT are closed, and again once the CONNECT
+ * has been accepted with the keepalive the client asked for. */
 int keepalive__add(struct mosquitto *context)
 {
-	UNUSED(context);
+	/* Local bridges never time out in this fashion. */
+	if(context->keepalive == 0 || context->bridge){
+		keepalive__remove(context);
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	if(keepalive_wheel_init == false){
+		timer_wheel__init(&keepalive_wheel, db.now_s);
+		keepalive_wheel_init = true;
+	}
+	context->keepalive_timer.data = context;
+	timer_wheel__add(&keepalive_wheel, &context->keepalive_timer, keepalive__expiry(context));
 
 	return MOSQ_ERR_SUCCESS;
 }
@@ -35,24 +58,23 @@ int keepalive__add(struct mosquitto *context)
 
 void keepalive__check(void)
 {
-	struct mosquitto *context, *ctxt_tmp;
-
-	if(last_keepalive_check + 5 < db.now_s){
-		last_keepalive_check = db.now_s;
-
-		/* FIXME - this needs replacing with something more efficient */
-		HASH_ITER(hh_sock, db.contexts_by_sock, context, ctxt_tmp){
-			if(context->sock != INVALID_SOCKET){
-				/* Local bridges never time out in this fashion. */
-				if(!(context->keepalive)
-						|| context->bridge
-						|| db.now_s - context->last_msg_in <= (time_t)(context->keepalive)*3/2){
-
-				}else{
-					/* Client has exceeded keepalive*1.5 */
-					do_disconnect(context, MOSQ_ERR_KEEPALIVE);
-				}
-			}
+	struct mosquitto__timer *timer;
+	struct mosquitto *context;
+	time_t expiry;
+
+	timer_wheel__advance(&keepalive_wheel, db.now_s);
+
+	while((timer = timer_wheel__pop_expired(&keepalive_wheel))){
+		context = (struct mosquitto *)timer->data;
+		if(context->sock == INVALID_SOCKET){
+			continue;
+		}
+		expiry = keepalive__expiry(context);
+		if(db.now_s > expiry){
+			/* Client has exceeded keepalive*1.5 */
+			do_disconnect(context, MOSQ_ERR_KEEPALIVE);
+		}else{
+			timer_wheel__add(&keepalive_wheel, timer, expiry);
 		}
 	}
 }
@@ -60,7 +82,7 @@ void keepalive__check(void)
 
 int keepalive__remove(struct mosquitto *context)
 {
-	UNUSED(context);
+	timer_wheel__remove(&keepalive_wheel, &context->keepalive_timer);
 
 	return MOSQ_ERR_SUCCESS;
 }
@@ -68,6 +90,9 @@ int keepalive__remove(struct mosquitto *context)
 
 void keepalive__remove_all(void)
 {
+	timer_wheel__expire_all(&keepalive_wheel);
+	while(timer_wheel__pop_expired(&keepalive_wheel)){
+	}
 }
 
 
@@ -75,7 +75,7 @@ static int single_publish(struct mosquitto *context, struct mosquitto_message_v5
 	struct mosquitto_msg_store *stored;
 	uint16_t mid;
 
-	stored = mosquitto__calloc(1, sizeof(struct mosquitto_msg_store));
+	stored = mosquitto__slab_calloc(sizeof(struct mosquitto_msg_store));
 	if(stored == NULL) return MOSQ_ERR_NOMEM;
 
 	stored->topic = msg->topic;
@@ -202,12 +202,27 @@ int mosquitto_main_loop(struct mosquitto__listener_sock *listensock, int listens
 		bridge_check();
 #endif
 
+		mux__handle_ready();
+#ifdef WITH_BRIDGE
+		bridge__batch_flush_all();
+#endif
+		packet__write_deferred();
+
 		rc = mux__handle(listensock, listensock_count);
 		if(rc) return rc;
 
+		pwhash_pool__process();
+		io_threads__process();
+
+		retain__cursors_run();
+		spill__run();
+
 		session_expiry__check();
 		will_delay__check();
+		retain__expiry_check();
 #ifdef WITH_PERSISTENCE
+		persist__journal_sync();
+		persist__background_check();
 		if(db.config->persistence && db.config->autosave_interval){
 			if(db.config->autosave_on_changes){
 				if(db.persistence_changes >= db.config->autosave_interval){
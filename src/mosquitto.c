@@ -544,12 +544,27 @@ int main(int argc, char *argv[])
 
 	if(listeners__start()) return 1;
 
+	/* Without the wakeup pipe, password hashing and I/O threads aren't
+	 * started. */
+	mux__wakeup_init();
+
 	rc = mux__init(listensock, listensock_count);
 	if(rc) return rc;
 
+	rc = pwhash_pool__init();
+	if(rc) return rc;
+
+	rc = io_threads__init();
+	if(rc) return rc;
+
+	rc = spill__init();
+	if(rc) return rc;
+
 	signal__setup();
 
 #ifdef WITH_BRIDGE
+	rc = bridge__loop_init();
+	if(rc) return rc;
 	bridge__start_all();
 #endif
 
@@ -563,6 +578,10 @@ int main(int argc, char *argv[])
 
 	log__printf(NULL, MOSQ_LOG_INFO, "mosquitto version %s terminating", VERSION);
 
+	pwhash_pool__cleanup();
+	io_threads__cleanup();
+	mux__wakeup_cleanup();
+
 	/* FIXME - this isn't quite right, all wills with will delay zero should be
 	 * sent now, but those with positive will delay should be persisted and
 	 * restored, pending the client reconnecting in time. */
@@ -600,6 +619,9 @@ int main(int argc, char *argv[])
 	context__free_disused();
 
 	db__close();
+#ifdef WITH_BRIDGE
+	bridge__loop_cleanup();
+#endif
 
 	mosquitto_security_module_cleanup();
 
@@ -610,6 +632,7 @@ int main(int argc, char *argv[])
 	log__close(&config);
 	config__cleanup(db.config);
 	net__broker_cleanup();
+	memory__slab_cleanup();
 
 	return rc;
 }
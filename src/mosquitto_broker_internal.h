@@ -31,6 +31,7 @@ Contributors:
 #endif
 
 #include "mosquitto_internal.h"
+#include "acl_tree.h"
 #include "mosquitto_broker.h"
 #include "mosquitto_plugin.h"
 #include "mosquitto.h"
@@ -58,6 +59,28 @@ Contributors:
 #define CMD_PORT_LIMIT 10
 #define TOPIC_HIERARCHY_LIMIT 200
 
+/* Outgoing PUBLISH payloads at least this large reference the message store
+ * payload directly rather than being copied into every packet. */
+#define SHARED_PAYLOAD_MIN 1024
+
+/* Timer wheel geometry. The root level has one second resolution, each
+ * following level covers the whole range of the level below it per slot. */
+#define TIMER_WHEEL_ROOT_BITS 8
+#define TIMER_WHEEL_ROOT_SIZE (1 << TIMER_WHEEL_ROOT_BITS)
+#define TIMER_WHEEL_LEVEL_BITS 6
+#define TIMER_WHEEL_LEVEL_SIZE (1 << TIMER_WHEEL_LEVEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+/* Retained messages for a new subscription are sent in turns. Each turn
+ * visits at most RETAIN_CURSOR_BUDGET retain tree nodes, and a client is
+ * sent no more than one message per turn while it has RETAIN_CURSOR_PACKETS
+ * packets waiting to be written. */
+#define RETAIN_CURSOR_BUDGET 1000
+#define RETAIN_CURSOR_PACKETS 100
+
+/* Maximum number of expired retained messages removed per loop iteration */
+#define RETAIN_EXPIRY_BATCH 1000
+
 typedef uint64_t dbid_t;
 
 typedef int (*FUNC_plugin_init_v5)(mosquitto_plugin_id_t *, void **, struct mosquitto_opt *, int);
@@ -191,6 +214,7 @@ enum struct_ident{
 	id_listener = 1,
 	id_client = 2,
 	id_listener_ws = 3,
+	id_wakeup = 4,
 };
 #endif
 
@@ -206,6 +230,8 @@ struct mosquitto__listener {
 	enum mosquitto_protocol protocol;
 	int socket_domain;
 	bool use_username_as_clientid;
+	bool allow_bridge_batches;
+	bool allow_bridge_origin;
 	uint8_t max_qos;
 	uint16_t max_topic_alias;
 #ifdef WITH_TLS
@@ -254,15 +280,19 @@ typedef struct mosquitto_plugin_id_t{
 } mosquitto_plugin_id_t;
 
 struct mosquitto__config {
+	int acl_cache_size;
 	bool allow_duplicate_messages;
 	int autosave_interval;
 	bool autosave_on_changes;
+	bool autosave_background;
+	int bridge_loop_cache_size;
 	bool check_retain_source;
 	char *clientid_prefixes;
 	bool connection_messages;
 	uint16_t cmd_port[CMD_PORT_LIMIT];
 	int cmd_port_count;
 	bool daemon;
+	bool epoll_edge_triggered;
 	struct mosquitto__listener default_listener;
 	struct mosquitto__listener *listeners;
 	int listener_count;
@@ -277,23 +307,33 @@ struct mosquitto__config {
 	size_t max_inflight_bytes;
 	size_t max_queued_bytes;
 	int max_queued_messages;
+	size_t max_read_bytes;
+	int max_read_packets;
 	uint32_t max_packet_size;
 	uint32_t message_size_limit;
 	uint16_t max_inflight_messages;
 	uint16_t max_keepalive;
 	uint8_t max_qos;
+	int password_cache_timeout;
+	int password_hash_threads;
+	int io_threads;
 	bool persistence;
 	char *persistence_location;
 	char *persistence_file;
 	char *persistence_filepath;
+	bool persistence_journal;
 	time_t persistent_client_expiration;
 	char *pid_file;
 	bool queue_qos0_messages;
+	char *queue_spill_dir;
+	size_t queue_spill_max_bytes;
+	uint32_t queue_spill_segment_size;
 	bool per_listener_settings;
 	bool retain_available;
 	bool set_tcp_nodelay;
 	int sys_interval;
 	bool upgrade_outgoing_qos;
+	bool use_io_uring;
 	char *user;
 #ifdef WITH_WEBSOCKETS
 	int websockets_log_level;
@@ -328,6 +368,8 @@ struct mosquitto__subhier {
 	UT_hash_handle hh;
 	struct mosquitto__subhier *parent;
 	struct mosquitto__subhier *children;
+	struct mosquitto__subhier *child_plus; /* The "+" entry in children, if present */
+	struct mosquitto__subhier *child_hash; /* The "#" entry in children, if present */
 	struct mosquitto__subleaf *subs;
 	struct mosquitto__subshared *shared;
 	char *topic;
@@ -351,16 +393,68 @@ struct mosquitto__retainhier {
 	struct mosquitto__retainhier *parent;
 	struct mosquitto__retainhier *children;
 	struct mosquitto_msg_store *retained;
+	struct mosquitto__timer expiry_timer; /* Armed while retained has an expiry time */
 	char *topic;
 	uint16_t topic_len;
 };
 
+struct mosquitto__retain_frame{
+	struct mosquitto__retainhier *next; /* Next child to visit, NULL when done */
+	int level; /* Subscription level the children are matched against */
+	bool single; /* Only this child matches, don't continue to its siblings */
+};
+
+/* Delivery of retained messages to a new subscription, see retain__queue() */
+struct mosquitto__retain_cursor{
+	struct mosquitto__retain_cursor *next, *prev;
+	struct mosquitto__retain_cursor *context_next, *context_prev;
+	struct mosquitto *context;
+	char *sub;
+	char *local_sub;
+	char **split_topics;
+	struct mosquitto__retain_frame *stack;
+	int stack_len;
+	int stack_size;
+	uint32_t subscription_identifier;
+	uint8_t sub_qos;
+};
+
+/* Outgoing messages written to disk because a client's queue was full, see
+ * spill.c */
+struct mosquitto__spill{
+	struct mosquitto__spill *next, *prev;
+	struct mosquitto *context;
+	FILE *wfile;
+	FILE *rfile;
+	char *path; /* Buffer for segment file names */
+	uint64_t pending_bytes;
+	int pending_count;
+	uint32_t id;
+	uint32_t write_seq;
+	uint32_t read_seq;
+	uint32_t segment_bytes; /* Bytes written to the current write segment */
+	uint32_t next_len; /* Length of the next record to read, 0 if not read yet */
+	uint8_t next_qos;
+	bool restoring; /* Messages are being moved from disk to the queue */
+};
+
 struct mosquitto_msg_store_load{
 	UT_hash_handle hh;
 	dbid_t db_id;
 	struct mosquitto_msg_store *store;
 };
 
+/* Number of topic levels held in a mosquitto_msg_store without allocating. */
+#define MSG_STORE_TOPIC_LEVELS 8
+
+/* One level of a published topic. Topics that don't start with '$' have an
+ * extra empty level at the start, matching the subscription tree. */
+struct mosquitto__topic_level{
+	uint32_t offset; /* Offset of the level in the topic string */
+	uint32_t len;
+	unsigned hashv;
+};
+
 struct mosquitto_msg_store{
 	struct mosquitto_msg_store *next;
 	struct mosquitto_msg_store *prev;
@@ -368,24 +462,32 @@ struct mosquitto_msg_store{
 	char *source_id;
 	char *source_username;
 	struct mosquitto__listener *source_listener;
-	char **dest_ids;
+	char *bridge_origin; /* Loop detection origin, see bridge_loop.c */
+	uint64_t *dest_ids; /* Open addressed set of context dest_id values */
 	int dest_id_count;
+	int dest_id_size;
 	int ref_count;
 	char* topic;
+	struct mosquitto__topic_level *topic_levels; /* NULL until tokenised */
 	mosquitto_property *properties;
 	void *payload;
 	time_t message_expiry_time;
 	uint32_t payloadlen;
+	uint32_t payload_offset; /* payload is this far into its allocation */
+	int topic_level_count;
+	struct mosquitto__topic_level topic_levels_static[MSG_STORE_TOPIC_LEVELS];
 	enum mosquitto_msg_origin origin;
 	uint16_t source_mid;
 	uint16_t mid;
 	uint8_t qos;
 	bool retain;
+	bool journalled; /* In the persistence snapshot or journal */
 };
 
 struct mosquitto_client_msg{
 	struct mosquitto_client_msg *prev;
 	struct mosquitto_client_msg *next;
+	UT_hash_handle hh_mid;
 	struct mosquitto_msg_store *store;
 	mosquitto_property *properties;
 	time_t timestamp;
@@ -408,6 +510,9 @@ struct mosquitto__unpwd{
 	unsigned int password_len;
 	unsigned int salt_len;
 	int iterations;
+	unsigned char cache_hash[EVP_MAX_MD_SIZE]; /* Keyed hash of the last password verified for this user */
+	unsigned int cache_hash_len;
+	time_t cache_expiry;
 #endif
 	enum mosquitto_pwhash_type hashtype;
 };
@@ -424,6 +529,18 @@ struct mosquitto__acl_user{
 	struct mosquitto__acl_user *next;
 	char *username;
 	struct mosquitto__acl *acl;
+	struct mosquitto__acl_node *tree; /* acl compiled for checking */
+};
+
+
+struct mosquitto__acl_cache_entry{
+	char *topic;
+	uint64_t generation; /* db.acl_generation when this result was stored */
+	uint32_t hash;
+	int access;
+	int result;
+	uint8_t qos;
+	bool retain;
 };
 
 
@@ -440,10 +557,22 @@ struct mosquitto_message_v5{
 };
 
 
+struct mosquitto__timer_wheel{
+	struct mosquitto__timer *root[TIMER_WHEEL_ROOT_SIZE];
+	struct mosquitto__timer *levels[TIMER_WHEEL_LEVELS][TIMER_WHEEL_LEVEL_SIZE];
+	struct mosquitto__timer *expired;
+	time_t now; /* Next tick to be processed */
+	int count;
+};
+
+
 struct mosquitto_db{
 	dbid_t last_db_id;
+	uint64_t last_dest_id;
 	struct mosquitto__subhier *subs;
 	struct mosquitto__retainhier *retains;
+	struct mosquitto__retain_cursor *retain_cursors;
+	struct mosquitto__spill *spills;
 	struct mosquitto *contexts_by_id;
 	struct mosquitto *contexts_by_sock;
 	struct mosquitto *contexts_for_free;
@@ -470,7 +599,12 @@ struct mosquitto_db{
 	int retained_count;
 #endif
 	int persistence_changes;
+	uint64_t acl_generation; /* Incremented to invalidate all cached ACL results */
+	bool retain_cursors_pending; /* Don't wait for network events, retained messages are waiting to be sent */
+	int pwhash_jobs_pending; /* Password checks handed to the hashing threads and not yet collected */
 	struct mosquitto *ll_for_free;
+	struct mosquitto *write_deferred; /* Clients with packets not yet written */
+	struct mosquitto *read_ready; /* Clients with input not yet read or handled */
 #ifdef WITH_EPOLL
 	int epollfd;
 #endif
@@ -483,6 +617,21 @@ enum mosquitto__bridge_direction{
 	bd_both = 2
 };
 
+/* Compression of bridge message batches, see bridge_batch.c. These values are
+ * also used in the batch header. */
+enum mosquitto__batch_compression{
+	mosq_bc_none = 0,
+	mosq_bc_zlib = 1
+};
+
+#define BRIDGE_BATCH_TOPIC "$bridge/batch"
+#define BRIDGE_BATCH_PROPERTY "mosquitto-batch"
+/* Largest uncompressed batch, unless max_packet_size is set */
+#define BRIDGE_BATCH_MAX_SIZE 16777216
+#define BRIDGE_ORIGIN_PROPERTY "mosquitto-origin"
+/* Large enough for "<broker id>:<message id>" */
+#define BRIDGE_ORIGIN_LEN_MAX 40
+
 enum mosquitto_bridge_start_type{
 	bst_automatic = 0,
 	bst_lazy = 1,
@@ -496,6 +645,8 @@ struct mosquitto__bridge_topic{
 	char *remote_prefix;
 	char *local_topic; /* topic prefixed with local_prefix */
 	char *remote_topic; /* topic prefixed with remote_prefix */
+	size_t local_prefix_len;
+	size_t remote_prefix_len;
 	enum mosquitto__bridge_direction direction;
 	uint8_t qos;
 };
@@ -521,6 +672,8 @@ struct mosquitto__bridge{
 	struct mosquitto__bridge_topic *topics;
 	int topic_count;
 	bool topic_remapping;
+	struct mosquitto__acl_node *remap_in; /* remote_topic of remapped "in" and "both" topics, ranked by 1 + index in topics */
+	struct mosquitto__acl_node *remap_out; /* local_topic of remapped "out" and "both" topics, ranked as remap_in */
 	enum mosquitto__protocol protocol_version;
 	time_t restart_t;
 	char *remote_clientid;
@@ -544,6 +697,19 @@ struct mosquitto__bridge{
 	bool attempt_unsubscribe;
 	bool initial_notification_done;
 	bool outgoing_retain;
+	int connections; /* Number of parallel connections to the remote broker */
+	int stream; /* Which of the connections this is, 0 for the configured bridge */
+	char *first_clientid; /* local_clientid of the first connection */
+	uint32_t batch_size; /* bridge_batch_size, 0 if batching isn't wanted */
+	enum mosquitto__batch_compression batch_compression;
+	bool batch_active; /* The remote broker accepted batches on this connection */
+	enum mosquitto__batch_compression batch_active_compression;
+	uint8_t *batch_buf; /* Messages waiting to be sent in the next batch */
+	size_t batch_len;
+	size_t batch_buf_size;
+	int batch_count;
+	uint8_t batch_qos;
+	struct mosquitto_msg_store *batch_store; /* Batch being queued by bridge__batch_flush() */
 #ifdef WITH_TLS
 	bool tls_insecure;
 	bool tls_ocsp_required;
@@ -638,13 +804,26 @@ int db__open(struct mosquitto__config *config);
 int db__close(void);
 #ifdef WITH_PERSISTENCE
 int persist__backup(bool shutdown);
+void persist__background_check(void);
 int persist__restore(void);
+int persist__journal_open(void);
+void persist__journal_close(void);
+void persist__journal_sync(void);
+void persist__journal_client(struct mosquitto *context);
+void persist__journal_client_remove(struct mosquitto *context);
+void persist__journal_client_msg(struct mosquitto *context, struct mosquitto_client_msg *cmsg);
+void persist__journal_client_msg_remove(struct mosquitto *context, struct mosquitto_client_msg *cmsg);
+void persist__journal_sub(struct mosquitto *context, const char *sub, uint8_t qos, uint32_t identifier, int options);
+void persist__journal_sub_remove(struct mosquitto *context, const char *sub);
+void persist__journal_retain(struct mosquitto_msg_store *stored);
 #endif
 /* Return the number of in-flight messages in count. */
 int db__message_count(int *count);
 int db__message_delete_outgoing(struct mosquitto *context, uint16_t mid, enum mosquitto_msg_state expect_state, int qos);
 int db__message_insert(struct mosquitto *context, uint16_t mid, enum mosquitto_msg_direction dir, uint8_t qos, bool retain, struct mosquitto_msg_store *stored, mosquitto_property *properties, bool update);
 int db__message_remove_incoming(struct mosquitto* context, uint16_t mid);
+int db__message_remove_by_mid(struct mosquitto *context, enum mosquitto_msg_direction dir, uint16_t mid);
+void db__message_remove_outgoing(struct mosquitto *context, struct mosquitto_client_msg *item, bool inflight);
 int db__message_release_incoming(struct mosquitto *context, uint16_t mid);
 int db__message_update_outgoing(struct mosquitto *context, uint16_t mid, enum mosquitto_msg_state state, int qos);
 void db__message_dequeue_first(struct mosquitto *context, struct mosquitto_msg_data *msg_data);
@@ -682,6 +861,7 @@ void sub__tree_print(struct mosquitto__subhier *root, int level);
 int sub__clean_session(struct mosquitto *context);
 int sub__messages_queue(const char *source_id, const char *topic, uint8_t qos, int retain, struct mosquitto_msg_store **stored);
 int sub__topic_tokenise(const char *subtopic, char **local_sub, char ***topics, const char **sharename);
+int sub__topic_levels(struct mosquitto_msg_store *stored);
 void sub__topic_tokens_free(struct sub__token *tokens);
 
 /* ============================================================
@@ -697,6 +877,7 @@ void context__add_to_by_id(struct mosquitto *context);
 void context__remove_from_by_id(struct mosquitto *context);
 
 int connect__on_authorised(struct mosquitto *context, void *auth_data_out, uint16_t auth_data_out_len);
+void connect__delayed_auth_complete(struct mosquitto *context, int result);
 
 
 /* ============================================================
@@ -734,6 +915,28 @@ void bridge_check(void);
 int bridge__register_local_connections(void);
 int bridge__add_topic(struct mosquitto__bridge *bridge, const char *topic, enum mosquitto__bridge_direction direction, uint8_t qos, const char *local_prefix, const char *remote_prefix);
 int bridge__remap_topic_in(struct mosquitto *context, char **topic);
+int bridge__remap_topic_out(struct mosquitto *context, const char **topic, char **topic_buf);
+void bridge__remap_free(struct mosquitto__bridge *bridge);
+bool bridge__stream_accepts(struct mosquitto__bridge *bridge, const struct mosquitto_msg_store *stored);
+int bridge__batch_request(struct mosquitto *context, mosquitto_property **properties);
+void bridge__batch_on_connack(struct mosquitto *context, const mosquitto_property *properties);
+bool bridge__batch_accepts(struct mosquitto *context, const struct mosquitto_msg_store *stored, uint8_t qos, const mosquitto_property *properties);
+int bridge__batch_add(struct mosquitto *context, const struct mosquitto_msg_store *stored, uint8_t qos, bool retain);
+int bridge__batch_flush(struct mosquitto *context);
+void bridge__batch_flush_all(void);
+void bridge__batch_free(struct mosquitto__bridge *bridge);
+void bridge__batch_offer(struct mosquitto *context, const char *value);
+int bridge__batch_connack_properties(struct mosquitto *context, mosquitto_property **properties);
+int bridge__batch_receive(struct mosquitto *context, const uint8_t *payload, uint32_t payloadlen);
+int bridge__loop_init(void);
+void bridge__loop_cleanup(void);
+int bridge__loop_request(struct mosquitto *context, mosquitto_property **properties);
+bool bridge__loop_trusted(struct mosquitto *context);
+void bridge__loop_offer(struct mosquitto *context);
+bool bridge__loop_seen(const char *origin, size_t len);
+bool bridge__loop_check(struct mosquitto *context, struct mosquitto_msg_store *msg);
+size_t bridge__loop_origin(struct mosquitto *context, const struct mosquitto_msg_store *stored, const char **origin, char *buf, size_t buflen);
+bool bridge__loop_property(struct mosquitto *context, const struct mosquitto_msg_store *stored, mosquitto_property *prop, char *buf, size_t buflen);
 #endif
 
 /* ============================================================
@@ -744,10 +947,22 @@ int mux__loop_prepare(void);
 int mux__add_out(struct mosquitto *context);
 int mux__remove_out(struct mosquitto *context);
 int mux__add_in(struct mosquitto *context);
+int mux__remove_in(struct mosquitto *context);
 int mux__delete(struct mosquitto *context);
 int mux__wait(void);
 int mux__handle(struct mosquitto__listener_sock *listensock, int listensock_count);
 int mux__cleanup(void);
+bool mux__using_uring(void);
+int mux__timeout(void);
+int mux__wakeup_init(void);
+void mux__wakeup_cleanup(void);
+mosq_sock_t mux__wakeup_sock(void);
+void mux__wakeup(void);
+void mux__wakeup_drain(void);
+int mux__read(struct mosquitto *context);
+void mux__ready_add(struct mosquitto *context);
+void mux__ready_remove(struct mosquitto *context);
+void mux__handle_ready(void);
 
 /* ============================================================
  * Listener related functions
@@ -768,7 +983,7 @@ void LIB_ERROR(void);
 void plugin__handle_tick(void);
 
 /* ============================================================
- * Property related functions
+ * Keepalive related functions
  * ============================================================ */
 int keepalive__add(struct mosquitto *context);
 void keepalive__check(void);
@@ -789,12 +1004,19 @@ int property__process_disconnect(struct mosquitto *context, mosquitto_property *
 int retain__init(void);
 void retain__clean(struct mosquitto__retainhier **retainhier);
 int retain__queue(struct mosquitto *context, const char *sub, uint8_t sub_qos, uint32_t subscription_identifier);
-int retain__store(const char *topic, struct mosquitto_msg_store *stored, char **split_topics);
+int retain__store(struct mosquitto_msg_store *stored);
+void retain__cursors_run(void);
+void retain__expiry_check(void);
+void retain__cursor_remove(struct mosquitto *context, const char *sub);
+void retain__cursors_move(struct mosquitto *from, struct mosquitto *to);
+void retain__cursors_free(struct mosquitto *context);
 
 /* ============================================================
  * Security related functions
  * ============================================================ */
 int acl__find_acls(struct mosquitto *context);
+void acl__free_client(struct mosquitto *context);
+void acl__cache_free(struct mosquitto *context);
 int mosquitto_security_module_init(void);
 int mosquitto_security_module_cleanup(void);
 
@@ -814,6 +1036,37 @@ int mosquitto_security_auth_start(struct mosquitto *context, bool reauth, const
 int mosquitto_security_auth_continue(struct mosquitto *context, const void *data_in, uint16_t data_len, void **data_out, uint16_t *data_out_len);
 
 void unpwd__free_item(struct mosquitto__unpwd **unpwd, struct mosquitto__unpwd *item);
+#ifdef WITH_TLS
+int pw__digest(const char *password, const unsigned char *salt, unsigned int salt_len, unsigned char *hash, unsigned int *hash_len, enum mosquitto_pwhash_type hashtype, int iterations);
+void unpwd__cache_add(struct mosquitto *context, const char *password, const unsigned char *password_hash, unsigned int password_hash_len);
+#endif
+
+/* ============================================================
+ * Password hashing threads
+ * ============================================================ */
+int pwhash_pool__init(void);
+void pwhash_pool__cleanup(void);
+bool pwhash_pool__active(void);
+int pwhash_pool__submit(struct mosquitto *context, const struct mosquitto__unpwd *u);
+void pwhash_pool__cancel(struct mosquitto *context);
+void pwhash_pool__process(void);
+
+/* ============================================================
+ * Client I/O threads
+ * ============================================================ */
+int io_threads__init(void);
+void io_threads__cleanup(void);
+void io_threads__add(struct mosquitto *context);
+int io_threads__remove(struct mosquitto *context);
+int io_threads__add_in(struct mosquitto *context);
+int io_threads__remove_in(struct mosquitto *context);
+int io_threads__add_out(struct mosquitto *context);
+int io_threads__remove_out(struct mosquitto *context);
+int io_threads__read(struct mosquitto *context);
+int io_threads__write(struct mosquitto *context);
+void io_threads__finish(struct mosquitto *context);
+void io_threads__finish_listener(struct mosquitto__listener *listener);
+void io_threads__process(void);
 
 /* ============================================================
  * Session expiry
@@ -825,6 +1078,15 @@ void session_expiry__remove_all(void);
 void session_expiry__check(void);
 void session_expiry__send_all(void);
 
+/* ============================================================
+ * Disk spill queue
+ * ============================================================ */
+int spill__init(void);
+int spill__append(struct mosquitto *context, const struct mosquitto_msg_store *stored, uint8_t qos, bool retain, const mosquitto_property *properties);
+void spill__run(void);
+void spill__move(struct mosquitto *from, struct mosquitto *to);
+void spill__free(struct mosquitto *context);
+
 /* ============================================================
  * Signals
  * ============================================================ */
@@ -854,6 +1116,16 @@ void mosq_websockets_init(struct mosquitto__listener *listener, const struct mos
 #endif
 void do_disconnect(struct mosquitto *context, int reason);
 
+/* ============================================================
+ * Timer wheel
+ * ============================================================ */
+void timer_wheel__init(struct mosquitto__timer_wheel *wheel, time_t now);
+void timer_wheel__add(struct mosquitto__timer_wheel *wheel, struct mosquitto__timer *timer, time_t expiry);
+void timer_wheel__remove(struct mosquitto__timer_wheel *wheel, struct mosquitto__timer *timer);
+void timer_wheel__advance(struct mosquitto__timer_wheel *wheel, time_t now);
+void timer_wheel__expire_all(struct mosquitto__timer_wheel *wheel);
+struct mosquitto__timer *timer_wheel__pop_expired(struct mosquitto__timer_wheel *wheel);
+
 /* ============================================================
  * Will delay
  * ============================================================ */
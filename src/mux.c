@@ -17,10 +17,41 @@ Contributors:
    Tatsuzo Osawa - Add epoll.
 */
 
+#include "config.h"
+
+#ifdef WITH_EPOLL
+#  include <sys/epoll.h>
+#endif
+
+#include <errno.h>
+#include <string.h>
+#ifndef WIN32
+#  include <unistd.h>
+#endif
+
 #include "mux.h"
+#include "net_mosq.h"
+#include "packet_mosq.h"
+#include "tls_mosq.h"
+#include "utlist.h"
+
+#ifdef WITH_IO_URING
+static bool use_uring = false;
+#endif
+/* Written to by other threads to wake the main loop, see mux__wakeup(). */
+static mosq_sock_t wakeup_pipe[2] = {INVALID_SOCKET, INVALID_SOCKET};
 
 int mux__init(struct mosquitto__listener_sock *listensock, int listensock_count)
 {
+#ifdef WITH_IO_URING
+	if(db.config->use_io_uring){
+		if(mux_uring__init(listensock, listensock_count) == MOSQ_ERR_SUCCESS){
+			use_uring = true;
+			return MOSQ_ERR_SUCCESS;
+		}
+		log__printf(NULL, MOSQ_LOG_INFO, "Using epoll for network events.");
+	}
+#endif
 #ifdef WITH_EPOLL
 	return mux_epoll__init(listensock, listensock_count);
 #else
@@ -30,6 +61,10 @@ int mux__init(struct mosquitto__listener_sock *listensock, int listensock_count)
 
 int mux__add_out(struct mosquitto *context)
 {
+	if(context->io_client) return io_threads__add_out(context);
+#ifdef WITH_IO_URING
+	if(use_uring) return mux_uring__add_out(context);
+#endif
 #ifdef WITH_EPOLL
 	return mux_epoll__add_out(context);
 #else
@@ -40,6 +75,10 @@ int mux__add_out(struct mosquitto *context)
 
 int mux__remove_out(struct mosquitto *context)
 {
+	if(context->io_client) return io_threads__remove_out(context);
+#ifdef WITH_IO_URING
+	if(use_uring) return mux_uring__remove_out(context);
+#endif
 #ifdef WITH_EPOLL
 	return mux_epoll__remove_out(context);
 #else
@@ -50,6 +89,10 @@ int mux__remove_out(struct mosquitto *context)
 
 int mux__add_in(struct mosquitto *context)
 {
+	if(context->io_client) return io_threads__add_in(context);
+#ifdef WITH_IO_URING
+	if(use_uring) return mux_uring__add_in(context);
+#endif
 #ifdef WITH_EPOLL
 	return mux_epoll__add_in(context);
 #else
@@ -58,8 +101,26 @@ int mux__add_in(struct mosquitto *context)
 }
 
 
+int mux__remove_in(struct mosquitto *context)
+{
+	if(context->io_client) return io_threads__remove_in(context);
+#ifdef WITH_IO_URING
+	if(use_uring) return mux_uring__remove_in(context);
+#endif
+#ifdef WITH_EPOLL
+	return mux_epoll__remove_in(context);
+#else
+	return mux_poll__remove_in(context);
+#endif
+}
+
+
 int mux__delete(struct mosquitto *context)
 {
+	if(context->io_client) return io_threads__remove(context);
+#ifdef WITH_IO_URING
+	if(use_uring) return mux_uring__delete(context);
+#endif
 #ifdef WITH_EPOLL
 	return mux_epoll__delete(context);
 #else
@@ -70,6 +131,13 @@ int mux__delete(struct mosquitto *context)
 
 int mux__handle(struct mosquitto__listener_sock *listensock, int listensock_count)
 {
+#ifdef WITH_IO_URING
+	if(use_uring){
+		UNUSED(listensock);
+		UNUSED(listensock_count);
+		return mux_uring__handle();
+	}
+#endif
 #ifdef WITH_EPOLL
 	UNUSED(listensock);
 	UNUSED(listensock_count);
@@ -82,9 +150,226 @@ int mux__handle(struct mosquitto__listener_sock *listensock, int listensock_coun
 
 int mux__cleanup(void)
 {
+#ifdef WITH_IO_URING
+	if(use_uring){
+		use_uring = false;
+		return mux_uring__cleanup();
+	}
+#endif
 #ifdef WITH_EPOLL
 	return mux_epoll__cleanup();
 #else
 	return mux_poll__cleanup();
 #endif
 }
+
+
+bool mux__using_uring(void)
+{
+#ifdef WITH_IO_URING
+	return use_uring;
+#else
+	return false;
+#endif
+}
+
+
+/* The read end of the wakeup pipe is watched by each of the event
+ * multiplexers along with the listening sockets. It is created before and
+ * closed after the multiplexer, so that threads that are still running while
+ * the broker shuts down always have somewhere to write to. */
+int mux__wakeup_init(void)
+{
+#ifdef WIN32
+	return MOSQ_ERR_NOT_SUPPORTED;
+#else
+	int fds[2];
+
+	if(pipe(fds)){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error creating wakeup pipe: %s.", strerror(errno));
+		return MOSQ_ERR_ERRNO;
+	}
+	wakeup_pipe[0] = fds[0];
+	wakeup_pipe[1] = fds[1];
+	if(net__socket_nonblock(&wakeup_pipe[0]) || net__socket_nonblock(&wakeup_pipe[1])){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error creating wakeup pipe: %s.", strerror(errno));
+		mux__wakeup_cleanup();
+		return MOSQ_ERR_ERRNO;
+	}
+	return MOSQ_ERR_SUCCESS;
+#endif
+}
+
+
+void mux__wakeup_cleanup(void)
+{
+	int i;
+
+	for(i=0; i<2; i++){
+		if(wakeup_pipe[i] != INVALID_SOCKET){
+			COMPAT_CLOSE(wakeup_pipe[i]);
+			wakeup_pipe[i] = INVALID_SOCKET;
+		}
+	}
+}
+
+
+/* The socket for the multiplexers to watch, or INVALID_SOCKET if there is no
+ * wakeup pipe. */
+mosq_sock_t mux__wakeup_sock(void)
+{
+	return wakeup_pipe[0];
+}
+
+
+/* Wake the main loop from another thread. If the pipe is full the main loop
+ * has already got a wakeup waiting, so a failed write doesn't matter. */
+void mux__wakeup(void)
+{
+#ifndef WIN32
+	char c = 0;
+
+	if(wakeup_pipe[1] != INVALID_SOCKET){
+		if(write(wakeup_pipe[1], &c, 1)){
+			/* Nothing to do */
+		}
+	}
+#endif
+}
+
+
+/* Called by the multiplexers when the wakeup pipe is readable. Whatever woke
+ * the loop is dealt with later in the loop iteration. */
+void mux__wakeup_drain(void)
+{
+#ifndef WIN32
+	char buf[64];
+
+	while(read(wakeup_pipe[0], buf, sizeof(buf)) > 0){
+	}
+#endif
+}
+
+
+/* How long to wait for network events, in milliseconds. */
+int mux__timeout(void)
+{
+	if(db.retain_cursors_pending || db.read_ready){
+		return 0;
+	}else{
+		return 100;
+	}
+}
+
+
+void mux__ready_add(struct mosquitto *context)
+{
+	if(context->read_ready == false){
+		context->read_ready = true;
+		DL_APPEND2(db.read_ready, context, read_ready_prev, read_ready_next);
+	}
+}
+
+
+void mux__ready_remove(struct mosquitto *context)
+{
+	if(context->read_ready){
+		DL_DELETE2(db.read_ready, context, read_ready_prev, read_ready_next);
+		context->read_ready = false;
+	}
+}
+
+
+static bool mux__read_budget_spent(struct mosquitto *context)
+{
+	return (db.config->max_read_packets > 0 && context->read_packets >= db.config->max_read_packets)
+		|| (db.config->max_read_bytes > 0 && context->read_bytes >= db.config->max_read_bytes);
+}
+
+
+/* Whether the client may have input that can be handled without waiting for
+ * its socket to be reported as readable again. */
+static bool mux__read_more(struct mosquitto *context)
+{
+	if(context->in_unread || SSL_DATA_PENDING(context)){
+		return true;
+	}
+	if(context->io_client){
+		/* Only the I/O thread reads from the socket */
+		return false;
+	}
+#ifdef WITH_EPOLL
+	/* With edge triggered events the socket must be read until it would
+	 * block, or there is no guarantee of it being reported again. */
+	if((context->events & EPOLLET) && context->read_drained == false){
+		return true;
+	}
+#endif
+	return false;
+}
+
+
+/* Read and handle input from a client, until there is nothing more to read
+ * or the client has used its read budget for this loop iteration. A client
+ * that still has input at that point is put on the ready list, and is read
+ * again by mux__handle_ready() in the next iteration, so one busy client can't
+ * hold up all of the others. */
+int mux__read(struct mosquitto *context)
+{
+	int rc;
+
+	mux__ready_remove(context);
+	context->read_packets = 0;
+	context->read_bytes = 0;
+
+	do{
+		rc = packet__read(context);
+		if(rc){
+			return rc;
+		}
+		if(context->sock == INVALID_SOCKET
+				|| context->state == mosq_cs_delayed_auth
+				|| context->state == mosq_cs_connect_pending){
+
+			return MOSQ_ERR_SUCCESS;
+		}
+		if(mux__read_budget_spent(context)){
+			if(mux__read_more(context)){
+				mux__ready_add(context);
+				return MOSQ_ERR_SUCCESS;
+			}
+			break;
+		}
+	}while(mux__read_more(context));
+
+	if(context->io_client){
+		/* Everything read so far has been handled */
+		io_threads__read(context);
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Read from the clients that were left on the ready list. Clients that use up
+ * their budget again go to the back of the list, and are not read a second
+ * time in this call. */
+void mux__handle_ready(void)
+{
+	struct mosquitto *context, *ctxt_tmp;
+	int count;
+	int rc;
+
+	DL_COUNT2(db.read_ready, ctxt_tmp, count, read_ready_next);
+	while(count > 0 && db.read_ready){
+		count--;
+		context = db.read_ready;
+		mux__ready_remove(context);
+		if(context->sock == INVALID_SOCKET){
+			continue;
+		}
+		rc = mux__read(context);
+		if(rc){
+			do_disconnect(context, rc);
+		}
+	}
+}
@@ -25,14 +25,25 @@ int mux_epoll__init(struct mosquitto__listener_sock *listensock, int listensock_
 int mux_epoll__add_out(struct mosquitto *context);
 int mux_epoll__remove_out(struct mosquitto *context);
 int mux_epoll__add_in(struct mosquitto *context);
+int mux_epoll__remove_in(struct mosquitto *context);
 int mux_epoll__delete(struct mosquitto *context);
 int mux_epoll__handle(void);
 int mux_epoll__cleanup(void);
 
+int mux_uring__init(struct mosquitto__listener_sock *listensock, int listensock_count);
+int mux_uring__add_out(struct mosquitto *context);
+int mux_uring__remove_out(struct mosquitto *context);
+int mux_uring__add_in(struct mosquitto *context);
+int mux_uring__remove_in(struct mosquitto *context);
+int mux_uring__delete(struct mosquitto *context);
+int mux_uring__handle(void);
+int mux_uring__cleanup(void);
+
 int mux_poll__init(struct mosquitto__listener_sock *listensock, int listensock_count);
 int mux_poll__add_out(struct mosquitto *context);
 int mux_poll__remove_out(struct mosquitto *context);
 int mux_poll__add_in(struct mosquitto *context);
+int mux_poll__remove_in(struct mosquitto *context);
 int mux_poll__delete(struct mosquitto *context);
 int mux_poll__handle(struct mosquitto__listener_sock *listensock, int listensock_count);
 int mux_poll__cleanup(void);
@@ -69,6 +69,8 @@ static void loop_handle_reads_writes(struct mosquitto *context, uint32_t events)
 
 static sigset_t my_sigblock;
 static struct epoll_event ep_events[MAX_EVENTS];
+static bool edge_triggered = false;
+static int wakeup_ident = id_wakeup;
 
 int mux_epoll__init(struct mosquitto__listener_sock *listensock, int listensock_count)
 {
@@ -85,6 +87,7 @@ int mux_epoll__init(struct mosquitto__listener_sock *listensock, int listensock_
 #endif
 
 	memset(&ep_events, 0, sizeof(struct epoll_event)*MAX_EVENTS);
+	edge_triggered = db.config->epoll_edge_triggered;
 
 	db.epollfd = 0;
 	if ((db.epollfd = epoll_create(MAX_EVENTS)) == -1) {
@@ -103,13 +106,79 @@ int mux_epoll__init(struct mosquitto__listener_sock *listensock, int listensock_
 		}
 	}
 
+	if(mux__wakeup_sock() != INVALID_SOCKET){
+		ev.data.ptr = &wakeup_ident;
+		ev.events = EPOLLIN;
+		if (epoll_ctl(db.epollfd, EPOLL_CTL_ADD, mux__wakeup_sock(), &ev) == -1) {
+			log__printf(NULL, MOSQ_LOG_ERR, "Error in epoll initial registering: %s", strerror(errno));
+			(void)close(db.epollfd);
+			db.epollfd = 0;
+			return MOSQ_ERR_UNKNOWN;
+		}
+	}
+
+	if(edge_triggered){
+		log__printf(NULL, MOSQ_LOG_INFO, "Using edge triggered epoll for network events.");
+	}
+
 	return MOSQ_ERR_SUCCESS;
 }
 
+
+/* In edge triggered mode a client socket is registered once, for both reading
+ * and writing. Whether the broker wants to read or write is then only tracked
+ * in context->events, which saves an epoll_ctl() call each time a client's
+ * output queue fills or empties. EPOLLET in context->events marks the socket
+ * as registered. Websockets clients are serviced by libwebsockets, which
+ * expects level triggered events, so are left as they are. */
+static bool mux_epoll__is_edge_triggered(struct mosquitto *context)
+{
+#ifdef WITH_WEBSOCKETS
+	if(context->wsi){
+		return false;
+	}
+#else
+	UNUSED(context);
+#endif
+	return edge_triggered;
+}
+
+
+static void mux_epoll__edge_register(struct mosquitto *context, uint32_t events)
+{
+	struct epoll_event ev;
+
+	if(context->events & EPOLLET){
+		if((events & EPOLLIN) && !(context->events & EPOLLIN)){
+			/* Reading was paused, so input may have arrived without
+			 * there being an edge left to report it. */
+			context->read_drained = false;
+			mux__ready_add(context);
+		}
+		context->events |= events;
+		return;
+	}
+
+	memset(&ev, 0, sizeof(struct epoll_event));
+	ev.data.ptr = context;
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+	if(epoll_ctl(db.epollfd, EPOLL_CTL_ADD, context->sock, &ev) == -1){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error in epoll accepting: %s", strerror(errno));
+		return;
+	}
+	context->events = EPOLLET | events;
+}
+
+
 int mux_epoll__add_out(struct mosquitto *context)
 {
 	struct epoll_event ev;
 
+	if(mux_epoll__is_edge_triggered(context)){
+		mux_epoll__edge_register(context, EPOLLIN | EPOLLOUT);
+		return MOSQ_ERR_SUCCESS;
+	}
+
 	if(!(context->events & EPOLLOUT)) {
 		memset(&ev, 0, sizeof(struct epoll_event));
 		ev.data.ptr = context;
@@ -129,6 +198,11 @@ int mux_epoll__remove_out(struct mosquitto *context)
 {
 	struct epoll_event ev;
 
+	if(mux_epoll__is_edge_triggered(context)){
+		context->events &= ~(uint32_t)EPOLLOUT;
+		return MOSQ_ERR_SUCCESS;
+	}
+
 	if(context->events & EPOLLOUT) {
 		memset(&ev, 0, sizeof(struct epoll_event));
 		ev.data.ptr = context;
@@ -148,15 +222,49 @@ int mux_epoll__add_in(struct mosquitto *context)
 {
 	struct epoll_event ev;
 
+	if(mux_epoll__is_edge_triggered(context)){
+		mux_epoll__edge_register(context, EPOLLIN);
+		return MOSQ_ERR_SUCCESS;
+	}
+
 	memset(&ev, 0, sizeof(struct epoll_event));
 	ev.events = EPOLLIN;
 	ev.data.ptr = context;
 	if (epoll_ctl(db.epollfd, EPOLL_CTL_ADD, context->sock, &ev) == -1) {
 		if(errno != EEXIST){
 			log__printf(NULL, MOSQ_LOG_ERR, "Error in epoll accepting: %s", strerror(errno));
+		}else{
+			/* Already registered, reading may have been paused */
+			ev.events = EPOLLIN | (context->events & EPOLLOUT);
+			if(epoll_ctl(db.epollfd, EPOLL_CTL_MOD, context->sock, &ev) == -1){
+				log__printf(NULL, MOSQ_LOG_DEBUG, "Error in epoll re-registering to EPOLLIN: %s", strerror(errno));
+			}
+		}
+	}
+	context->events = ev.events;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Stop reading from a client. Errors and hang ups are still reported. */
+int mux_epoll__remove_in(struct mosquitto *context)
+{
+	struct epoll_event ev;
+
+	if(mux_epoll__is_edge_triggered(context)){
+		context->events &= ~(uint32_t)EPOLLIN;
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	if(context->events & EPOLLIN){
+		memset(&ev, 0, sizeof(struct epoll_event));
+		ev.events = context->events & EPOLLOUT;
+		ev.data.ptr = context;
+		if(epoll_ctl(db.epollfd, EPOLL_CTL_MOD, context->sock, &ev) == -1){
+			log__printf(NULL, MOSQ_LOG_DEBUG, "Error in epoll re-registering without EPOLLIN: %s", strerror(errno));
 		}
+		context->events = ev.events;
 	}
-	context->events = EPOLLIN;
 	return MOSQ_ERR_SUCCESS;
 }
 
@@ -166,6 +274,9 @@ int mux_epoll__delete(struct mosquitto *context)
 	struct epoll_event ev;
 
 	memset(&ev, 0, sizeof(struct epoll_event));
+	if(context->events & EPOLLET){
+		context->events = 0;
+	}
 	if(context->sock != INVALID_SOCKET){
 		if(epoll_ctl(db.epollfd, EPOLL_CTL_DEL, context->sock, &ev) == -1){
 			return 1;
@@ -178,16 +289,13 @@ int mux_epoll__delete(struct mosquitto *context)
 int mux_epoll__handle(void)
 {
 	int i;
-	struct epoll_event ev;
-	sigset_t origsig;
 	struct mosquitto *context;
 	struct mosquitto__listener_sock *listensock;
 	int event_count;
 
-	memset(&ev, 0, sizeof(struct epoll_event));
-	sigprocmask(SIG_SETMASK, &my_sigblock, &origsig);
-	event_count = epoll_wait(db.epollfd, ep_events, MAX_EVENTS, 100);
-	sigprocmask(SIG_SETMASK, &origsig, NULL);
+	/* epoll_pwait() applies the signal mask for the duration of the wait
+	 * only, saving a pair of sigprocmask() calls on every loop iteration. */
+	event_count = epoll_pwait(db.epollfd, ep_events, MAX_EVENTS, mux__timeout(), &my_sigblock);
 
 	db.now_s = mosquitto_time();
 	db.now_real_s = time(NULL);
@@ -205,6 +313,11 @@ int mux_epoll__handle(void)
 			context = ep_events[i].data.ptr;
 			if(context->ident == id_client){
 				loop_handle_reads_writes(context, ep_events[i].events);
+			}else if(context->ident == id_wakeup){
+				mux__wakeup_drain();
+				/* Clients closed by their peer must be gone before any
+				 * new connections later in this batch are accepted. */
+				io_threads__process();
 			}else if(context->ident == id_listener){
 				listensock = ep_events[i].data.ptr;
 
@@ -255,6 +368,11 @@ static void loop_handle_reads_writes(struct mosquitto *context, uint32_t events)
 	}
 #endif
 
+	if(context->events & EPOLLET){
+		/* Only act on the events that are wanted at the moment. */
+		events &= context->events | EPOLLERR | EPOLLHUP;
+	}
+
 	if(events & EPOLLOUT
 #ifdef WITH_TLS
 			|| context->want_write
@@ -291,13 +409,15 @@ static void loop_handle_reads_writes(struct mosquitto *context, uint32_t events)
 #endif
 			){
 
-		do{
-			rc = packet__read(context);
+		/* A client on the ready list is read by mux__handle_ready() in the
+		 * next iteration. */
+		if(context->read_ready == false){
+			rc = mux__read(context);
 			if(rc){
 				do_disconnect(context, rc);
 				return;
 			}
-		}while(SSL_DATA_PENDING(context));
+		}
 	}else{
 		if(events & (EPOLLERR | EPOLLHUP)){
 			do_disconnect(context, MOSQ_ERR_CONN_LOST);
@@ -60,6 +60,7 @@ static void loop_handle_reads_writes(void);
 
 static struct pollfd *pollfds = NULL;
 static size_t pollfd_max, pollfd_current_max;
+static int wakeup_index = -1;
 #ifndef WIN32
 static sigset_t my_sigblock;
 #endif
@@ -100,6 +101,14 @@ int mux_poll__init(struct mosquitto__listener_sock *listensock, int listensock_c
 		pollfds[pollfd_index].revents = 0;
 		pollfd_index++;
 	}
+	wakeup_index = -1;
+	if(mux__wakeup_sock() != INVALID_SOCKET){
+		pollfds[pollfd_index].fd = mux__wakeup_sock();
+		pollfds[pollfd_index].events = POLLIN;
+		pollfds[pollfd_index].revents = 0;
+		wakeup_index = (int)pollfd_index;
+		pollfd_index++;
+	}
 
 	pollfd_current_max = pollfd_index-1;
 	return MOSQ_ERR_SUCCESS;
@@ -156,7 +165,23 @@ int mux_poll__remove_out(struct mosquitto *context)
 
 int mux_poll__add_in(struct mosquitto *context)
 {
-	return mux_poll__add(context, POLLIN);
+	if(context->pollfd_index != -1){
+		/* Already registered, reading may have been paused */
+		return mux_poll__add(context, (uint16_t)(POLLIN | (context->events & POLLOUT)));
+	}else{
+		return mux_poll__add(context, POLLIN);
+	}
+}
+
+
+/* Stop reading from a client. Errors and hang ups are still reported. */
+int mux_poll__remove_in(struct mosquitto *context)
+{
+	if(context->events & POLLIN){
+		return mux_poll__add(context, (uint16_t)(context->events & POLLOUT));
+	}else{
+		return MOSQ_ERR_SUCCESS;
+	}
 }
 
 int mux_poll__delete(struct mosquitto *context)
@@ -198,10 +223,10 @@ int mux_poll__handle(struct mosquitto__listener_sock *listensock, int listensock
 
 #ifndef WIN32
 	sigprocmask(SIG_SETMASK, &my_sigblock, &origsig);
-	fdcount = poll(pollfds, pollfd_current_max+1, 100);
+	fdcount = poll(pollfds, pollfd_current_max+1, mux__timeout());
 	sigprocmask(SIG_SETMASK, &origsig, NULL);
 #else
-	fdcount = WSAPoll(pollfds, pollfd_current_max+1, 100);
+	fdcount = WSAPoll(pollfds, pollfd_current_max+1, mux__timeout());
 #endif
 
 	db.now_s = mosquitto_time();
@@ -223,6 +248,10 @@ int mux_poll__handle(struct mosquitto__listener_sock *listensock, int listensock
 	}else{
 		loop_handle_reads_writes();
 
+		if(wakeup_index != -1 && pollfds[wakeup_index].revents & POLLIN){
+			mux__wakeup_drain();
+		}
+
 		for(i=0; i<listensock_count; i++){
 			if(pollfds[i].revents & POLLIN){
 #ifdef WITH_WEBSOCKETS
@@ -331,13 +360,13 @@ static void loop_handle_reads_writes(void)
 #else
 		if(pollfds[context->pollfd_index].revents & POLLIN){
 #endif
-			do{
-				rc = packet__read(context);
+			if(context->read_ready == false){
+				rc = mux__read(context);
 				if(rc){
 					do_disconnect(context, rc);
 					continue;
 				}
-			}while(SSL_DATA_PENDING(context));
+			}
 		}else{
 			if(context->pollfd_index >= 0 && pollfds[context->pollfd_index].revents & (POLLERR | POLLNVAL | POLLHUP)){
 				do_disconnect(context, MOSQ_ERR_CONN_LOST);
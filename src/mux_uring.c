@@ -0,0 +1,687 @@
+/*
+Copyright (c) 2022 Roger Light <roger@atchoo.org>
+
+All rights reserved. This program and the accompanying materials
+are made available under the terms of the Eclipse Public License 2.0
+and Eclipse Distribution License v1.0 which accompany this distribution.
+
+The Eclipse Public License is available at
+   https://www.eclipse.org/legal/epl-2.0/
+and the Eclipse Distribution License is available at
+  http://www.eclipse.org/org/documents/edl-v10.php.
+
+SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+
+Contributors:
+   Roger Light - initial implementation and documentation.
+*/
+
+/* io_uring event multiplexer.
+ *
+ * Sockets are watched with one-shot IORING_OP_POLL_ADD requests, so events
+ * are level triggered in the same way as for epoll and the rest of the broker
+ * still does its own reads and writes, including through OpenSSL. The
+ * difference to epoll is the number of system calls: adding and removing
+ * interest in writing for a client only changes the state kept here, and all
+ * of the poll requests that need to be (re)armed are submitted in the same
+ * io_uring_enter() call that waits for the next events.
+ *
+ * Each request is identified by the socket and a generation count for that
+ * socket, so completions of requests for a socket that has since been closed
+ * or reused are ignored.
+ *
+ * If a request can't be queued because the submission queue is full and
+ * can't be submitted, the socket is left to be armed, or the request removed,
+ * on the next pass of the loop, which then doesn't wait.
+ *
+ * A poll request holds a reference to its socket until it is removed, and if
+ * the broker is killed that happens only when the kernel gets round to
+ * tearing the ring down. The listening sockets are therefore watched with an
+ * epoll instance, and only that is polled through the ring, so a restarted
+ * broker can listen on the same ports straight away.
+ *
+ * Only poll requests are used. Multishot accept and recv, and provided buffer
+ * rings, are deliberately not: reads have to go through OpenSSL and the
+ * per-client read budgets, the listening sockets are kept out of the ring as
+ * described above, and clients read by I/O threads don't use the ring at all.
+ */
+
+#include "config.h"
+
+#ifdef WITH_IO_URING
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef WITH_WEBSOCKETS
+#  include <libwebsockets.h>
+#endif
+
+#include "mosquitto_broker_internal.h"
+#include "memory_mosq.h"
+#include "mux.h"
+#include "packet_mosq.h"
+#include "time_mosq.h"
+#include "util_mosq.h"
+
+#define URING_ENTRIES 4096
+#define MAX_LISTEN_EVENTS 16
+
+struct uring_fd{
+	void *ptr; /* Client or listener, NULL if the socket isn't registered */
+	uint32_t gen;
+	uint32_t events; /* Events wanted */
+	uint32_t armed_events; /* Events of the current poll request, 0 if none */
+	bool dirty; /* In dirty_fds */
+};
+
+static void loop_handle_reads_writes(struct mosquitto *context, uint32_t events);
+
+static sigset_t my_sigblock;
+
+static int ring_fd = -1;
+static int listen_epfd = -1;
+static void *sq_ring = MAP_FAILED;
+static void *cq_ring = MAP_FAILED;
+static struct io_uring_sqe *sqes = MAP_FAILED;
+static size_t sq_ring_size;
+static size_t cq_ring_size;
+static size_t sqes_size;
+static unsigned *sq_head;
+static unsigned *sq_tail;
+static unsigned *sq_mask;
+static unsigned *sq_array;
+static unsigned sq_entries;
+static unsigned *cq_head;
+static unsigned *cq_tail;
+static unsigned *cq_mask;
+static struct io_uring_cqe *cqes;
+static unsigned sq_local_tail;
+static unsigned to_submit;
+
+static struct uring_fd *fds = NULL;
+static int fds_size = 0;
+static int *dirty_fds = NULL;
+static int dirty_count = 0;
+static int dirty_size = 0;
+static uint64_t *removals = NULL; /* Poll removals that couldn't be queued */
+static int removal_count = 0;
+static int removal_size = 0;
+
+
+static int uring__enter(unsigned submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz)
+{
+	return (int)syscall(__NR_io_uring_enter, ring_fd, submit, min_complete, flags, arg, argsz);
+}
+
+
+static void uring__flush_sq(void)
+{
+	__atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+}
+
+
+static struct io_uring_sqe *uring__get_sqe(void)
+{
+	struct io_uring_sqe *sqe;
+	unsigned idx;
+
+	if(sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries){
+		/* Submission queue is full, send what we have so far. */
+		uring__flush_sq();
+		while(uring__enter(to_submit, 0, 0, NULL, 0) < 0){
+			if(errno != EINTR){
+				/* EBUSY means completions have to be collected first, which
+				 * happens in mux_uring__handle(). */
+				if(errno != EBUSY && errno != EAGAIN){
+					log__printf(NULL, MOSQ_LOG_ERR, "Error in io_uring submitting: %s.", strerror(errno));
+				}
+				return NULL;
+			}
+		}
+		to_submit = sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+		if(to_submit >= sq_entries){
+			return NULL;
+		}
+	}
+	idx = sq_local_tail & *sq_mask;
+	sqe = &sqes[idx];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sq_array[idx] = idx;
+	sq_local_tail++;
+	to_submit++;
+
+	return sqe;
+}
+
+
+static uint64_t uring__key(int fd)
+{
+	return ((uint64_t)fds[fd].gen << 32) | (uint32_t)fd;
+}
+
+
+static int uring__arm(int fd)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = uring__get_sqe();
+	if(sqe == NULL) return MOSQ_ERR_UNKNOWN;
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = fds[fd].events;
+	sqe->user_data = uring__key(fd);
+	fds[fd].armed_events = fds[fd].events | POLLERR | POLLHUP;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static int uring__remove(uint64_t key)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = uring__get_sqe();
+	if(sqe == NULL) return MOSQ_ERR_UNKNOWN;
+
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->addr = key;
+	sqe->user_data = 0;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static void uring__disarm(int fd)
+{
+	uint64_t *removals_new;
+
+	if(fds[fd].armed_events){
+		if(uring__remove(uring__key(fd))){
+			/* Tried again before the next wait. If this fails too, the
+			 * request is only removed when it completes. */
+			if(removal_count == removal_size){
+				removals_new = mosquitto__realloc(removals, sizeof(uint64_t)*(size_t)(removal_size+1024));
+				if(removals_new){
+					removals = removals_new;
+					removal_size += 1024;
+				}
+			}
+			if(removal_count < removal_size){
+				removals[removal_count] = uring__key(fd);
+				removal_count++;
+			}
+		}
+		fds[fd].armed_events = 0;
+	}
+	/* Any completion still to come for the old request is ignored. */
+	fds[fd].gen++;
+	if(fds[fd].gen == 0) fds[fd].gen = 1;
+}
+
+
+static int uring__fd_grow(int fd)
+{
+	struct uring_fd *fds_new;
+	int size;
+
+	if(fd < fds_size) return MOSQ_ERR_SUCCESS;
+
+	size = fds_size?fds_size:1024;
+	while(size <= fd){
+		size *= 2;
+	}
+	fds_new = mosquitto__realloc(fds, sizeof(struct uring_fd)*(size_t)size);
+	if(fds_new == NULL) return MOSQ_ERR_NOMEM;
+	memset(&fds_new[fds_size], 0, sizeof(struct uring_fd)*(size_t)(size - fds_size));
+	fds = fds_new;
+	fds_size = size;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Record the events wanted for a socket. The poll request is updated before
+ * the next wait. */
+static int uring__set(int fd, void *ptr, uint32_t events)
+{
+	int *dirty_new;
+
+	if(fd < 0) return MOSQ_ERR_INVAL;
+	if(uring__fd_grow(fd)) return MOSQ_ERR_NOMEM;
+
+	fds[fd].ptr = ptr;
+	fds[fd].events = events;
+	if(fds[fd].gen == 0) fds[fd].gen = 1;
+
+	if(fds[fd].dirty == false){
+		if(dirty_count == dirty_size){
+			dirty_new = mosquitto__realloc(dirty_fds, sizeof(int)*(size_t)(dirty_size+1024));
+			if(dirty_new == NULL) return MOSQ_ERR_NOMEM;
+			dirty_fds = dirty_new;
+			dirty_size += 1024;
+		}
+		dirty_fds[dirty_count] = fd;
+		dirty_count++;
+		fds[fd].dirty = true;
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Queue the poll requests that have changed. Returns false if any are left
+ * for the next pass because the submission queue is full. */
+static bool uring__arm_dirty(void)
+{
+	struct uring_fd *f;
+	int i;
+
+	while(removal_count > 0){
+		if(uring__remove(removals[removal_count-1])){
+			return false;
+		}
+		removal_count--;
+	}
+
+	for(i=0; i<dirty_count; i++){
+		f = &fds[dirty_fds[i]];
+		if(f->ptr == NULL){
+			f->dirty = false;
+			continue;
+		}
+
+		if(f->armed_events && f->armed_events != (f->events | POLLERR | POLLHUP)){
+			uring__disarm(dirty_fds[i]);
+		}
+		if(f->armed_events == 0 && uring__arm(dirty_fds[i])){
+			/* This and the rest stay dirty */
+			memmove(dirty_fds, &dirty_fds[i], sizeof(int)*(size_t)(dirty_count-i));
+			dirty_count -= i;
+			return false;
+		}
+		f->dirty = false;
+	}
+	dirty_count = 0;
+	return true;
+}
+
+
+int mux_uring__init(struct mosquitto__listener_sock *listensock, int listensock_count)
+{
+	struct io_uring_params params;
+	struct epoll_event ev;
+	int i;
+
+	sigemptyset(&my_sigblock);
+	sigaddset(&my_sigblock, SIGINT);
+	sigaddset(&my_sigblock, SIGTERM);
+	sigaddset(&my_sigblock, SIGUSR1);
+	sigaddset(&my_sigblock, SIGUSR2);
+	sigaddset(&my_sigblock, SIGHUP);
+
+	memset(&params, 0, sizeof(struct io_uring_params));
+	ring_fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+	if(ring_fd < 0){
+		log__printf(NULL, MOSQ_LOG_INFO, "io_uring not available: %s.", strerror(errno));
+		ring_fd = -1;
+		return MOSQ_ERR_NOT_SUPPORTED;
+	}
+	if(!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP)){
+		log__printf(NULL, MOSQ_LOG_INFO, "io_uring not available: kernel too old.");
+		mux_uring__cleanup();
+		return MOSQ_ERR_NOT_SUPPORTED;
+	}
+
+	sq_ring_size = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+	cq_ring_size = params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe);
+	sqes_size = params.sq_entries*sizeof(struct io_uring_sqe);
+
+	sq_ring = mmap(NULL, sq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+	cq_ring = mmap(NULL, cq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+	sqes = mmap(NULL, sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+	if(sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes == MAP_FAILED){
+		log__printf(NULL, MOSQ_LOG_INFO, "io_uring not available: %s.", strerror(errno));
+		mux_uring__cleanup();
+		return MOSQ_ERR_NOT_SUPPORTED;
+	}
+
+	sq_head = (unsigned *)((uint8_t *)sq_ring + params.sq_off.head);
+	sq_tail = (unsigned *)((uint8_t *)sq_ring + params.sq_off.tail);
+	sq_mask = (unsigned *)((uint8_t *)sq_ring + params.sq_off.ring_mask);
+	sq_array = (unsigned *)((uint8_t *)sq_ring + params.sq_off.array);
+	sq_entries = params.sq_entries;
+	cq_head = (unsigned *)((uint8_t *)cq_ring + params.cq_off.head);
+	cq_tail = (unsigned *)((uint8_t *)cq_ring + params.cq_off.tail);
+	cq_mask = (unsigned *)((uint8_t *)cq_ring + params.cq_off.ring_mask);
+	cqes = (struct io_uring_cqe *)((uint8_t *)cq_ring + params.cq_off.cqes);
+	sq_local_tail = *sq_tail;
+	to_submit = 0;
+
+	listen_epfd = epoll_create(MAX_LISTEN_EVENTS);
+	if(listen_epfd == -1){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error in epoll creating: %s", strerror(errno));
+		mux_uring__cleanup();
+		return MOSQ_ERR_UNKNOWN;
+	}
+	memset(&ev, 0, sizeof(struct epoll_event));
+	for(i=0; i<listensock_count; i++){
+		ev.data.ptr = &listensock[i];
+		ev.events = EPOLLIN;
+		if(epoll_ctl(listen_epfd, EPOLL_CTL_ADD, listensock[i].sock, &ev) == -1){
+			log__printf(NULL, MOSQ_LOG_ERR, "Error in epoll initial registering: %s", strerror(errno));
+			mux_uring__cleanup();
+			return MOSQ_ERR_UNKNOWN;
+		}
+	}
+	if(uring__set(listen_epfd, &listen_epfd, POLLIN)){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Out of memory.");
+		mux_uring__cleanup();
+		return MOSQ_ERR_NOMEM;
+	}
+
+	if(mux__wakeup_sock() != INVALID_SOCKET && uring__set(mux__wakeup_sock(), &listen_epfd, POLLIN)){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Out of memory.");
+		mux_uring__cleanup();
+		return MOSQ_ERR_NOMEM;
+	}
+
+	log__printf(NULL, MOSQ_LOG_INFO, "Using io_uring for network events.");
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int mux_uring__add_out(struct mosquitto *context)
+{
+	if(!(context->events & POLLOUT)){
+		context->events = POLLIN | POLLOUT;
+		return uring__set(context->sock, context, context->events);
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int mux_uring__remove_out(struct mosquitto *context)
+{
+	if(context->events & POLLOUT){
+		context->events = POLLIN;
+		return uring__set(context->sock, context, context->events);
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int mux_uring__add_in(struct mosquitto *context)
+{
+	context->events = POLLIN | (context->events & POLLOUT);
+	return uring__set(context->sock, context, context->events);
+}
+
+
+/* Stop reading from a client. Errors and hang ups are still reported. */
+int mux_uring__remove_in(struct mosquitto *context)
+{
+	if(context->events & POLLIN){
+		context->events &= (uint32_t)~POLLIN;
+		return uring__set(context->sock, context, context->events);
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int mux_uring__delete(struct mosquitto *context)
+{
+	int fd = context->sock;
+
+	if(fd != INVALID_SOCKET && fd < fds_size && fds[fd].ptr == context){
+		/* The poll request holds a reference to the socket, so it must be
+		 * removed for the socket to be closed. */
+		uring__disarm(fd);
+		fds[fd].ptr = NULL;
+		fds[fd].events = 0;
+	}
+	return 0;
+}
+
+
+static void uring__accept(void)
+{
+	struct epoll_event ev[MAX_LISTEN_EVENTS];
+	struct mosquitto *context;
+	struct mosquitto__listener_sock *listensock;
+	int event_count;
+	int i;
+
+	event_count = epoll_wait(listen_epfd, ev, MAX_LISTEN_EVENTS, 0);
+	for(i=0; i<event_count; i++){
+		listensock = ev[i].data.ptr;
+		if(listensock->ident == id_listener){
+			while((context = net__socket_accept(listensock)) != NULL){
+				context->events = POLLIN;
+				mux__add_in(context);
+			}
+#ifdef WITH_WEBSOCKETS
+		}else if(listensock->ident == id_listener_ws){
+			/* Nothing needs to happen here, because we always call lws_service in the loop.
+			 * The important point is we've been woken up for this listener. */
+#endif
+		}
+	}
+}
+
+
+int mux_uring__handle(void)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	struct io_uring_cqe *cqe;
+	uint64_t user_data;
+	uint32_t events;
+	unsigned head;
+	int timeout;
+	int fd;
+	int rc;
+
+	if(uring__arm_dirty()){
+		timeout = mux__timeout();
+	}else{
+		timeout = 0;
+	}
+	uring__flush_sq();
+
+	memset(&ts, 0, sizeof(ts));
+	ts.tv_sec = timeout/1000;
+	ts.tv_nsec = (timeout%1000)*1000000;
+	memset(&arg, 0, sizeof(arg));
+	arg.sigmask = (uint64_t)(uintptr_t)&my_sigblock;
+	arg.sigmask_sz = _NSIG/8;
+	arg.ts = (uint64_t)(uintptr_t)&ts;
+
+	/* Submitting the poll requests and waiting for events is one call. */
+	rc = uring__enter(to_submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	if(rc < 0){
+		if(errno != EINTR && errno != ETIME && errno != EBUSY){
+			log__printf(NULL, MOSQ_LOG_ERR, "Error in io_uring waiting: %s.", strerror(errno));
+		}
+	}
+	to_submit = sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+
+	db.now_s = mosquitto_time();
+	db.now_real_s = time(NULL);
+
+	head = *cq_head;
+	while(head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)){
+		cqe = &cqes[head & *cq_mask];
+		user_data = cqe->user_data;
+		if(cqe->res < 0){
+			events = POLLERR;
+		}else{
+			events = (uint32_t)cqe->res;
+		}
+		head++;
+		__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+		if(user_data == 0) continue;
+		fd = (int)(user_data & 0xFFFFFFFF);
+		if(fd >= fds_size || fds[fd].ptr == NULL || fds[fd].gen != (uint32_t)(user_data >> 32)){
+			continue;
+		}
+
+		/* The request is used up, it is armed again before the next wait. */
+		fds[fd].armed_events = 0;
+		uring__set(fd, fds[fd].ptr, fds[fd].events);
+
+		if(fd == listen_epfd){
+			uring__accept();
+		}else if(fd == mux__wakeup_sock()){
+			mux__wakeup_drain();
+		}else{
+			loop_handle_reads_writes(fds[fd].ptr, events);
+		}
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int mux_uring__cleanup(void)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned count = 0;
+	int i;
+
+	if(sq_ring != MAP_FAILED && cq_ring != MAP_FAILED && sqes != MAP_FAILED){
+		/* Remove the poll requests so that the client sockets are really
+		 * closed when the broker closes them. */
+		for(i=0; i<fds_size; i++){
+			if(fds[i].armed_events){
+				uring__disarm(i);
+				count++;
+			}
+		}
+		uring__flush_sq();
+		memset(&ts, 0, sizeof(ts));
+		ts.tv_sec = 1;
+		memset(&arg, 0, sizeof(arg));
+		arg.ts = (uint64_t)(uintptr_t)&ts;
+		/* One completion for each removal and one for each request removed */
+		uring__enter(to_submit, count*2, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+		to_submit = 0;
+	}
+
+	if(sq_ring != MAP_FAILED){
+		munmap(sq_ring, sq_ring_size);
+		sq_ring = MAP_FAILED;
+	}
+	if(cq_ring != MAP_FAILED){
+		munmap(cq_ring, cq_ring_size);
+		cq_ring = MAP_FAILED;
+	}
+	if(sqes != MAP_FAILED){
+		munmap(sqes, sqes_size);
+		sqes = MAP_FAILED;
+	}
+	if(ring_fd != -1){
+		(void)close(ring_fd);
+		ring_fd = -1;
+	}
+	if(listen_epfd != -1){
+		(void)close(listen_epfd);
+		listen_epfd = -1;
+	}
+	mosquitto__free(fds);
+	fds = NULL;
+	fds_size = 0;
+	mosquitto__free(dirty_fds);
+	dirty_fds = NULL;
+	dirty_count = 0;
+	dirty_size = 0;
+	mosquitto__free(removals);
+	removals = NULL;
+	removal_count = 0;
+	removal_size = 0;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static void loop_handle_reads_writes(struct mosquitto *context, uint32_t events)
+{
+	int err;
+	socklen_t len;
+	int rc;
+
+	if(context->sock == INVALID_SOCKET){
+		return;
+	}
+
+#ifdef WITH_WEBSOCKETS
+	if(context->wsi){
+		struct lws_pollfd wspoll;
+		wspoll.fd = context->sock;
+		wspoll.events = (int16_t)context->events;
+		wspoll.revents = (int16_t)events;
+		lws_service_fd(lws_get_context(context->wsi), &wspoll);
+		return;
+	}
+#endif
+
+	if(events & POLLOUT
+#ifdef WITH_TLS
+			|| context->want_write
+			|| (context->ssl && context->state == mosq_cs_new)
+#endif
+			){
+
+		if(context->state == mosq_cs_connect_pending){
+			len = sizeof(int);
+			if(!getsockopt(context->sock, SOL_SOCKET, SO_ERROR, (char *)&err, &len)){
+				if(err == 0){
+					mosquitto__set_state(context, mosq_cs_new);
+#if defined(WITH_ADNS) && defined(WITH_BRIDGE)
+					if(context->bridge){
+						bridge__connect_step3(context);
+					}
+#endif
+				}
+			}else{
+				do_disconnect(context, MOSQ_ERR_CONN_LOST);
+				return;
+			}
+		}
+		rc = packet__write(context);
+		if(rc){
+			do_disconnect(context, rc);
+			return;
+		}
+	}
+
+	if(events & POLLIN
+#ifdef WITH_TLS
+			|| (context->ssl && context->state == mosq_cs_new)
+#endif
+			){
+
+		if(context->read_ready == false){
+			rc = mux__read(context);
+			if(rc){
+				do_disconnect(context, rc);
+				return;
+			}
+		}
+	}else{
+		if(events & (POLLERR | POLLHUP)){
+			do_disconnect(context, MOSQ_ERR_CONN_LOST);
+			return;
+		}
+	}
+}
+#endif
@@ -195,6 +195,10 @@ struct mosquitto *net__socket_accept(struct mosquitto__listener_sock *listensock
 	}
 	new_context->listener->client_count++;
 
+	if(new_context->listener->max_connections > 0 && new_context->listener->client_count > new_context->listener->max_connections){
+		/* Clients whose I/O thread hasn't yet seen them close still count. */
+		io_threads__finish_listener(new_context->listener);
+	}
 	if(new_context->listener->max_connections > 0 && new_context->listener->client_count > new_context->listener->max_connections){
 		if(db.config->connection_messages == true){
 			log__printf(NULL, MOSQ_LOG_NOTICE, "Client connection from %s denied: max_connections exceeded.", new_context->address);
@@ -245,6 +249,8 @@ struct mosquitto *net__socket_accept(struct mosquitto__listener_sock *listensock
 		log__printf(NULL, MOSQ_LOG_NOTICE, "New connection from %s:%d on port %d.",
 				new_context->address, new_context->remote_port, new_context->listener->port);
 	}
+	keepalive__add(new_context);
+	io_threads__add(new_context);
 
 	return new_context;
 }
@@ -375,6 +381,8 @@ int net__tls_server_ctx(struct mosquitto__listener *listener)
 	/* Use even less memory per SSL connection. */
 	SSL_CTX_set_mode(listener->ssl_ctx, SSL_MODE_RELEASE_BUFFERS);
 #endif
+	/* A retried write may come from a different buffer, see net__writev(). */
+	SSL_CTX_set_mode(listener->ssl_ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 
 #ifdef WITH_EC
 #if OPENSSL_VERSION_NUMBER >= 0x10002000L && OPENSSL_VERSION_NUMBER < 0x10100000L
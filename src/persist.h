@@ -31,6 +31,10 @@ extern const unsigned char magic[15];
 #define DB_CHUNK_RETAIN 4
 #define DB_CHUNK_SUB 5
 #define DB_CHUNK_CLIENT 6
+/* Journal only chunks */
+#define DB_CHUNK_CLIENT_MSG_REMOVE 7
+#define DB_CHUNK_SUB_REMOVE 8
+#define DB_CHUNK_CLIENT_REMOVE 9
 /* End DB read/write */
 
 #define read_e(f, b, c) if(fread(b, 1, c, f) != c){ goto error; }
@@ -145,6 +149,37 @@ struct P_retain{
 };
 
 
+struct PF_client_msg_remove{
+	uint16_t mid;
+	uint16_t id_len;
+	uint8_t direction;
+};
+struct P_client_msg_remove{
+	struct PF_client_msg_remove F;
+	char *client_id;
+};
+
+
+struct PF_sub_remove{
+	uint16_t id_len;
+	uint16_t topic_len;
+};
+struct P_sub_remove{
+	struct PF_sub_remove F;
+	char *client_id;
+	char *topic;
+};
+
+
+struct PF_client_remove{
+	uint16_t id_len;
+};
+struct P_client_remove{
+	struct PF_client_remove F;
+	char *client_id;
+};
+
+
 int persist__read_string_len(FILE *db_fptr, char **str, uint16_t len);
 int persist__read_string(FILE *db_fptr, char **str);
 
@@ -165,6 +200,9 @@ int persist__chunk_client_msg_read_v56(FILE *db_fptr, struct P_client_msg *chunk
 int persist__chunk_msg_store_read_v56(FILE *db_fptr, struct P_msg_store *chunk, uint32_t length);
 int persist__chunk_retain_read_v56(FILE *db_fptr, struct P_retain *chunk);
 int persist__chunk_sub_read_v56(FILE *db_fptr, struct P_sub *chunk);
+int persist__chunk_client_msg_remove_read_v56(FILE *db_fptr, struct P_client_msg_remove *chunk);
+int persist__chunk_sub_remove_read_v56(FILE *db_fptr, struct P_sub_remove *chunk);
+int persist__chunk_client_remove_read_v56(FILE *db_fptr, struct P_client_remove *chunk);
 
 int persist__chunk_cfg_write_v6(FILE *db_fptr, struct PF_cfg *chunk);
 int persist__chunk_client_write_v6(FILE *db_fptr, struct P_client *chunk);
@@ -172,5 +210,14 @@ int persist__chunk_client_msg_write_v6(FILE *db_fptr, struct P_client_msg *chunk
 int persist__chunk_message_store_write_v6(FILE *db_fptr, struct P_msg_store *chunk);
 int persist__chunk_retain_write_v6(FILE *db_fptr, struct P_retain *chunk);
 int persist__chunk_sub_write_v6(FILE *db_fptr, struct P_sub *chunk);
+int persist__chunk_client_msg_remove_write_v6(FILE *db_fptr, struct P_client_msg_remove *chunk);
+int persist__chunk_sub_remove_write_v6(FILE *db_fptr, struct P_sub_remove *chunk);
+int persist__chunk_client_remove_write_v6(FILE *db_fptr, struct P_client_remove *chunk);
+
+int persist__file_header_write(FILE *db_fptr);
+
+int persist__journal_rotate(void);
+void persist__journal_truncate(void);
+void persist__journal_prev_remove(void);
 
 #endif
@@ -0,0 +1,504 @@
+/*
+Copyright (c) 2022 Roger Light <roger@atchoo.org>
+
+All rights reserved. This program and the accompanying materials
+are made available under the terms of the Eclipse Public License 2.0
+and Eclipse Distribution License v1.0 which accompany this distribution.
+
+The Eclipse Public License is available at
+   https://www.eclipse.org/legal/epl-2.0/
+and the Eclipse Distribution License is available at
+  http://www.eclipse.org/org/documents/edl-v10.php.
+
+SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+
+Contributors:
+   Roger Light - initial implementation and documentation.
+*/
+
+/* Append only journal of changes to persistent sessions and retained
+ * messages made since the last save of the in-memory database.
+ *
+ * The journal uses the same chunks as the database file, plus a few chunks
+ * that record removals. Messages are written to the journal the first time a
+ * QoS>0 client message or a retained message refers to them. Writes are
+ * buffered and flushed to disk once per main loop iteration, so a busy broker
+ * makes one fsync() for many changes.
+ *
+ * On start, the journal is replayed on top of the database file. It is
+ * truncated after each successful save. A background save moves the journal
+ * aside to <file>.journal.prev before forking, so that changes made while the
+ * save is running go to a new journal, and removes it once the save has
+ * finished.
+ *
+ * If writing to the journal fails, the journal is cut back to its last
+ * complete sync and closed, and a full save is requested. Nothing is
+ * journalled until that save has been made, because the journal would be
+ * missing the changes that couldn't be written.
+ */
+
+#include "config.h"
+
+#ifdef WITH_PERSISTENCE
+
+#ifndef WIN32
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mosquitto_broker_internal.h"
+#include "memory_mosq.h"
+#include "misc_mosq.h"
+#include "mqtt_protocol.h"
+#include "persist.h"
+
+#define JOURNAL_HEADER_LEN (15 + 2*sizeof(uint32_t))
+
+static FILE *journal_fptr = NULL;
+static char *journal_path = NULL;
+static char *journal_prev_path = NULL;
+static bool journal_dirty = false;
+static bool journal_failed = false;
+static long journal_synced_len = 0;
+
+extern bool flag_db_backup;
+
+
+static bool journal__context_wanted(struct mosquitto *context)
+{
+	if(journal_fptr == NULL || context->id == NULL || context->id[0] == '\0'){
+		return false;
+	}
+	if(context->clean_start == false){
+		return true;
+	}
+#ifdef WITH_BRIDGE
+	if(context->bridge && context->bridge->clean_start_local == false){
+		return true;
+	}
+#endif
+	return false;
+}
+
+
+static bool journal__msg_wanted(struct mosquitto *context, struct mosquitto_client_msg *cmsg)
+{
+	if(cmsg->qos == 0 || cmsg->store == NULL || cmsg->store->topic == NULL){
+		return false;
+	}
+	if(!strncmp(cmsg->store->topic, "$SYS", 4)){
+		/* Not in the database file either */
+		return false;
+	}
+	return journal__context_wanted(context);
+}
+
+
+static void journal__fail(void)
+{
+	int err = errno;
+
+	log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to write to persistence journal %s: %s. Saving in-memory database instead.",
+			journal_path, strerror(err));
+	fclose(journal_fptr);
+	journal_fptr = NULL;
+#ifndef WIN32
+	/* Anything after the last sync may end part way through a chunk. */
+	if(truncate(journal_path, journal_synced_len)){
+		log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Unable to truncate persistence journal %s: %s.",
+				journal_path, strerror(errno));
+	}
+#endif
+	journal_dirty = false;
+	journal_failed = true;
+	flag_db_backup = true;
+}
+
+
+static int journal__create(const char *mode)
+{
+	journal_fptr = mosquitto__fopen(journal_path, mode, true);
+	if(journal_fptr == NULL){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to open persistence journal %s: %s.",
+				journal_path, strerror(errno));
+		return 1;
+	}
+	fseek(journal_fptr, 0, SEEK_END);
+	journal_synced_len = ftell(journal_fptr);
+	if(journal_synced_len == 0){
+		if(persist__file_header_write(journal_fptr)){
+			fclose(journal_fptr);
+			journal_fptr = NULL;
+			return 1;
+		}
+		journal_dirty = true;
+	}
+	journal_failed = false;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int persist__journal_open(void)
+{
+	size_t len;
+
+	if(db.config->persistence == false
+			|| db.config->persistence_filepath == NULL
+			|| db.config->persistence_journal == false){
+
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	len = strlen(db.config->persistence_filepath) + strlen(".journal.prev") + 1;
+	journal_path = mosquitto__malloc(len);
+	journal_prev_path = mosquitto__malloc(len);
+	if(journal_path == NULL || journal_prev_path == NULL){
+		mosquitto__free(journal_path);
+		mosquitto__free(journal_prev_path);
+		journal_path = NULL;
+		journal_prev_path = NULL;
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Out of memory.");
+		return MOSQ_ERR_NOMEM;
+	}
+	snprintf(journal_path, len, "%s.journal", db.config->persistence_filepath);
+	snprintf(journal_prev_path, len, "%s.journal.prev", db.config->persistence_filepath);
+
+	return journal__create("ab");
+}
+
+
+void persist__journal_close(void)
+{
+	persist__journal_sync();
+	if(journal_fptr){
+		fclose(journal_fptr);
+		journal_fptr = NULL;
+	}
+	mosquitto__free(journal_path);
+	mosquitto__free(journal_prev_path);
+	journal_path = NULL;
+	journal_prev_path = NULL;
+}
+
+
+/* Called once per main loop iteration. */
+void persist__journal_sync(void)
+{
+	if(journal_fptr == NULL || journal_dirty == false) return;
+
+	if(fflush(journal_fptr)){
+		journal__fail();
+		return;
+	}
+#ifndef WIN32
+	if(fsync(fileno(journal_fptr))){
+		journal__fail();
+		return;
+	}
+#endif
+	journal_synced_len = ftell(journal_fptr);
+	journal_dirty = false;
+}
+
+
+/* Start a new journal, after the in-memory database has been saved. This
+ * also starts journalling again after a failed write. */
+void persist__journal_truncate(void)
+{
+	if(journal_fptr == NULL && journal_failed == false) return;
+
+	if(journal_fptr){
+		fclose(journal_fptr);
+		journal_fptr = NULL;
+	}
+	if(journal__create("wb") == MOSQ_ERR_SUCCESS){
+		persist__journal_sync();
+	}
+	persist__journal_prev_remove();
+}
+
+
+static int journal__append_to_prev(void)
+{
+	FILE *in_fptr, *out_fptr;
+	char buf[4096];
+	size_t len;
+	int rc = 0;
+
+	in_fptr = mosquitto__fopen(journal_path, "rb", false);
+	if(in_fptr == NULL) return 1;
+	out_fptr = mosquitto__fopen(journal_prev_path, "ab", true);
+	if(out_fptr == NULL){
+		fclose(in_fptr);
+		return 1;
+	}
+
+	if(fseek(in_fptr, (long)JOURNAL_HEADER_LEN, SEEK_SET) == 0){
+		while((len = fread(buf, 1, sizeof(buf), in_fptr)) > 0){
+			if(fwrite(buf, 1, len, out_fptr) != len){
+				rc = 1;
+				break;
+			}
+		}
+	}
+	fflush(out_fptr);
+#ifndef WIN32
+	fsync(fileno(out_fptr));
+#endif
+	fclose(out_fptr);
+	fclose(in_fptr);
+	return rc;
+}
+
+
+/* Move the journal aside before a background save, and start a new one for
+ * changes made while the save is running. If an earlier background save
+ * failed, the journal is added to the end of the one it left behind. */
+int persist__journal_rotate(void)
+{
+	FILE *prev_fptr;
+	int rc;
+
+	if(journal_fptr == NULL && journal_failed == false) return MOSQ_ERR_SUCCESS;
+
+	persist__journal_sync();
+	if(journal_fptr){
+		fclose(journal_fptr);
+		journal_fptr = NULL;
+	}
+
+	prev_fptr = mosquitto__fopen(journal_prev_path, "rb", false);
+	if(prev_fptr == NULL){
+		rc = rename(journal_path, journal_prev_path);
+	}else{
+		fclose(prev_fptr);
+		rc = journal__append_to_prev();
+	}
+	if(rc){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to move persistence journal %s aside.", journal_path);
+		if(journal_failed == false){
+			journal__create("ab");
+		}
+		return 1;
+	}
+
+	if(journal__create("wb")) return 1;
+	persist__journal_sync();
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+void persist__journal_prev_remove(void)
+{
+	if(journal_prev_path == NULL) return;
+
+	if(remove(journal_prev_path) != 0 && errno != ENOENT){
+		log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Unable to remove %s: %s.",
+				journal_prev_path, strerror(errno));
+	}
+}
+
+
+static int journal__store(struct mosquitto_msg_store *stored)
+{
+	struct P_msg_store chunk;
+
+	if(stored->journalled) return MOSQ_ERR_SUCCESS;
+
+	memset(&chunk, 0, sizeof(struct P_msg_store));
+
+	chunk.F.store_id = stored->db_id;
+	chunk.F.expiry_time = stored->message_expiry_time;
+	chunk.F.payloadlen = stored->payloadlen;
+	chunk.F.source_mid = stored->source_mid;
+	if(stored->source_id){
+		chunk.F.source_id_len = (uint16_t)strlen(stored->source_id);
+		chunk.source.id = stored->source_id;
+	}
+	if(stored->source_username){
+		chunk.F.source_username_len = (uint16_t)strlen(stored->source_username);
+		chunk.source.username = stored->source_username;
+	}
+	chunk.F.topic_len = (uint16_t)strlen(stored->topic);
+	chunk.topic = stored->topic;
+	if(stored->source_listener){
+		chunk.F.source_port = stored->source_listener->port;
+	}
+	chunk.F.qos = stored->qos;
+	chunk.F.retain = (uint8_t)stored->retain;
+	chunk.payload = stored->payload;
+	chunk.properties = stored->properties;
+
+	if(persist__chunk_message_store_write_v6(journal_fptr, &chunk)){
+		journal__fail();
+		return 1;
+	}
+	stored->journalled = true;
+	journal_dirty = true;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+void persist__journal_client(struct mosquitto *context)
+{
+	struct P_client chunk;
+
+	if(!journal__context_wanted(context)) return;
+
+	memset(&chunk, 0, sizeof(struct P_client));
+
+	if(context->session_expiry_interval != 0 && context->session_expiry_interval != UINT32_MAX && context->session_expiry_time == 0){
+		chunk.F.session_expiry_time = context->session_expiry_interval + db.now_real_s;
+	}else{
+		chunk.F.session_expiry_time = context->session_expiry_time;
+	}
+	chunk.F.session_expiry_interval = context->session_expiry_interval;
+	chunk.F.last_mid = context->last_mid;
+	chunk.F.id_len = (uint16_t)strlen(context->id);
+	chunk.client_id = context->id;
+	if(context->username){
+		chunk.F.username_len = (uint16_t)strlen(context->username);
+		chunk.username = context->username;
+	}
+	if(context->listener){
+		chunk.F.listener_port = context->listener->port;
+	}
+
+	if(persist__chunk_client_write_v6(journal_fptr, &chunk)){
+		journal__fail();
+		return;
+	}
+	journal_dirty = true;
+}
+
+
+void persist__journal_client_remove(struct mosquitto *context)
+{
+	struct P_client_remove chunk;
+
+	if(!journal__context_wanted(context)) return;
+
+	memset(&chunk, 0, sizeof(struct P_client_remove));
+	chunk.F.id_len = (uint16_t)strlen(context->id);
+	chunk.client_id = context->id;
+
+	if(persist__chunk_client_remove_write_v6(journal_fptr, &chunk)){
+		journal__fail();
+		return;
+	}
+	journal_dirty = true;
+}
+
+
+void persist__journal_client_msg(struct mosquitto *context, struct mosquitto_client_msg *cmsg)
+{
+	struct P_client_msg chunk;
+
+	if(!journal__msg_wanted(context, cmsg)) return;
+	if(journal__store(cmsg->store)) return;
+
+	memset(&chunk, 0, sizeof(struct P_client_msg));
+	chunk.F.store_id = cmsg->store->db_id;
+	chunk.F.mid = cmsg->mid;
+	chunk.F.id_len = (uint16_t)strlen(context->id);
+	chunk.F.qos = cmsg->qos;
+	chunk.F.retain_dup = (uint8_t)((cmsg->retain&0x0F)<<4 | (cmsg->dup&0x0F));
+	chunk.F.direction = (uint8_t)cmsg->direction;
+	chunk.F.state = (uint8_t)cmsg->state;
+	chunk.client_id = context->id;
+	chunk.properties = cmsg->properties;
+
+	if(persist__chunk_client_msg_write_v6(journal_fptr, &chunk)){
+		journal__fail();
+		return;
+	}
+	journal_dirty = true;
+}
+
+
+void persist__journal_client_msg_remove(struct mosquitto *context, struct mosquitto_client_msg *cmsg)
+{
+	struct P_client_msg_remove chunk;
+
+	if(!journal__msg_wanted(context, cmsg)) return;
+
+	memset(&chunk, 0, sizeof(struct P_client_msg_remove));
+	chunk.F.mid = cmsg->mid;
+	chunk.F.id_len = (uint16_t)strlen(context->id);
+	chunk.F.direction = (uint8_t)cmsg->direction;
+	chunk.client_id = context->id;
+
+	if(persist__chunk_client_msg_remove_write_v6(journal_fptr, &chunk)){
+		journal__fail();
+		return;
+	}
+	journal_dirty = true;
+}
+
+
+void persist__journal_sub(struct mosquitto *context, const char *sub, uint8_t qos, uint32_t identifier, int options)
+{
+	struct P_sub chunk;
+
+	if(!journal__context_wanted(context)) return;
+
+	memset(&chunk, 0, sizeof(struct P_sub));
+	chunk.F.identifier = identifier;
+	chunk.F.id_len = (uint16_t)strlen(context->id);
+	chunk.F.topic_len = (uint16_t)strlen(sub);
+	chunk.F.qos = qos;
+	chunk.F.options = (uint8_t)(options & (MQTT_SUB_OPT_NO_LOCAL | MQTT_SUB_OPT_RETAIN_AS_PUBLISHED));
+	chunk.client_id = context->id;
+	chunk.topic = (char *)sub;
+
+	if(persist__chunk_sub_write_v6(journal_fptr, &chunk)){
+		journal__fail();
+		return;
+	}
+	journal_dirty = true;
+}
+
+
+void persist__journal_sub_remove(struct mosquitto *context, const char *sub)
+{
+	struct P_sub_remove chunk;
+
+	if(!journal__context_wanted(context)) return;
+
+	memset(&chunk, 0, sizeof(struct P_sub_remove));
+	chunk.F.id_len = (uint16_t)strlen(context->id);
+	chunk.F.topic_len = (uint16_t)strlen(sub);
+	chunk.client_id = context->id;
+	chunk.topic = (char *)sub;
+
+	if(persist__chunk_sub_remove_write_v6(journal_fptr, &chunk)){
+		journal__fail();
+		return;
+	}
+	journal_dirty = true;
+}
+
+
+/* A retained message with an empty payload is journalled too, so that
+ * replaying it clears the retained message. */
+void persist__journal_retain(struct mosquitto_msg_store *stored)
+{
+	struct P_retain chunk;
+
+	if(journal_fptr == NULL || stored->topic == NULL) return;
+	if(journal__store(stored)) return;
+
+	memset(&chunk, 0, sizeof(struct P_retain));
+	chunk.F.store_id = stored->db_id;
+
+	if(persist__chunk_retain_write_v6(journal_fptr, &chunk)){
+		journal__fail();
+		return;
+	}
+	journal_dirty = true;
+}
+
+#endif
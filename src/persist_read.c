@@ -22,6 +22,7 @@ Contributors:
 
 #ifndef WIN32
 #include <arpa/inet.h>
+#include <unistd.h>
 #endif
 #include <assert.h>
 #include <errno.h>
@@ -40,6 +41,7 @@ Contributors:
 #include "util_mosq.h"
 
 uint32_t db_version;
+static bool journal_replay = false;
 
 const unsigned char magic[15] = {0x00, 0xB5, 0x00, 'm','o','s','q','u','i','t','t','o',' ','d','b'};
 
@@ -109,6 +111,20 @@ int persist__read_string(FILE *db_fptr, char **str)
 }
 
 
+static struct mosquitto_client_msg *persist__client_msg_find(struct mosquitto_msg_data *msg_data, uint16_t mid)
+{
+	struct mosquitto_client_msg *cmsg;
+
+	HASH_FIND(hh_mid, msg_data->inflight_by_mid, &mid, sizeof(mid), cmsg);
+	if(cmsg) return cmsg;
+
+	DL_FOREACH(msg_data->queued, cmsg){
+		if(cmsg->mid == mid) return cmsg;
+	}
+	return NULL;
+}
+
+
 static int persist__client_msg_restore(struct P_client_msg *chunk)
 {
 	struct mosquitto_client_msg *cmsg;
@@ -128,7 +144,22 @@ static int persist__client_msg_restore(struct P_client_msg *chunk)
 		return 0;
 	}
 
-	cmsg = mosquitto__calloc(1, sizeof(struct mosquitto_client_msg));
+	if(journal_replay && chunk->F.mid != 0){
+		/* The journal records state changes as another copy of the message */
+		if(chunk->F.direction == mosq_md_out){
+			cmsg = persist__client_msg_find(&context->msgs_out, chunk->F.mid);
+		}else{
+			cmsg = persist__client_msg_find(&context->msgs_in, chunk->F.mid);
+		}
+		if(cmsg){
+			cmsg->state = chunk->F.state;
+			cmsg->dup = chunk->F.retain_dup&0x0F;
+			mosquitto_property_free_all(&chunk->properties);
+			return MOSQ_ERR_SUCCESS;
+		}
+	}
+
+	cmsg = mosquitto__slab_calloc(sizeof(struct mosquitto_client_msg));
 	if(!cmsg){
 		log__printf(NULL, MOSQ_LOG_ERR, "Error: Out of memory.");
 		return MOSQ_ERR_NOMEM;
@@ -159,6 +190,9 @@ static int persist__client_msg_restore(struct P_client_msg *chunk)
 		db__msg_add_to_queued_stats(msg_data, cmsg);
 	}else{
 		DL_APPEND(msg_data->inflight, cmsg);
+		if(cmsg->mid != 0){
+			HASH_ADD(hh_mid, msg_data->inflight_by_mid, mid, sizeof(cmsg->mid), cmsg);
+		}
 		if(chunk->F.qos > 0 && msg_data->inflight_quota > 0){
 			msg_data->inflight_quota--;
 		}
@@ -265,6 +299,20 @@ static int persist__msg_store_chunk_restore(FILE *db_fptr, uint32_t length)
 		return rc;
 	}
 
+	if(chunk.F.store_id > db.last_db_id){
+		db.last_db_id = chunk.F.store_id;
+	}
+	HASH_FIND(hh, db.msg_store_load, &chunk.F.store_id, sizeof(dbid_t), load);
+	if(load){
+		/* Already restored, the journal can repeat a message */
+		mosquitto__free(chunk.source.id);
+		mosquitto__free(chunk.source.username);
+		mosquitto__free(chunk.topic);
+		mosquitto__free(chunk.payload);
+		mosquitto_property_free_all(&chunk.properties);
+		return MOSQ_ERR_SUCCESS;
+	}
+
 	if(chunk.F.source_port){
 		for(i=0; i<db.config->listener_count; i++){
 			if(db.config->listeners[i].port == chunk.F.source_port){
@@ -300,7 +348,7 @@ static int persist__msg_store_chunk_restore(FILE *db_fptr, uint32_t length)
 		message_expiry_interval = 0;
 	}
 
-	stored = mosquitto__calloc(1, sizeof(struct mosquitto_msg_store));
+	stored = mosquitto__slab_calloc(sizeof(struct mosquitto_msg_store));
 	if(stored == NULL){
 		mosquitto__free(load);
 		mosquitto__free(chunk.source.id);
@@ -329,6 +377,7 @@ static int persist__msg_store_chunk_restore(FILE *db_fptr, uint32_t length)
 
 	if(rc == MOSQ_ERR_SUCCESS){
 		stored->source_listener = chunk.source.listener;
+		stored->journalled = true;
 		load->db_id = stored->db_id;
 		load->store = stored;
 
@@ -345,8 +394,6 @@ static int persist__retain_chunk_restore(FILE *db_fptr)
 	struct mosquitto_msg_store_load *load;
 	struct P_retain chunk;
 	int rc;
-	char **split_topics;
-	char *local_topic;
 
 	memset(&chunk, 0, sizeof(struct P_retain));
 
@@ -361,10 +408,7 @@ static int persist__retain_chunk_restore(FILE *db_fptr)
 
 	HASH_FIND(hh, db.msg_store_load, &chunk.F.store_id, sizeof(dbid_t), load);
 	if(load){
-		if(sub__topic_tokenise(load->store->topic, &local_topic, &split_topics, NULL)) return 1;
-		retain__store(load->store->topic, load->store, split_topics);
-		mosquitto__free(local_topic);
-		mosquitto__free(split_topics);
+		if(retain__store(load->store) == MOSQ_ERR_INVAL) return 1;
 	}else{
 		/* Can't find the message - probably expired */
 	}
@@ -396,6 +440,86 @@ static int persist__sub_chunk_restore(FILE *db_fptr)
 }
 
 
+static int persist__client_msg_remove_chunk_restore(FILE *db_fptr)
+{
+	struct P_client_msg_remove chunk;
+	struct mosquitto *context;
+	int rc;
+
+	memset(&chunk, 0, sizeof(struct P_client_msg_remove));
+
+	rc = persist__chunk_client_msg_remove_read_v56(db_fptr, &chunk);
+	if(rc){
+		return rc;
+	}
+
+	if(chunk.client_id){
+		HASH_FIND(hh_id, db.contexts_by_id, chunk.client_id, strlen(chunk.client_id), context);
+		if(context){
+			db__message_remove_by_mid(context, chunk.F.direction, chunk.F.mid);
+		}
+	}
+	mosquitto__free(chunk.client_id);
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static int persist__sub_remove_chunk_restore(FILE *db_fptr)
+{
+	struct P_sub_remove chunk;
+	struct mosquitto *context;
+	uint8_t reason;
+	int rc;
+
+	memset(&chunk, 0, sizeof(struct P_sub_remove));
+
+	rc = persist__chunk_sub_remove_read_v56(db_fptr, &chunk);
+	if(rc){
+		return rc;
+	}
+
+	if(chunk.client_id && chunk.topic){
+		HASH_FIND(hh_id, db.contexts_by_id, chunk.client_id, strlen(chunk.client_id), context);
+		if(context){
+			sub__remove(context, chunk.topic, db.subs, &reason);
+		}
+	}
+	mosquitto__free(chunk.client_id);
+	mosquitto__free(chunk.topic);
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static int persist__client_remove_chunk_restore(FILE *db_fptr)
+{
+	struct P_client_remove chunk;
+	struct mosquitto *context;
+	int rc;
+
+	memset(&chunk, 0, sizeof(struct P_client_remove));
+
+	rc = persist__chunk_client_remove_read_v56(db_fptr, &chunk);
+	if(rc){
+		return rc;
+	}
+
+	if(chunk.client_id){
+		HASH_FIND(hh_id, db.contexts_by_id, chunk.client_id, strlen(chunk.client_id), context);
+		if(context){
+			/* The session ended, it is freed with the other disused
+			 * contexts once the broker is running. */
+			session_expiry__remove(context);
+			context__add_to_disused(context);
+		}
+	}
+	mosquitto__free(chunk.client_id);
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+
 int persist__chunk_header_read(FILE *db_fptr, uint32_t *chunk, uint32_t *length)
 {
 	if(db_version == 6 || db_version == 5){
@@ -406,7 +530,7 @@ int persist__chunk_header_read(FILE *db_fptr, uint32_t *chunk, uint32_t *length)
 }
 
 
-int persist__restore(void)
+static int persist__file_restore(void)
 {
 	FILE *fptr;
 	char header[15];
@@ -416,17 +540,8 @@ int persist__restore(void)
 	uint32_t chunk, length;
 	size_t rlen;
 	char *err;
-	struct mosquitto_msg_store_load *load, *load_tmp;
 	struct PF_cfg cfg_chunk;
 
-	assert(db.config);
-
-	if(!db.config->persistence || db.config->persistence_filepath == NULL){
-		return MOSQ_ERR_SUCCESS;
-	}
-
-	db.msg_store_load = NULL;
-
 	fptr = mosquitto__fopen(db.config->persistence_filepath, "rb", false);
 	if(fptr == NULL) return MOSQ_ERR_SUCCESS;
 	rlen = fread(&header, 1, 15, fptr);
@@ -530,11 +645,6 @@ int persist__restore(void)
 	}
 
 	fclose(fptr);
-
-	HASH_ITER(hh, db.msg_store_load, load, load_tmp){
-		HASH_DELETE(hh, db.msg_store_load, load);
-		mosquitto__free(load);
-	}
 	return rc;
 error:
 	err = strerror(errno);
@@ -543,6 +653,158 @@ error:
 	return 1;
 }
 
+
+static int persist__journal_chunk_restore(FILE *fptr, uint32_t chunk, uint32_t length)
+{
+	switch(chunk){
+		case DB_CHUNK_MSG_STORE:
+			return persist__msg_store_chunk_restore(fptr, length);
+		case DB_CHUNK_CLIENT_MSG:
+			return persist__client_msg_chunk_restore(fptr, length);
+		case DB_CHUNK_RETAIN:
+			return persist__retain_chunk_restore(fptr);
+		case DB_CHUNK_SUB:
+			return persist__sub_chunk_restore(fptr);
+		case DB_CHUNK_CLIENT:
+			return persist__client_chunk_restore(fptr);
+		case DB_CHUNK_CLIENT_MSG_REMOVE:
+			return persist__client_msg_remove_chunk_restore(fptr);
+		case DB_CHUNK_SUB_REMOVE:
+			return persist__sub_remove_chunk_restore(fptr);
+		case DB_CHUNK_CLIENT_REMOVE:
+			return persist__client_remove_chunk_restore(fptr);
+		default:
+			log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Unsupported chunk \"%d\" in persistence journal. Ignoring.", chunk);
+			fseek(fptr, length, SEEK_CUR);
+			return MOSQ_ERR_SUCCESS;
+	}
+}
+
+
+/* Replay a journal on top of the database file. A chunk that is cut short
+ * was being written when the broker stopped, so it and anything after it is
+ * discarded, and the journal is truncated so that new chunks can be added
+ * after the last complete one. */
+static int persist__journal_restore(const char *path)
+{
+	FILE *fptr;
+	char header[15];
+	uint32_t crc;
+	uint32_t i32temp;
+	uint32_t chunk, length;
+	long pos, end;
+	int count = 0;
+	int rc = 0;
+
+	fptr = mosquitto__fopen(path, "rb", false);
+	if(fptr == NULL) return MOSQ_ERR_SUCCESS;
+
+	if(fread(&header, 1, 15, fptr) != 15
+			|| memcmp(header, magic, 15)
+			|| fread(&crc, 1, sizeof(uint32_t), fptr) != sizeof(uint32_t)
+			|| fread(&i32temp, 1, sizeof(uint32_t), fptr) != sizeof(uint32_t)
+			|| ntohl(i32temp) != MOSQ_DB_VERSION){
+
+		fclose(fptr);
+		log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Ignoring persistence journal %s, unrecognised file format.", path);
+		return MOSQ_ERR_SUCCESS;
+	}
+	db_version = MOSQ_DB_VERSION;
+
+	pos = ftell(fptr);
+	fseek(fptr, 0, SEEK_END);
+	end = ftell(fptr);
+	fseek(fptr, pos, SEEK_SET);
+
+	journal_replay = true;
+	while(persist__chunk_header_read(fptr, &chunk, &length) == MOSQ_ERR_SUCCESS){
+		if(pos + (long)sizeof(struct PF_header) + (long)length > end){
+			break;
+		}
+		rc = persist__journal_chunk_restore(fptr, chunk, length);
+		if(rc){
+			break;
+		}
+		count++;
+		pos += (long)sizeof(struct PF_header) + (long)length;
+		fseek(fptr, pos, SEEK_SET);
+	}
+	journal_replay = false;
+	fclose(fptr);
+
+	if(rc){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to replay persistence journal %s.", path);
+		return rc;
+	}
+	if(count > 0){
+		log__printf(NULL, MOSQ_LOG_INFO, "Replayed %d changes from persistence journal %s.", count, path);
+	}
+#ifndef WIN32
+	if(pos < end){
+		log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Discarding incomplete change at the end of persistence journal %s.", path);
+		if(truncate(path, pos)){
+			log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to truncate %s: %s.", path, strerror(errno));
+			return 1;
+		}
+	}
+#endif
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static int persist__journals_restore(void)
+{
+	char *path;
+	size_t len;
+	int rc;
+
+	len = strlen(db.config->persistence_filepath) + strlen(".journal.prev") + 1;
+	path = mosquitto__malloc(len);
+	if(!path){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Out of memory.");
+		return MOSQ_ERR_NOMEM;
+	}
+
+	/* Left behind by a background save that didn't finish */
+	snprintf(path, len, "%s.journal.prev", db.config->persistence_filepath);
+	rc = persist__journal_restore(path);
+	if(rc == MOSQ_ERR_SUCCESS){
+		snprintf(path, len, "%s.journal", db.config->persistence_filepath);
+		rc = persist__journal_restore(path);
+	}
+	mosquitto__free(path);
+
+	/* Messages whose clients all finished with them */
+	db__msg_store_compact();
+	return rc;
+}
+
+
+int persist__restore(void)
+{
+	struct mosquitto_msg_store_load *load, *load_tmp;
+	int rc;
+
+	assert(db.config);
+
+	if(!db.config->persistence || db.config->persistence_filepath == NULL){
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	db.msg_store_load = NULL;
+
+	rc = persist__file_restore();
+	if(rc == MOSQ_ERR_SUCCESS && db.config->persistence_journal){
+		rc = persist__journals_restore();
+	}
+
+	HASH_ITER(hh, db.msg_store_load, load, load_tmp){
+		HASH_DELETE(hh, db.msg_store_load, load);
+		mosquitto__free(load);
+	}
+	return rc;
+}
+
 static int persist__restore_sub(const char *client_id, const char *sub, uint8_t qos, uint32_t identifier, int options)
 {
 	struct mosquitto *context;
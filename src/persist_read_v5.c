@@ -276,4 +276,55 @@ error:
 	return 1;
 }
 
+
+int persist__chunk_client_msg_remove_read_v56(FILE *db_fptr, struct P_client_msg_remove *chunk)
+{
+	read_e(db_fptr, &chunk->F, sizeof(struct PF_client_msg_remove));
+	chunk->F.mid = ntohs(chunk->F.mid);
+	chunk->F.id_len = ntohs(chunk->F.id_len);
+
+	return persist__read_string_len(db_fptr, &chunk->client_id, chunk->F.id_len);
+error:
+	log__printf(NULL, MOSQ_LOG_ERR, "Error: %s.", strerror(errno));
+	return 1;
+}
+
+
+int persist__chunk_sub_remove_read_v56(FILE *db_fptr, struct P_sub_remove *chunk)
+{
+	int rc;
+
+	read_e(db_fptr, &chunk->F, sizeof(struct PF_sub_remove));
+	chunk->F.id_len = ntohs(chunk->F.id_len);
+	chunk->F.topic_len = ntohs(chunk->F.topic_len);
+
+	rc = persist__read_string_len(db_fptr, &chunk->client_id, chunk->F.id_len);
+	if(rc){
+		return rc;
+	}
+	rc = persist__read_string_len(db_fptr, &chunk->topic, chunk->F.topic_len);
+	if(rc){
+		mosquitto__free(chunk->client_id);
+		chunk->client_id = NULL;
+		return rc;
+	}
+
+	return MOSQ_ERR_SUCCESS;
+error:
+	log__printf(NULL, MOSQ_LOG_ERR, "Error: %s.", strerror(errno));
+	return 1;
+}
+
+
+int persist__chunk_client_remove_read_v56(FILE *db_fptr, struct P_client_remove *chunk)
+{
+	read_e(db_fptr, &chunk->F, sizeof(struct PF_client_remove));
+	chunk->F.id_len = ntohs(chunk->F.id_len);
+
+	return persist__read_string_len(db_fptr, &chunk->client_id, chunk->F.id_len);
+error:
+	log__printf(NULL, MOSQ_LOG_ERR, "Error: %s.", strerror(errno));
+	return 1;
+}
+
 #endif
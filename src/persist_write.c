@@ -22,6 +22,8 @@ Contributors:
 
 #ifndef WIN32
 #include <arpa/inet.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #endif
 #include <assert.h>
 #include <errno.h>
@@ -308,23 +310,20 @@ static int persist__retain_save_all(FILE *db_fptr)
 	return MOSQ_ERR_SUCCESS;
 }
 
-int persist__backup(bool shutdown)
+#ifndef WIN32
+static pid_t background_pid = 0;
+#endif
+
+
+static int persist__write(bool shutdown)
 {
 	int rc = 0;
 	FILE *db_fptr = NULL;
-	uint32_t db_version_w = htonl(MOSQ_DB_VERSION);
-	uint32_t crc = 0;
 	char *err;
 	char *outfile = NULL;
 	size_t len;
 	struct PF_cfg cfg_chunk;
 
-	if(db.config == NULL) return MOSQ_ERR_INVAL;
-	if(db.config->persistence == false) return MOSQ_ERR_SUCCESS;
-	if(db.config->persistence_filepath == NULL) return MOSQ_ERR_INVAL;
-
-	log__printf(NULL, MOSQ_LOG_INFO, "Saving in-memory database to %s.", db.config->persistence_filepath);
-
 	len = strlen(db.config->persistence_filepath)+5;
 	outfile = mosquitto__malloc(len+1);
 	if(!outfile){
@@ -371,9 +370,9 @@ int persist__backup(bool shutdown)
 	}
 
 	/* Header */
-	write_e(db_fptr, magic, 15);
-	write_e(db_fptr, &crc, sizeof(uint32_t));
-	write_e(db_fptr, &db_version_w, sizeof(uint32_t));
+	if(persist__file_header_write(db_fptr)){
+		goto error;
+	}
 
 	memset(&cfg_chunk, 0, sizeof(struct PF_cfg));
 	cfg_chunk.last_db_id = db.last_db_id;
@@ -441,4 +440,148 @@ error:
 }
 
 
+/* Write the database, then start a new journal if that succeeded. */
+static int persist__write_journalled(bool shutdown)
+{
+	int rc;
+
+	rc = persist__write(shutdown);
+	if(rc == MOSQ_ERR_SUCCESS){
+		persist__journal_truncate();
+	}
+	return rc;
+}
+
+
+#ifndef WIN32
+/* Close the client sockets in a snapshot process, so that clients the
+ * broker disconnects while the snapshot is being written are really
+ * disconnected, rather than held open by the copy of the socket. */
+static void persist__background_close_sockets(void)
+{
+	struct mosquitto *context, *ctxt_tmp;
+
+	HASH_ITER(hh_sock, db.contexts_by_sock, context, ctxt_tmp){
+		if(context->sock != INVALID_SOCKET){
+			close(context->sock);
+		}
+	}
+}
+
+
+/* Write the database from a forked child process. The child has a copy on
+ * write image of the database as it is at the time of the fork, so the
+ * parent can carry on serving clients while it is written. */
+static int persist__backup_background(void)
+{
+	pid_t pid;
+	int rc;
+
+	if(background_pid > 0){
+		log__printf(NULL, MOSQ_LOG_DEBUG, "Background save of in-memory database already in progress.");
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	if(persist__journal_rotate()){
+		return persist__write_journalled(false);
+	}
+
+	pid = fork();
+	if(pid == 0){
+		persist__background_close_sockets();
+		rc = persist__write(false);
+		_exit(rc?1:0);
+	}else if(pid < 0){
+		log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Unable to start background save of in-memory database: %s.", strerror(errno));
+		return persist__write_journalled(false);
+	}
+
+	log__printf(NULL, MOSQ_LOG_INFO, "Saving in-memory database to %s in background process %d.",
+			db.config->persistence_filepath, (int)pid);
+	background_pid = pid;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static void persist__background_finish(int status)
+{
+	if(WIFEXITED(status) && WEXITSTATUS(status) == 0){
+		log__printf(NULL, MOSQ_LOG_INFO, "Background save of in-memory database complete.");
+		persist__journal_prev_remove();
+	}else{
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Background save of in-memory database failed.");
+	}
+	background_pid = 0;
+}
+#endif
+
+
+/* Check whether a background save has finished. */
+void persist__background_check(void)
+{
+#ifndef WIN32
+	pid_t pid;
+	int status;
+
+	if(background_pid <= 0) return;
+
+	pid = waitpid(background_pid, &status, WNOHANG);
+	if(pid == background_pid){
+		persist__background_finish(status);
+	}else if(pid < 0){
+		background_pid = 0;
+	}
+#endif
+}
+
+
+/* Wait for a background save to finish, so that it can't overwrite a save
+ * made afterwards. */
+static void persist__background_wait(void)
+{
+#ifndef WIN32
+	pid_t pid;
+	int status;
+
+	if(background_pid <= 0) return;
+
+	log__printf(NULL, MOSQ_LOG_INFO, "Waiting for background save of in-memory database to finish.");
+	do{
+		pid = waitpid(background_pid, &status, 0);
+	}while(pid < 0 && errno == EINTR);
+
+	if(pid == background_pid){
+		persist__background_finish(status);
+	}else{
+		background_pid = 0;
+	}
+#endif
+}
+
+
+int persist__backup(bool shutdown)
+{
+	int rc;
+
+	if(db.config == NULL) return MOSQ_ERR_INVAL;
+	if(db.config->persistence == false) return MOSQ_ERR_SUCCESS;
+	if(db.config->persistence_filepath == NULL) return MOSQ_ERR_INVAL;
+
+#ifndef WIN32
+	if(shutdown == false && db.config->autosave_background){
+		return persist__backup_background();
+	}
+#endif
+	persist__background_wait();
+
+	log__printf(NULL, MOSQ_LOG_INFO, "Saving in-memory database to %s.", db.config->persistence_filepath);
+	rc = persist__write_journalled(shutdown);
+	if(shutdown){
+		/* Nothing after this point needs to be journalled */
+		persist__journal_close();
+	}
+	return rc;
+}
+
+
 #endif
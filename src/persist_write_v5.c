@@ -241,4 +241,88 @@ error:
 	log__printf(NULL, MOSQ_LOG_ERR, "Error: %s.", strerror(errno));
 	return 1;
 }
+
+int persist__chunk_client_msg_remove_write_v6(FILE *db_fptr, struct P_client_msg_remove *chunk)
+{
+	struct PF_header header;
+	uint16_t id_len = chunk->F.id_len;
+
+	chunk->F.mid = htons(chunk->F.mid);
+	chunk->F.id_len = htons(chunk->F.id_len);
+
+	header.chunk = htonl(DB_CHUNK_CLIENT_MSG_REMOVE);
+	header.length = htonl((uint32_t)sizeof(struct PF_client_msg_remove) + id_len);
+
+	write_e(db_fptr, &header, sizeof(struct PF_header));
+	write_e(db_fptr, &chunk->F, sizeof(struct PF_client_msg_remove));
+	write_e(db_fptr, chunk->client_id, id_len);
+
+	return MOSQ_ERR_SUCCESS;
+error:
+	log__printf(NULL, MOSQ_LOG_ERR, "Error: %s.", strerror(errno));
+	return 1;
+}
+
+
+int persist__chunk_sub_remove_write_v6(FILE *db_fptr, struct P_sub_remove *chunk)
+{
+	struct PF_header header;
+	uint16_t id_len = chunk->F.id_len;
+	uint16_t topic_len = chunk->F.topic_len;
+
+	chunk->F.id_len = htons(chunk->F.id_len);
+	chunk->F.topic_len = htons(chunk->F.topic_len);
+
+	header.chunk = htonl(DB_CHUNK_SUB_REMOVE);
+	header.length = htonl((uint32_t)sizeof(struct PF_sub_remove) +
+			id_len + topic_len);
+
+	write_e(db_fptr, &header, sizeof(struct PF_header));
+	write_e(db_fptr, &chunk->F, sizeof(struct PF_sub_remove));
+	write_e(db_fptr, chunk->client_id, id_len);
+	write_e(db_fptr, chunk->topic, topic_len);
+
+	return MOSQ_ERR_SUCCESS;
+error:
+	log__printf(NULL, MOSQ_LOG_ERR, "Error: %s.", strerror(errno));
+	return 1;
+}
+
+
+int persist__chunk_client_remove_write_v6(FILE *db_fptr, struct P_client_remove *chunk)
+{
+	struct PF_header header;
+	uint16_t id_len = chunk->F.id_len;
+
+	chunk->F.id_len = htons(chunk->F.id_len);
+
+	header.chunk = htonl(DB_CHUNK_CLIENT_REMOVE);
+	header.length = htonl((uint32_t)sizeof(struct PF_client_remove) + id_len);
+
+	write_e(db_fptr, &header, sizeof(struct PF_header));
+	write_e(db_fptr, &chunk->F, sizeof(struct PF_client_remove));
+	write_e(db_fptr, chunk->client_id, id_len);
+
+	return MOSQ_ERR_SUCCESS;
+error:
+	log__printf(NULL, MOSQ_LOG_ERR, "Error: %s.", strerror(errno));
+	return 1;
+}
+
+
+/* The snapshot and the journal start with the same header. */
+int persist__file_header_write(FILE *db_fptr)
+{
+	uint32_t db_version_w = htonl(MOSQ_DB_VERSION);
+	uint32_t crc = 0;
+
+	write_e(db_fptr, magic, 15);
+	write_e(db_fptr, &crc, sizeof(uint32_t));
+	write_e(db_fptr, &db_version_w, sizeof(uint32_t));
+
+	return MOSQ_ERR_SUCCESS;
+error:
+	log__printf(NULL, MOSQ_LOG_ERR, "Error: %s.", strerror(errno));
+	return 1;
+}
 #endif
@@ -164,8 +164,11 @@ int plugin__handle_message(struct mosquitto *context, struct mosquitto_msg_store
 		}
 
 		if(stored->payload != event_data.payload){
-			mosquitto__free(stored->payload);
+			if(stored->payload){
+				mosquitto__free((uint8_t *)stored->payload - stored->payload_offset);
+			}
 			stored->payload = event_data.payload;
+			stored->payload_offset = 0;
 			stored->payloadlen = event_data.payloadlen;
 		}
 
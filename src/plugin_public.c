@@ -265,6 +265,12 @@ int mosquitto_set_username(struct mosquitto *client, const char *username)
 }
 
 
+
+void mosquitto_acl_cache_invalidate(void)
+{
+	db.acl_generation++;
+}
+
 /* Check to see whether durable clients still have rights to their subscriptions. */
 static void check_subscription_acls(struct mosquitto *context)
 {
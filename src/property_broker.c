@@ -49,6 +49,12 @@ int property__process_connect(struct mosquitto *context, mosquitto_property **pr
 				return MOSQ_ERR_PROTOCOL;
 			}
 			context->maximum_packet_size = p->value.i32;
+#ifdef WITH_BRIDGE
+		}else if(p->identifier == MQTT_PROP_USER_PROPERTY && !strcmp(p->name.v, BRIDGE_BATCH_PROPERTY)){
+			bridge__batch_offer(context, p->value.s.v);
+		}else if(p->identifier == MQTT_PROP_USER_PROPERTY && !strcmp(p->name.v, BRIDGE_ORIGIN_PROPERTY)){
+			bridge__loop_offer(context);
+#endif
 		}
 		p = p->next;
 	}
@@ -0,0 +1,346 @@
+/*
+Copyright (c) 2022 Roger Light <roger@atchoo.org>
+
+All rights reserved. This program and the accompanying materials
+are made available under the terms of the Eclipse Public License 2.0
+and Eclipse Distribution License v1.0 which accompany this distribution.
+
+The Eclipse Public License is available at
+   https://www.eclipse.org/legal/epl-2.0/
+and the Eclipse Distribution License is available at
+  http://www.eclipse.org/org/documents/edl-v10.php.
+
+SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+
+Contributors:
+   Roger Light - initial implementation and documentation.
+*/
+
+/* Password hashing threads.
+ *
+ * Checking a password_file password means running PBKDF2 with the iteration
+ * count the password was created with, which is deliberately slow. Doing that
+ * on the main thread stalls all other network traffic, which is most visible
+ * when a large number of clients reconnect at once.
+ *
+ * When password_hash_threads is set, the check of a client CONNECT is handed
+ * to one of these threads and the client waits in the mosq_cs_delayed_auth
+ * state, with its socket not being read. The threads only compute and compare
+ * hashes on copies of the data they need; everything else, including
+ * allocating and freeing the jobs, happens on the main thread. Completed jobs
+ * are collected by pwhash_pool__process() from the main loop, which then
+ * finishes the CONNECT handling for the client. A thread that finishes a job
+ * wakes the main loop through mux__wakeup(), so results aren't left waiting
+ * for the next network event or loop timeout.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "mosquitto_broker_internal.h"
+#include "memory_mosq.h"
+#include "utlist.h"
+
+#if defined(WITH_THREADING) && defined(WITH_TLS)
+
+/* The rest of the broker is single threaded and uses the no-op versions of
+ * these from dummypthread.h. */
+#undef pthread_create
+#undef pthread_join
+#undef pthread_cancel
+#undef pthread_testcancel
+#undef pthread_mutex_init
+#undef pthread_mutex_destroy
+#undef pthread_mutex_lock
+#undef pthread_mutex_unlock
+#include <pthread.h>
+
+struct mosquitto__auth_job{
+	struct mosquitto__auth_job *next, *prev;
+	struct mosquitto *context;
+	char *password;
+	unsigned char *salt;
+	unsigned int salt_len;
+	unsigned char password_hash[EVP_MAX_MD_SIZE];
+	unsigned int password_hash_len;
+	int iterations;
+	enum mosquitto_pwhash_type hashtype;
+	int result;
+};
+
+static pthread_t *threads = NULL;
+static int thread_count = 0;
+static pthread_mutex_t job_mutex;
+static pthread_cond_t job_cond;
+static bool threads_stop = false;
+static struct mosquitto__auth_job *jobs_waiting = NULL;
+static struct mosquitto__auth_job *jobs_complete = NULL;
+
+
+static void pwhash_pool__job_run(struct mosquitto__auth_job *job)
+{
+	unsigned char hash[EVP_MAX_MD_SIZE];
+	unsigned int hash_len;
+	int rc;
+
+	rc = pw__digest(job->password, job->salt, job->salt_len, hash, &hash_len, job->hashtype, job->iterations);
+	if(rc == MOSQ_ERR_SUCCESS){
+		if(hash_len == job->password_hash_len && !pw__memcmp_const(job->password_hash, hash, hash_len)){
+			job->result = MOSQ_ERR_SUCCESS;
+		}else{
+			job->result = MOSQ_ERR_AUTH;
+		}
+	}else{
+		job->result = rc;
+	}
+}
+
+
+static void *pwhash_pool__thread(void *userdata)
+{
+	struct mosquitto__auth_job *job;
+
+	UNUSED(userdata);
+
+	pthread_mutex_lock(&job_mutex);
+	while(1){
+		while(jobs_waiting == NULL && threads_stop == false){
+			pthread_cond_wait(&job_cond, &job_mutex);
+		}
+		if(threads_stop){
+			break;
+		}
+		job = jobs_waiting;
+		DL_DELETE(jobs_waiting, job);
+		pthread_mutex_unlock(&job_mutex);
+
+		pwhash_pool__job_run(job);
+
+		pthread_mutex_lock(&job_mutex);
+		DL_APPEND(jobs_complete, job);
+		mux__wakeup();
+	}
+	pthread_mutex_unlock(&job_mutex);
+
+	return NULL;
+}
+
+
+int pwhash_pool__init(void)
+{
+	int i;
+
+	if(db.config->password_hash_threads == 0){
+		return MOSQ_ERR_SUCCESS;
+	}
+	if(mux__wakeup_sock() == INVALID_SOCKET){
+		/* The main loop would never find out that a job had finished. */
+		log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Unable to start password hashing threads, passwords will be checked on the main thread.");
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	threads = mosquitto__calloc((size_t)db.config->password_hash_threads, sizeof(pthread_t));
+	if(threads == NULL){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Out of memory.");
+		return MOSQ_ERR_NOMEM;
+	}
+	pthread_mutex_init(&job_mutex, NULL);
+	pthread_cond_init(&job_cond, NULL);
+	threads_stop = false;
+
+	for(i=0; i<db.config->password_hash_threads; i++){
+		if(pthread_create(&threads[i], NULL, pwhash_pool__thread, NULL)){
+			log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Unable to start password hashing thread, passwords will be checked on the main thread.");
+			break;
+		}
+		thread_count++;
+	}
+	if(thread_count > 0){
+		log__printf(NULL, MOSQ_LOG_INFO, "Started %d password hashing thread%s.", thread_count, thread_count==1?"":"s");
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static void pwhash_pool__job_free(struct mosquitto__auth_job *job)
+{
+	if(job->context){
+		job->context->auth_job = NULL;
+	}
+	if(job->password){
+		memset(job->password, 0, strlen(job->password));
+		mosquitto__free(job->password);
+	}
+	mosquitto__free(job->salt);
+	mosquitto__free(job);
+}
+
+
+void pwhash_pool__cleanup(void)
+{
+	struct mosquitto__auth_job *job, *job_tmp;
+	int i;
+
+	if(threads == NULL){
+		return;
+	}
+
+	pthread_mutex_lock(&job_mutex);
+	threads_stop = true;
+	pthread_cond_broadcast(&job_cond);
+	pthread_mutex_unlock(&job_mutex);
+
+	for(i=0; i<thread_count; i++){
+		pthread_join(threads[i], NULL);
+	}
+	mosquitto__free(threads);
+	threads = NULL;
+	thread_count = 0;
+
+	DL_FOREACH_SAFE(jobs_waiting, job, job_tmp){
+		DL_DELETE(jobs_waiting, job);
+		pwhash_pool__job_free(job);
+	}
+	DL_FOREACH_SAFE(jobs_complete, job, job_tmp){
+		DL_DELETE(jobs_complete, job);
+		pwhash_pool__job_free(job);
+	}
+	db.pwhash_jobs_pending = 0;
+
+	pthread_cond_destroy(&job_cond);
+	pthread_mutex_destroy(&job_mutex);
+}
+
+
+bool pwhash_pool__active(void)
+{
+	return thread_count > 0;
+}
+
+
+/* Queue a check of context->password against the password_file entry u.
+ * Returns MOSQ_ERR_AUTH_DELAYED if the check has been queued, in which case
+ * the result is passed to connect__delayed_auth_complete() once it is known. */
+int pwhash_pool__submit(struct mosquitto *context, const struct mosquitto__unpwd *u)
+{
+	struct mosquitto__auth_job *job;
+
+	if(u->password_len > sizeof(job->password_hash)){
+		return MOSQ_ERR_AUTH;
+	}
+
+	job = mosquitto__calloc(1, sizeof(struct mosquitto__auth_job));
+	if(job == NULL){
+		return MOSQ_ERR_NOMEM;
+	}
+	job->password = mosquitto__strdup(context->password);
+	job->salt = mosquitto__malloc(u->salt_len);
+	if(job->password == NULL || job->salt == NULL){
+		pwhash_pool__job_free(job);
+		return MOSQ_ERR_NOMEM;
+	}
+	memcpy(job->salt, u->salt, u->salt_len);
+	job->salt_len = u->salt_len;
+	memcpy(job->password_hash, u->password, u->password_len);
+	job->password_hash_len = u->password_len;
+	job->iterations = u->iterations;
+	job->hashtype = u->hashtype;
+	job->context = context;
+	context->auth_job = job;
+
+	pthread_mutex_lock(&job_mutex);
+	DL_APPEND(jobs_waiting, job);
+	pthread_cond_signal(&job_cond);
+	pthread_mutex_unlock(&job_mutex);
+
+	db.pwhash_jobs_pending++;
+
+	return MOSQ_ERR_AUTH_DELAYED;
+}
+
+
+/* The client is going away, so its job must not refer to it any more. The job
+ * itself is freed when it completes. */
+void pwhash_pool__cancel(struct mosquitto *context)
+{
+	if(context->auth_job){
+		context->auth_job->context = NULL;
+		context->auth_job = NULL;
+	}
+}
+
+
+void pwhash_pool__process(void)
+{
+	struct mosquitto__auth_job *complete, *job, *job_tmp;
+	struct mosquitto *context;
+
+	if(db.pwhash_jobs_pending == 0){
+		return;
+	}
+
+	pthread_mutex_lock(&job_mutex);
+	complete = jobs_complete;
+	jobs_complete = NULL;
+	pthread_mutex_unlock(&job_mutex);
+
+	DL_FOREACH_SAFE(complete, job, job_tmp){
+		DL_DELETE(complete, job);
+		db.pwhash_jobs_pending--;
+
+		context = job->context;
+		if(context){
+			context->auth_job = NULL;
+			job->context = NULL;
+			if(job->result == MOSQ_ERR_SUCCESS){
+				unpwd__cache_add(context, job->password, job->password_hash, job->password_hash_len);
+			}
+			connect__delayed_auth_complete(context, job->result);
+		}
+		pwhash_pool__job_free(job);
+	}
+}
+
+#else
+
+int pwhash_pool__init(void)
+{
+	if(db.config->password_hash_threads > 0){
+		log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Password hashing threads are not available, passwords will be checked on the main thread.");
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+void pwhash_pool__cleanup(void)
+{
+}
+
+
+bool pwhash_pool__active(void)
+{
+	return false;
+}
+
+
+int pwhash_pool__submit(struct mosquitto *context, const struct mosquitto__unpwd *u)
+{
+	UNUSED(context);
+	UNUSED(u);
+
+	return MOSQ_ERR_NOT_SUPPORTED;
+}
+
+
+void pwhash_pool__cancel(struct mosquitto *context)
+{
+	UNUSED(context);
+}
+
+
+void pwhash_pool__process(void)
+{
+}
+
+#endif
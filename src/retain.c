@@ -29,6 +29,10 @@ Contributors:
 
 #include "utlist.h"
 
+/* Retain tree nodes holding a message with an expiry time, so expired
+ * messages are removed even if no subscriber ever reads them. */
+static struct mosquitto__timer_wheel expiry_wheel;
+
 static struct mosquitto__retainhier *retain__add_hier_entry(struct mosquitto__retainhier *parent, struct mosquitto__retainhier **sibling, const char *topic, uint16_t len)
 {
 	struct mosquitto__retainhier *child;
@@ -49,7 +53,8 @@ static struct mosquitto__retainhier *retain__add_hier_entry(struct mosquitto__re
 		log__printf(NULL, MOSQ_LOG_ERR, "Error: Out of memory.");
 		return NULL;
 	}else{
-		strncpy(child->topic, topic, (size_t)child->topic_len+1);
+		memcpy(child->topic, topic, child->topic_len);
+		child->topic[child->topic_len] = '\0';
 	}
 
 	HASH_ADD_KEYPTR(hh, *sibling, child->topic, child->topic_len, child);
@@ -58,10 +63,66 @@ static struct mosquitto__retainhier *retain__add_hier_entry(struct mosquitto__re
 }
 
 
+/* Move any retained delivery cursor that would visit node next on to the
+ * following sibling, before node is removed from the tree. */
+static void retain__cursors_skip(struct mosquitto__retainhier *node)
+{
+	struct mosquitto__retain_cursor *cursor;
+	struct mosquitto__retain_frame *frame;
+	int i;
+
+	DL_FOREACH(db.retain_cursors, cursor){
+		for(i=0; i<cursor->stack_len; i++){
+			frame = &cursor->stack[i];
+			if(frame->next == node){
+				if(frame->single){
+					frame->next = NULL;
+				}else{
+					frame->next = node->hh.next;
+				}
+			}
+		}
+	}
+}
+
+
+/* Remove node if it no longer holds a retained message or has children, then
+ * do the same for its parents. This stops branches for topics that are no
+ * longer retained building up. The top level entries are never removed. */
+static void retain__prune(struct mosquitto__retainhier *node)
+{
+	struct mosquitto__retainhier *parent;
+
+	while(node->parent && node->retained == NULL && node->children == NULL){
+		parent = node->parent;
+
+		retain__cursors_skip(node);
+		timer_wheel__remove(&expiry_wheel, &node->expiry_timer);
+		HASH_DELETE(hh, parent->children, node);
+		mosquitto__free(node->topic);
+		mosquitto__free(node);
+
+		node = parent;
+	}
+}
+
+
+static void retain__release(struct mosquitto__retainhier *node)
+{
+	db__msg_store_ref_dec(&node->retained);
+	node->retained = NULL;
+#ifdef WITH_SYS_TREE
+	db.retained_count--;
+#endif
+}
+
+
 int retain__init(void)
 {
 	struct mosquitto__retainhier *retainhier;
 
+	timer_wheel__init(&expiry_wheel, db.now_real_s);
+
 	retainhier = retain__add_hier_entry(NULL, &db.retains, "", 0);
 	if(!retainhier) return MOSQ_ERR_NOMEM;
 
@@ -72,27 +133,31 @@ int retain__init(void)
 }
 
 
-int retain__store(const char *topic, struct mosquitto_msg_store *stored, char **split_topics)
+int retain__store(struct mosquitto_msg_store *stored)
 {
 	struct mosquitto__retainhier *retainhier;
 	struct mosquitto__retainhier *branch;
+	const struct mosquitto__topic_level *level;
 	int i;
-	size_t slen;
+	int rc;
 
 	assert(stored);
-	assert(split_topics);
 
-	HASH_FIND(hh, db.retains, split_topics[0], strlen(split_topics[0]), retainhier);
+	rc = sub__topic_levels(stored);
+	if(rc) return rc;
+
+	level = &stored->topic_levels[0];
+	HASH_FIND_BYHASHVALUE(hh, db.retains, &stored->topic[level->offset], level->len, level->hashv, retainhier);
 	if(retainhier == NULL){
-		retainhier = retain__add_hier_entry(NULL, &db.retains, split_topics[0], (uint16_t)strlen(split_topics[0]));
+		retainhier = retain__add_hier_entry(NULL, &db.retains, &stored->topic[level->offset], (uint16_t)level->len);
 		if(!retainhier) return MOSQ_ERR_NOMEM;
 	}
 
-	for(i=0; split_topics[i] != NULL; i++){
-		slen = strlen(split_topics[i]);
-		HASH_FIND(hh, retainhier->children, split_topics[i], slen, branch);
+	for(i=0; i<stored->topic_level_count; i++){
+		level = &stored->topic_levels[i];
+		HASH_FIND_BYHASHVALUE(hh, retainhier->children, &stored->topic[level->offset], level->len, level->hashv, branch);
 		if(branch == NULL){
-			branch = retain__add_hier_entry(retainhier, &retainhier->children, split_topics[i], (uint16_t)slen);
+			branch = retain__add_hier_entry(retainhier, &retainhier->children, &stored->topic[level->offset], (uint16_t)level->len);
 			if(branch == NULL){
 				return MOSQ_ERR_NOMEM;
 			}
@@ -100,21 +165,23 @@ int retain__store(const char *topic, struct mosquitto_msg_store *stored, char **
 		retainhier = branch;
 	}
 
+	if(retainhier->retained == stored){
+		/* Already retained, as when the persistence journal repeats a
+		 * retained message that is also in the database file. */
+		return MOSQ_ERR_SUCCESS;
+	}
+
 #ifdef WITH_PERSISTENCE
-	if(strncmp(topic, "$SYS", 4)){
+	if(strncmp(stored->topic, "$SYS", 4)){
 		/* Retained messages count as a persistence change, but only if
 		 * they aren't for $SYS. */
 		db.persistence_changes++;
+		persist__journal_retain(stored);
 	}
-#else
-	UNUSED(topic);
 #endif
 
 	if(retainhier->retained){
-		db__msg_store_ref_dec(&retainhier->retained);
-#ifdef WITH_SYS_TREE
-		db.retained_count--;
-#endif
+		retain__release(retainhier);
 	}
 	if(stored->payloadlen){
 		retainhier->retained = stored;
@@ -122,14 +189,53 @@ int retain__store(const char *topic, struct mosquitto_msg_store *stored, char **
 #ifdef WITH_SYS_TREE
 		db.retained_count++;
 #endif
+		if(stored->message_expiry_time > 0){
+			retainhier->expiry_timer.data = retainhier;
+			timer_wheel__add(&expiry_wheel, &retainhier->expiry_timer, stored->message_expiry_time);
+		}else{
+			timer_wheel__remove(&expiry_wheel, &retainhier->expiry_timer);
+		}
 	}else{
-		retainhier->retained = NULL;
+		retain__prune(retainhier);
 	}
 
 	return MOSQ_ERR_SUCCESS;
 }
 
 
+/* Remove retained messages that have expired, at most RETAIN_EXPIRY_BATCH
+ * per call. Any remaining are left for the next call. The wheel is driven by
+ * the wall clock, like message expiry times, and re-sorts itself if the clock
+ * goes backwards. */
+void retain__expiry_check(void)
+{
+	struct mosquitto__timer *timer;
+	struct mosquitto__retainhier *retainhier;
+	int count = 0;
+
+	timer_wheel__advance(&expiry_wheel, db.now_real_s);
+
+	while(count < RETAIN_EXPIRY_BATCH && (timer = timer_wheel__pop_expired(&expiry_wheel))){
+		retainhier = (struct mosquitto__retainhier *)timer->data;
+
+		if(timer->expiry >= db.now_real_s){
+			/* Left over from an earlier call by the batch limit, and the
+			 * wall clock has since gone backwards past its expiry. */
+			timer_wheel__add(&expiry_wheel, timer, timer->expiry);
+			continue;
+		}
+
+		/* The message may have been removed already by retain__process(),
+		 * in which case only the branch needs pruning. */
+		if(retainhier->retained){
+			retain__release(retainhier);
+		}
+		retain__prune(retainhier);
+		count++;
+	}
+}
+
+
 static int retain__process(struct mosquitto__retainhier *branch, struct mosquitto *context, uint8_t sub_qos, uint32_t subscription_identifier)
 {
 	int rc = 0;
@@ -139,11 +245,9 @@ static int retain__process(struct mosquitto__retainhier *branch, struct mosquitt
 	struct mosquitto_msg_store *retained;
 
 	if(branch->retained->message_expiry_time > 0 && db.now_real_s >= branch->retained->message_expiry_time){
-		db__msg_store_ref_dec(&branch->retained);
-		branch->retained = NULL;
-#ifdef WITH_SYS_TREE
-		db.retained_count--;
-#endif
+		/* The expiry timer is left armed, and will prune the branch. It can't
+		 * be pruned here because a cursor may be about to visit it. */
+		retain__release(branch);
 		return MOSQ_ERR_SUCCESS;
 	}
 
@@ -167,10 +271,14 @@ static int retain__process(struct mosquitto__retainhier *branch, struct mosquitt
 		retain_ctxt.listener = retained->source_listener;
 
 		rc = acl__find_acls(&retain_ctxt);
-		if(rc) return rc;
+		if(rc){
+			acl__free_client(&retain_ctxt);
+			return rc;
+		}
 
 		rc = mosquitto_acl_check(&retain_ctxt, retained->topic, retained->payloadlen, retained->payload,
 				retained->qos, retained->retain, MOSQ_ACL_WRITE);
+		acl__free_client(&retain_ctxt);
 		if(rc == MOSQ_ERR_ACL_DENIED){
 			return MOSQ_ERR_SUCCESS;
 		}else if(rc != MOSQ_ERR_SUCCESS){
@@ -192,74 +300,159 @@ static int retain__process(struct mosquitto__retainhier *branch, struct mosquitt
 	if(subscription_identifier > 0){
 		mosquitto_property_add_varint(&properties, MQTT_PROP_SUBSCRIPTION_IDENTIFIER, subscription_identifier);
 	}
-	return db__message_insert(context, mid, mosq_md_out, qos, true, retained, properties, false);
+	return db__message_insert(context, mid, mosq_md_out, qos, true, retained, properties, true);
 }
 
 
-static int retain__search(struct mosquitto__retainhier *retainhier, char **split_topics, struct mosquitto *context, const char *sub, uint8_t sub_qos, uint32_t subscription_identifier, int level)
+static uint8_t retain__qos(struct mosquitto_msg_store *retained, uint8_t sub_qos)
 {
-	struct mosquitto__retainhier *branch, *branch_tmp;
-	int flag = 0;
-
-	if(!strcmp(split_topics[0], "#") && split_topics[1] == NULL){
-		HASH_ITER(hh, retainhier->children, branch, branch_tmp){
-			/* Set flag to indicate that we should check for retained messages
-			 * on "foo" when we are subscribing to e.g. "foo/#" and then exit
-			 * this function and return to an earlier retain__search().
-			 */
-			flag = -1;
-			if(branch->retained){
-				retain__process(branch, context, sub_qos, subscription_identifier);
-			}
-			if(branch->children){
-				retain__search(branch, split_topics, context, sub, sub_qos, subscription_identifier, level+1);
-			}
-		}
+	if(db.config->upgrade_outgoing_qos || retained->qos > sub_qos){
+		return sub_qos;
 	}else{
-		if(!strcmp(split_topics[0], "+")){
-			HASH_ITER(hh, retainhier->children, branch, branch_tmp){
-				if(split_topics[1] != NULL){
-					if(retain__search(branch, &(split_topics[1]), context, sub, sub_qos, subscription_identifier, level+1) == -1
-							|| (split_topics[1] != NULL && !strcmp(split_topics[1], "#") && level>0)){
-
-						if(branch->retained){
-							retain__process(branch, context, sub_qos, subscription_identifier);
-						}
-					}
-				}else{
-					if(branch->retained){
-						retain__process(branch, context, sub_qos, subscription_identifier);
-					}
-				}
+		return retained->qos;
+	}
+}
+
+
+/* Is the client able to take another message right now? Retained messages
+ * are normally only sent when they can go straight out, so the client's
+ * queue isn't filled up with them. The first message of each turn is also
+ * sent if it can be queued, so a client that is always busy with other
+ * messages still gets its retained messages, one per turn. */
+static bool retain__cursor_ready(struct mosquitto *context, uint8_t qos, bool first)
+{
+	if(context->sock == INVALID_SOCKET){
+		/* Continue once the client reconnects */
+		return false;
+	}
+	if(first){
+		return db__ready_for_flight(context, mosq_md_out, qos)
+				|| (qos > 0 && db__ready_for_queue(context, qos, &context->msgs_out));
+	}
+	if(context->msgs_out.queued || context->out_packet_count >= RETAIN_CURSOR_PACKETS){
+		return false;
+	}
+	return db__ready_for_flight(context, mosq_md_out, qos);
+}
+
+
+static int retain__cursor_push(struct mosquitto__retain_cursor *cursor, struct mosquitto__retainhier *node, int level)
+{
+	struct mosquitto__retain_frame *frame;
+	const char *topic = cursor->split_topics[level];
+
+	if(node->children == NULL) return MOSQ_ERR_SUCCESS;
+
+	if(cursor->stack_len == cursor->stack_size){
+		frame = mosquitto__realloc(cursor->stack, sizeof(struct mosquitto__retain_frame)*(size_t)(cursor->stack_size*2));
+		if(frame == NULL) return MOSQ_ERR_NOMEM;
+		cursor->stack = frame;
+		cursor->stack_size *= 2;
+	}
+	frame = &cursor->stack[cursor->stack_len];
+	frame->level = level;
+
+	if(!strcmp(topic, "+") || !strcmp(topic, "#")){
+		frame->next = node->children;
+		frame->single = false;
+	}else{
+		HASH_FIND(hh, node->children, topic, strlen(topic), frame->next);
+		if(frame->next == NULL) return MOSQ_ERR_SUCCESS;
+		frame->single = true;
+	}
+	cursor->stack_len++;
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static void retain__cursor_free(struct mosquitto__retain_cursor *cursor)
+{
+	DL_DELETE(db.retain_cursors, cursor);
+	DL_DELETE2(cursor->context->retain_cursors, cursor, context_prev, context_next);
+	mosquitto__free(cursor->sub);
+	mosquitto__free(cursor->local_sub);
+	mosquitto__free(cursor->split_topics);
+	mosquitto__free(cursor->stack);
+	mosquitto__free(cursor);
+}
+
+
+/* Carry on with a depth first walk of the retain tree, sending matching
+ * retained messages until either the walk is complete, the client can't
+ * take any more messages, or the node budget runs out.
+ *
+ * The walk is complete when the stack is empty. *budget is decremented by
+ * the number of nodes visited. */
+static int retain__cursor_step(struct mosquitto__retain_cursor *cursor, int *budget)
+{
+	struct mosquitto__retain_frame *frame;
+	struct mosquitto__retainhier *branch;
+	char **split_topics = cursor->split_topics;
+	int level;
+	bool multi, deliver;
+	bool sent = false;
+	int rc;
+
+	while(cursor->stack_len > 0){
+		if(*budget <= 0) return MOSQ_ERR_SUCCESS;
+
+		frame = &cursor->stack[cursor->stack_len-1];
+		branch = frame->next;
+		if(branch == NULL){
+			cursor->stack_len--;
+			continue;
+		}
+		level = frame->level;
+		multi = !strcmp(split_topics[level], "#");
+
+		/* The retained message at this branch is delivered if the
+		 * subscription level here is "#", if the subscription ends here, or if
+		 * its only remaining level is "#". */
+		deliver = multi
+				|| split_topics[level+1] == NULL
+				|| (!strcmp(split_topics[level+1], "#") && split_topics[level+2] == NULL);
+
+		if(deliver && branch->retained){
+			if(!retain__cursor_ready(cursor->context, retain__qos(branch->retained, cursor->sub_qos), !sent)){
+				/* Leave the frame where it is, and try again later */
+				return MOSQ_ERR_SUCCESS;
 			}
+		}
+
+		(*budget)--;
+		if(frame->single){
+			frame->next = NULL;
 		}else{
-			HASH_FIND(hh, retainhier->children, split_topics[0], strlen(split_topics[0]), branch);
-			if(branch){
-				if(split_topics[1] != NULL){
-					if(retain__search(branch, &(split_topics[1]), context, sub, sub_qos, subscription_identifier, level+1) == -1
-							|| (split_topics[1] != NULL && !strcmp(split_topics[1], "#") && level>0)){
-
-						if(branch->retained){
-							retain__process(branch, context, sub_qos, subscription_identifier);
-						}
-					}
-				}else{
-					if(branch->retained){
-						retain__process(branch, context, sub_qos, subscription_identifier);
-					}
-				}
-			}
+			frame->next = branch->hh.next;
+		}
+
+		if(deliver && branch->retained){
+			rc = retain__process(branch, cursor->context, cursor->sub_qos, cursor->subscription_identifier);
+			if(rc == MOSQ_ERR_NOMEM) return rc;
+			sent = true;
 		}
+		if(multi){
+			rc = retain__cursor_push(cursor, branch, level);
+		}else if(split_topics[level+1]){
+			rc = retain__cursor_push(cursor, branch, level+1);
+		}else{
+			rc = MOSQ_ERR_SUCCESS;
+		}
+		if(rc) return rc;
 	}
-	return flag;
+	return MOSQ_ERR_SUCCESS;
 }
 
 
+/* Retained messages for a new subscription aren't sent here, but by a
+ * cursor that is stepped from the main loop with retain__cursors_run(). This
+ * means a subscription that matches a large number of retained messages
+ * doesn't block the broker, and the messages are sent only as quickly as
+ * the client can receive them. */
 int retain__queue(struct mosquitto *context, const char *sub, uint8_t sub_qos, uint32_t subscription_identifier)
 {
 	struct mosquitto__retainhier *retainhier;
-	char *local_sub;
-	char **split_topics;
+	struct mosquitto__retain_cursor *cursor;
 	int rc;
 
 	assert(context);
@@ -269,21 +462,110 @@ int retain__queue(struct mosquitto *context, const char *sub, uint8_t sub_qos, u
 		return MOSQ_ERR_SUCCESS;
 	}
 
-	rc = sub__topic_tokenise(sub, &local_sub, &split_topics, NULL);
-	if(rc) return rc;
+	/* Subscribing again restarts delivery from the beginning */
+	retain__cursor_remove(context, sub);
+
+	cursor = mosquitto__calloc(1, sizeof(struct mosquitto__retain_cursor));
+	if(cursor == NULL) return MOSQ_ERR_NOMEM;
+
+	cursor->context = context;
+	cursor->sub_qos = sub_qos;
+	cursor->subscription_identifier = subscription_identifier;
+	cursor->sub = mosquitto__strdup(sub);
+	cursor->stack_size = 8;
+	cursor->stack = mosquitto__malloc(sizeof(struct mosquitto__retain_frame)*(size_t)cursor->stack_size);
+	if(cursor->sub == NULL || cursor->stack == NULL){
+		mosquitto__free(cursor->sub);
+		mosquitto__free(cursor->stack);
+		mosquitto__free(cursor);
+		return MOSQ_ERR_NOMEM;
+	}
 
-	HASH_FIND(hh, db.retains, split_topics[0], strlen(split_topics[0]), retainhier);
+	rc = sub__topic_tokenise(sub, &cursor->local_sub, &cursor->split_topics, NULL);
+	if(rc){
+		mosquitto__free(cursor->sub);
+		mosquitto__free(cursor->stack);
+		mosquitto__free(cursor);
+		return rc;
+	}
+	DL_APPEND(db.retain_cursors, cursor);
+	DL_APPEND2(context->retain_cursors, cursor, context_prev, context_next);
 
+	HASH_FIND(hh, db.retains, cursor->split_topics[0], strlen(cursor->split_topics[0]), retainhier);
 	if(retainhier){
-		retain__search(retainhier, split_topics, context, sub, sub_qos, subscription_identifier, 0);
+		rc = retain__cursor_push(cursor, retainhier, 0);
+		if(rc){
+			retain__cursor_free(cursor);
+			return rc;
+		}
+	}
+	if(cursor->stack_len == 0){
+		retain__cursor_free(cursor);
 	}
-	mosquitto__free(local_sub);
-	mosquitto__free(split_topics);
 
 	return MOSQ_ERR_SUCCESS;
 }
 
 
+/* Give every active cursor a turn at sending retained messages. */
+void retain__cursors_run(void)
+{
+	struct mosquitto__retain_cursor *cursor, *cursor_tmp;
+	int budget;
+	int rc;
+
+	db.retain_cursors_pending = false;
+	DL_FOREACH_SAFE(db.retain_cursors, cursor, cursor_tmp){
+		budget = RETAIN_CURSOR_BUDGET;
+		rc = retain__cursor_step(cursor, &budget);
+		if(rc){
+			log__printf(NULL, MOSQ_LOG_ERR, "Error: Out of memory sending retained messages to %s.", cursor->context->id);
+			retain__cursor_free(cursor);
+		}else if(cursor->stack_len == 0){
+			retain__cursor_free(cursor);
+		}else if(budget <= 0){
+			/* Only stopped to let other clients have a turn */
+			db.retain_cursors_pending = true;
+		}
+	}
+}
+
+
+void retain__cursor_remove(struct mosquitto *context, const char *sub)
+{
+	struct mosquitto__retain_cursor *cursor, *cursor_tmp;
+
+	DL_FOREACH_SAFE2(context->retain_cursors, cursor, cursor_tmp, context_next){
+		if(!strcmp(cursor->sub, sub)){
+			retain__cursor_free(cursor);
+		}
+	}
+}
+
+
+/* Move unfinished retained delivery to a new context taking over a session. */
+void retain__cursors_move(struct mosquitto *from, struct mosquitto *to)
+{
+	struct mosquitto__retain_cursor *cursor;
+
+	DL_FOREACH2(from->retain_cursors, cursor, context_next){
+		cursor->context = to;
+	}
+	DL_CONCAT2(to->retain_cursors, from->retain_cursors, context_prev, context_next);
+	from->retain_cursors = NULL;
+}
+
+
+void retain__cursors_free(struct mosquitto *context)
+{
+	struct mosquitto__retain_cursor *cursor, *cursor_tmp;
+
+	DL_FOREACH_SAFE2(context->retain_cursors, cursor, cursor_tmp, context_next){
+		retain__cursor_free(cursor);
+	}
+}
+
+
 void retain__clean(struct mosquitto__retainhier **retainhier)
 {
 	struct mosquitto__retainhier *peer, *retainhier_tmp;
@@ -293,6 +575,7 @@ void retain__clean(struct mosquitto__retainhier **retainhier)
 			db__msg_store_ref_dec(&peer->retained);
 		}
 		retain__clean(&peer->children);
+		timer_wheel__remove(&expiry_wheel, &peer->expiry_timer);
 		mosquitto__free(peer->topic);
 
 		HASH_DELETE(hh, *retainhier, peer);
@@ -518,6 +518,9 @@ int mosquitto_security_init(bool reload)
 	int i;
 	int rc;
 
+	/* Results cached before a reload may no longer be valid */
+	db.acl_generation++;
+
 	if(db.config->per_listener_settings){
 		for(i=0; i<db.config->listener_count; i++){
 			rc = security__init_single(&db.config->listeners[i].security_options, reload);
@@ -676,40 +679,19 @@ static int acl__check_dollar(const char *topic, int access)
 }
 
 
-int mosquitto_acl_check(struct mosquitto *context, const char *topic, uint32_t payloadlen, void* payload, uint8_t qos, bool retain, int access)
+static int acl__check_plugins(struct mosquitto *context, struct mosquitto__security_options *opts, const char *topic, uint32_t payloadlen, void* payload, uint8_t qos, bool retain, int access)
 {
 	int rc;
 	int i;
-	struct mosquitto__security_options *opts;
 	struct mosquitto_acl_msg msg;
 	struct mosquitto__callback *cb_base;
 	struct mosquitto_evt_acl_check event_data;
 
-	if(!context->id){
-		return MOSQ_ERR_ACL_DENIED;
-	}
-	if(context->bridge){
-		return MOSQ_ERR_SUCCESS;
-	}
-
-	rc = acl__check_dollar(topic, access);
-	if(rc) return rc;
-
 	/*
 	 * If no plugins exist we should accept at this point so set rc to success.
 	 */
 	rc = MOSQ_ERR_SUCCESS;
 
-	if(db.config->per_listener_settings){
-		if(context->listener){
-			opts = &context->listener->security_options;
-		}else{
-			return MOSQ_ERR_ACL_DENIED;
-		}
-	}else{
-		opts = &db.config->security_options;
-	}
-
 	memset(&msg, 0, sizeof(msg));
 	msg.topic = topic;
 	msg.payloadlen = payloadlen;
@@ -752,6 +734,135 @@ int mosquitto_acl_check(struct mosquitto *context, const char *topic, uint32_t p
 	return rc;
 }
 
+
+/* ################################################################
+ * #
+ * # ACL result cache
+ * #
+ * ################################################################ */
+
+/* Each client has a direct mapped cache of acl_cache_size results, indexed
+ * by a hash of everything that goes into a check except the payload. An
+ * entry is only valid while its generation matches db.acl_generation, so
+ * incrementing that invalidates the results of every client at once. */
+
+static uint32_t acl__cache_hash(const char *topic, uint8_t qos, bool retain, int access)
+{
+	uint32_t hash = 2166136261U; /* FNV-1a */
+
+	while(*topic){
+		hash = (hash ^ (uint8_t)(*topic)) * 16777619U;
+		topic++;
+	}
+	hash = (hash ^ (uint32_t)access) * 16777619U;
+	hash = (hash ^ qos) * 16777619U;
+	hash = (hash ^ (retain?1U:0U)) * 16777619U;
+
+	return hash;
+}
+
+
+static struct mosquitto__acl_cache_entry *acl__cache_slot(struct mosquitto *context, uint32_t hash)
+{
+	if(context->acl_cache_size != db.config->acl_cache_size){
+		/* First use, or acl_cache_size has changed on reload */
+		acl__cache_free(context);
+		context->acl_cache = mosquitto__calloc((size_t)db.config->acl_cache_size, sizeof(struct mosquitto__acl_cache_entry));
+		if(context->acl_cache == NULL) return NULL;
+		context->acl_cache_size = db.config->acl_cache_size;
+	}
+	return &context->acl_cache[hash % (uint32_t)context->acl_cache_size];
+}
+
+
+static void acl__cache_store(struct mosquitto__acl_cache_entry *entry, uint32_t hash, const char *topic, uint8_t qos, bool retain, int access, int result)
+{
+	char *topic_dup;
+
+	if(entry->topic == NULL || strcmp(entry->topic, topic)){
+		topic_dup = mosquitto__strdup(topic);
+		if(topic_dup == NULL){
+			/* Not caching this result isn't an error */
+			return;
+		}
+		mosquitto__free(entry->topic);
+		entry->topic = topic_dup;
+	}
+	entry->generation = db.acl_generation;
+	entry->hash = hash;
+	entry->access = access;
+	entry->qos = qos;
+	entry->retain = retain;
+	entry->result = result;
+}
+
+
+void acl__cache_free(struct mosquitto *context)
+{
+	int i;
+
+	if(context->acl_cache){
+		for(i=0; i<context->acl_cache_size; i++){
+			mosquitto__free(context->acl_cache[i].topic);
+		}
+		mosquitto__free(context->acl_cache);
+		context->acl_cache = NULL;
+	}
+	context->acl_cache_size = 0;
+}
+
+
+int mosquitto_acl_check(struct mosquitto *context, const char *topic, uint32_t payloadlen, void* payload, uint8_t qos, bool retain, int access)
+{
+	int rc;
+	struct mosquitto__security_options *opts;
+	struct mosquitto__acl_cache_entry *entry = NULL;
+	uint32_t hash = 0;
+
+	if(!context->id){
+		return MOSQ_ERR_ACL_DENIED;
+	}
+	if(context->bridge){
+		return MOSQ_ERR_SUCCESS;
+	}
+
+	rc = acl__check_dollar(topic, access);
+	if(rc) return rc;
+
+	if(db.config->per_listener_settings){
+		if(context->listener){
+			opts = &context->listener->security_options;
+		}else{
+			return MOSQ_ERR_ACL_DENIED;
+		}
+	}else{
+		opts = &db.config->security_options;
+	}
+
+	if(db.config->acl_cache_size > 0){
+		hash = acl__cache_hash(topic, qos, retain, access);
+		entry = acl__cache_slot(context, hash);
+		if(entry && entry->topic
+				&& entry->generation == db.acl_generation
+				&& entry->hash == hash
+				&& entry->access == access
+				&& entry->qos == qos
+				&& entry->retain == retain
+				&& !strcmp(entry->topic, topic)){
+
+			return entry->result;
+		}
+	}
+
+	rc = acl__check_plugins(context, opts, topic, payloadlen, payload, qos, retain, access);
+
+	/* Errors other than a denial may be transient, so are not cached */
+	if(entry && (rc == MOSQ_ERR_SUCCESS || rc == MOSQ_ERR_ACL_DENIED)){
+		acl__cache_store(entry, hash, topic, qos, retain, access, rc);
+	}
+	return rc;
+}
+
 int mosquitto_unpwd_check(struct mosquitto *context)
 {
 	int rc;
@@ -22,6 +22,11 @@ Contributors:
 #include <stdio.h>
 #include <string.h>
 
+#ifdef WITH_TLS
+#  include <openssl/hmac.h>
+#  include <openssl/rand.h>
+#endif
+
 #include "mosquitto_broker_internal.h"
 #include "memory_mosq.h"
 #include "mqtt_protocol.h"
@@ -34,9 +39,6 @@ static int unpwd__file_parse(struct mosquitto__unpwd **unpwd, const char *passwo
 static int acl__cleanup(bool reload);
 static int unpwd__cleanup(struct mosquitto__unpwd **unpwd, bool reload);
 static int psk__file_parse(struct mosquitto__unpwd **psk_id, const char *psk_file);
-#ifdef WITH_TLS
-static int pw__digest(const char *password, const unsigned char *salt, unsigned int salt_len, unsigned char *hash, unsigned int *hash_len, enum mosquitto_pwhash_type hashtype, int iterations);
-#endif
 static int mosquitto_unpwd_check_default(int event, void *event_data, void *userdata);
 static int mosquitto_acl_check_default(int event, void *event_data, void *userdata);
 
@@ -250,6 +252,7 @@ static int add__acl(struct mosquitto__security_options *security_opts, const cha
 		}
 		acl_user->next = NULL;
 		acl_user->acl = NULL;
+		acl_user->tree = NULL;
 	}
 
 	acl = mosquitto__malloc(sizeof(struct mosquitto__acl));
@@ -295,7 +298,7 @@ static int add__acl(struct mosquitto__security_options *security_opts, const cha
 		}
 	}
 
-	return MOSQ_ERR_SUCCESS;
+	return acl_tree__add(&acl_user->tree, topic, access);
 }
 
 static int add__acl_pattern(struct mosquitto__security_options *security_opts, const char *topic, int access)
@@ -365,99 +368,58 @@ static int add__acl_pattern(struct mosquitto__security_options *security_opts, c
 	return MOSQ_ERR_SUCCESS;
 }
 
-static int mosquitto_acl_check_default(int event, void *event_data, void *userdata)
+static bool acl__dangerous_client(struct mosquitto *context, bool log)
 {
-	struct mosquitto_evt_acl_check *ed = event_data;
-	char *local_acl;
-	struct mosquitto__acl *acl_root;
-	bool result;
-	size_t i;
-	size_t len, tlen, clen, ulen;
-	char *s;
-	struct mosquitto__security_options *security_opts = NULL;
-
-	UNUSED(event);
-	UNUSED(userdata);
-
-	if(ed->client->bridge) return MOSQ_ERR_SUCCESS;
-	if(ed->access == MOSQ_ACL_SUBSCRIBE || ed->access == MOSQ_ACL_UNSUBSCRIBE) return MOSQ_ERR_SUCCESS; /* FIXME - implement ACL subscription strings. */
-
-	if(db.config->per_listener_settings){
-		if(!ed->client->listener) return MOSQ_ERR_ACL_DENIED;
-		security_opts = &ed->client->listener->security_options;
-	}else{
-		security_opts = &db.config->security_options;
-	}
-	if(!security_opts->acl_file && !security_opts->acl_list && !security_opts->acl_patterns){
-		return MOSQ_ERR_PLUGIN_DEFER;
-	}
-
-	if(!ed->client->acl_list && !security_opts->acl_patterns) return MOSQ_ERR_ACL_DENIED;
-
-	if(ed->client->acl_list){
-		acl_root = ed->client->acl_list->acl;
-	}else{
-		acl_root = NULL;
+	/* We are using pattern based acls. Check whether the username or
+	 * client id contains a + or # and if so deny access.
+	 *
+	 * Without this, a malicious client may configure its username/client
+	 * id to bypass ACL checks (or have a username/client id that cannot
+	 * publish or receive messages to its own place in the hierarchy).
+	 */
+	if(context->username && strpbrk(context->username, "+#")){
+		if(log){
+			log__printf(NULL, MOSQ_LOG_NOTICE, "ACL denying access to client with dangerous username \"%s\"", context->username);
+		}
+		return true;
 	}
 
-	/* Loop through all ACLs for this client. ACL denials are iterated over first. */
-	while(acl_root){
-		/* Loop through the topic looking for matches to this ACL. */
-
-		/* If subscription starts with $, acl_root->topic must also start with $. */
-		if(ed->topic[0] == '$' && acl_root->topic[0] != '$'){
-			acl_root = acl_root->next;
-			continue;
+	if(context->id && strpbrk(context->id, "+#")){
+		if(log){
+			log__printf(NULL, MOSQ_LOG_NOTICE, "ACL denying access to client with dangerous client id \"%s\"", context->id);
 		}
-		mosquitto_topic_matches_sub(acl_root->topic, ed->topic, &result);
-		if(result){
-			if(acl_root->access == MOSQ_ACL_NONE){
-				/* Access was explicitly denied for this topic. */
-				return MOSQ_ERR_ACL_DENIED;
-			}
-			if(ed->access & acl_root->access){
-				/* And access is allowed. */
-				return MOSQ_ERR_SUCCESS;
-			}
-		}
-		acl_root = acl_root->next;
+		return true;
 	}
+	return false;
+}
 
-	acl_root = security_opts->acl_patterns;
-
-	if(acl_root){
-		/* We are using pattern based acls. Check whether the username or
-		 * client id contains a + or # and if so deny access.
-		 *
-		 * Without this, a malicious client may configure its username/client
-		 * id to bypass ACL checks (or have a username/client id that cannot
-		 * publish or receive messages to its own place in the hierarchy).
-		 */
-		if(ed->client->username && strpbrk(ed->client->username, "+#")){
-			log__printf(NULL, MOSQ_LOG_NOTICE, "ACL denying access to client with dangerous username \"%s\"", ed->client->username);
-			return MOSQ_ERR_ACL_DENIED;
-		}
 
-		if(ed->client->id && strpbrk(ed->client->id, "+#")){
-			log__printf(NULL, MOSQ_LOG_NOTICE, "ACL denying access to client with dangerous client id \"%s\"", ed->client->id);
-			return MOSQ_ERR_ACL_DENIED;
-		}
-	}
+/* Substitute the client id and username into the pattern ACLs and compile
+ * the result, so checks for this client don't need to do it every time. */
+static int acl__patterns_compile(struct mosquitto *context, struct mosquitto__security_options *security_opts)
+{
+	struct mosquitto__acl *acl_root;
+	char *local_acl;
+	size_t i;
+	size_t len, tlen, clen, ulen;
+	char *s;
+	int rc;
+
+	acl_tree__free(&context->acl_patterns);
 
-	/* Loop through all pattern ACLs. ACL denial patterns are iterated over first. */
-	if(!ed->client->id) return MOSQ_ERR_ACL_DENIED;
-	clen = strlen(ed->client->id);
+	rc = acl_tree__init(&context->acl_patterns);
+	if(rc) return rc;
 
-	while(acl_root){
+	clen = strlen(context->id);
+	for(acl_root = security_opts->acl_patterns; acl_root; acl_root = acl_root->next){
 		tlen = strlen(acl_root->topic);
 
-		if(acl_root->ucount && !ed->client->username){
-			acl_root = acl_root->next;
+		if(acl_root->ucount && !context->username){
 			continue;
 		}
 
-		if(ed->client->username){
-			ulen = strlen(ed->client->username);
+		if(context->username){
+			ulen = strlen(context->username);
 			len = tlen + (size_t)acl_root->ccount*(clen-2) + (size_t)acl_root->ucount*(ulen-2);
 		}else{
 			ulen = 0;
@@ -470,12 +432,12 @@ static int mosquitto_acl_check_default(int event, void *event_data, void *userda
 			if(i<tlen-1 && acl_root->topic[i] == '%'){
 				if(acl_root->topic[i+1] == 'c'){
 					i++;
-					strncpy(s, ed->client->id, clen);
+					strncpy(s, context->id, clen);
 					s+=clen;
 					continue;
-				}else if(ed->client->username && acl_root->topic[i+1] == 'u'){
+				}else if(context->username && acl_root->topic[i+1] == 'u'){
 					i++;
-					strncpy(s, ed->client->username, ulen);
+					strncpy(s, context->username, ulen);
 					s+=ulen;
 					continue;
 				}
@@ -485,20 +447,65 @@ static int mosquitto_acl_check_default(int event, void *event_data, void *userda
 		}
 		local_acl[len] = '\0';
 
-		mosquitto_topic_matches_sub(local_acl, ed->topic, &result);
+		rc = acl_tree__add(&context->acl_patterns, local_acl, acl_root->access);
 		mosquitto__free(local_acl);
-		if(result){
-			if(acl_root->access == MOSQ_ACL_NONE){
-				/* Access was explicitly denied for this topic pattern. */
-				return MOSQ_ERR_ACL_DENIED;
-			}
-			if(ed->access & acl_root->access){
-				/* And access is allowed. */
-				return MOSQ_ERR_SUCCESS;
-			}
+		if(rc) return rc;
+	}
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static int mosquitto_acl_check_default(int event, void *event_data, void *userdata)
+{
+	struct mosquitto_evt_acl_check *ed = event_data;
+	struct mosquitto__security_options *security_opts = NULL;
+	int rc;
+
+	UNUSED(event);
+	UNUSED(userdata);
+
+	if(ed->client->bridge) return MOSQ_ERR_SUCCESS;
+	if(ed->access == MOSQ_ACL_SUBSCRIBE || ed->access == MOSQ_ACL_UNSUBSCRIBE) return MOSQ_ERR_SUCCESS; /* FIXME - implement ACL subscription strings. */
+
+	if(db.config->per_listener_settings){
+		if(!ed->client->listener) return MOSQ_ERR_ACL_DENIED;
+		security_opts = &ed->client->listener->security_options;
+	}else{
+		security_opts = &db.config->security_options;
+	}
+	if(!security_opts->acl_file && !security_opts->acl_list && !security_opts->acl_patterns){
+		return MOSQ_ERR_PLUGIN_DEFER;
+	}
+
+	if(!ed->client->acl_list && !security_opts->acl_patterns) return MOSQ_ERR_ACL_DENIED;
+
+	/* ACLs for this client. Any matching denial takes priority. */
+	if(ed->client->acl_list){
+		rc = acl_tree__check(ed->client->acl_list->tree, ed->topic, ed->access);
+		if(rc != MOSQ_ERR_NOT_FOUND){
+			return rc;
+		}
+	}
+
+	if(security_opts->acl_patterns){
+		if(acl__dangerous_client(ed->client, true)){
+			return MOSQ_ERR_ACL_DENIED;
+		}
+		if(!ed->client->id) return MOSQ_ERR_ACL_DENIED;
+
+		if(ed->client->acl_patterns == NULL){
+			/* Not compiled when the client connected, e.g. for a client
+			 * restored from persistence. */
+			rc = acl__patterns_compile(ed->client, security_opts);
+			if(rc) return rc;
 		}
 
-		acl_root = acl_root->next;
+		/* Pattern ACLs. Any matching denial takes priority. */
+		rc = acl_tree__check(ed->client->acl_patterns, ed->topic, ed->access);
+		if(rc != MOSQ_ERR_NOT_FOUND){
+			return rc;
+		}
 	}
 
 	return MOSQ_ERR_ACL_DENIED;
@@ -659,6 +666,7 @@ static void acl__cleanup_single(struct mosquitto__security_options *security_opt
 		user_tail = security_opts->acl_list->next;
 
 		free__acl(security_opts->acl_list->acl);
+		acl_tree__free(&security_opts->acl_list->tree);
 		mosquitto__free(security_opts->acl_list->username);
 		mosquitto__free(security_opts->acl_list);
 
@@ -687,6 +695,7 @@ static int acl__cleanup(bool reload)
 	 */
 	HASH_ITER(hh_id, db.contexts_by_id, context, ctxt_tmp){
 		context->acl_list = NULL;
+		acl__free_client(context);
 	}
 
 	if(db.config->per_listener_settings){
@@ -736,10 +745,22 @@ int acl__find_acls(struct mosquitto *context)
 		context->acl_list = NULL;
 	}
 
+	acl__free_client(context);
+	if(security_opts->acl_patterns && context->id && !acl__dangerous_client(context, false)){
+		return acl__patterns_compile(context, security_opts);
+	}
+
 	return MOSQ_ERR_SUCCESS;
 }
 
 
+void acl__free_client(struct mosquitto *context)
+{
+	acl_tree__free(&context->acl_patterns);
+	acl__cache_free(context);
+}
+
+
 static int pwfile__parse(const char *file, struct mosquitto__unpwd **root)
 {
 	FILE *pwfile;
@@ -989,6 +1010,85 @@ static int mosquitto__memcmp_const(const void *a, const void *b, size_t len)
 #endif
 
 
+#ifdef WITH_TLS
+/* Verified passwords are remembered as an HMAC keyed with a random value that
+ * is never written anywhere, so a repeat login with the same password can be
+ * checked without running PBKDF2 again. */
+static unsigned char cache_key[32];
+static bool cache_key_valid = false;
+
+static int unpwd__cache_hash(const char *password, unsigned char *hash, unsigned int *hash_len)
+{
+	if(cache_key_valid == false){
+		if(RAND_bytes(cache_key, sizeof(cache_key)) != 1){
+			return MOSQ_ERR_UNKNOWN;
+		}
+		cache_key_valid = true;
+	}
+	if(HMAC(EVP_sha256(), cache_key, sizeof(cache_key),
+				(const unsigned char *)password, strlen(password), hash, hash_len) == NULL){
+
+		return MOSQ_ERR_UNKNOWN;
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static bool unpwd__cache_check(struct mosquitto__unpwd *u, const char *password)
+{
+	unsigned char hash[EVP_MAX_MD_SIZE];
+	unsigned int hash_len;
+
+	if(db.config->password_cache_timeout == 0 || u->cache_expiry < db.now_s){
+		return false;
+	}
+	if(unpwd__cache_hash(password, hash, &hash_len)){
+		return false;
+	}
+	return hash_len == u->cache_hash_len && !mosquitto__memcmp_const(u->cache_hash, hash, hash_len);
+}
+
+
+static void unpwd__cache_store(struct mosquitto__unpwd *u, const char *password)
+{
+	if(db.config->password_cache_timeout == 0){
+		return;
+	}
+	if(unpwd__cache_hash(password, u->cache_hash, &u->cache_hash_len) == MOSQ_ERR_SUCCESS){
+		u->cache_expiry = db.now_s + db.config->password_cache_timeout;
+	}
+}
+
+
+/* Remember a password that has been verified against password_hash away from
+ * the password_file entry it came from. The entry may have been replaced by a
+ * reload in the meantime, in which case nothing is stored. */
+void unpwd__cache_add(struct mosquitto *context, const char *password, const unsigned char *password_hash, unsigned int password_hash_len)
+{
+	struct mosquitto__unpwd *u;
+	struct mosquitto__unpwd *unpwd_ref;
+
+	if(db.config->password_cache_timeout == 0 || context->username == NULL){
+		return;
+	}
+
+	if(db.config->per_listener_settings){
+		if(!context->listener) return;
+		unpwd_ref = context->listener->security_options.unpwd;
+	}else{
+		unpwd_ref = db.config->security_options.unpwd;
+	}
+
+	HASH_FIND(hh, unpwd_ref, context->username, strlen(context->username), u);
+	if(u && u->password && u->password_len == password_hash_len
+			&& !mosquitto__memcmp_const(u->password, password_hash, password_hash_len)){
+
+		unpwd__cache_store(u, password);
+	}
+}
+#endif
+
+
 static int mosquitto_unpwd_check_default(int event, void *event_data, void *userdata)
 {
 	struct mosquitto_evt_basic_auth *ed = event_data;
@@ -1020,9 +1120,25 @@ static int mosquitto_unpwd_check_default(int event, void *event_data, void *user
 		if(u->password){
 			if(ed->client->password){
 #ifdef WITH_TLS
+				if(unpwd__cache_check(u, ed->client->password)){
+					return MOSQ_ERR_SUCCESS;
+				}
+				if(u->hashtype == pw_sha512_pbkdf2
+						&& ed->client->state == mosq_cs_new
+#ifdef WITH_WEBSOCKETS
+						&& ed->client->wsi == NULL
+#endif
+						&& pwhash_pool__active()){
+
+					/* Only a new connection can be left waiting for the result,
+					 * anything else, such as a check after a reload, is done
+					 * here. */
+					return pwhash_pool__submit(ed->client, u);
+				}
 				rc = pw__digest(ed->client->password, u->salt, u->salt_len, hash, &hash_len, u->hashtype, u->iterations);
 				if(rc == MOSQ_ERR_SUCCESS){
 					if(hash_len == u->password_len && !mosquitto__memcmp_const(u->password, hash, hash_len)){
+						unpwd__cache_store(u, ed->client->password);
 						return MOSQ_ERR_SUCCESS;
 					}else{
 						return MOSQ_ERR_AUTH;
@@ -27,26 +27,23 @@ Contributors:
 #include "sys_tree.h"
 #include "time_mosq.h"
 
-static struct session_expiry_list *expiry_list = NULL;
-static time_t last_check = 0;
+static struct mosquitto__timer_wheel expiry_wheel;
+static bool expiry_wheel_init = false;
 
 
-static int session_expiry__cmp(struct session_expiry_list *i1, struct session_expiry_list *i2)
+static void session_expiry__schedule(struct mosquitto *context)
 {
-	if(i1->context->session_expiry_time == i2->context->session_expiry_time){
-		return 0;
-	}else if(i1->context->session_expiry_time > i2->context->session_expiry_time){
-		return 1;
-	}else{
-		return -1;
+	if(expiry_wheel_init == false){
+		timer_wheel__init(&expiry_wheel, db.now_real_s);
+		expiry_wheel_init = true;
 	}
+	context->expiry_timer.data = context;
+	timer_wheel__add(&expiry_wheel, &context->expiry_timer, context->session_expiry_time);
 }
 
 
 int session_expiry__add(struct mosquitto *context)
 {
-	struct session_expiry_list *item;
-
 	if(db.config->persistent_client_expiration == 0){
 		if(context->session_expiry_interval == UINT32_MAX){
 			/* There isn't a global expiry set, and the client has asked to
@@ -55,28 +52,23 @@ int session_expiry__add(struct mosquitto *context)
 		}
 	}
 
-	item = mosquitto__calloc(1, sizeof(struct session_expiry_list));
-	if(!item) return MOSQ_ERR_NOMEM;
-
-	item->context = context;
-	item->context->session_expiry_time = db.now_real_s;
+	context->session_expiry_time = db.now_real_s;
 
 	if(db.config->persistent_client_expiration == 0){
 		/* No global expiry, so use the client expiration interval */
-		item->context->session_expiry_time += item->context->session_expiry_interval;
+		context->session_expiry_time += context->session_expiry_interval;
 	}else{
 		/* We have a global expiry interval */
-		if(db.config->persistent_client_expiration < item->context->session_expiry_interval){
+		if(db.config->persistent_client_expiration < context->session_expiry_interval){
 			/* The client expiry is longer than the global expiry, so use the global */
-			item->context->session_expiry_time += db.config->persistent_client_expiration;
+			context->session_expiry_time += db.config->persistent_client_expiration;
 		}else{
 			/* The global expiry is longer than the client expiry, so use the client */
-			item->context->session_expiry_time += item->context->session_expiry_interval;
+			context->session_expiry_time += context->session_expiry_interval;
 		}
 	}
-	context->expiry_list_item = item;
 
-	DL_INSERT_INORDER(expiry_list, item, session_expiry__cmp);
+	session_expiry__schedule(context);
 
 	return MOSQ_ERR_SUCCESS;
 }
@@ -84,8 +76,6 @@ int session_expiry__add(struct mosquitto *context)
 
 int session_expiry__add_from_persistence(struct mosquitto *context, time_t expiry_time)
 {
-	struct session_expiry_list *item;
-
 	if(db.config->persistent_client_expiration == 0){
 		if(context->session_expiry_interval == UINT32_MAX){
 			/* There isn't a global expiry set, and the client has asked to
@@ -94,14 +84,8 @@ int session_expiry__add_from_persistence(struct mosquitto *context, time_t expir
 		}
 	}
 
-	item = mosquitto__calloc(1, sizeof(struct session_expiry_list));
-	if(!item) return MOSQ_ERR_NOMEM;
-
-	item->context = context;
-	item->context->session_expiry_time = expiry_time;
-	context->expiry_list_item = item;
-
-	DL_INSERT_INORDER(expiry_list, item, session_expiry__cmp);
+	context->session_expiry_time = expiry_time;
+	session_expiry__schedule(context);
 
 	return MOSQ_ERR_SUCCESS;
 }
@@ -109,23 +93,19 @@ int session_expiry__add_from_persistence(struct mosquitto *context, time_t expir
 
 void session_expiry__remove(struct mosquitto *context)
 {
-	if(context->expiry_list_item){
-		DL_DELETE(expiry_list, context->expiry_list_item);
-		mosquitto__free(context->expiry_list_item);
-		context->expiry_list_item = NULL;
-	}
+	timer_wheel__remove(&expiry_wheel, &context->expiry_timer);
 }
 
 
 /* Call on broker shutdown only */
 void session_expiry__remove_all(void)
 {
-	struct session_expiry_list *item, *tmp;
+	struct mosquitto__timer *timer;
 	struct mosquitto *context;
 
-	DL_FOREACH_SAFE(expiry_list, item, tmp){
-		context = item->context;
-		session_expiry__remove(context);
+	timer_wheel__expire_all(&expiry_wheel);
+	while((timer = timer_wheel__pop_expired(&expiry_wheel))){
+		context = (struct mosquitto *)timer->data;
 		context->session_expiry_interval = 0;
 		context->will_delay_interval = 0;
 		will_delay__remove(context);
@@ -135,34 +115,25 @@ void session_expiry__remove_all(void)
 
 void session_expiry__check(void)
 {
-	struct session_expiry_list *item, *tmp;
+	struct mosquitto__timer *timer;
 	struct mosquitto *context;
 
-	if(db.now_real_s <= last_check) return;
-
-	last_check = db.now_real_s;
+	timer_wheel__advance(&expiry_wheel, db.now_real_s);
 
-	DL_FOREACH_SAFE(expiry_list, item, tmp){
-		if(item->context->session_expiry_time < db.now_real_s){
+	while((timer = timer_wheel__pop_expired(&expiry_wheel))){
+		context = (struct mosquitto *)timer->data;
 
-			context = item->context;
-			session_expiry__remove(context);
-
-			if(context->id){
-				log__printf(NULL, MOSQ_LOG_NOTICE, "Expiring client %s due to timeout.", context->id);
-			}
-			G_CLIENTS_EXPIRED_INC();
-
-			/* Session has now expired, so clear interval */
-			context->session_expiry_interval = 0;
-			/* Session has expired, so will delay should be cleared. */
-			context->will_delay_interval = 0;
-			will_delay__remove(context);
-			context__send_will(context);
-			context__add_to_disused(context);
-		}else{
-			return;
+		if(context->id){
+			log__printf(NULL, MOSQ_LOG_NOTICE, "Expiring client %s due to timeout.", context->id);
 		}
+		G_CLIENTS_EXPIRED_INC();
+
+		/* Session has now expired, so clear interval */
+		context->session_expiry_interval = 0;
+		/* Session has expired, so will delay should be cleared. */
+		context->will_delay_interval = 0;
+		will_delay__remove(context);
+		context__send_will(context);
+		context__add_to_disused(context);
 	}
 }
-
@@ -0,0 +1,644 @@
+/*
+Copyright (c) 2022 Roger Light <roger@atchoo.org>
+
+All rights reserved. This program and the accompanying materials
+are made available under the terms of the Eclipse Public License 2.0
+and Eclipse Distribution License v1.0 which accompany this distribution.
+
+The Eclipse Public License is available at
+   https://www.eclipse.org/legal/epl-2.0/
+and the Eclipse Distribution License is available at
+  http://www.eclipse.org/org/documents/edl-v10.php.
+
+SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+
+Contributors:
+   Roger Light - initial implementation and documentation.
+*/
+
+/* Disk spill queue for outgoing messages.
+ *
+ * With queue_spill_dir set, an outgoing message that would otherwise be
+ * dropped because the client's queue is full is written to disk instead. Once
+ * a client has messages on disk, all of its new outgoing messages are written
+ * there too, so they are delivered in the order they arrived.
+ *
+ * Each client with messages on disk has its own series of append only segment
+ * files, <queue_spill_dir>/<spill id>-<sequence>.spill. A new segment is
+ * started once the current one reaches queue_spill_segment_size, and each
+ * segment is removed once every message in it has been read back.
+ *
+ * Messages are read back from the main loop while the client is connected,
+ * only as fast as there is room for them in its queue, so the memory used by
+ * a client is still bounded by max_queued_messages and max_queued_bytes.
+ *
+ * Spilled messages aren't saved by persistence, so with persistence enabled
+ * the messages for sessions that are saved are never spilled. Whatever is
+ * left on disk at startup belonged to sessions that have ended.
+ *
+ * Each record is:
+ *   uint32 length of the record after the qos byte
+ *   uint8  qos
+ *   uint8  retain
+ *   uint32 message expiry time, high word
+ *   uint32 message expiry time, low word
+ *   string topic
+ *   string bridge loop detection origin, or empty
+ *   message properties, with length
+ *   client message properties, with length
+ *   uint32 payload length
+ *   payload
+ */
+
+#include "config.h"
+
+#ifndef WIN32
+#include <dirent.h>
+#include <unistd.h>
+#endif
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mosquitto_broker_internal.h"
+#include "memory_mosq.h"
+#include "misc_mosq.h"
+#include "mqtt_protocol.h"
+#include "packet_mosq.h"
+#include "property_mosq.h"
+#include "utlist.h"
+#include "util_mosq.h"
+
+#define SPILL_HEADER_LEN 5
+#define SPILL_SUFFIX ".spill"
+
+static uint32_t spill_last_id = 0;
+
+
+#ifndef WIN32
+/* Count the complete records in a segment left by a previous run. */
+static int spill__count_records(const char *path)
+{
+	FILE *fptr;
+	uint8_t header[SPILL_HEADER_LEN];
+	uint32_t len;
+	long pos = 0, size;
+	int count = 0;
+
+	fptr = mosquitto__fopen(path, "rb", false);
+	if(!fptr){
+		return 0;
+	}
+	if(fseek(fptr, 0, SEEK_END) != 0 || (size = ftell(fptr)) < 0 || fseek(fptr, 0, SEEK_SET) != 0){
+		fclose(fptr);
+		return 0;
+	}
+	/* A write that failed may have left a partial record at the end. */
+	while(fread(header, 1, SPILL_HEADER_LEN, fptr) == SPILL_HEADER_LEN){
+		len = ((uint32_t)header[0]<<24) + ((uint32_t)header[1]<<16)
+				+ ((uint32_t)header[2]<<8) + (uint32_t)header[3];
+		pos += SPILL_HEADER_LEN + (long)len;
+		if(len == 0 || pos > size || fseek(fptr, pos, SEEK_SET) != 0){
+			break;
+		}
+		count++;
+	}
+	fclose(fptr);
+	return count;
+}
+#endif
+
+
+int spill__init(void)
+{
+#ifndef WIN32
+	DIR *dh;
+	struct dirent *de;
+	char *path;
+	size_t len;
+	size_t suffix_len = strlen(SPILL_SUFFIX);
+	int discarded = 0;
+#endif
+
+	if(db.config->queue_spill_dir == NULL){
+		return MOSQ_ERR_SUCCESS;
+	}
+
+#ifndef WIN32
+	/* Messages left on disk by a previous run belonged to sessions that
+	 * weren't saved, so are removed. How many is logged, because they are
+	 * lost. */
+	dh = opendir(db.config->queue_spill_dir);
+	if(!dh){
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to open queue_spill_dir '%s': %s.",
+				db.config->queue_spill_dir, strerror(errno));
+		return MOSQ_ERR_UNKNOWN;
+	}
+	while((de = readdir(dh)) != NULL){
+		len = strlen(de->d_name);
+		if(len > suffix_len && !strcmp(&de->d_name[len-suffix_len], SPILL_SUFFIX)){
+			len += strlen(db.config->queue_spill_dir) + 2;
+			path = mosquitto__malloc(len);
+			if(!path){
+				closedir(dh);
+				return MOSQ_ERR_NOMEM;
+			}
+			snprintf(path, len, "%s/%s", db.config->queue_spill_dir, de->d_name);
+			discarded += spill__count_records(path);
+			if(remove(path) != 0){
+				log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Unable to remove old spill file %s: %s.",
+						path, strerror(errno));
+			}
+			mosquitto__free(path);
+		}
+	}
+	closedir(dh);
+	if(discarded > 0){
+		log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Discarded %d messages left in %s by a previous run.",
+				discarded, db.config->queue_spill_dir);
+	}
+#endif
+
+	log__printf(NULL, MOSQ_LOG_INFO, "Outgoing messages for clients with full queues will be written to %s.",
+			db.config->queue_spill_dir);
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+static void spill__segment_path(struct mosquitto__spill *spill, uint32_t seq)
+{
+	snprintf(spill->path, strlen(db.config->queue_spill_dir)+32, "%s/%08x-%08x" SPILL_SUFFIX,
+			db.config->queue_spill_dir, spill->id, seq);
+}
+
+
+static struct mosquitto__spill *spill__new(struct mosquitto *context)
+{
+	struct mosquitto__spill *spill;
+
+	spill = mosquitto__calloc(1, sizeof(struct mosquitto__spill));
+	if(!spill){
+		return NULL;
+	}
+	spill->path = mosquitto__malloc(strlen(db.config->queue_spill_dir)+32);
+	if(!spill->path){
+		mosquitto__free(spill);
+		return NULL;
+	}
+	spill->context = context;
+	spill->id = ++spill_last_id;
+	spill->read_seq = 1;
+
+	context->spill = spill;
+	DL_APPEND(db.spills, spill);
+
+	return spill;
+}
+
+
+/* Start a new segment for writing, closing the current one. */
+static int spill__segment_start(struct mosquitto__spill *spill)
+{
+	if(spill->wfile){
+		fclose(spill->wfile);
+		spill->wfile = NULL;
+	}
+	spill->write_seq++;
+	spill->segment_bytes = 0;
+
+	spill__segment_path(spill, spill->write_seq);
+	spill->wfile = mosquitto__fopen(spill->path, "wb", true);
+	if(!spill->wfile){
+		/* Only logged once, until the client's messages are no longer being
+		 * dropped. */
+		if(spill->context->is_dropping == false){
+			log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to open spill file %s: %s.", spill->path, strerror(errno));
+		}
+		return MOSQ_ERR_ERRNO;
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+int spill__append(struct mosquitto *context, const struct mosquitto_msg_store *stored, uint8_t qos, bool retain, const mosquitto_property *properties)
+{
+	struct mosquitto__spill *spill;
+	struct mosquitto__packet packet;
+	uint16_t topic_len, origin_len = 0;
+	uint32_t len;
+	uint64_t expiry;
+	int rc;
+
+	if(db.config->queue_spill_dir == NULL || context->id == NULL){
+		return MOSQ_ERR_NOT_SUPPORTED;
+	}
+#ifdef WITH_PERSISTENCE
+	if(db.config->persistence && (context->clean_start == false
+#  ifdef WITH_BRIDGE
+				|| (context->bridge && context->bridge->clean_start_local == false)
+#  endif
+				)){
+
+		/* The session is saved, but its messages on disk wouldn't be. */
+		return MOSQ_ERR_NOT_SUPPORTED;
+	}
+#endif
+	if(context->spill && context->spill->restoring){
+		/* Only happens if a message read back from disk doesn't fit in the
+		 * queue, it can't go back to the start of the file. */
+		return MOSQ_ERR_NOT_SUPPORTED;
+	}
+
+	topic_len = (uint16_t)strlen(stored->topic);
+	if(stored->bridge_origin && strlen(stored->bridge_origin) <= UINT16_MAX){
+		origin_len = (uint16_t)strlen(stored->bridge_origin);
+	}
+	len = (uint32_t)(1 + 2*sizeof(uint32_t)
+			+ 2 + topic_len
+			+ 2 + origin_len
+			+ property__get_remaining_length(stored->properties)
+			+ property__get_remaining_length(properties)
+			+ sizeof(uint32_t) + stored->payloadlen);
+
+	if(db.config->queue_spill_max_bytes > 0){
+		if(context->spill){
+			if(context->spill->pending_bytes + SPILL_HEADER_LEN + len > db.config->queue_spill_max_bytes){
+				return MOSQ_ERR_OVERSIZE_PACKET;
+			}
+		}else if(SPILL_HEADER_LEN + len > db.config->queue_spill_max_bytes){
+			return MOSQ_ERR_OVERSIZE_PACKET;
+		}
+	}
+
+	spill = context->spill;
+	if(spill == NULL){
+		spill = spill__new(context);
+		if(spill == NULL){
+			return MOSQ_ERR_NOMEM;
+		}
+	}
+	if(spill->wfile == NULL || spill->segment_bytes >= db.config->queue_spill_segment_size){
+		rc = spill__segment_start(spill);
+		if(rc){
+			if(spill->pending_count == 0){
+				spill__free(context);
+			}
+			return rc;
+		}
+	}
+
+	memset(&packet, 0, sizeof(struct mosquitto__packet));
+	packet.packet_length = SPILL_HEADER_LEN + len - stored->payloadlen;
+	packet.payload = mosquitto__malloc(packet.packet_length);
+	if(!packet.payload){
+		if(spill->pending_count == 0){
+			spill__free(context);
+		}
+		return MOSQ_ERR_NOMEM;
+	}
+
+	expiry = (uint64_t)stored->message_expiry_time;
+	packet__write_uint32(&packet, len);
+	packet__write_byte(&packet, qos);
+	packet__write_byte(&packet, retain);
+	packet__write_uint32(&packet, (uint32_t)(expiry >> 32));
+	packet__write_uint32(&packet, (uint32_t)(expiry & UINT32_MAX));
+	packet__write_string(&packet, stored->topic, topic_len);
+	packet__write_string(&packet, stored->bridge_origin, origin_len);
+	rc = property__write_all(&packet, stored->properties, true);
+	if(rc == MOSQ_ERR_SUCCESS){
+		rc = property__write_all(&packet, properties, true);
+	}
+	if(rc){
+		mosquitto__free(packet.payload);
+		if(spill->pending_count == 0){
+			spill__free(context);
+		}
+		return rc;
+	}
+	packet__write_uint32(&packet, stored->payloadlen);
+
+	if(fwrite(packet.payload, 1, packet.packet_length, spill->wfile) != packet.packet_length
+			|| (stored->payloadlen > 0 && fwrite(stored->payload, 1, stored->payloadlen, spill->wfile) != stored->payloadlen)){
+
+		spill__segment_path(spill, spill->write_seq);
+		log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to write to spill file %s: %s.", spill->path, strerror(errno));
+		mosquitto__free(packet.payload);
+		/* Nothing more is written to this segment, and the partial record
+		 * is cut off the end. If that fails too, the reader skips the
+		 * partial record and moves on to the next segment. */
+		fclose(spill->wfile);
+		spill->wfile = NULL;
+#ifndef WIN32
+		if(truncate(spill->path, (off_t)spill->segment_bytes) != 0){
+			log__printf(NULL, MOSQ_LOG_WARNING, "Warning: Unable to truncate spill file %s: %s.", spill->path, strerror(errno));
+		}
+#endif
+		if(spill->pending_count == 0){
+			spill__free(context);
+		}
+		return MOSQ_ERR_ERRNO;
+	}
+	mosquitto__free(packet.payload);
+
+	spill->segment_bytes += SPILL_HEADER_LEN + len;
+	spill->pending_bytes += SPILL_HEADER_LEN + len;
+	spill->pending_count++;
+	if(spill->pending_count == 1){
+		log__printf(NULL, MOSQ_LOG_NOTICE, "Outgoing messages for client %s are being written to disk.", context->id);
+	}
+
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Check whether the rest of a record whose header has just been read is in
+ * the file. */
+static bool spill__record_complete(FILE *fptr, uint32_t len)
+{
+	long pos, size;
+
+	pos = ftell(fptr);
+	if(pos < 0 || fseek(fptr, 0, SEEK_END) != 0){
+		return false;
+	}
+	size = ftell(fptr);
+	if(fseek(fptr, pos, SEEK_SET) != 0){
+		return false;
+	}
+	return size >= pos && (uint64_t)(size - pos) >= len;
+}
+
+
+/* Read the header of the next record, moving on to the next segment when the
+ * current one has been read completely. */
+static int spill__read_header(struct mosquitto__spill *spill)
+{
+	uint8_t header[SPILL_HEADER_LEN];
+	size_t count;
+
+	while(1){
+		if(spill->rfile == NULL){
+			spill__segment_path(spill, spill->read_seq);
+			spill->rfile = mosquitto__fopen(spill->path, "rb", false);
+			if(!spill->rfile){
+				log__printf(NULL, MOSQ_LOG_ERR, "Error: Unable to open spill file %s: %s.", spill->path, strerror(errno));
+				return MOSQ_ERR_ERRNO;
+			}
+		}
+
+		/* The segment may have been appended to since the last read. */
+		clearerr(spill->rfile);
+		count = fread(header, 1, SPILL_HEADER_LEN, spill->rfile);
+		if(count == SPILL_HEADER_LEN){
+			spill->next_len = ((uint32_t)header[0]<<24) + ((uint32_t)header[1]<<16)
+					+ ((uint32_t)header[2]<<8) + (uint32_t)header[3];
+			spill->next_qos = header[4];
+			if(spill->read_seq >= spill->write_seq || spill__record_complete(spill->rfile, spill->next_len)){
+				if(spill->next_len == 0 || spill->next_qos > 2){
+					return MOSQ_ERR_MALFORMED_PACKET;
+				}
+				return MOSQ_ERR_SUCCESS;
+			}
+			/* A failed write left a partial record at the end of a segment
+			 * that is no longer written to. It was never counted as
+			 * pending. */
+			spill->next_len = 0;
+		}
+
+		if(spill->read_seq >= spill->write_seq){
+			/* Messages are still pending but the last segment has no more */
+			return MOSQ_ERR_MALFORMED_PACKET;
+		}
+		fclose(spill->rfile);
+		spill->rfile = NULL;
+		(void)remove(spill->path);
+		spill->read_seq++;
+	}
+}
+
+
+/* Read the record whose header has just been read. *stored is set to NULL
+ * if the message has expired. */
+static int spill__read_message(struct mosquitto__spill *spill, struct mosquitto_msg_store **stored, bool *retain, mosquitto_property **properties)
+{
+	struct mosquitto__packet packet;
+	struct mosquitto_msg_store *msg;
+	uint32_t expiry_hi, expiry_lo;
+	uint32_t message_expiry_interval = 0;
+	time_t expiry;
+	uint16_t slen;
+	uint8_t byte;
+	int rc;
+
+	*stored = NULL;
+	*properties = NULL;
+
+	memset(&packet, 0, sizeof(struct mosquitto__packet));
+	packet.remaining_length = spill->next_len;
+	packet.payload = mosquitto__malloc(spill->next_len+1U);
+	if(!packet.payload){
+		return MOSQ_ERR_NOMEM;
+	}
+	if(fread(packet.payload, 1, spill->next_len, spill->rfile) != spill->next_len){
+		mosquitto__free(packet.payload);
+		return MOSQ_ERR_MALFORMED_PACKET;
+	}
+	/* Ensure payload is always zero terminated */
+	packet.payload[spill->next_len] = 0;
+
+	msg = mosquitto__slab_calloc(sizeof(struct mosquitto_msg_store));
+	if(!msg){
+		mosquitto__free(packet.payload);
+		return MOSQ_ERR_NOMEM;
+	}
+	msg->qos = spill->next_qos;
+
+	rc = packet__read_byte(&packet, &byte);
+	if(rc) goto error;
+	*retain = byte;
+	rc = packet__read_uint32(&packet, &expiry_hi);
+	if(rc) goto error;
+	rc = packet__read_uint32(&packet, &expiry_lo);
+	if(rc) goto error;
+	rc = packet__read_string(&packet, &msg->topic, &slen);
+	if(rc) goto error;
+	if(msg->topic == NULL){
+		rc = MOSQ_ERR_MALFORMED_PACKET;
+		goto error;
+	}
+	rc = packet__read_string(&packet, &msg->bridge_origin, &slen);
+	if(rc) goto error;
+	rc = property__read_all(CMD_PUBLISH, &packet, &msg->properties);
+	if(rc) goto error;
+	rc = property__read_all(CMD_PUBLISH, &packet, properties);
+	if(rc) goto error;
+	rc = packet__read_uint32(&packet, &msg->payloadlen);
+	if(rc) goto error;
+	if(packet.pos + msg->payloadlen != packet.remaining_length){
+		rc = MOSQ_ERR_MALFORMED_PACKET;
+		goto error;
+	}
+
+	/* The payload stays where it is in the record buffer */
+	msg->payload = &packet.payload[packet.pos];
+	msg->payload_offset = packet.pos;
+	packet.payload = NULL;
+
+	expiry = (time_t)(((uint64_t)expiry_hi<<32) + expiry_lo);
+	if(expiry > 0){
+		if(expiry <= db.now_real_s){
+			db__msg_store_free(msg);
+			mosquitto_property_free_all(properties);
+			return MOSQ_ERR_SUCCESS;
+		}
+		message_expiry_interval = (uint32_t)(expiry - db.now_real_s);
+	}
+	msg->retain = *retain;
+
+	rc = db__message_store(NULL, msg, message_expiry_interval, 0, mosq_mo_broker);
+	if(rc){
+		mosquitto_property_free_all(properties);
+		return rc;
+	}
+	*stored = msg;
+	return MOSQ_ERR_SUCCESS;
+
+error:
+	mosquitto__free(packet.payload);
+	db__msg_store_free(msg);
+	mosquitto_property_free_all(properties);
+	return rc;
+}
+
+
+/* Move messages from disk to the client's queue while there is room for
+ * them. */
+static int spill__restore(struct mosquitto__spill *spill)
+{
+	struct mosquitto *context = spill->context;
+	struct mosquitto_msg_store *stored;
+	mosquitto_property *properties;
+	uint16_t mid;
+	uint8_t qos;
+	bool retain;
+	int rc;
+
+	if(spill->wfile){
+		fflush(spill->wfile);
+	}
+
+	while(spill->pending_count > 0){
+		if(spill->next_len == 0){
+			rc = spill__read_header(spill);
+			if(rc) return rc;
+		}
+		qos = spill->next_qos;
+		if(!db__ready_for_flight(context, mosq_md_out, qos)
+				&& (qos == 0 || !db__ready_for_queue(context, qos, &context->msgs_out))){
+
+			return MOSQ_ERR_SUCCESS;
+		}
+
+		rc = spill__read_message(spill, &stored, &retain, &properties);
+		spill->pending_count--;
+		spill->pending_bytes -= SPILL_HEADER_LEN + spill->next_len;
+		spill->next_len = 0;
+		if(rc) return rc;
+		if(stored == NULL){
+			/* Expired while on disk */
+			continue;
+		}
+
+		if(qos > 0){
+			mid = mosquitto__mid_generate(context);
+		}else{
+			mid = 0;
+		}
+		db__msg_store_ref_inc(stored);
+		spill->restoring = true;
+		rc = db__message_insert(context, mid, mosq_md_out, qos, retain, stored, properties, true);
+		spill->restoring = false;
+		db__msg_store_ref_dec(&stored);
+		if(rc == MOSQ_ERR_NOMEM){
+			return rc;
+		}
+		if(context->spill != spill){
+			/* Freed while sending, the client has gone */
+			return MOSQ_ERR_SUCCESS;
+		}
+	}
+	return MOSQ_ERR_SUCCESS;
+}
+
+
+/* Called once per pass of the main loop, to send messages from disk to the
+ * clients that are connected. */
+void spill__run(void)
+{
+	struct mosquitto__spill *spill, *spill_tmp;
+	struct mosquitto *context;
+	int rc;
+
+	DL_FOREACH_SAFE(db.spills, spill, spill_tmp){
+		context = spill->context;
+		if(context->state != mosq_cs_active || context->sock == INVALID_SOCKET){
+			continue;
+		}
+
+		rc = spill__restore(spill);
+		if(context->spill != spill){
+			continue;
+		}
+		if(rc){
+			log__printf(NULL, MOSQ_LOG_ERR,
+					"Error: Unable to read messages written to disk for client %s, %d messages lost.",
+					context->id, spill->pending_count);
+			spill__free(context);
+		}else if(spill->pending_count == 0){
+			log__printf(NULL, MOSQ_LOG_INFO,
+					"All messages written to disk for client %s have been queued.",
+					context->id);
+			spill__free(context);
+		}
+	}
+}
+
+
+/* Move messages on disk to a new context taking over a session. */
+void spill__move(struct mosquitto *from, struct mosquitto *to)
+{
+	if(from->spill){
+		spill__free(to);
+		to->spill = from->spill;
+		to->spill->context = to;
+		from->spill = NULL;
+	}
+}
+
+
+void spill__free(struct mosquitto *context)
+{
+	struct mosquitto__spill *spill = context->spill;
+	uint32_t seq;
+
+	if(spill == NULL){
+		return;
+	}
+
+	if(spill->rfile){
+		fclose(spill->rfile);
+	}
+	if(spill->wfile){
+		fclose(spill->wfile);
+	}
+	for(seq=spill->read_seq; seq<=spill->write_seq; seq++){
+		spill__segment_path(spill, seq);
+		(void)remove(spill->path);
+	}
+
+	DL_DELETE(db.spills, spill);
+	mosquitto__free(spill->path);
+	mosquitto__free(spill);
+	context->spill = NULL;
+}
@@ -451,6 +451,19 @@ static int sub__remove_shared(struct mosquitto *context, struct mosquitto__subhi
 }
 
 
+static void sub__remove_hier_entry(struct mosquitto__subhier *parent, struct mosquitto__subhier *branch)
+{
+	if(parent->child_plus == branch){
+		parent->child_plus = NULL;
+	}else if(parent->child_hash == branch){
+		parent->child_hash = NULL;
+	}
+	HASH_DELETE(hh, parent->children, branch);
+	mosquitto__free(branch->topic);
+	mosquitto__free(branch);
+}
+
+
 static int sub__remove_recurse(struct mosquitto *context, struct mosquitto__subhier *subhier, char **topics, uint8_t *reason, const char *sharename)
 {
 	struct mosquitto__subhier *branch;
@@ -467,34 +480,32 @@ static int sub__remove_recurse(struct mosquitto *context, struct mosquitto__subh
 	if(branch){
 		sub__remove_recurse(context, branch, &(topics[1]), reason, sharename);
 		if(!branch->children && !branch->subs && !branch->shared){
-			HASH_DELETE(hh, subhier->children, branch);
-			mosquitto__free(branch->topic);
-			mosquitto__free(branch);
+			sub__remove_hier_entry(subhier, branch);
 		}
 	}
 	return MOSQ_ERR_SUCCESS;
 }
 
 
-static int sub__search(struct mosquitto__subhier *subhier, char **split_topics, const char *source_id, const char *topic, uint8_t qos, int retain, struct mosquitto_msg_store *stored)
+static int sub__search(struct mosquitto__subhier *subhier, const struct mosquitto__topic_level *levels, int level_count, const char *source_id, const char *topic, uint8_t qos, int retain, struct mosquitto_msg_store *stored)
 {
 	/* FIXME - need to take into account source_id if the client is a bridge */
 	struct mosquitto__subhier *branch;
 	int rc;
 	bool have_subscribers = false;
 
-	if(split_topics && split_topics[0]){
+	if(level_count > 0){
 		/* Check for literal match */
-		HASH_FIND(hh, subhier->children, split_topics[0], strlen(split_topics[0]), branch);
+		HASH_FIND_BYHASHVALUE(hh, subhier->children, &stored->topic[levels[0].offset], levels[0].len, levels[0].hashv, branch);
 
 		if(branch){
-			rc = sub__search(branch, &(split_topics[1]), source_id, topic, qos, retain, stored);
+			rc = sub__search(branch, &(levels[1]), level_count-1, source_id, topic, qos, retain, stored);
 			if(rc == MOSQ_ERR_SUCCESS){
 				have_subscribers = true;
 			}else if(rc != MOSQ_ERR_NO_SUBSCRIBERS){
 				return rc;
 			}
-			if(split_topics[1] == NULL){ /* End of list */
+			if(level_count == 1){ /* End of list */
 				rc = subs__process(branch, source_id, topic, qos, retain, stored);
 				if(rc == MOSQ_ERR_SUCCESS){
 					have_subscribers = true;
@@ -505,16 +516,16 @@ static int sub__search(struct mosquitto__subhier *subhier, char **split_topics,
 		}
 
 		/* Check for + match */
-		HASH_FIND(hh, subhier->children, "+", 1, branch);
+		branch = subhier->child_plus;
 
 		if(branch){
-			rc = sub__search(branch, &(split_topics[1]), source_id, topic, qos, retain, stored);
+			rc = sub__search(branch, &(levels[1]), level_count-1, source_id, topic, qos, retain, stored);
 			if(rc == MOSQ_ERR_SUCCESS){
 				have_subscribers = true;
 			}else if(rc != MOSQ_ERR_NO_SUBSCRIBERS){
 				return rc;
 			}
-			if(split_topics[1] == NULL){ /* End of list */
+			if(level_count == 1){ /* End of list */
 				rc = subs__process(branch, source_id, topic, qos, retain, stored);
 				if(rc == MOSQ_ERR_SUCCESS){
 					have_subscribers = true;
@@ -526,7 +537,7 @@ static int sub__search(struct mosquitto__subhier *subhier, char **split_topics,
 	}
 
 	/* Check for # match */
-	HASH_FIND(hh, subhier->children, "#", 1, branch);
+	branch = subhier->child_hash;
 	if(branch && !branch->children){
 		/* The topic matches due to a # wildcard - process the
 		 * subscriptions but *don't* return. Although this branch has ended
@@ -571,6 +582,14 @@ struct mosquitto__subhier *sub__add_hier_entry(struct mosquitto__subhier *parent
 
 	HASH_ADD_KEYPTR(hh, *sibling, child->topic, child->topic_len, child);
 
+	if(parent && len == 1){
+		if(topic[0] == '+'){
+			parent->child_plus = child;
+		}else if(topic[0] == '#'){
+			parent->child_hash = child;
+		}
+	}
+
 	return child;
 }
 
@@ -613,6 +632,11 @@ int sub__add(struct mosquitto *context, const char *sub, uint8_t qos, uint32_t i
 	mosquitto__free(local_sub);
 	mosquitto__free(topics);
 
+#ifdef WITH_PERSISTENCE
+	if(rc == MOSQ_ERR_SUCCESS || rc == MOSQ_ERR_SUB_EXISTS){
+		persist__journal_sub(context, sub, qos, identifier, options);
+	}
+#endif
 	return rc;
 }
 
@@ -634,6 +658,11 @@ int sub__remove(struct mosquitto *context, const char *sub, struct mosquitto__su
 	if(subhier){
 		*reason = MQTT_RC_NO_SUBSCRIPTION_EXISTED;
 		rc = sub__remove_recurse(context, subhier, topics, reason, sharename);
+#ifdef WITH_PERSISTENCE
+		if(rc == MOSQ_ERR_SUCCESS && *reason == 0){
+			persist__journal_sub_remove(context, sub);
+		}
+#endif
 	}
 
 	mosquitto__free(local_sub);
@@ -646,12 +675,12 @@ int sub__messages_queue(const char *source_id, const char *topic, uint8_t qos, i
 {
 	int rc = MOSQ_ERR_SUCCESS, rc2;
 	struct mosquitto__subhier *subhier;
-	char **split_topics = NULL;
-	char *local_topic = NULL;
+	const struct mosquitto__topic_level *levels;
 
 	assert(topic);
 
-	if(sub__topic_tokenise(topic, &local_topic, &split_topics, NULL)) return 1;
+	if(sub__topic_levels(*stored)) return 1;
+	levels = (*stored)->topic_levels;
 
 	/* Protect this message until we have sent it to all
 	clients - this is required because websockets client calls
@@ -659,18 +688,16 @@ int sub__messages_queue(const char *source_id, const char *topic, uint8_t qos, i
 	*/
 	db__msg_store_ref_inc(*stored);
 
-	HASH_FIND(hh, db.subs, split_topics[0], strlen(split_topics[0]), subhier);
+	HASH_FIND_BYHASHVALUE(hh, db.subs, &(*stored)->topic[levels[0].offset], levels[0].len, levels[0].hashv, subhier);
 	if(subhier){
-		rc = sub__search(subhier, split_topics, source_id, topic, qos, retain, *stored);
+		rc = sub__search(subhier, levels, (*stored)->topic_level_count, source_id, topic, qos, retain, *stored);
 	}
 
 	if(retain){
-		rc2 = retain__store(topic, *stored, split_topics);
+		rc2 = retain__store(*stored);
 		if(rc2) rc = rc2;
 	}
 
-	mosquitto__free(split_topics);
-	mosquitto__free(local_topic);
 	/* Remove our reference and free if needed. */
 	db__msg_store_ref_dec(stored);
 
@@ -692,9 +719,7 @@ static struct mosquitto__subhier *tmp_remove_subs(struct mosquitto__subhier *sub
 	}
 
 	parent = sub->parent;
-	HASH_DELETE(hh, parent->children, sub);
-	mosquitto__free(sub->topic);
-	mosquitto__free(sub);
+	sub__remove_hier_entry(parent, sub);
 
 	if(parent->subs == NULL
 			&& parent->children == NULL
@@ -716,6 +741,8 @@ int sub__clean_session(struct mosquitto *context)
 	struct mosquitto__subleaf *leaf;
 	struct mosquitto__subhier *hier;
 
+	retain__cursors_free(context);
+
 	for(i=0; i<context->sub_count; i++){
 		if(context->subs[i] == NULL){
 			continue;
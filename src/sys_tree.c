@@ -127,6 +127,35 @@ static void sys_tree__update_memory(char *buf)
 }
 #endif
 
+static void sys_tree__update_slabs(char *buf)
+{
+	static unsigned long used_prev[MEMORY_SLAB_CLASSES];
+	static unsigned long free_prev[MEMORY_SLAB_CLASSES];
+	static bool initial = true;
+	char topic[100];
+	size_t size;
+	unsigned long used, free_count;
+	uint32_t len;
+	int i;
+
+	for(i=0; i<MEMORY_SLAB_CLASSES; i++){
+		memory__slab_stats(i, &size, &used, &free_count);
+		if(initial || used_prev[i] != used){
+			used_prev[i] = used;
+			snprintf(topic, sizeof(topic), "$SYS/broker/heap/slab/%d/used", (int)size);
+			len = (uint32_t)snprintf(buf, BUFLEN, "%lu", used);
+			db__messages_easy_queue(NULL, topic, SYS_TREE_QOS, len, buf, 1, 60, NULL);
+		}
+		if(initial || free_prev[i] != free_count){
+			free_prev[i] = free_count;
+			snprintf(topic, sizeof(topic), "$SYS/broker/heap/slab/%d/free", (int)size);
+			len = (uint32_t)snprintf(buf, BUFLEN, "%lu", free_count);
+			db__messages_easy_queue(NULL, topic, SYS_TREE_QOS, len, buf, 1, 60, NULL);
+		}
+	}
+	initial = false;
+}
+
 static void calc_load(char *buf, const char *topic, bool initial, double exponent, double interval, double *current)
 {
 	double new_value;
@@ -318,6 +347,7 @@ void sys_tree__update(int interval, time_t start_time)
 #ifdef REAL_WITH_MEMORY_TRACKING
 		sys_tree__update_memory(buf);
 #endif
+		sys_tree__update_slabs(buf);
 
 		if(msgs_received != g_msgs_received){
 			msgs_received = g_msgs_received;
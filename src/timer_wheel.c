@@ -0,0 +1,247 @@
+/*
+Copyright (c) 2022 Roger Light <roger@atchoo.org>
+
+All rights reserved. This program and the accompanying materials
+are made available under the terms of the Eclipse Public License 2.0
+and Eclipse Distribution License v1.0 which accompany this distribution.
+
+The Eclipse Public License is available at
+   https://www.eclipse.org/legal/epl-2.0/
+and the Eclipse Distribution License is available at
+  http://www.eclipse.org/org/documents/edl-v10.php.
+
+SPDX-License-Identifier: EPL-2.0 OR BSD-3-Clause
+
+Contributors:
+   Roger Light - initial implementation and documentation.
+*/
+
+/* Hierarchical timer wheel with one second resolution.
+ *
+ * Timers are kept in unsorted per-slot lists, so adding and removing a timer
+ * is O(1). Timers due within TIMER_WHEEL_ROOT_SIZE seconds live in the root
+ * level, timers further away live in coarser levels and are moved down
+ * ("cascaded") when the root level wraps around. Advancing the wheel by one
+ * second only touches the timers that are due, plus the occasional cascade,
+ * rather than every timer that exists.
+ *
+ * A timer fires once the clock passed to timer_wheel__advance() is greater
+ * than its expiry time. Fired timers are placed on an expired list and handed
+ * out by timer_wheel__pop_expired(), which means the caller is free to add or
+ * remove other timers whilst processing them. A timer that is added after its
+ * expiry time fires at the next advance.
+ *
+ * If the clock goes backwards, which can happen for wheels driven by the wall
+ * clock, every timer is re-sorted against the new time, so a timer fires
+ * once the clock passes its expiry time again rather than straight away.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <utlist.h>
+
+#include "mosquitto_broker_internal.h"
+
+/* Clock jumps larger than this re-sort all timers rather than stepping
+ * through every second in between. */
+#define TIMER_WHEEL_MAX_STEP (TIMER_WHEEL_ROOT_SIZE*TIMER_WHEEL_LEVEL_SIZE)
+
+
+static void timer_wheel__link(struct mosquitto__timer **slot, struct mosquitto__timer *timer)
+{
+	DL_APPEND(*slot, timer);
+	timer->slot = slot;
+}
+
+
+static void timer_wheel__insert(struct mosquitto__timer_wheel *wheel, struct mosquitto__timer *timer)
+{
+	time_t tick;
+	time_t delta;
+	time_t range;
+	int level;
+	int shift;
+
+	tick = timer->expiry + 1;
+	if(tick < wheel->now){
+		tick = wheel->now;
+	}
+	delta = tick - wheel->now;
+
+	if(delta < TIMER_WHEEL_ROOT_SIZE){
+		timer_wheel__link(&wheel->root[tick & (TIMER_WHEEL_ROOT_SIZE-1)], timer);
+		return;
+	}
+
+	shift = TIMER_WHEEL_ROOT_BITS;
+	for(level=0; level<TIMER_WHEEL_LEVELS; level++){
+		range = (time_t)1 << (shift + TIMER_WHEEL_LEVEL_BITS);
+		if(delta < range || level == TIMER_WHEEL_LEVELS-1){
+			if(delta >= range){
+				/* Beyond the end of the wheel. Park the timer in the furthest
+				 * slot, it will be re-sorted when that slot is cascaded. */
+				tick = wheel->now + range - 1;
+			}
+			timer_wheel__link(&wheel->levels[level][(tick >> shift) & (TIMER_WHEEL_LEVEL_SIZE-1)], timer);
+			return;
+		}
+		shift += TIMER_WHEEL_LEVEL_BITS;
+	}
+}
+
+
+/* Move all timers in a slot to the expired list. */
+static void timer_wheel__expire_slot(struct mosquitto__timer_wheel *wheel, struct mosquitto__timer **slot)
+{
+	struct mosquitto__timer *timer;
+
+	if(*slot == NULL) return;
+
+	DL_FOREACH(*slot, timer){
+		timer->slot = &wheel->expired;
+		wheel->count--;
+	}
+	DL_CONCAT(wheel->expired, *slot);
+	*slot = NULL;
+}
+
+
+/* Re-insert all timers from a slot relative to the current tick. */
+static void timer_wheel__resort(struct mosquitto__timer_wheel *wheel, struct mosquitto__timer **slot)
+{
+	struct mosquitto__timer *list, *timer, *timer_tmp;
+
+	list = *slot;
+	*slot = NULL;
+	DL_FOREACH_SAFE(list, timer, timer_tmp){
+		DL_DELETE(list, timer);
+		timer_wheel__insert(wheel, timer);
+	}
+}
+
+
+static void timer_wheel__step(struct mosquitto__timer_wheel *wheel)
+{
+	int idx;
+	int level;
+	int shift;
+
+	idx = (int)(wheel->now & (TIMER_WHEEL_ROOT_SIZE-1));
+	if(idx == 0){
+		shift = TIMER_WHEEL_ROOT_BITS;
+		for(level=0; level<TIMER_WHEEL_LEVELS; level++){
+			int lidx = (int)((wheel->now >> shift) & (TIMER_WHEEL_LEVEL_SIZE-1));
+
+			timer_wheel__resort(wheel, &wheel->levels[level][lidx]);
+			if(lidx != 0){
+				break;
+			}
+			shift += TIMER_WHEEL_LEVEL_BITS;
+		}
+	}
+	timer_wheel__expire_slot(wheel, &wheel->root[idx]);
+	wheel->now++;
+}
+
+
+void timer_wheel__init(struct mosquitto__timer_wheel *wheel, time_t now)
+{
+	memset(wheel, 0, sizeof(struct mosquitto__timer_wheel));
+	wheel->now = now;
+}
+
+
+void timer_wheel__add(struct mosquitto__timer_wheel *wheel, struct mosquitto__timer *timer, time_t expiry)
+{
+	timer_wheel__remove(wheel, timer);
+
+	/* If the slot this timer belongs in has already been processed, it goes
+	 * in the current slot. It isn't expired straight away, because the clock
+	 * may have gone backwards since the last advance. */
+	timer->expiry = expiry;
+	timer_wheel__insert(wheel, timer);
+	wheel->count++;
+}
+
+
+void timer_wheel__remove(struct mosquitto__timer_wheel *wheel, struct mosquitto__timer *timer)
+{
+	if(timer->slot == NULL) return;
+
+	DL_DELETE(*timer->slot, timer);
+	if(timer->slot != &wheel->expired){
+		wheel->count--;
+	}
+	timer->slot = NULL;
+	timer->prev = NULL;
+	timer->next = NULL;
+}
+
+
+/* Re-sort every timer against a new time. Overdue timers end up in the
+ * current slot. */
+static void timer_wheel__rebase(struct mosquitto__timer_wheel *wheel, time_t now)
+{
+	int level, i;
+
+	wheel->now = now;
+	for(i=0; i<TIMER_WHEEL_ROOT_SIZE; i++){
+		timer_wheel__resort(wheel, &wheel->root[i]);
+	}
+	for(level=0; level<TIMER_WHEEL_LEVELS; level++){
+		for(i=0; i<TIMER_WHEEL_LEVEL_SIZE; i++){
+			timer_wheel__resort(wheel, &wheel->levels[level][i]);
+		}
+	}
+}
+
+
+void timer_wheel__advance(struct mosquitto__timer_wheel *wheel, time_t now)
+{
+	if(wheel->count == 0){
+		wheel->now = now + 1;
+		return;
+	}
+
+	if(now + 1 < wheel->now){
+		/* The clock has gone backwards. */
+		timer_wheel__rebase(wheel, now);
+	}else if(now - wheel->now > TIMER_WHEEL_MAX_STEP){
+		/* Large jump, most likely the wall clock being set. This is quicker
+		 * than stepping through every second in between. */
+		timer_wheel__rebase(wheel, now);
+	}
+
+	while(wheel->now <= now){
+		timer_wheel__step(wheel);
+	}
+}
+
+
+/* Move every timer to the expired list, regardless of expiry time. */
+void timer_wheel__expire_all(struct mosquitto__timer_wheel *wheel)
+{
+	int level, i;
+
+	for(i=0; i<TIMER_WHEEL_ROOT_SIZE; i++){
+		timer_wheel__expire_slot(wheel, &wheel->root[i]);
+	}
+	for(level=0; level<TIMER_WHEEL_LEVELS; level++){
+		for(i=0; i<TIMER_WHEEL_LEVEL_SIZE; i++){
+			timer_wheel__expire_slot(wheel, &wheel->levels[level][i]);
+		}
+	}
+}
+
+
+struct mosquitto__timer *timer_wheel__pop_expired(struct mosquitto__timer_wheel *wheel)
+{
+	struct mosquitto__timer *timer;
+
+	timer = wheel->expired;
+	if(timer){
+		timer_wheel__remove(wheel, timer);
+	}
+	return timer;
+}
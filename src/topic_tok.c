@@ -116,3 +116,62 @@ int sub__topic_tokenise(const char *subtopic, char **local_sub, char ***topics,
 	}
 	return MOSQ_ERR_SUCCESS;
 }
+
+
+/* Split the topic of a stored message into levels, recording the offset,
+ * length and hash of each level. This is done once per message, the result
+ * is reused for the subscription match and the retain store. */
+int sub__topic_levels(struct mosquitto_msg_store *stored)
+{
+	struct mosquitto__topic_level *levels;
+	const char *topic;
+	const char *c;
+	int count;
+	int i = 0;
+
+	if(stored->topic_levels) return MOSQ_ERR_SUCCESS;
+
+	topic = stored->topic;
+	if(topic == NULL || topic[0] == '\0'){
+		return MOSQ_ERR_INVAL;
+	}
+
+	count = 1;
+	if(topic[0] != '$'){
+		count++;
+	}
+	for(c=topic; *c; c++){
+		if(*c == '/') count++;
+	}
+
+	if(count <= MSG_STORE_TOPIC_LEVELS){
+		levels = stored->topic_levels_static;
+	}else{
+		levels = (struct mosquitto__topic_level *)mosquitto__malloc(sizeof(struct mosquitto__topic_level)*(size_t)count);
+		if(levels == NULL) return MOSQ_ERR_NOMEM;
+	}
+
+	if(topic[0] != '$'){
+		levels[0].offset = 0;
+		levels[0].len = 0;
+		HASH_VALUE("", 0, levels[0].hashv);
+		i++;
+	}
+
+	c = topic;
+	while(1){
+		levels[i].offset = (uint32_t)(c - topic);
+		while(*c && *c != '/'){
+			c++;
+		}
+		levels[i].len = (uint32_t)(c - topic) - levels[i].offset;
+		HASH_VALUE(&topic[levels[i].offset], levels[i].len, levels[i].hashv);
+		i++;
+		if(*c == '\0') break;
+		c++;
+	}
+
+	stored->topic_levels = levels;
+	stored->topic_level_count = count;
+	return MOSQ_ERR_SUCCESS;
+}
@@ -283,7 +283,7 @@ static int callback_mqtt(
 				}
 
 				packet__cleanup(packet);
-				mosquitto__free(packet);
+				mosquitto__slab_free(packet);
 
 				mosq->next_msg_out = db.now_s + mosq->keepalive;
 			}
@@ -337,10 +337,11 @@ static int callback_mqtt(
 					mosq->in_packet.remaining_count = (int8_t)(mosq->in_packet.remaining_count * -1);
 
 					if(mosq->in_packet.remaining_length > 0){
-						mosq->in_packet.payload = mosquitto__malloc(mosq->in_packet.remaining_length*sizeof(uint8_t));
+						mosq->in_packet.payload = mosquitto__malloc(mosq->in_packet.remaining_length+1);
 						if(!mosq->in_packet.payload){
 							return -1;
 						}
+						mosq->in_packet.payload[mosq->in_packet.remaining_length] = 0;
 						mosq->in_packet.to_process = mosq->in_packet.remaining_length;
 					}
 				}
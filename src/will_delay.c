@@ -26,32 +26,23 @@ Contributors:
 #include "memory_mosq.h"
 #include "time_mosq.h"
 
-static struct will_delay_list *delay_list = NULL;
-static time_t last_check = 0;
-
-
-static int will_delay__cmp(struct will_delay_list *i1, struct will_delay_list *i2)
-{
-	return (int)(i1->context->will_delay_interval - i2->context->will_delay_interval);
-}
+static struct mosquitto__timer_wheel delay_wheel;
+static bool delay_wheel_init = false;
 
 
 int will_delay__add(struct mosquitto *context)
 {
-	struct will_delay_list *item;
-
-	if(context->will_delay_entry){
+	if(context->will_delay_timer.slot){
 		return MOSQ_ERR_SUCCESS;
 	}
 
-	item = mosquitto__calloc(1, sizeof(struct will_delay_list));
-	if(!item) return MOSQ_ERR_NOMEM;
-
-	item->context = context;
-	context->will_delay_entry = item;
-	item->context->will_delay_time = db.now_real_s + item->context->will_delay_interval;
-
-	DL_INSERT_INORDER(delay_list, item, will_delay__cmp);
+	if(delay_wheel_init == false){
+		timer_wheel__init(&delay_wheel, db.now_real_s);
+		delay_wheel_init = true;
+	}
+	context->will_delay_time = db.now_real_s + context->will_delay_interval;
+	context->will_delay_timer.data = context;
+	timer_wheel__add(&delay_wheel, &context->will_delay_timer, context->will_delay_time);
 
 	return MOSQ_ERR_SUCCESS;
 }
@@ -60,37 +51,30 @@ int will_delay__add(struct mosquitto *context)
 /* Call on broker shutdown only */
 void will_delay__send_all(void)
 {
-	struct will_delay_list *item, *tmp;
-
-	DL_FOREACH_SAFE(delay_list, item, tmp){
-		DL_DELETE(delay_list, item);
-		item->context->will_delay_interval = 0;
-		item->context->will_delay_entry = NULL;
-		context__send_will(item->context);
-		mosquitto__free(item);
+	struct mosquitto__timer *timer;
+	struct mosquitto *context;
+
+	timer_wheel__expire_all(&delay_wheel);
+	while((timer = timer_wheel__pop_expired(&delay_wheel))){
+		context = (struct mosquitto *)timer->data;
+		context->will_delay_interval = 0;
+		context__send_will(context);
 	}
 }
 
 void will_delay__check(void)
 {
-	struct will_delay_list *item, *tmp;
-
-	if(db.now_real_s <= last_check) return;
-
-	last_check = db.now_real_s;
-
-	DL_FOREACH_SAFE(delay_list, item, tmp){
-		if(item->context->will_delay_time < db.now_real_s){
-			DL_DELETE(delay_list, item);
-			item->context->will_delay_interval = 0;
-			item->context->will_delay_entry = NULL;
-			context__send_will(item->context);
-			if(item->context->session_expiry_interval == 0){
-				context__add_to_disused(item->context);
-			}
-			mosquitto__free(item);
-		}else{
-			return;
+	struct mosquitto__timer *timer;
+	struct mosquitto *context;
+
+	timer_wheel__advance(&delay_wheel, db.now_real_s);
+
+	while((timer = timer_wheel__pop_expired(&delay_wheel))){
+		context = (struct mosquitto *)timer->data;
+		context->will_delay_interval = 0;
+		context__send_will(context);
+		if(context->session_expiry_interval == 0){
+			context__add_to_disused(context);
 		}
 	}
 }
@@ -98,10 +82,5 @@ void will_delay__check(void)
 
 void will_delay__remove(struct mosquitto *mosq)
 {
-	if(mosq->will_delay_entry != NULL){
-		DL_DELETE(delay_list, mosq->will_delay_entry);
-		mosquitto__free(mosq->will_delay_entry);
-		mosq->will_delay_entry = NULL;
-	}
+	timer_wheel__remove(&delay_wheel, &mosq->will_delay_timer);
 }
-
@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+
+# Exercise the broker with io_threads set, so client sockets are read and
+# written by the I/O threads: packets sent straight after a CONNECT that is
+# checked by a password hashing thread, pipelined packets read with a small
+# read budget, large messages to a subscriber that stops reading for a while,
+# messages sent just before a connection is taken over, and a client that goes
+# away without disconnecting.
+
+from mosq_test_helper import *
+
+def write_config(filename, port1, port2, pw_file):
+    with open(filename, 'w') as f:
+        f.write("per_listener_settings true\n")
+        f.write("port %d\n" % (port1))
+        f.write("password_file %s\n" % (pw_file))
+        f.write("allow_anonymous false\n")
+        f.write("password_hash_threads 1\n")
+        f.write("io_threads 2\n")
+        f.write("use_io_uring false\n")
+        f.write("max_read_packets 5\n")
+        # Clients on this listener don't wait for a hashing thread
+        f.write("listener %d\n" % (port2))
+        f.write("allow_anonymous true\n")
+
+def write_pwfile(filename):
+    with open(filename, 'w') as f:
+        # Username user, password password
+        f.write('user:$7$1000$vcOZoRqMMTnQXLJI$se7zHA77MHwy7EhBV+/9sUY7V/quHgh2dcVgosXP7nWik32y/RP6yFQFZKc/BoA2suZ5rBJ6Wk0QNWLHONUjKA==\n')
+
+def recv_all(sock, length):
+    data = b""
+    while len(data) < length:
+        d = sock.recv(length - len(data))
+        if len(d) == 0:
+            raise mosq_test.TestError
+        data += d
+    return data
+
+def do_test(proto_ver):
+    pw_file = os.path.basename(__file__).replace('.py', '.pwfile')
+    (port, port2) = mosq_test.get_port(2)
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    write_config(conf_file, port, port2, pw_file)
+    write_pwfile(pw_file)
+
+    rc = 1
+    keepalive = 60
+    count = 100
+
+    sub_connect_packet = mosq_test.gen_connect("io-threads-sub", keepalive=keepalive, username="user", password="password", proto_ver=proto_ver)
+    pub_connect_packet = mosq_test.gen_connect("io-threads-pub", keepalive=keepalive, username="user", password="password", proto_ver=proto_ver)
+    takeover_connect_packet = mosq_test.gen_connect("io-threads-takeover", keepalive=keepalive, proto_ver=proto_ver)
+    will_connect_packet = mosq_test.gen_connect("io-threads-will", keepalive=keepalive, username="user", password="password", will_topic="io_threads/will", will_payload=b"gone", proto_ver=proto_ver)
+    connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+
+    mid = 1
+    subscribe_packet = mosq_test.gen_subscribe(mid, "io_threads/#", 1, proto_ver=proto_ver)
+    suback_packet = mosq_test.gen_suback(mid, 1, proto_ver=proto_ver)
+
+    will_packet = mosq_test.gen_publish("io_threads/will", qos=0, payload="gone", proto_ver=proto_ver)
+
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+    try:
+        # SUBSCRIBE is sent without waiting for the CONNACK
+        sub = mosq_test.client_connect_only(port=port)
+        sub.send(sub_connect_packet + subscribe_packet)
+        mosq_test.expect_packet(sub, "sub connack", connack_packet)
+        mosq_test.expect_packet(sub, "suback", suback_packet)
+
+        pub = mosq_test.do_client_connect(pub_connect_packet, connack_packet, port=port, connack_error="pub connack")
+
+        # Pipelined QoS 0 messages, which take several read budgets
+        qos0_packets = []
+        for i in range(count):
+            qos0_packets.append(mosq_test.gen_publish("io_threads/qos0", qos=0, payload="message %d" % (i), proto_ver=proto_ver))
+        pub.send(b"".join(qos0_packets))
+        for i in range(count):
+            mosq_test.expect_packet(sub, "qos0 publish %d" % (i), qos0_packets[i])
+
+        # The subscriber doesn't read anything until all of the messages
+        # have been published, so the broker has to wait for its socket to
+        # become writable again.
+        publish_packets = []
+        for i in range(count):
+            payload = "%d-" % (i) + "x"*(i*1000)
+            publish_packets.append(mosq_test.gen_publish("io_threads/data", qos=1, mid=i+1, payload=payload, proto_ver=proto_ver))
+            puback_packet = mosq_test.gen_puback(i+1, proto_ver=proto_ver)
+            mosq_test.do_send_receive(pub, publish_packets[i], puback_packet, "puback %d" % (i))
+
+        for i in range(count):
+            # The broker's message ids for the subscriber also start from 1
+            if recv_all(sub, len(publish_packets[i])) != publish_packets[i]:
+                print("FAIL: Received incorrect publish %d" % (i))
+                raise mosq_test.TestError
+            sub.send(mosq_test.gen_puback(i+1, proto_ver=proto_ver))
+
+        # A message sent just before closing the connection is handled before
+        # the connection is taken over by the next one
+        takeover_packets = []
+        for i in range(10):
+            takeover_packets.append(mosq_test.gen_publish("io_threads/takeover", qos=0, payload="takeover %d" % (i), proto_ver=proto_ver))
+            takeover = mosq_test.do_client_connect(takeover_connect_packet, connack_packet, port=port2, connack_error="takeover connack %d" % (i))
+            takeover.send(takeover_packets[i])
+            takeover.close()
+        for i in range(10):
+            mosq_test.expect_packet(sub, "takeover publish %d" % (i), takeover_packets[i])
+
+        # A client that goes away without disconnecting has its will sent
+        will = mosq_test.do_client_connect(will_connect_packet, connack_packet, port=port, connack_error="will connack")
+        will.close()
+        mosq_test.expect_packet(sub, "will", will_packet)
+
+        mosq_test.do_ping(sub)
+        mosq_test.do_ping(pub)
+        rc = 0
+
+        sub.close()
+        pub.close()
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file)
+        os.remove(pw_file)
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        stde = stde.decode('utf-8')
+        if rc == 0 and "Started 2 I/O threads." not in stde:
+            print("FAIL: I/O threads not started")
+            rc = 1
+        if rc:
+            print(stde)
+            print("proto_ver=%d" % (proto_ver))
+            exit(rc)
+
+do_test(proto_ver=4)
+do_test(proto_ver=5)
+exit(0)
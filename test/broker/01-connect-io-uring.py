@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+
+# Exercise the broker event loop with use_io_uring set: several clients
+# connecting, large messages that don't fit in a single write, a subscriber
+# that stops reading for a while and a client that goes away without
+# disconnecting.
+#
+# When the broker has been built with WITH_IO_URING=yes, and the tests are run
+# with the same setting, the broker must also report that it is using io_uring,
+# unless the kernel doesn't support it. Otherwise this test checks the same
+# behaviour for whichever event loop the broker uses.
+
+from mosq_test_helper import *
+
+def write_config(filename, port):
+    with open(filename, 'w') as f:
+        f.write("port %d\n" % (port))
+        f.write("allow_anonymous true\n")
+        f.write("use_io_uring true\n")
+
+def recv_all(sock, length):
+    data = b""
+    while len(data) < length:
+        d = sock.recv(length - len(data))
+        if len(d) == 0:
+            raise mosq_test.TestError
+        data += d
+    return data
+
+def do_test(proto_ver):
+    port = mosq_test.get_port()
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    write_config(conf_file, port)
+
+    rc = 1
+    keepalive = 60
+    count = 100
+
+    sub_connect_packet = mosq_test.gen_connect("io-uring-sub", keepalive=keepalive, proto_ver=proto_ver)
+    pub_connect_packet = mosq_test.gen_connect("io-uring-pub", keepalive=keepalive, proto_ver=proto_ver)
+    will_connect_packet = mosq_test.gen_connect("io-uring-will", keepalive=keepalive, will_topic="io_uring/will", will_payload=b"gone", proto_ver=proto_ver)
+    connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+
+    mid = 1
+    subscribe_packet = mosq_test.gen_subscribe(mid, "io_uring/#", 1, proto_ver=proto_ver)
+    suback_packet = mosq_test.gen_suback(mid, 1, proto_ver=proto_ver)
+
+    will_packet = mosq_test.gen_publish("io_uring/will", qos=0, payload="gone", proto_ver=proto_ver)
+
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+    try:
+        sub = mosq_test.do_client_connect(sub_connect_packet, connack_packet, port=port, connack_error="sub connack")
+        mosq_test.do_send_receive(sub, subscribe_packet, suback_packet, "suback")
+
+        pub = mosq_test.do_client_connect(pub_connect_packet, connack_packet, port=port, connack_error="pub connack")
+
+        # The subscriber doesn't read anything until all of the messages
+        # have been published, so the broker has to wait for its socket to
+        # become writable again.
+        publish_packets = []
+        for i in range(count):
+            payload = "%d-" % (i) + "x"*(i*1000)
+            publish_packets.append(mosq_test.gen_publish("io_uring/data", qos=1, mid=i+1, payload=payload, proto_ver=proto_ver))
+            puback_packet = mosq_test.gen_puback(i+1, proto_ver=proto_ver)
+            mosq_test.do_send_receive(pub, publish_packets[i], puback_packet, "puback %d" % (i))
+
+        for i in range(count):
+            # The broker's message ids for the subscriber also start from 1
+            if recv_all(sub, len(publish_packets[i])) != publish_packets[i]:
+                print("FAIL: Received incorrect publish %d" % (i))
+                raise mosq_test.TestError
+            sub.send(mosq_test.gen_puback(i+1, proto_ver=proto_ver))
+
+        # A client that goes away without disconnecting has its will sent
+        will = mosq_test.do_client_connect(will_connect_packet, connack_packet, port=port, connack_error="will connack")
+        will.close()
+        mosq_test.expect_packet(sub, "will", will_packet)
+
+        mosq_test.do_ping(sub)
+        mosq_test.do_ping(pub)
+        rc = 0
+
+        sub.close()
+        pub.close()
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file)
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        stde = stde.decode('utf-8')
+        if rc == 0 and os.environ.get('WITH_IO_URING') == 'yes':
+            if "Using io_uring for network events." not in stde and "io_uring not available" not in stde:
+                print("FAIL: Broker isn't using io_uring")
+                rc = 1
+        if rc:
+            print(stde)
+            print("proto_ver=%d" % (proto_ver))
+            exit(rc)
+
+do_test(proto_ver=4)
+do_test(proto_ver=5)
+exit(0)
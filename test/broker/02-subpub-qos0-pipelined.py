@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+
+# Test whether packets are handled correctly when many of them arrive in a
+# single read, when packets are split at arbitrary points across reads, and
+# when a payload is larger than the broker's read buffer.
+
+from mosq_test_helper import *
+import time
+
+def do_test(proto_ver):
+    rc = 1
+    mid = 53
+    keepalive = 60
+    connect_packet = mosq_test.gen_connect("subpub-pipelined-test", keepalive=keepalive, proto_ver=proto_ver)
+    connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+
+    subscribe_packet = mosq_test.gen_subscribe(mid, "pipelined/#", 0, proto_ver=proto_ver)
+    suback_packet = mosq_test.gen_suback(mid, 0, proto_ver=proto_ver)
+
+    publish_packets = []
+    for i in range(100):
+        publish_packets.append(mosq_test.gen_publish("pipelined/%d" % (i), qos=0, payload="message %d" % (i), proto_ver=proto_ver))
+    publish_packets.append(mosq_test.gen_publish("pipelined/large", qos=0, payload="x"*100000, proto_ver=proto_ver))
+    publish_packets.append(mosq_test.gen_publish("pipelined/empty", qos=0, proto_ver=proto_ver))
+
+    port = mosq_test.get_port()
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), port=port)
+
+    try:
+        sock = mosq_test.client_connect_only(port=port, timeout=20)
+        sock.send(connect_packet + subscribe_packet)
+        mosq_test.expect_packet(sock, "connack", connack_packet)
+        mosq_test.expect_packet(sock, "suback", suback_packet)
+
+        # All at once
+        sock.send(b"".join(publish_packets))
+        for p in publish_packets:
+            mosq_test.expect_packet(sock, "publish", p)
+
+        # In pieces that don't line up with packet boundaries
+        data = b"".join(publish_packets)
+        for i in range(0, len(data), 7001):
+            sock.send(data[i:i+7001])
+            time.sleep(0.001)
+        for p in publish_packets:
+            mosq_test.expect_packet(sock, "publish", p)
+
+        mosq_test.do_ping(sock)
+        rc = 0
+
+        sock.close()
+    except mosq_test.TestError:
+        pass
+    finally:
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        if rc:
+            print(stde.decode('utf-8'))
+            print("proto_ver=%d" % (proto_ver))
+            exit(rc)
+
+do_test(proto_ver=4)
+do_test(proto_ver=5)
+exit(0)
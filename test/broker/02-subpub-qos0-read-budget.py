@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+
+# Test whether pipelined packets are all handled, in order, when clients have
+# small read budgets and so are read from the ready list, both with level and
+# edge triggered epoll. A second client is used to check that it is still
+# served while the first one has input waiting.
+
+from mosq_test_helper import *
+
+def write_config(filename, port, edge_triggered, max_read_packets, max_read_bytes):
+    with open(filename, 'w') as f:
+        f.write("listener %d\n" % (port))
+        f.write("allow_anonymous true\n")
+        f.write("epoll_edge_triggered %s\n" % (edge_triggered))
+        f.write("max_read_packets %d\n" % (max_read_packets))
+        f.write("max_read_bytes %d\n" % (max_read_bytes))
+
+def do_test(proto_ver, edge_triggered, max_read_packets, max_read_bytes):
+    rc = 1
+    mid = 53
+    keepalive = 60
+    connect1_packet = mosq_test.gen_connect("read-budget-test1", keepalive=keepalive, proto_ver=proto_ver)
+    connect2_packet = mosq_test.gen_connect("read-budget-test2", keepalive=keepalive, proto_ver=proto_ver)
+    connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+
+    subscribe_packet = mosq_test.gen_subscribe(mid, "budget/#", 0, proto_ver=proto_ver)
+    suback_packet = mosq_test.gen_suback(mid, 0, proto_ver=proto_ver)
+
+    publish_packets = []
+    for i in range(100):
+        publish_packets.append(mosq_test.gen_publish("budget/%d" % (i), qos=0, payload="message %d" % (i), proto_ver=proto_ver))
+    publish_packets.append(mosq_test.gen_publish("budget/large", qos=0, payload="x"*100000, proto_ver=proto_ver))
+
+    port = mosq_test.get_port()
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    write_config(conf_file, port, edge_triggered, max_read_packets, max_read_bytes)
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+    try:
+        sock1 = mosq_test.client_connect_only(port=port, timeout=20)
+        sock1.send(connect1_packet + subscribe_packet)
+        mosq_test.expect_packet(sock1, "connack", connack_packet)
+        mosq_test.expect_packet(sock1, "suback", suback_packet)
+
+        sock2 = mosq_test.do_client_connect(connect2_packet, connack_packet, port=port)
+
+        sock1.send(b"".join(publish_packets))
+        mosq_test.do_ping(sock2)
+        for p in publish_packets:
+            mosq_test.expect_packet(sock1, "publish", p)
+
+        mosq_test.do_ping(sock1)
+        rc = 0
+
+        sock2.close()
+        sock1.close()
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file)
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        if rc:
+            print(stde.decode('utf-8'))
+            print("proto_ver=%d edge_triggered=%s max_read_packets=%d max_read_bytes=%d" % (proto_ver, edge_triggered, max_read_packets, max_read_bytes))
+            exit(rc)
+
+do_test(proto_ver=4, edge_triggered="false", max_read_packets=1, max_read_bytes=0)
+do_test(proto_ver=5, edge_triggered="false", max_read_packets=0, max_read_bytes=1)
+do_test(proto_ver=4, edge_triggered="true", max_read_packets=1, max_read_bytes=0)
+do_test(proto_ver=5, edge_triggered="true", max_read_packets=0, max_read_bytes=1)
+do_test(proto_ver=4, edge_triggered="true", max_read_packets=0, max_read_bytes=0)
+exit(0)
@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+
+# Does a large payload get delivered intact to multiple subscribers with
+# different QoS and subscription identifiers? Large payloads are sent straight
+# from the message store rather than being copied into each packet.
+
+from mosq_test_helper import *
+
+def do_test(proto_ver):
+    rc = 1
+    keepalive = 60
+    payload = "".join(chr(0x41 + (i % 26)) for i in range(70000))
+
+    connect1_packet = mosq_test.gen_connect("subpub-large-1", keepalive=keepalive, proto_ver=proto_ver)
+    connect2_packet = mosq_test.gen_connect("subpub-large-2", keepalive=keepalive, proto_ver=proto_ver)
+    connect3_packet = mosq_test.gen_connect("subpub-large-pub", keepalive=keepalive, proto_ver=proto_ver)
+    connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+
+    mid = 1
+    if proto_ver == 5:
+        props = mqtt5_props.gen_varint_prop(mqtt5_props.PROP_SUBSCRIPTION_IDENTIFIER, 42)
+    else:
+        props = None
+    subscribe1_packet = mosq_test.gen_subscribe(mid, "subpub/large", 1, proto_ver=proto_ver, properties=props)
+    suback1_packet = mosq_test.gen_suback(mid, 1, proto_ver=proto_ver)
+
+    subscribe2_packet = mosq_test.gen_subscribe(mid, "subpub/#", 0, proto_ver=proto_ver)
+    suback2_packet = mosq_test.gen_suback(mid, 0, proto_ver=proto_ver)
+
+    mid = 300
+    publish_packet = mosq_test.gen_publish("subpub/large", qos=1, mid=mid, payload=payload, proto_ver=proto_ver)
+    puback_packet = mosq_test.gen_puback(mid, proto_ver=proto_ver)
+
+    mid = 1
+    publish1_packet = mosq_test.gen_publish("subpub/large", qos=1, mid=mid, payload=payload, proto_ver=proto_ver, properties=props)
+    puback1_packet = mosq_test.gen_puback(mid, proto_ver=proto_ver)
+    publish2_packet = mosq_test.gen_publish("subpub/large", qos=0, payload=payload, proto_ver=proto_ver)
+
+    port = mosq_test.get_port()
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), port=port)
+
+    try:
+        sock1 = mosq_test.do_client_connect(connect1_packet, connack_packet, timeout=20, port=port)
+        mosq_test.do_send_receive(sock1, subscribe1_packet, suback1_packet, "suback1")
+
+        sock2 = mosq_test.do_client_connect(connect2_packet, connack_packet, timeout=20, port=port)
+        mosq_test.do_send_receive(sock2, subscribe2_packet, suback2_packet, "suback2")
+
+        sock3 = mosq_test.do_client_connect(connect3_packet, connack_packet, timeout=20, port=port)
+        mosq_test.do_send_receive(sock3, publish_packet, puback_packet, "puback")
+
+        mosq_test.expect_packet(sock1, "publish1", publish1_packet)
+        sock1.send(puback1_packet)
+        mosq_test.expect_packet(sock2, "publish2", publish2_packet)
+
+        # Second delivery, after the first message has been completely released
+        mosq_test.do_send_receive(sock3, publish_packet, puback_packet, "puback")
+        mid = 2
+        publish1_packet = mosq_test.gen_publish("subpub/large", qos=1, mid=mid, payload=payload, proto_ver=proto_ver, properties=props)
+        mosq_test.expect_packet(sock1, "publish1", publish1_packet)
+        mosq_test.expect_packet(sock2, "publish2", publish2_packet)
+        rc = 0
+
+        sock1.close()
+        sock2.close()
+        sock3.close()
+    except mosq_test.TestError:
+        pass
+    finally:
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        if rc:
+            print(stde.decode('utf-8'))
+            print("proto_ver=%d" % (proto_ver))
+            exit(rc)
+
+
+do_test(proto_ver=4)
+do_test(proto_ver=5)
+exit(0)
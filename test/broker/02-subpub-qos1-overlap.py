@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+
+# Test whether clients with overlapping subscriptions receive only one copy of
+# a message, with several subscribers so the duplicate tracking has to grow.
+# MQTT v3.1.1 only, v5 clients receive one copy per matching subscription.
+
+from mosq_test_helper import *
+
+def do_test(proto_ver):
+    rc = 1
+    keepalive = 60
+    sub_count = 6
+
+    connect_packet = mosq_test.gen_connect("pub-overlap-test", keepalive=keepalive, proto_ver=proto_ver)
+    connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+
+    mid = 300
+    publish1_packet = mosq_test.gen_publish("subpub/qos1", qos=1, mid=mid, payload="message1", proto_ver=proto_ver)
+    puback1_packet = mosq_test.gen_puback(mid, proto_ver=proto_ver)
+
+    mid = 301
+    publish2_packet = mosq_test.gen_publish("subpub/qos1", qos=1, mid=mid, payload="message2", proto_ver=proto_ver)
+    puback2_packet = mosq_test.gen_puback(mid, proto_ver=proto_ver)
+
+    publish1_out = mosq_test.gen_publish("subpub/qos1", qos=1, mid=1, payload="message1", proto_ver=proto_ver)
+    # A mid is allocated for each matching subscription, even those that are
+    # then suppressed as duplicates.
+    publish2_out = mosq_test.gen_publish("subpub/qos1", qos=1, mid=4, payload="message2", proto_ver=proto_ver)
+
+    port = mosq_test.get_port()
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), port=port)
+
+    socks = []
+    try:
+        for i in range(0, sub_count):
+            sub_connect_packet = mosq_test.gen_connect("sub-overlap-test-%d" % (i), keepalive=keepalive, proto_ver=proto_ver)
+            sock = mosq_test.do_client_connect(sub_connect_packet, connack_packet, timeout=20, port=port)
+            socks.append(sock)
+
+            for mid, topic in ((1, "subpub/#"), (2, "subpub/+"), (3, "subpub/qos1")):
+                subscribe_packet = mosq_test.gen_subscribe(mid, topic, 1, proto_ver=proto_ver)
+                suback_packet = mosq_test.gen_suback(mid, 1, proto_ver=proto_ver)
+                mosq_test.do_send_receive(sock, subscribe_packet, suback_packet, "suback")
+
+        pub_sock = mosq_test.do_client_connect(connect_packet, connack_packet, timeout=20, port=port)
+        mosq_test.do_send_receive(pub_sock, publish1_packet, puback1_packet, "puback1")
+        mosq_test.do_send_receive(pub_sock, publish2_packet, puback2_packet, "puback2")
+
+        # If the first message was duplicated, the second packet received
+        # would be another copy of it rather than the second message.
+        for sock in socks:
+            mosq_test.expect_packet(sock, "publish1", publish1_out)
+            mosq_test.expect_packet(sock, "publish2", publish2_out)
+        rc = 0
+
+        pub_sock.close()
+    except mosq_test.TestError:
+        pass
+    finally:
+        for sock in socks:
+            sock.close()
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        if rc:
+            print(stde.decode('utf-8'))
+            print("proto_ver=%d" % (proto_ver))
+            exit(rc)
+
+
+do_test(proto_ver=4)
+exit(0)
@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+
+# With queue_spill_dir set, are QoS 0 messages for a connected client that
+# isn't reading them dropped rather than written to disk, unless
+# queue_qos0_messages is set?
+
+from mosq_test_helper import *
+import shutil
+
+def write_config(filename, port, spill_dir, queue_qos0):
+    with open(filename, 'w') as f:
+        f.write("port %d\n" % (port))
+        f.write("allow_anonymous true\n")
+        f.write("max_queued_messages 5\n")
+        f.write("queue_spill_dir %s\n" % (spill_dir))
+        if queue_qos0:
+            f.write("queue_qos0_messages true\n")
+
+def spill_files(spill_dir):
+    return [f for f in os.listdir(spill_dir) if f.endswith(".spill")]
+
+def do_test(queue_qos0):
+    port = mosq_test.get_port()
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    spill_dir = os.path.basename(__file__).replace('.py', '_spill')
+    os.mkdir(spill_dir)
+    # The broker may drop privileges
+    os.chmod(spill_dir, 0o777)
+    write_config(conf_file, port, spill_dir, queue_qos0)
+
+    rc = 1
+    keepalive = 60
+    sub_connect_packet = mosq_test.gen_connect("qos0-spill-sub", keepalive=keepalive)
+    pub_connect_packet = mosq_test.gen_connect("qos0-spill-pub", keepalive=keepalive)
+    connack_packet = mosq_test.gen_connack(rc=0)
+
+    mid = 1
+    subscribe_packet = mosq_test.gen_subscribe(mid, "spill/#", 0)
+    suback_packet = mosq_test.gen_suback(mid, 0)
+
+    count = 200
+    publish_packet = mosq_test.gen_publish("spill/qos0", qos=0, payload="x"*100000)
+
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+    try:
+        sub = mosq_test.do_client_connect(sub_connect_packet, connack_packet, port=port, connack_error="sub connack")
+        mosq_test.do_send_receive(sub, subscribe_packet, suback_packet, "suback")
+
+        # The subscriber doesn't read anything, so its socket fills up
+        pub = mosq_test.do_client_connect(pub_connect_packet, connack_packet, port=port, connack_error="pub connack")
+        for i in range(count):
+            pub.send(publish_packet)
+        mosq_test.do_ping(pub)
+
+        if queue_qos0:
+            if len(spill_files(spill_dir)) == 0:
+                print("FAIL: Expected QoS 0 messages to be written to disk")
+                raise mosq_test.TestError
+        else:
+            if len(spill_files(spill_dir)) != 0:
+                print("FAIL: QoS 0 messages written to disk")
+                raise mosq_test.TestError
+        rc = 0
+
+        pub.close()
+        sub.close()
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file)
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        shutil.rmtree(spill_dir)
+        stde = stde.decode('utf-8')
+        if rc == 0 and queue_qos0 == False and "Outgoing messages are being dropped" not in stde:
+            print("FAIL: Expected QoS 0 messages to be dropped")
+            rc = 1
+        if rc:
+            print(stde)
+            print("queue_qos0=%s" % (queue_qos0))
+            exit(rc)
+
+do_test(queue_qos0=False)
+do_test(queue_qos0=True)
+exit(0)
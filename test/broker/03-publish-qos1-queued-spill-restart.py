@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+
+# With queue_spill_dir set, are spill files left by a previous run removed when
+# the broker starts, and is the number of messages in them logged? A partial
+# record at the end of a file is not counted.
+
+from mosq_test_helper import *
+import shutil
+import struct
+
+def write_config(filename, port, spill_dir):
+    with open(filename, 'w') as f:
+        f.write("port %d\n" % (port))
+        f.write("allow_anonymous true\n")
+        f.write("queue_spill_dir %s\n" % (spill_dir))
+
+def write_spill(path, count, partial):
+    with open(path, 'wb') as f:
+        for i in range(count):
+            f.write(struct.pack("!IB", 10, 1) + b"x"*10)
+        if partial:
+            f.write(struct.pack("!IB", 10, 1) + b"x"*5)
+
+def spill_files(spill_dir):
+    return [f for f in os.listdir(spill_dir) if f.endswith(".spill")]
+
+def do_test():
+    port = mosq_test.get_port()
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    spill_dir = os.path.basename(__file__).replace('.py', '_spill')
+    os.mkdir(spill_dir)
+    # The broker may drop privileges
+    os.chmod(spill_dir, 0o777)
+    write_config(conf_file, port, spill_dir)
+
+    write_spill(os.path.join(spill_dir, "00000001-00000001.spill"), 3, False)
+    write_spill(os.path.join(spill_dir, "00000001-00000002.spill"), 2, True)
+    write_spill(os.path.join(spill_dir, "00000002-00000001.spill"), 0, True)
+    for f in spill_files(spill_dir):
+        os.chmod(os.path.join(spill_dir, f), 0o666)
+
+    rc = 1
+    keepalive = 60
+    connect_packet = mosq_test.gen_connect("spill-restart", keepalive=keepalive)
+    connack_packet = mosq_test.gen_connack(rc=0)
+
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+    try:
+        sock = mosq_test.do_client_connect(connect_packet, connack_packet, port=port)
+        mosq_test.do_ping(sock)
+        if len(spill_files(spill_dir)) != 0:
+            print("FAIL: Old spill files not removed")
+            raise mosq_test.TestError
+        rc = 0
+
+        sock.close()
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file)
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        shutil.rmtree(spill_dir)
+        stde = stde.decode('utf-8')
+        if rc == 0 and "Discarded 5 messages left in %s by a previous run." % (spill_dir) not in stde:
+            print("FAIL: Discarded messages not logged")
+            rc = 1
+        if rc:
+            print(stde)
+            exit(rc)
+
+do_test()
+exit(0)
@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+
+# With queue_spill_dir set, are QoS 1 messages for an offline persistent client
+# that don't fit in its queue written to disk rather than dropped, and are they
+# all delivered in order when the client reconnects? With persistence enabled,
+# the messages for a persistent client are dropped instead, because messages on
+# disk would not survive a restart.
+
+from mosq_test_helper import *
+import shutil
+
+def write_config(filename, port, spill_dir, persistence):
+    with open(filename, 'w') as f:
+        f.write("port %d\n" % (port))
+        if persistence:
+            f.write("persistence true\n")
+            f.write("persistence_file %s\n" % (filename.replace('.conf', '.db')))
+        f.write("allow_anonymous true\n")
+        f.write("max_queued_messages 5\n")
+        f.write("queue_spill_dir %s\n" % (spill_dir))
+        f.write("queue_spill_segment_size 1024\n")
+
+def read_packet(sock):
+    header = b""
+    while len(header) < 2 or header[-1] & 0x80:
+        data = sock.recv(1)
+        if len(data) == 0:
+            raise mosq_test.TestError
+        header += data
+
+    remaining_length = 0
+    multiplier = 1
+    for c in header[1:]:
+        remaining_length += (c & 0x7F) * multiplier
+        multiplier *= 128
+
+    payload = b""
+    while len(payload) < remaining_length:
+        data = sock.recv(remaining_length - len(payload))
+        if len(data) == 0:
+            raise mosq_test.TestError
+        payload += data
+    return (header, payload)
+
+def spill_files(spill_dir):
+    return [f for f in os.listdir(spill_dir) if f.endswith(".spill")]
+
+def do_test(proto_ver, persistence):
+    port = mosq_test.get_port()
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    spill_dir = os.path.basename(__file__).replace('.py', '_spill')
+    os.mkdir(spill_dir)
+    # The broker may drop privileges
+    os.chmod(spill_dir, 0o777)
+    write_config(conf_file, port, spill_dir, persistence)
+
+    rc = 1
+    keepalive = 60
+    connect_packet = mosq_test.gen_connect("queued-spill-test", keepalive=keepalive, clean_session=False, proto_ver=proto_ver, session_expiry=60)
+    connack1_packet = mosq_test.gen_connack(flags=0, rc=0, proto_ver=proto_ver)
+    connack2_packet = mosq_test.gen_connack(flags=1, rc=0, proto_ver=proto_ver)
+
+    mid = 1
+    subscribe_packet = mosq_test.gen_subscribe(mid, "spill/#", 1, proto_ver=proto_ver)
+    suback_packet = mosq_test.gen_suback(mid, 1, proto_ver=proto_ver)
+
+    helper_connect_packet = mosq_test.gen_connect("queued-spill-helper", keepalive=keepalive, proto_ver=proto_ver)
+    helper_connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+
+    count = 100
+    topics = []
+    payloads = []
+    for i in range(count):
+        topics.append("spill/%d" % (i % 10))
+        payloads.append("message %d" % (i))
+
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+    try:
+        sock = mosq_test.do_client_connect(connect_packet, connack1_packet, port=port)
+        mosq_test.do_send_receive(sock, subscribe_packet, suback_packet, "suback")
+        sock.close()
+
+        helper = mosq_test.do_client_connect(helper_connect_packet, helper_connack_packet, port=port, connack_error="helper connack")
+        for i in range(count):
+            publish_packet = mosq_test.gen_publish(topics[i], qos=1, mid=i+1, payload=payloads[i], proto_ver=proto_ver)
+            puback_packet = mosq_test.gen_puback(i+1, proto_ver=proto_ver)
+            mosq_test.do_send_receive(helper, publish_packet, puback_packet, "helper puback %d" % (i))
+        helper.close()
+
+        if persistence:
+            if len(spill_files(spill_dir)) != 0:
+                print("FAIL: Messages spilled with persistence enabled")
+                raise mosq_test.TestError
+            # Only the messages that fit in the queue are delivered
+            expected_count = 5
+        else:
+            if len(spill_files(spill_dir)) < 2:
+                print("FAIL: Expected messages to be spilled to more than one segment")
+                raise mosq_test.TestError
+            expected_count = count
+
+        sock = mosq_test.do_client_connect(connect_packet, connack2_packet, port=port)
+        for i in range(expected_count):
+            (header, body) = read_packet(sock)
+            # The message id follows the topic
+            topic_len = (body[0]<<8) + body[1]
+            mid = (body[2+topic_len]<<8) + body[3+topic_len]
+            expected = mosq_test.gen_publish(topics[i], qos=1, mid=mid, payload=payloads[i], proto_ver=proto_ver)
+            if header + body != expected:
+                print("FAIL: Received incorrect publish %d" % (i))
+                print("Received: "+mosq_test.to_string(header + body))
+                print("Expected: "+mosq_test.to_string(expected))
+                raise mosq_test.TestError
+            sock.send(mosq_test.gen_puback(mid, proto_ver=proto_ver))
+
+        mosq_test.do_ping(sock)
+        if len(spill_files(spill_dir)) != 0:
+            print("FAIL: Spill files not removed")
+            raise mosq_test.TestError
+        rc = 0
+
+        sock.close()
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file)
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        shutil.rmtree(spill_dir)
+        if persistence:
+            os.remove(conf_file.replace('.conf', '.db'))
+        stde = stde.decode('utf-8')
+        if rc == 0 and persistence == False and "being written to disk" not in stde:
+            rc = 1
+        if rc == 0 and persistence and "being written to disk" in stde:
+            rc = 1
+        if rc:
+            print(stde)
+            print("proto_ver=%d" % (proto_ver))
+            exit(rc)
+
+do_test(proto_ver=4, persistence=False)
+do_test(proto_ver=5, persistence=False)
+do_test(proto_ver=4, persistence=True)
+do_test(proto_ver=5, persistence=True)
+exit(0)
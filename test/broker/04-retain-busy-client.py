@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+
+# Test whether a client that always has messages queued for it still receives
+# retained messages for a new subscription, rather than waiting for its queue
+# to empty.
+
+from mosq_test_helper import *
+
+def write_config(filename, port):
+    with open(filename, 'w') as f:
+        f.write("port %d\n" % (port))
+        f.write("allow_anonymous true\n")
+        f.write("max_inflight_messages 1\n")
+        f.write("max_queued_messages 100\n")
+
+def read_packet(sock):
+    data = sock.recv(1)
+    if len(data) == 0:
+        raise mosq_test.TestError
+    cmd = data[0]
+    rl = 0
+    multiplier = 1
+    while True:
+        byte = sock.recv(1)[0]
+        rl += (byte & 127)*multiplier
+        multiplier *= 128
+        if byte & 128 == 0:
+            break
+    payload = b""
+    while len(payload) < rl:
+        d = sock.recv(rl - len(payload))
+        if len(d) == 0:
+            raise mosq_test.TestError
+        payload += d
+    return (cmd, payload)
+
+def do_test(proto_ver):
+    port = mosq_test.get_port()
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    write_config(conf_file, port)
+
+    rc = 1
+    keepalive = 60
+    retained_count = 5
+
+    if proto_ver == 5:
+        pub_reason_code = mqtt5_rc.MQTT_RC_NO_MATCHING_SUBSCRIBERS
+    else:
+        pub_reason_code = 0
+    sub_connect_packet = mosq_test.gen_connect("retain-busy-sub", keepalive=keepalive, proto_ver=proto_ver)
+    pub_connect_packet = mosq_test.gen_connect("retain-busy-pub", keepalive=keepalive, proto_ver=proto_ver)
+    if proto_ver == 5:
+        props = mqtt5_props.gen_uint16_prop(mqtt5_props.PROP_TOPIC_ALIAS_MAXIMUM, 10) \
+            + mqtt5_props.gen_uint16_prop(mqtt5_props.PROP_RECEIVE_MAXIMUM, 1)
+        connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver, properties=props, property_helper=False)
+    else:
+        connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+
+    subscribe1_packet = mosq_test.gen_subscribe(1, "retain/busy/live", 1, proto_ver=proto_ver)
+    suback1_packet = mosq_test.gen_suback(1, 1, proto_ver=proto_ver)
+    subscribe2_packet = mosq_test.gen_subscribe(2, "retain/busy/r/#", 1, proto_ver=proto_ver)
+
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+    try:
+        pub = mosq_test.do_client_connect(pub_connect_packet, connack_packet, port=port)
+        for i in range(retained_count):
+            publish_packet = mosq_test.gen_publish("retain/busy/r/%d" % (i), qos=1, mid=i+1, payload="retained %d" % (i), retain=True, proto_ver=proto_ver)
+            puback_packet = mosq_test.gen_puback(i+1, proto_ver=proto_ver, reason_code=pub_reason_code)
+            mosq_test.do_send_receive(pub, publish_packet, puback_packet, "retained puback %d" % (i))
+
+        sub = mosq_test.do_client_connect(sub_connect_packet, connack_packet, port=port)
+        mosq_test.do_send_receive(sub, subscribe1_packet, suback1_packet, "suback1")
+
+        # One live message in flight and two queued
+        pub_mid = 100
+        for i in range(3):
+            publish_packet = mosq_test.gen_publish("retain/busy/live", qos=1, mid=pub_mid, payload="live", proto_ver=proto_ver)
+            puback_packet = mosq_test.gen_puback(pub_mid, proto_ver=proto_ver)
+            mosq_test.do_send_receive(pub, publish_packet, puback_packet, "live puback")
+            pub_mid += 1
+
+        sub.send(subscribe2_packet)
+
+        # Each live message that is acknowledged is replaced by another one,
+        # so the subscriber's queue is never empty.
+        retained = 0
+        for i in range(100):
+            (cmd, payload) = read_packet(sub)
+            if cmd & 0xF0 != 0x30:
+                continue
+            tlen = struct.unpack("!H", payload[0:2])[0]
+            topic = payload[2:2+tlen].decode('utf-8')
+            mid = struct.unpack("!H", payload[2+tlen:4+tlen])[0]
+            sub.send(mosq_test.gen_puback(mid, proto_ver=proto_ver))
+            if topic == "retain/busy/live":
+                publish_packet = mosq_test.gen_publish("retain/busy/live", qos=1, mid=pub_mid, payload="live", proto_ver=proto_ver)
+                puback_packet = mosq_test.gen_puback(pub_mid, proto_ver=proto_ver)
+                mosq_test.do_send_receive(pub, publish_packet, puback_packet, "live puback")
+                pub_mid += 1
+            else:
+                retained += 1
+                if retained == retained_count:
+                    break
+
+        if retained != retained_count:
+            print("FAIL: Received %d retained messages, expected %d" % (retained, retained_count))
+            raise mosq_test.TestError
+
+        rc = 0
+
+        sub.close()
+        pub.close()
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file)
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        if rc:
+            print(stde.decode('utf-8'))
+            print("proto_ver=%d" % (proto_ver))
+            exit(rc)
+
+do_test(proto_ver=4)
+do_test(proto_ver=5)
+exit(0)
@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+
+# Test whether a wildcard subscription that matches more retained messages
+# than fit in the client's in-flight window and queue receives all of them,
+# sent as the client acknowledges earlier messages.
+
+from mosq_test_helper import *
+
+def write_config(filename, port):
+    with open(filename, 'w') as f:
+        f.write("port %d\n" % (port))
+        f.write("allow_anonymous true\n")
+        f.write("max_queued_messages 10\n")
+
+
+def do_test(proto_ver):
+    port = mosq_test.get_port()
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    write_config(conf_file, port)
+
+    rc = 1
+    keepalive = 60
+    count = 50
+
+    if proto_ver == 5:
+        props = mqtt5_props.gen_uint16_prop(mqtt5_props.PROP_RECEIVE_MAXIMUM, 5)
+        pub_reason_code = mqtt5_rc.MQTT_RC_NO_MATCHING_SUBSCRIBERS
+    else:
+        props = b""
+        pub_reason_code = 0
+    sub_connect_packet = mosq_test.gen_connect("retain-paced-sub", keepalive=keepalive, proto_ver=proto_ver, properties=props)
+    pub_connect_packet = mosq_test.gen_connect("retain-paced-pub", keepalive=keepalive, proto_ver=proto_ver)
+    connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+
+    mid = 1
+    subscribe_packet = mosq_test.gen_subscribe(mid, "retain/paced/#", 1, proto_ver=proto_ver)
+    suback_packet = mosq_test.gen_suback(mid, 1, proto_ver=proto_ver)
+
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+    try:
+        pub_sock = mosq_test.do_client_connect(pub_connect_packet, connack_packet, port=port)
+        for i in range(count):
+            publish_packet = mosq_test.gen_publish("retain/paced/%03d" % (i), qos=1, mid=i+1, payload="message %d" % (i), retain=True, proto_ver=proto_ver)
+            puback_packet = mosq_test.gen_puback(i+1, proto_ver=proto_ver, reason_code=pub_reason_code)
+            mosq_test.do_send_receive(pub_sock, publish_packet, puback_packet, "puback %d" % (i))
+        pub_sock.close()
+
+        sock = mosq_test.do_client_connect(sub_connect_packet, connack_packet, port=port)
+        mosq_test.do_send_receive(sock, subscribe_packet, suback_packet, "suback")
+
+        for i in range(count):
+            publish_packet = mosq_test.gen_publish("retain/paced/%03d" % (i), qos=1, mid=i+1, payload="message %d" % (i), retain=True, proto_ver=proto_ver)
+            puback_packet = mosq_test.gen_puback(i+1, proto_ver=proto_ver)
+            mosq_test.do_receive_send(sock, publish_packet, puback_packet, "publish %d" % (i))
+
+        mosq_test.do_ping(sock)
+        rc = 0
+
+        sock.close()
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file)
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        if rc:
+            print(stde.decode('utf-8'))
+            print("proto_ver=%d" % (proto_ver))
+            exit(rc)
+
+do_test(proto_ver=4)
+do_test(proto_ver=5)
+exit(0)
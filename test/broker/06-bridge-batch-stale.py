@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+
+# Is a message batch that is still waiting to be acknowledged when a bridge
+# disconnects dropped, rather than resent, if the remote broker does not accept
+# batches when the bridge reconnects? Messages published after the reconnect
+# must be sent individually.
+
+from mosq_test_helper import *
+
+def write_config(filename, port1, port2):
+    with open(filename, 'w') as f:
+        f.write("port %d\n" % (port2))
+        f.write("allow_anonymous true\n")
+        f.write("\n")
+        f.write("connection bridge_sample\n")
+        f.write("address 127.0.0.1:%d\n" % (port1))
+        f.write("topic bridge/# out 1\n")
+        f.write("notifications false\n")
+        f.write("restart_timeout 1\n")
+        f.write("bridge_protocol_version mqttv50\n")
+        f.write("bridge_batch_size 1000\n")
+
+def read_packet(sock):
+    data = sock.recv(1)
+    if len(data) == 0:
+        raise mosq_test.TestError
+    cmd = data[0]
+    rl = 0
+    multiplier = 1
+    while True:
+        byte = sock.recv(1)[0]
+        rl += (byte & 127)*multiplier
+        multiplier *= 128
+        if byte & 128 == 0:
+            break
+    payload = b""
+    while len(payload) < rl:
+        d = sock.recv(rl - len(payload))
+        if len(d) == 0:
+            raise mosq_test.TestError
+        payload += d
+    return (cmd, payload)
+
+# Skips anything that isn't a PUBLISH, such as the bridge's UNSUBSCRIBE
+def read_publish_topic(sock):
+    while True:
+        (cmd, payload) = read_packet(sock)
+        if cmd & 0xF0 == 0x30:
+            break
+    tlen = struct.unpack("!H", payload[0:2])[0]
+    return payload[2:2+tlen].decode('utf-8')
+
+def do_test():
+    proto_ver = 5
+    (port1, port2) = mosq_test.get_port(2)
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    write_config(conf_file, port1, port2)
+
+    rc = 1
+    keepalive = 60
+    props = mqtt5_props.gen_string_pair_prop(mqtt5_props.PROP_USER_PROPERTY, "mosquitto-batch", "none")
+    batch_connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver, properties=props)
+    connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+
+    helper_connect_packet = mosq_test.gen_connect("test-helper", keepalive=keepalive, proto_ver=proto_ver)
+    helper_connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+    helper_publish1_packet = mosq_test.gen_publish("bridge/batched", qos=1, mid=1, payload="batched", proto_ver=proto_ver)
+    helper_puback1_packet = mosq_test.gen_puback(1, proto_ver=proto_ver)
+    helper_publish2_packet = mosq_test.gen_publish("bridge/single", qos=1, mid=2, payload="single", proto_ver=proto_ver)
+    helper_puback2_packet = mosq_test.gen_puback(2, proto_ver=proto_ver)
+
+    ssock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    ssock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    ssock.settimeout(40)
+    ssock.bind(('', port1))
+    ssock.listen(5)
+
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), port=port2, use_conf=True)
+
+    try:
+        (bridge, address) = ssock.accept()
+        bridge.settimeout(20)
+
+        (cmd, payload) = read_packet(bridge)
+        if cmd != 0x10:
+            raise mosq_test.TestError
+        bridge.send(batch_connack_packet)
+
+        helper_sock = mosq_test.do_client_connect(helper_connect_packet, helper_connack_packet, port=port2, connack_error="helper connack")
+        mosq_test.do_send_receive(helper_sock, helper_publish1_packet, helper_puback1_packet, "helper puback1")
+
+        if read_publish_topic(bridge) != "$bridge/batch":
+            print("FAIL: Message not batched")
+            raise mosq_test.TestError
+        # Disconnect without acknowledging the batch
+        bridge.close()
+
+        (bridge, address) = ssock.accept()
+        bridge.settimeout(20)
+
+        (cmd, payload) = read_packet(bridge)
+        if cmd != 0x10:
+            raise mosq_test.TestError
+        bridge.send(connack_packet)
+
+        mosq_test.do_send_receive(helper_sock, helper_publish2_packet, helper_puback2_packet, "helper puback2")
+        topic = read_publish_topic(bridge)
+        if topic != "bridge/single":
+            print("FAIL: Received %s, expected bridge/single" % (topic))
+            raise mosq_test.TestError
+        rc = 0
+
+        helper_sock.close()
+        bridge.close()
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file)
+        try:
+            bridge.close()
+        except NameError:
+            pass
+
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        ssock.close()
+        stde = stde.decode('utf-8')
+        if rc == 0 and "dropped 1 queued message batches" not in stde:
+            print("FAIL: Batch drop not logged")
+            rc = 1
+        if rc:
+            print(stde)
+            exit(rc)
+
+
+do_test()
+
+exit(0)
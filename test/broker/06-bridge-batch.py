@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+
+# Does a bridge with bridge_batch_size set negotiate message batches with a
+# remote broker, and are the batched messages delivered to subscribers on the
+# remote broker in order and with their retain flag? A listener without
+# allow_bridge_batches must not accept batches.
+
+from mosq_test_helper import *
+
+def write_remote_config(filename, port1):
+    with open(filename, 'w') as f:
+        f.write("listener %d\n" % (port1))
+        f.write("allow_anonymous true\n")
+        f.write("allow_bridge_batches true\n")
+
+def write_config(filename, port1, port2, batch_size):
+    with open(filename, 'w') as f:
+        f.write("port %d\n" % (port2))
+        f.write("allow_anonymous true\n")
+        f.write("\n")
+        f.write("connection bridge_sample\n")
+        f.write("address 127.0.0.1:%d\n" % (port1))
+        f.write("remote_clientid bridge-batch-test\n")
+        f.write("topic bridge/# out 1\n")
+        f.write("bridge_protocol_version mqttv50\n")
+        f.write("bridge_batch_size %d\n" % (batch_size))
+
+def do_test(proto_ver, batch_size):
+    (port1, port2) = mosq_test.get_port(2)
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    remote_conf_file = os.path.basename(__file__).replace('.py', '_remote.conf')
+    write_config(conf_file, port1, port2, batch_size)
+    write_remote_config(remote_conf_file, port1)
+
+    rc = 1
+    keepalive = 60
+    connect_packet = mosq_test.gen_connect("bridge-batch-sub", keepalive=keepalive, proto_ver=proto_ver)
+    connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+
+    mid = 1
+    state_topic = "$SYS/broker/connection/bridge-batch-test/state"
+    subscribe1_packet = mosq_test.gen_subscribe(mid, state_topic, 0, proto_ver=proto_ver)
+    suback1_packet = mosq_test.gen_suback(mid, 0, proto_ver=proto_ver)
+    state_packet = mosq_test.gen_publish(state_topic, qos=0, payload="1", proto_ver=proto_ver)
+
+    mid = 2
+    subscribe2_packet = mosq_test.gen_subscribe(mid, "bridge/#", 0, proto_ver=proto_ver)
+    suback2_packet = mosq_test.gen_suback(mid, 0, proto_ver=proto_ver)
+
+    helper_connect_packet = mosq_test.gen_connect("bridge-batch-helper", keepalive=keepalive, proto_ver=proto_ver)
+    helper_connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+
+    helper_publish_packets = []
+    expected_packets = []
+    for i in range(100):
+        topic = "bridge/%d" % (i % 20)
+        helper_publish_packets.append(mosq_test.gen_publish(topic, qos=0, payload="message %d" % (i), proto_ver=proto_ver))
+        expected_packets.append(mosq_test.gen_publish(topic, qos=0, payload="message %d" % (i), proto_ver=proto_ver))
+
+    # A retained message sent in a batch must be stored as retained on the
+    # remote broker.
+    helper_publish_packets.append(mosq_test.gen_publish("bridge/retained", qos=0, retain=True, payload="retained", proto_ver=proto_ver))
+    expected_packets.append(mosq_test.gen_publish("bridge/retained", qos=0, payload="retained", proto_ver=proto_ver))
+
+    mid = 3
+    subscribe3_packet = mosq_test.gen_subscribe(mid, "bridge/retained", 0, proto_ver=proto_ver)
+    suback3_packet = mosq_test.gen_suback(mid, 0, proto_ver=proto_ver)
+    retained_packet = mosq_test.gen_publish("bridge/retained", qos=0, retain=True, payload="retained", proto_ver=proto_ver)
+
+    # A client asking to send batches to the local broker, which doesn't allow
+    # them, gets a plain CONNACK.
+    props = mqtt5_props.gen_string_pair_prop(mqtt5_props.PROP_USER_PROPERTY, "mosquitto-batch", "none")
+    offer_connect_packet = mosq_test.gen_connect("bridge-batch-offer", keepalive=keepalive, proto_ver=5, properties=props)
+    offer_connack_packet = mosq_test.gen_connack(rc=0, proto_ver=5)
+
+    remote_cmd = ['../../src/mosquitto', '-v', '-c', remote_conf_file]
+    broker = mosq_test.start_broker(cmd=remote_cmd, filename=os.path.basename(__file__), port=port1)
+    local_broker = None
+
+    try:
+        sock = mosq_test.do_client_connect(connect_packet, connack_packet, port=port1)
+        mosq_test.do_send_receive(sock, subscribe1_packet, suback1_packet, "suback1")
+
+        local_cmd = ['../../src/mosquitto', '-v', '-c', conf_file]
+        local_broker = mosq_test.start_broker(cmd=local_cmd, filename=os.path.basename(__file__)+'_local', port=port2)
+
+        # Wait for the bridge to connect
+        mosq_test.expect_packet(sock, "state", state_packet)
+
+        offer = mosq_test.do_client_connect(offer_connect_packet, offer_connack_packet, port=port2, connack_error="offer connack")
+        offer.close()
+        mosq_test.do_send_receive(sock, subscribe2_packet, suback2_packet, "suback2")
+
+        helper = mosq_test.do_client_connect(helper_connect_packet, helper_connack_packet, port=port2, connack_error="helper connack")
+        helper.send(b"".join(helper_publish_packets))
+        for p in expected_packets:
+            mosq_test.expect_packet(sock, "publish", p)
+
+        mosq_test.do_send_receive(sock, subscribe3_packet, suback3_packet, "suback3")
+        mosq_test.expect_packet(sock, "retained", retained_packet)
+        mosq_test.do_ping(sock)
+        rc = 0
+
+        helper.close()
+        sock.close()
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file)
+        os.remove(remote_conf_file)
+        if local_broker is not None:
+            local_broker.terminate()
+            local_broker.wait()
+            (stdo, local_stde) = local_broker.communicate()
+            local_stde = local_stde.decode('utf-8')
+        else:
+            local_stde = ""
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        stde = stde.decode('utf-8')
+        if rc == 0 and "sending messages in batches" not in local_stde:
+            rc = 1
+        if rc == 0 and "Received batched PUBLISH" not in stde:
+            rc = 1
+        if rc:
+            print(stde)
+            print(local_stde)
+            print("proto_ver=%d batch_size=%d" % (proto_ver, batch_size))
+            exit(rc)
+
+do_test(proto_ver=4, batch_size=1000)
+do_test(proto_ver=5, batch_size=100000)
+exit(0)
@@ -0,0 +1,179 @@
+#!/usr/bin/env python3
+
+# Does a bridge with bridge_connections set make that many connections to the
+# remote broker, subscribe to incoming topics on the first connection only, and
+# send each outgoing message on the connection its topic maps to, in order?
+
+from mosq_test_helper import *
+
+def write_config(filename, port1, port2, protocol_version, connections):
+    with open(filename, 'w') as f:
+        f.write("port %d\n" % (port2))
+        f.write("allow_anonymous true\n")
+        f.write("\n")
+        f.write("connection bridge_sample\n")
+        f.write("address 127.0.0.1:%d\n" % (port1))
+        f.write("topic bridge/# out 0\n")
+        f.write("topic in/# in 0\n")
+        f.write("notifications false\n")
+        f.write("restart_timeout 5\n")
+        f.write("bridge_attempt_unsubscribe false\n")
+        f.write("bridge_protocol_version %s\n" % (protocol_version))
+        f.write("bridge_connections %d\n" % (connections))
+
+# Mirrors bridge__topic_stream() in src/bridge.c
+def topic_stream(topic, connections):
+    mask = 0xFFFFFFFFFFFFFFFF
+    key = 14695981039346656037
+    for c in topic.encode('utf-8'):
+        key ^= c
+        key = (key * 1099511628211) & mask
+
+    b = -1
+    j = 0
+    while j < connections:
+        b = j
+        key = (key * 2862933555777941757 + 1) & mask
+        j = int(float(b + 1) * (float(1 << 31) / float((key >> 33) + 1)))
+    return b
+
+def read_packet(sock):
+    header = b""
+    while len(header) < 2 or header[-1] & 0x80:
+        data = sock.recv(1)
+        if len(data) == 0:
+            raise mosq_test.TestError
+        header += data
+
+    remaining_length = 0
+    multiplier = 1
+    for c in header[1:]:
+        remaining_length += (c & 0x7F) * multiplier
+        multiplier *= 128
+
+    payload = b""
+    while len(payload) < remaining_length:
+        data = sock.recv(remaining_length - len(payload))
+        if len(data) == 0:
+            raise mosq_test.TestError
+        payload += data
+    return header + payload
+
+def do_test(proto_ver, connections):
+    if proto_ver == 4:
+        bridge_protocol = "mqttv311"
+        proto_ver_connect = 128+4
+    else:
+        bridge_protocol = "mqttv50"
+        proto_ver_connect = 5
+
+    (port1, port2) = mosq_test.get_port(2)
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    write_config(conf_file, port1, port2, bridge_protocol, connections)
+
+    rc = 1
+    keepalive = 60
+    client_id = socket.gethostname()+".bridge_sample"
+    connect_packets = {}
+    for i in range(connections):
+        if i == 0:
+            cid = client_id
+        else:
+            cid = "%s.%d" % (client_id, i+1)
+        connect_packets[mosq_test.gen_connect(cid, keepalive=keepalive, clean_session=False, proto_ver=proto_ver_connect)] = i
+    connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+
+    mid = 1
+    if proto_ver == 5:
+        opts = mqtt5_opts.MQTT_SUB_OPT_NO_LOCAL | mqtt5_opts.MQTT_SUB_OPT_RETAIN_AS_PUBLISHED
+    else:
+        opts = 0
+    subscribe_packet = mosq_test.gen_subscribe(mid, "in/#", 0 | opts, proto_ver=proto_ver)
+    suback_packet = mosq_test.gen_suback(mid, 0, proto_ver=proto_ver)
+
+    helper_connect_packet = mosq_test.gen_connect("helper", keepalive=keepalive, clean_session=True, proto_ver=proto_ver)
+    helper_connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+    helper_subscribe_packet = mosq_test.gen_subscribe(mid, "in/#", 0, proto_ver=proto_ver)
+    helper_suback_packet = mosq_test.gen_suback(mid, 0, proto_ver=proto_ver)
+
+    in_publish_packet = mosq_test.gen_publish("in/test", qos=0, payload="incoming", proto_ver=proto_ver)
+
+    helper_publish_packets = []
+    expected_packets = [[] for i in range(connections)]
+    for i in range(100):
+        topic = "bridge/%d" % (i % 20)
+        packet = mosq_test.gen_publish(topic, qos=0, payload="message %d" % (i), proto_ver=proto_ver)
+        helper_publish_packets.append(packet)
+        expected_packets[topic_stream(topic, connections)].append(packet)
+
+    ssock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    ssock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    ssock.settimeout(40)
+    ssock.bind(('', port1))
+    ssock.listen(5)
+
+    bridges = [None] * connections
+    try:
+        broker = mosq_test.start_broker(filename=os.path.basename(__file__), port=port2, use_conf=True)
+
+        for i in range(connections):
+            (bridge, address) = ssock.accept()
+            bridge.settimeout(20)
+
+            packet = read_packet(bridge)
+            if packet not in connect_packets or bridges[connect_packets[packet]] is not None:
+                print("FAIL: Received unexpected connect %s" % (packet))
+                raise mosq_test.TestError
+            bridges[connect_packets[packet]] = bridge
+            bridge.send(connack_packet)
+
+        # Only the first connection subscribes to the incoming topic
+        mosq_test.expect_packet(bridges[0], "subscribe", subscribe_packet)
+        bridges[0].send(suback_packet)
+
+        helper = mosq_test.do_client_connect(helper_connect_packet, helper_connack_packet, port=port2)
+        mosq_test.do_send_receive(helper, helper_subscribe_packet, helper_suback_packet, "helper suback")
+
+        bridges[0].send(in_publish_packet)
+        mosq_test.expect_packet(helper, "incoming publish", in_publish_packet)
+
+        helper.send(b"".join(helper_publish_packets))
+        for i in range(connections):
+            for p in expected_packets[i]:
+                mosq_test.expect_packet(bridges[i], "publish %d" % (i), p)
+
+        # Nothing else should have been sent on any connection
+        for i in range(connections):
+            bridges[i].settimeout(0.5)
+            try:
+                data = bridges[i].recv(1)
+                if len(data) > 0:
+                    print("FAIL: Unexpected data on connection %d" % (i))
+                    raise mosq_test.TestError
+            except socket.timeout:
+                pass
+
+        rc = 0
+        helper.close()
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file)
+        for bridge in bridges:
+            if bridge is not None:
+                bridge.close()
+
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        ssock.close()
+        if rc:
+            print(stde.decode('utf-8'))
+            print("proto_ver=%d connections=%d" % (proto_ver, connections))
+            exit(rc)
+
+do_test(proto_ver=4, connections=1)
+do_test(proto_ver=4, connections=3)
+do_test(proto_ver=5, connections=4)
+
+exit(0)
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+
+# With bridge_loop_cache_size set, is the "mosquitto-origin" user property
+# ignored for clients on a listener without allow_bridge_origin? Messages
+# carrying it must have it removed and must not be dropped as looping when the
+# same origin is sent again, and a client asking for it in its CONNECT must not
+# receive messages tagged with their origin. The broker warns at startup that
+# no listener has allow_bridge_origin set.
+
+from mosq_test_helper import *
+
+def write_config(filename, port):
+    with open(filename, 'w') as f:
+        f.write("listener %d\n" % (port))
+        f.write("allow_anonymous true\n")
+        f.write("bridge_loop_cache_size 1000\n")
+
+def do_test():
+    port = mosq_test.get_port()
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    write_config(conf_file, port)
+
+    rc = 1
+    keepalive = 60
+    proto_ver = 5
+
+    props = mqtt5_props.gen_string_pair_prop(mqtt5_props.PROP_USER_PROPERTY, "mosquitto-origin", "0123456789abcdef")
+    sub_connect_packet = mosq_test.gen_connect("loop-untrusted-sub", keepalive=keepalive, proto_ver=proto_ver, properties=props)
+    pub_connect_packet = mosq_test.gen_connect("loop-untrusted-pub", keepalive=keepalive, proto_ver=proto_ver)
+    connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+
+    mid = 1
+    subscribe_packet = mosq_test.gen_subscribe(mid, "loop/#", 0, proto_ver=proto_ver)
+    suback_packet = mosq_test.gen_suback(mid, 0, proto_ver=proto_ver)
+
+    props = mqtt5_props.gen_string_pair_prop(mqtt5_props.PROP_USER_PROPERTY, "mosquitto-origin", "fedcba9876543210:1")
+    publish1_packet = mosq_test.gen_publish("loop/test", qos=1, mid=1, payload="message", proto_ver=proto_ver, properties=props)
+    puback1_packet = mosq_test.gen_puback(1, proto_ver=proto_ver)
+    publish2_packet = mosq_test.gen_publish("loop/test", qos=1, mid=2, payload="message", proto_ver=proto_ver, properties=props)
+    puback2_packet = mosq_test.gen_puback(2, proto_ver=proto_ver)
+
+    expected_packet = mosq_test.gen_publish("loop/test", qos=0, payload="message", proto_ver=proto_ver)
+
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+    try:
+        sub = mosq_test.do_client_connect(sub_connect_packet, connack_packet, port=port, connack_error="sub connack")
+        mosq_test.do_send_receive(sub, subscribe_packet, suback_packet, "suback")
+
+        pub = mosq_test.do_client_connect(pub_connect_packet, connack_packet, port=port, connack_error="pub connack")
+        mosq_test.do_send_receive(pub, publish1_packet, puback1_packet, "puback1")
+        mosq_test.expect_packet(sub, "publish1", expected_packet)
+
+        # The same origin again is not treated as a loop
+        mosq_test.do_send_receive(pub, publish2_packet, puback2_packet, "puback2")
+        mosq_test.expect_packet(sub, "publish2", expected_packet)
+
+        mosq_test.do_ping(sub)
+        rc = 0
+
+        pub.close()
+        sub.close()
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file)
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        stde = stde.decode('utf-8')
+        if rc == 0 and "no listener has allow_bridge_origin set" not in stde:
+            print("FAIL: No warning about allow_bridge_origin")
+            rc = 1
+        if rc:
+            print(stde)
+            exit(rc)
+
+do_test()
+exit(0)
@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+
+# Two brokers, each with a bridge to the other carrying the same topics in
+# both directions, form a loop. With bridge_loop_cache_size set, are messages
+# delivered exactly once on each broker rather than being forwarded around
+# the loop, both when messages are sent individually and in batches?
+
+from mosq_test_helper import *
+
+def write_config(filename, port, remote_port, name, batch_size):
+    with open(filename, 'w') as f:
+        f.write("listener %d\n" % (port))
+        f.write("allow_anonymous true\n")
+        f.write("allow_bridge_batches true\n")
+        f.write("allow_bridge_origin true\n")
+        f.write("bridge_loop_cache_size 1000\n")
+        f.write("\n")
+        f.write("connection %s\n" % (name))
+        f.write("address 127.0.0.1:%d\n" % (remote_port))
+        f.write("remote_clientid %s\n" % (name))
+        f.write("topic loop/# both 1\n")
+        f.write("restart_timeout 1\n")
+        f.write("bridge_protocol_version mqttv50\n")
+        if batch_size > 0:
+            f.write("bridge_batch_size %d\n" % (batch_size))
+
+def read_packet(sock):
+    header = b""
+    while len(header) < 2 or header[-1] & 0x80:
+        data = sock.recv(1)
+        if len(data) == 0:
+            raise mosq_test.TestError
+        header += data
+
+    remaining_length = 0
+    multiplier = 1
+    for c in header[1:]:
+        remaining_length += (c & 0x7F) * multiplier
+        multiplier *= 128
+
+    payload = b""
+    while len(payload) < remaining_length:
+        data = sock.recv(remaining_length - len(payload))
+        if len(data) == 0:
+            raise mosq_test.TestError
+        payload += data
+    return header + payload
+
+# The state notification may arrive live or as a retained message, depending
+# on whether the bridge connected before the subscription was made.
+def wait_for_state(sock, topic):
+    live = mosq_test.gen_publish(topic, qos=0, payload="1", proto_ver=5)
+    retained = mosq_test.gen_publish(topic, qos=0, retain=True, payload="1", proto_ver=5)
+    while True:
+        packet = read_packet(sock)
+        if packet == live or packet == retained:
+            return
+
+def do_test(batch_size):
+    (port_a, port_b) = mosq_test.get_port(2)
+    conf_file_a = os.path.basename(__file__).replace('.py', '_a.conf')
+    conf_file_b = os.path.basename(__file__).replace('.py', '_b.conf')
+    write_config(conf_file_a, port_a, port_b, "loop-a-to-b", batch_size)
+    write_config(conf_file_b, port_b, port_a, "loop-b-to-a", batch_size)
+
+    rc = 1
+    keepalive = 60
+    proto_ver = 5
+
+    mid = 1
+    subscribe_packet = mosq_test.gen_subscribe(mid, "loop/#", 0, proto_ver=proto_ver)
+    suback_packet = mosq_test.gen_suback(mid, 0, proto_ver=proto_ver)
+
+    publish_packets = []
+    expected_packets = []
+    for i in range(20):
+        publish_packets.append(mosq_test.gen_publish("loop/%d" % (i), qos=1, mid=i+1, payload="message %d" % (i), proto_ver=proto_ver))
+        expected_packets.append(mosq_test.gen_publish("loop/%d" % (i), qos=0, payload="message %d" % (i), proto_ver=proto_ver))
+
+    broker_a = None
+    broker_b = None
+    try:
+        cmd_a = ['../../src/mosquitto', '-v', '-c', conf_file_a]
+        cmd_b = ['../../src/mosquitto', '-v', '-c', conf_file_b]
+        broker_a = mosq_test.start_broker(cmd=cmd_a, filename=os.path.basename(__file__)+'_a', port=port_a)
+        broker_b = mosq_test.start_broker(cmd=cmd_b, filename=os.path.basename(__file__)+'_b', port=port_b)
+
+        connect_packet = mosq_test.gen_connect("loop-sub-a", keepalive=keepalive, proto_ver=proto_ver)
+        connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+        sub_a = mosq_test.do_client_connect(connect_packet, connack_packet, port=port_a)
+        connect_packet = mosq_test.gen_connect("loop-sub-b", keepalive=keepalive, proto_ver=proto_ver)
+        sub_b = mosq_test.do_client_connect(connect_packet, connack_packet, port=port_b)
+
+        # Wait for both bridges to connect
+        state_subscribe_packet = mosq_test.gen_subscribe(mid, "$SYS/broker/connection/loop-b-to-a/state", 0, proto_ver=proto_ver)
+        mosq_test.do_send_receive(sub_a, state_subscribe_packet, suback_packet, "state suback a")
+        wait_for_state(sub_a, "$SYS/broker/connection/loop-b-to-a/state")
+        state_subscribe_packet = mosq_test.gen_subscribe(mid, "$SYS/broker/connection/loop-a-to-b/state", 0, proto_ver=proto_ver)
+        mosq_test.do_send_receive(sub_b, state_subscribe_packet, suback_packet, "state suback b")
+        wait_for_state(sub_b, "$SYS/broker/connection/loop-a-to-b/state")
+
+        mosq_test.do_send_receive(sub_a, subscribe_packet, suback_packet, "suback a")
+        mosq_test.do_send_receive(sub_b, subscribe_packet, suback_packet, "suback b")
+
+        connect_packet = mosq_test.gen_connect("loop-pub", keepalive=keepalive, proto_ver=proto_ver)
+        pub = mosq_test.do_client_connect(connect_packet, connack_packet, port=port_a)
+        for i in range(len(publish_packets)):
+            puback_packet = mosq_test.gen_puback(i+1, proto_ver=proto_ver)
+            mosq_test.do_send_receive(pub, publish_packets[i], puback_packet, "puback %d" % (i))
+
+        for p in expected_packets:
+            mosq_test.expect_packet(sub_b, "publish b", p)
+        for p in expected_packets:
+            mosq_test.expect_packet(sub_a, "publish a", p)
+
+        # Give any copies of the messages time to go around the loop, then
+        # check that nothing else has been received.
+        time.sleep(1)
+        mosq_test.do_ping(sub_a)
+        mosq_test.do_ping(sub_b)
+        rc = 0
+
+        pub.close()
+        sub_a.close()
+        sub_b.close()
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file_a)
+        os.remove(conf_file_b)
+        stde_a = ""
+        stde_b = ""
+        if broker_a is not None:
+            broker_a.terminate()
+            broker_a.wait()
+            (stdo, stde_a) = broker_a.communicate()
+            stde_a = stde_a.decode('utf-8')
+        if broker_b is not None:
+            broker_b.terminate()
+            broker_b.wait()
+            (stdo, stde_b) = broker_b.communicate()
+            stde_b = stde_b.decode('utf-8')
+        if rc == 0 and "Dropped looping" not in stde_a + stde_b:
+            rc = 1
+        if rc == 0 and batch_size > 0 and "sending messages in batches" not in stde_a + stde_b:
+            rc = 1
+        if rc:
+            print(stde_a)
+            print(stde_b)
+            print("batch_size=%d" % (batch_size))
+            exit(rc)
+
+do_test(batch_size=0)
+do_test(batch_size=10000)
+exit(0)
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+
+# Check that cached ACL results are used for repeated checks, and that they
+# are discarded when the ACL file is reloaded.
+
+from mosq_test_helper import *
+import signal
+
+def write_config(filename, port):
+    with open(filename, 'w') as f:
+        f.write("port %d\n" % (port))
+        f.write("allow_anonymous true\n")
+        f.write("acl_file %s\n" % (filename.replace('.conf', '.acl')))
+        f.write("acl_cache_size 16\n")
+
+def write_acl(filename, write):
+    with open(filename, 'w') as f:
+        if write:
+            f.write('topic readwrite cache/topic\n')
+        else:
+            f.write('topic read cache/topic\n')
+
+def do_test(proto_ver):
+    rc = 1
+    keepalive = 60
+
+    connect_packet = mosq_test.gen_connect("acl-cache", keepalive=keepalive, proto_ver=proto_ver)
+    connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+
+    mid = 1
+    subscribe_packet = mosq_test.gen_subscribe(mid=mid, topic="cache/topic", qos=0, proto_ver=proto_ver)
+    suback_packet = mosq_test.gen_suback(mid=mid, qos=0, proto_ver=proto_ver)
+
+    publish1_packet = mosq_test.gen_publish(topic="cache/topic", qos=0, payload="message1", proto_ver=proto_ver)
+    publish2_packet = mosq_test.gen_publish(topic="cache/topic", qos=0, payload="message2", proto_ver=proto_ver)
+    publish3_packet = mosq_test.gen_publish(topic="cache/topic", qos=0, payload="message3", proto_ver=proto_ver)
+
+    port = mosq_test.get_port()
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    write_config(conf_file, port)
+    acl_file = os.path.basename(__file__).replace('.py', '.acl')
+    write_acl(acl_file, True)
+
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+    try:
+        sock = mosq_test.do_client_connect(connect_packet, connack_packet, port=port)
+        mosq_test.do_send_receive(sock, subscribe_packet, suback_packet, "suback")
+
+        # The second publish is checked using the cached results
+        mosq_test.do_send_receive(sock, publish1_packet, publish1_packet, "publish1")
+        mosq_test.do_send_receive(sock, publish2_packet, publish2_packet, "publish2")
+
+        # Remove write access
+        write_acl(acl_file, False)
+        broker.send_signal(signal.SIGHUP)
+        time.sleep(0.5)
+
+        # This must not be delivered
+        sock.send(publish3_packet)
+        mosq_test.do_ping(sock)
+
+        sock.close()
+        rc = 0
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file)
+        os.remove(acl_file)
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        if rc:
+            print(stde.decode('utf-8'))
+            print("proto_ver=%d" % (proto_ver))
+            exit(rc)
+
+do_test(proto_ver=4)
+do_test(proto_ver=5)
@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+
+# Check that password checks done by the password hashing threads give the
+# same results as those done on the main thread, that a packet sent straight
+# after CONNECT is handled once the client has been authorised, and that the
+# will of a client with a bad password is not sent. The last connection
+# should be accepted from the password cache.
+
+from mosq_test_helper import *
+
+def write_config(filename, port, pw_file):
+    with open(filename, 'w') as f:
+        f.write("port %d\n" % (port))
+        f.write("password_file %s\n" % (pw_file))
+        f.write("allow_anonymous false\n")
+        f.write("password_hash_threads 2\n")
+        f.write("password_cache_timeout 60\n")
+
+def write_pwfile(filename):
+    with open(filename, 'w') as f:
+        # Username user, password password
+        f.write('user:$7$1000$vcOZoRqMMTnQXLJI$se7zHA77MHwy7EhBV+/9sUY7V/quHgh2dcVgosXP7nWik32y/RP6yFQFZKc/BoA2suZ5rBJ6Wk0QNWLHONUjKA==\n')
+
+
+def do_test(proto_ver):
+    pw_file = os.path.basename(__file__).replace('.py', '.pwfile')
+    port = mosq_test.get_port()
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    write_config(conf_file, port, pw_file)
+    write_pwfile(pw_file)
+
+    rc = 1
+    keepalive = 10
+    connect1_packet = mosq_test.gen_connect("pwfile-threads-1", keepalive=keepalive, username="user", password="password", proto_ver=proto_ver)
+    connack1_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+
+    mid = 1
+    subscribe_packet = mosq_test.gen_subscribe(mid, topic="will/test", qos=0, proto_ver=proto_ver)
+    suback_packet = mosq_test.gen_suback(mid, 0, proto_ver=proto_ver)
+
+    connect2_packet = mosq_test.gen_connect("pwfile-threads-2", keepalive=keepalive, username="user", password="password9", will_topic="will/test", will_payload=b"will msg", proto_ver=proto_ver)
+    if proto_ver == 5:
+        connack2_packet = mosq_test.gen_connack(rc=mqtt5_rc.MQTT_RC_NOT_AUTHORIZED, proto_ver=proto_ver, properties=None)
+    else:
+        connack2_packet = mosq_test.gen_connack(rc=5, proto_ver=proto_ver)
+
+    connect3_packet = mosq_test.gen_connect("pwfile-threads-3", keepalive=keepalive, username="user", password="password", proto_ver=proto_ver)
+    connack3_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+    try:
+        # SUBSCRIBE is sent without waiting for the CONNACK
+        sock1 = mosq_test.client_connect_only(port=port)
+        sock1.send(connect1_packet + subscribe_packet)
+        mosq_test.expect_packet(sock1, "connack1", connack1_packet)
+        mosq_test.expect_packet(sock1, "suback", suback_packet)
+
+        sock2 = mosq_test.do_client_connect(connect2_packet, connack2_packet, port=port)
+        sock2.close()
+
+        sock3 = mosq_test.do_client_connect(connect3_packet, connack3_packet, port=port)
+        sock3.close()
+
+        # If we receive a will here, this is an error
+        mosq_test.do_ping(sock1)
+        sock1.close()
+        rc = 0
+
+    except mosq_test.TestError:
+        pass
+    finally:
+        os.remove(conf_file)
+        os.remove(pw_file)
+        broker.terminate()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        if rc == 0 and "Started 2 password hashing threads" not in stde.decode('utf-8'):
+            rc = 1
+        if rc:
+            print(stde.decode('utf-8'))
+            print("proto_ver=%d" % (proto_ver))
+            exit(rc)
+
+
+do_test(proto_ver=4)
+do_test(proto_ver=5)
+exit(0)
@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+
+# Check that a save requested with SIGUSR1 is written by a background process
+# when autosave_background is set. The broker is killed rather than stopped,
+# so only the background save can have written the persistence file.
+
+from mosq_test_helper import *
+import signal
+
+def write_config(filename, port):
+    with open(filename, 'w') as f:
+        f.write("port %d\n" % (port))
+        f.write("allow_anonymous true\n")
+        f.write("persistence true\n")
+        f.write("persistence_file %s\n" % (filename.replace('.conf', '.db')))
+        f.write("autosave_interval 0\n")
+        f.write("autosave_background true\n")
+
+def do_test(proto_ver):
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    write_config(conf_file, port)
+
+    persistence_file = os.path.basename(__file__).replace('.py', '.db')
+    try:
+        os.remove(persistence_file)
+    except OSError:
+        pass
+
+    rc = 1
+    keepalive = 60
+    connect_packet = mosq_test.gen_connect("autosave-background", keepalive=keepalive, proto_ver=proto_ver)
+    connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+
+    mid = 1
+    publish_packet = mosq_test.gen_publish("test/topic", qos=0, payload="retained message", retain=True, proto_ver=proto_ver)
+    subscribe_packet = mosq_test.gen_subscribe(mid, "test/topic", 0, proto_ver=proto_ver)
+    suback_packet = mosq_test.gen_suback(mid, 0, proto_ver=proto_ver)
+
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+    try:
+        sock = mosq_test.do_client_connect(connect_packet, connack_packet, port=port)
+        sock.send(publish_packet)
+        mosq_test.do_ping(sock)
+
+        broker.send_signal(signal.SIGUSR1)
+        for i in range(50):
+            if os.path.exists(persistence_file):
+                break
+            time.sleep(0.1)
+
+        # The broker must still be serving clients
+        mosq_test.do_ping(sock)
+        sock.close()
+
+        broker.kill()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        if b"in background process" not in stde:
+            raise mosq_test.TestError
+
+        broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+        sock = mosq_test.do_client_connect(connect_packet, connack_packet, port=port)
+        mosq_test.do_send_receive(sock, subscribe_packet, suback_packet, "suback")
+        mosq_test.expect_packet(sock, "publish", publish_packet)
+        rc = 0
+
+        sock.close()
+    except mosq_test.TestError:
+        pass
+    finally:
+        broker.terminate()
+        broker.wait()
+        os.remove(conf_file)
+        try:
+            os.remove(persistence_file)
+        except OSError:
+            pass
+        (stdo, stde) = broker.communicate()
+        if rc:
+            print(stde.decode('utf-8'))
+            exit(rc)
+
+
+port = mosq_test.get_port()
+do_test(proto_ver=4)
+do_test(proto_ver=5)
@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+
+# Check that QoS 1 messages queued for a persistent client are recovered from
+# the persistence journal when the broker is killed without saving, and that
+# messages the client has already acknowledged are not sent again.
+
+from mosq_test_helper import *
+
+def write_config(filename, port):
+    with open(filename, 'w') as f:
+        f.write("port %d\n" % (port))
+        f.write("allow_anonymous true\n")
+        f.write("persistence true\n")
+        f.write("persistence_file %s\n" % (filename.replace('.conf', '.db')))
+        f.write("persistence_journal true\n")
+        f.write("autosave_interval 0\n")
+
+def do_test(proto_ver):
+    conf_file = os.path.basename(__file__).replace('.py', '.conf')
+    write_config(conf_file, port)
+
+    persistence_file = os.path.basename(__file__).replace('.py', '.db')
+    journal_file = persistence_file + ".journal"
+    for f in [persistence_file, journal_file]:
+        try:
+            os.remove(f)
+        except OSError:
+            pass
+
+    rc = 1
+    keepalive = 60
+    sub_connect_packet = mosq_test.gen_connect("journal-sub", keepalive=keepalive, clean_session=False, proto_ver=proto_ver, session_expiry=60)
+    connack_packet = mosq_test.gen_connack(rc=0, proto_ver=proto_ver)
+    connack_packet2 = mosq_test.gen_connack(rc=0, flags=1, proto_ver=proto_ver)
+    pub_connect_packet = mosq_test.gen_connect("journal-pub", keepalive=keepalive, proto_ver=proto_ver)
+
+    mid = 1
+    subscribe_packet = mosq_test.gen_subscribe(mid, "journal/topic", 1, proto_ver=proto_ver)
+    suback_packet = mosq_test.gen_suback(mid, 1, proto_ver=proto_ver)
+
+    publish1_packet = mosq_test.gen_publish("journal/topic", qos=1, mid=10, payload="message 1", proto_ver=proto_ver)
+    puback1_packet = mosq_test.gen_puback(10, proto_ver=proto_ver)
+    publish2_packet = mosq_test.gen_publish("journal/topic", qos=1, mid=11, payload="message 2", proto_ver=proto_ver)
+    puback2_packet = mosq_test.gen_puback(11, proto_ver=proto_ver)
+
+    publish1_out_packet = mosq_test.gen_publish("journal/topic", qos=1, mid=1, payload="message 1", proto_ver=proto_ver)
+    puback1_out_packet = mosq_test.gen_puback(1, proto_ver=proto_ver)
+    publish2_out_packet = mosq_test.gen_publish("journal/topic", qos=1, mid=2, payload="message 2", proto_ver=proto_ver)
+
+    broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+    try:
+        sock = mosq_test.do_client_connect(sub_connect_packet, connack_packet, port=port)
+        mosq_test.do_send_receive(sock, subscribe_packet, suback_packet, "suback")
+        sock.close()
+
+        pub_sock = mosq_test.do_client_connect(pub_connect_packet, connack_packet, port=port)
+        mosq_test.do_send_receive(pub_sock, publish1_packet, puback1_packet, "puback1")
+
+        # Receive and acknowledge the first message
+        sock = mosq_test.do_client_connect(sub_connect_packet, connack_packet2, port=port)
+        mosq_test.expect_packet(sock, "publish1", publish1_out_packet)
+        sock.send(puback1_out_packet)
+        mosq_test.do_ping(sock)
+        sock.close()
+
+        # Queue the second message while the client is away
+        mosq_test.do_send_receive(pub_sock, publish2_packet, puback2_packet, "puback2")
+        mosq_test.do_ping(pub_sock)
+        pub_sock.close()
+
+        broker.kill()
+        broker.wait()
+        (stdo, stde) = broker.communicate()
+        if os.path.exists(persistence_file):
+            # Only the journal should have been written
+            raise mosq_test.TestError
+
+        broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+        sock = mosq_test.do_client_connect(sub_connect_packet, connack_packet2, port=port)
+        mosq_test.expect_packet(sock, "publish2", publish2_out_packet)
+        mosq_test.do_ping(sock)
+        rc = 0
+
+        sock.close()
+    except mosq_test.TestError:
+        pass
+    finally:
+        broker.terminate()
+        broker.wait()
+        os.remove(conf_file)
+        for f in [persistence_file, journal_file]:
+            try:
+                os.remove(f)
+            except OSError:
+                pass
+        (stdo, stde) = broker.communicate()
+        if rc:
+            print(stde.decode('utf-8'))
+            print("proto_ver=%d" % (proto_ver))
+            exit(rc)
+
+
+port = mosq_test.get_port()
+do_test(proto_ver=4)
+do_test(proto_ver=5)
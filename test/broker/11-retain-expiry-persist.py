@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+
+# Test whether an expired retained message that no client has subscribed to
+# is removed by the broker, and so isn't written to the persistence file.
+
+from mosq_test_helper import *
+
+def write_config(filename, port):
+    with open(filename, 'w') as f:
+        f.write("port %d\n" % (port))
+        f.write("allow_anonymous true\n")
+        f.write("persistence true\n")
+        f.write("persistence_file %s\n" % (filename.replace('.conf', '.db')))
+
+port = mosq_test.get_port()
+conf_file = os.path.basename(__file__).replace('.py', '.conf')
+write_config(conf_file, port)
+persistence_file = os.path.basename(__file__).replace('.py', '.db')
+try:
+    os.remove(persistence_file)
+except OSError:
+    pass
+
+rc = 1
+keepalive = 60
+connect_packet = mosq_test.gen_connect("retain-expiry", keepalive=keepalive, proto_ver=5)
+connack_packet = mosq_test.gen_connack(rc=0, proto_ver=5)
+
+props = mqtt5_props.gen_uint32_prop(mqtt5_props.PROP_MESSAGE_EXPIRY_INTERVAL, 1)
+publish1_packet = mosq_test.gen_publish("retain/expire", qos=0, payload="expires", retain=True, proto_ver=5, properties=props)
+publish2_packet = mosq_test.gen_publish("retain/keep", qos=0, payload="kept", retain=True, proto_ver=5)
+
+broker = mosq_test.start_broker(filename=os.path.basename(__file__), use_conf=True, port=port)
+
+try:
+    sock = mosq_test.do_client_connect(connect_packet, connack_packet, port=port)
+    sock.send(publish1_packet)
+    sock.send(publish2_packet)
+    mosq_test.do_ping(sock)
+    sock.close()
+
+    # Expiry is checked once the expiry interval has passed
+    time.sleep(3)
+
+    broker.terminate()
+    broker.wait()
+
+    with open(persistence_file, 'rb') as f:
+        data = f.read()
+    if b"retain/keep" in data and b"retain/expire" not in data:
+        rc = 0
+except mosq_test.TestError:
+    pass
+finally:
+    os.remove(conf_file)
+    broker.terminate()
+    broker.wait()
+    (stdo, stde) = broker.communicate()
+    try:
+        os.remove(persistence_file)
+    except OSError:
+        pass
+    if rc:
+        print(stde.decode('utf-8'))
+
+
+exit(rc)
@@ -8,6 +8,8 @@ tests = [
     (1, './01-connect-575314.py'),
     (1, './01-connect-allow-anonymous.py'),
     (1, './01-connect-disconnect-v5.py'),
+    (2, './01-connect-io-threads.py'),
+    (1, './01-connect-io-uring.py'),
     (1, './01-connect-max-connections.py'),
     (1, './01-connect-max-keepalive.py'),
     (1, './01-connect-take-over.py'),
@@ -22,16 +24,20 @@ tests = [
     (1, './02-subhier-crash.py'),
     (1, './02-subpub-qos0-long-topic.py'),
     (1, './02-subpub-qos0-oversize-payload.py'),
+    (1, './02-subpub-qos0-pipelined.py'),
+    (1, './02-subpub-qos0-read-budget.py'),
     (1, './02-subpub-qos0-queued-bytes.py'),
     (1, './02-subpub-qos0-retain-as-publish.py'),
     (1, './02-subpub-qos0-send-retain.py'),
     (1, './02-subpub-qos0-subscription-id.py'),
     (1, './02-subpub-qos0-topic-alias-unknown.py'),
     (1, './02-subpub-qos0-topic-alias.py'),
+    (1, './02-subpub-qos1-large-payload.py'),
     (1, './02-subpub-qos1-message-expiry-retain.py'),
     (1, './02-subpub-qos1-message-expiry-will.py'),
     (1, './02-subpub-qos1-message-expiry.py'),
     (1, './02-subpub-qos1-nolocal.py'),
+    (1, './02-subpub-qos1-overlap.py'),
     (1, './02-subpub-qos1-oversize-payload.py'),
     (1, './02-subpub-qos1.py'),
     (1, './02-subpub-qos2-1322.py'),
@@ -58,16 +64,21 @@ tests = [
     (1, './03-publish-dollar.py'),
     (1, './03-publish-invalid-utf8.py'),
     (1, './03-publish-long-topic.py'),
+    (1, './03-publish-qos0-queued-spill.py'),
     (1, './03-publish-qos1-max-inflight-expire.py'),
     (1, './03-publish-qos1-max-inflight.py'),
     (1, './03-publish-qos1-no-subscribers-v5.py'),
+    (1, './03-publish-qos1-queued-spill.py'),
+    (1, './03-publish-qos1-queued-spill-restart.py'),
     (1, './03-publish-qos1-retain-disabled.py'),
     (1, './03-publish-qos1.py'),
     (1, './03-publish-qos2-max-inflight.py'),
     (1, './03-publish-qos2.py'),
 
+    (1, './04-retain-busy-client.py'),
     (1, './04-retain-check-source-persist.py'),
     (1, './04-retain-check-source.py'),
+    (1, './04-retain-paced.py'),
     (1, './04-retain-qos0-clear.py'),
     (1, './04-retain-qos0-fresh.py'),
     (1, './04-retain-qos0-repeated.py'),
@@ -86,6 +97,8 @@ tests = [
     (2, './06-bridge-b2br-remapping.py'),
     (2, './06-bridge-br2b-disconnect-qos1.py'),
     (2, './06-bridge-br2b-disconnect-qos2.py'),
+    (2, './06-bridge-batch.py'),
+    (2, './06-bridge-batch-stale.py'),
     (2, './06-bridge-br2b-remapping.py'),
     (2, './06-bridge-clean-session-csF-lcsF.py'),
     (2, './06-bridge-clean-session-csF-lcsN.py'),
@@ -93,8 +106,11 @@ tests = [
     (2, './06-bridge-clean-session-csT-lcsF.py'),
     (2, './06-bridge-clean-session-csT-lcsN.py'),
     (2, './06-bridge-clean-session-csT-lcsT.py'),
+    (2, './06-bridge-connections.py'),
     (2, './06-bridge-fail-persist-resend-qos1.py'),
     (2, './06-bridge-fail-persist-resend-qos2.py'),
+    (2, './06-bridge-loop.py'),
+    (1, './06-bridge-loop-untrusted.py'),
     (1, './06-bridge-no-local.py'),
     (2, './06-bridge-outgoing-retain.py'),
     (3, './06-bridge-per-listener-settings.py'),
@@ -133,6 +149,7 @@ tests = [
     (3, './08-tls-psk-bridge.py'),
 
     (1, './09-acl-access-variants.py'),
+    (1, './09-acl-cache.py'),
     (1, './09-acl-change.py'),
     (1, './09-acl-empty-file.py'),
     (1, './09-auth-bad-method.py'),
@@ -155,15 +172,19 @@ tests = [
     (1, './09-plugin-auth-v2-unpwd-success.py'),
     (1, './09-plugin-publish.py'),
     (1, './09-plugin-tick.py'),
+    (1, './09-pwfile-hash-threads.py'),
     (1, './09-pwfile-parse-invalid.py'),
 
     (2, './10-listener-mount-point.py'),
 
     (1, './11-message-expiry.py'),
+    (1, './11-persistent-autosave-background.py'),
+    (1, './11-persistent-journal.py'),
     (1, './11-persistent-subscription.py'),
     (1, './11-persistent-subscription-v5.py'),
     (1, './11-persistent-subscription-no-local.py'),
     (1, './11-pub-props.py'),
+    (1, './11-retain-expiry-persist.py'),
     (1, './11-subscription-id.py'),
 
     (1, './12-prop-assigned-client-identifier.py'),
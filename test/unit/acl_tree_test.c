@@ -0,0 +1,222 @@
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <CUnit/CUnit.h>
+#include <CUnit/Basic.h>
+
+#define WITH_BROKER
+
+#include "mosquitto_broker_internal.h"
+
+#define RULE_COUNT 20
+#define TOPIC_COUNT 500
+
+struct rule{
+	char topic[100];
+	int access;
+};
+
+
+/* The result of checking an ACL list in which deny rules come first, using
+ * the same topic matching as the ACL list checks did before the tree. */
+static int list_check(struct rule *rules, int rule_count, const char *topic, int access)
+{
+	bool result;
+	int i;
+
+	for(i=0; i<rule_count; i++){
+		if(rules[i].access == MOSQ_ACL_NONE){
+			mosquitto_topic_matches_sub(rules[i].topic, topic, &result);
+			if(result) return MOSQ_ERR_ACL_DENIED;
+		}
+	}
+	for(i=0; i<rule_count; i++){
+		if(rules[i].access != MOSQ_ACL_NONE && (rules[i].access & access)){
+			mosquitto_topic_matches_sub(rules[i].topic, topic, &result);
+			if(result) return MOSQ_ERR_SUCCESS;
+		}
+	}
+	return MOSQ_ERR_NOT_FOUND;
+}
+
+
+static void random_topic(char *buf, size_t len, bool wildcards)
+{
+	const char *levels[] = {"a", "b", "c", "", "$SYS"};
+	int count = 1 + rand()%4;
+	int i;
+	int r;
+
+	buf[0] = '\0';
+	for(i=0; i<count; i++){
+		if(i > 0){
+			strncat(buf, "/", len-strlen(buf)-1);
+		}
+		r = rand()%7;
+		if(wildcards && r == 5){
+			strncat(buf, "+", len-strlen(buf)-1);
+		}else if(wildcards && r == 6){
+			strncat(buf, "#", len-strlen(buf)-1);
+			return;
+		}else if(r == 4 && i > 0){
+			strncat(buf, "d", len-strlen(buf)-1);
+		}else{
+			strncat(buf, levels[r%5], len-strlen(buf)-1);
+		}
+	}
+}
+
+
+static void TEST_basic(void)
+{
+	struct mosquitto__acl_node *root = NULL;
+
+	CU_ASSERT_EQUAL(acl_tree__add(&root, "room/+/temp", MOSQ_ACL_READ), MOSQ_ERR_SUCCESS);
+	CU_ASSERT_EQUAL(acl_tree__add(&root, "room/1/#", MOSQ_ACL_WRITE), MOSQ_ERR_SUCCESS);
+	CU_ASSERT_EQUAL(acl_tree__add(&root, "room/1/secret", MOSQ_ACL_NONE), MOSQ_ERR_SUCCESS);
+	CU_ASSERT_EQUAL(acl_tree__add(&root, "#", MOSQ_ACL_READ), MOSQ_ERR_SUCCESS);
+
+	CU_ASSERT_EQUAL(acl_tree__check(root, "room/2/temp", MOSQ_ACL_READ), MOSQ_ERR_SUCCESS);
+	CU_ASSERT_EQUAL(acl_tree__check(root, "room/2/temp", MOSQ_ACL_WRITE), MOSQ_ERR_NOT_FOUND);
+	CU_ASSERT_EQUAL(acl_tree__check(root, "room/1", MOSQ_ACL_WRITE), MOSQ_ERR_SUCCESS);
+	CU_ASSERT_EQUAL(acl_tree__check(root, "room/1/a/b", MOSQ_ACL_WRITE), MOSQ_ERR_SUCCESS);
+	CU_ASSERT_EQUAL(acl_tree__check(root, "room/1/secret", MOSQ_ACL_READ), MOSQ_ERR_ACL_DENIED);
+	CU_ASSERT_EQUAL(acl_tree__check(root, "room/1/secret/a", MOSQ_ACL_READ), MOSQ_ERR_SUCCESS);
+
+	/* Wildcards at the first level don't match $ topics */
+	CU_ASSERT_EQUAL(acl_tree__check(root, "$SYS/broker/uptime", MOSQ_ACL_READ), MOSQ_ERR_NOT_FOUND);
+	CU_ASSERT_EQUAL(acl_tree__add(&root, "$SYS/#", MOSQ_ACL_READ), MOSQ_ERR_SUCCESS);
+	CU_ASSERT_EQUAL(acl_tree__check(root, "$SYS/broker/uptime", MOSQ_ACL_READ), MOSQ_ERR_SUCCESS);
+
+	acl_tree__free(&root);
+	CU_ASSERT_PTR_NULL(root);
+	CU_ASSERT_EQUAL(acl_tree__check(root, "room/2/temp", MOSQ_ACL_READ), MOSQ_ERR_NOT_FOUND);
+}
+
+
+static void TEST_random(void)
+{
+	struct mosquitto__acl_node *root;
+	struct rule rules[RULE_COUNT];
+	char topic[100];
+	int access;
+	int i, j, run;
+
+	srand(1);
+	for(run=0; run<100; run++){
+		root = NULL;
+		for(i=0; i<RULE_COUNT; i++){
+			random_topic(rules[i].topic, sizeof(rules[i].topic), true);
+			rules[i].access = rand()%4;
+			CU_ASSERT_EQUAL(acl_tree__add(&root, rules[i].topic, rules[i].access), MOSQ_ERR_SUCCESS);
+		}
+		for(j=0; j<TOPIC_COUNT; j++){
+			random_topic(topic, sizeof(topic), false);
+			access = 1 + rand()%2;
+			CU_ASSERT_EQUAL(acl_tree__check(root, topic, access), list_check(rules, RULE_COUNT, topic, access));
+		}
+		acl_tree__free(&root);
+	}
+}
+
+
+/* The rank of the first rule in the list matching topic, or 0. */
+static int list_first(struct rule *rules, int rule_count, const char *topic)
+{
+	bool result;
+	int i;
+
+	for(i=0; i<rule_count; i++){
+		mosquitto_topic_matches_sub(rules[i].topic, topic, &result);
+		if(result) return i+1;
+	}
+	return 0;
+}
+
+
+static void TEST_ranked_random(void)
+{
+	struct mosquitto__acl_node *root;
+	struct mosquitto__acl_rule best;
+	struct rule rules[RULE_COUNT];
+	char topic[100];
+	int i, j, run, rank;
+
+	srand(2);
+	for(run=0; run<100; run++){
+		root = NULL;
+		for(i=0; i<RULE_COUNT; i++){
+			random_topic(rules[i].topic, sizeof(rules[i].topic), true);
+			rules[i].access = rand()%2;
+			CU_ASSERT_EQUAL(acl_tree__add_ranked(&root, rules[i].topic, i+1, rules[i].access), MOSQ_ERR_SUCCESS);
+		}
+		for(j=0; j<TOPIC_COUNT; j++){
+			random_topic(topic, sizeof(topic), false);
+			memset(&best, 0, sizeof(best));
+			acl_tree__find(root, topic, &best);
+			rank = list_first(rules, RULE_COUNT, topic);
+			CU_ASSERT_EQUAL(best.rank, rank);
+			if(rank){
+				CU_ASSERT_EQUAL(best.deny, rules[rank-1].access);
+			}
+		}
+		acl_tree__free(&root);
+	}
+}
+
+
+/* ========================================================================
+ * TEST SUITE SETUP
+ * ======================================================================== */
+
+int init_acl_tree_tests(void)
+{
+	CU_pSuite test_suite = NULL;
+
+	test_suite = CU_add_suite("ACL tree", NULL, NULL);
+	if(!test_suite){
+		printf("Error adding CUnit ACL tree test suite.\n");
+		return 1;
+	}
+
+	if(0
+			|| !CU_add_test(test_suite, "Basic", TEST_basic)
+			|| !CU_add_test(test_suite, "Random", TEST_random)
+			|| !CU_add_test(test_suite, "Ranked random", TEST_ranked_random)
+			){
+
+		printf("Error adding ACL tree CUnit tests.\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int fails;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	if(CU_initialize_registry() != CUE_SUCCESS){
+		printf("Error initializing CUnit registry.\n");
+		return 1;
+	}
+
+	if(0
+			|| init_acl_tree_tests()
+			){
+
+		CU_cleanup_registry();
+		return 1;
+	}
+
+	CU_basic_set_mode(CU_BRM_VERBOSE);
+	CU_basic_run_tests();
+	fails = CU_get_number_of_failures();
+	CU_cleanup_registry();
+
+	return (int)fails;
+}
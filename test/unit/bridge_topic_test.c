@@ -52,6 +52,36 @@ static void map_invalid_helper(const char *topic, const char *local_prefix, cons
 }
 
 
+static void map_in_check(struct mosquitto *mosq, const char *incoming, const char *expected)
+{
+	char *map_topic;
+	int rc;
+
+	map_topic = strdup(incoming);
+	rc = bridge__remap_topic_in(mosq, &map_topic);
+	CU_ASSERT_EQUAL(rc, 0);
+	CU_ASSERT_PTR_NOT_NULL(map_topic);
+	if(map_topic){
+		CU_ASSERT_STRING_EQUAL(map_topic, expected);
+		free(map_topic);
+	}
+}
+
+static void map_out_check(struct mosquitto *mosq, const char *outgoing, const char *expected)
+{
+	const char *map_topic = outgoing;
+	char *topic_buf;
+	int rc;
+
+	rc = bridge__remap_topic_out(mosq, &map_topic, &topic_buf);
+	CU_ASSERT_EQUAL(rc, 0);
+	CU_ASSERT_PTR_NOT_NULL(map_topic);
+	if(map_topic){
+		CU_ASSERT_STRING_EQUAL(map_topic, expected);
+	}
+	free(topic_buf);
+}
+
 static void TEST_remap_valid(void)
 {
 	/* Examples from man page */
@@ -70,6 +100,76 @@ static void TEST_remap_invalid(void)
 	map_invalid_helper(NULL, NULL, NULL);
 }
 
+static void TEST_remap_order(void)
+{
+	struct mosquitto mosq;
+	struct mosquitto__bridge bridge;
+	int rc;
+
+	memset(&mosq, 0, sizeof(struct mosquitto));
+	memset(&bridge, 0, sizeof(struct mosquitto__bridge));
+
+	mosq.bridge = &bridge;
+
+	rc = bridge__add_topic(&bridge, "sensors/+/temp", bd_in, 0, "L1/", "R/");
+	CU_ASSERT_EQUAL(rc, 0);
+	rc = bridge__add_topic(&bridge, "sensors/#", bd_in, 0, "L2/", "R/");
+	CU_ASSERT_EQUAL(rc, 0);
+	rc = bridge__add_topic(&bridge, "sensors/a/temp", bd_in, 0, "L3/", "R/");
+	CU_ASSERT_EQUAL(rc, 0);
+	rc = bridge__add_topic(&bridge, "#", bd_in, 0, NULL, "R/");
+	CU_ASSERT_EQUAL(rc, 0);
+	rc = bridge__add_topic(&bridge, "plain/#", bd_in, 0, NULL, NULL);
+	CU_ASSERT_EQUAL(rc, 0);
+
+	/* The first matching topic in configuration order is used */
+	map_in_check(&mosq, "R/sensors/a/temp", "L1/sensors/a/temp");
+	map_in_check(&mosq, "R/sensors/a/humidity", "L2/sensors/a/humidity");
+	map_in_check(&mosq, "R/sensors", "L2/sensors");
+	map_in_check(&mosq, "R/other", "other");
+	map_in_check(&mosq, "plain/topic", "plain/topic");
+	map_in_check(&mosq, "other", "other");
+
+	/* "in" topics are not used for outgoing messages */
+	map_out_check(&mosq, "L1/sensors/a/temp", "L1/sensors/a/temp");
+
+	bridge__remap_free(&bridge);
+}
+
+static void TEST_remap_out(void)
+{
+	struct mosquitto mosq;
+	struct mosquitto__bridge bridge;
+	int rc;
+
+	memset(&mosq, 0, sizeof(struct mosquitto));
+	memset(&bridge, 0, sizeof(struct mosquitto__bridge));
+
+	mosq.bridge = &bridge;
+
+	rc = bridge__add_topic(&bridge, "+/b", bd_out, 0, "L/", "R/");
+	CU_ASSERT_EQUAL(rc, 0);
+	rc = bridge__add_topic(&bridge, "strip/#", bd_out, 0, "L/", NULL);
+	CU_ASSERT_EQUAL(rc, 0);
+	rc = bridge__add_topic(&bridge, "add/#", bd_both, 0, NULL, "R/");
+	CU_ASSERT_EQUAL(rc, 0);
+	rc = bridge__add_topic(&bridge, "#", bd_out, 0, NULL, "$R/");
+	CU_ASSERT_EQUAL(rc, 0);
+
+	map_out_check(&mosq, "L/a/b", "R/a/b");
+	map_out_check(&mosq, "L/strip/x/y", "strip/x/y");
+	map_out_check(&mosq, "add/x", "R/add/x");
+	map_out_check(&mosq, "other/x", "$R/other/x");
+	/* Wildcards at the first level don't match topics beginning with $ */
+	map_out_check(&mosq, "$SYS/x", "$SYS/x");
+
+	/* "both" topics are also used for incoming messages */
+	map_in_check(&mosq, "R/add/x", "add/x");
+	map_in_check(&mosq, "R/a/b", "R/a/b");
+
+	bridge__remap_free(&bridge);
+}
+
 
 /* ========================================================================
  * TEST SUITE SETUP
@@ -88,6 +188,8 @@ int init_bridge_tests(void)
 	if(0
 			|| !CU_add_test(test_suite, "Remap valid", TEST_remap_valid)
 			|| !CU_add_test(test_suite, "Remap invalid", TEST_remap_invalid)
+			|| !CU_add_test(test_suite, "Remap order", TEST_remap_order)
+			|| !CU_add_test(test_suite, "Remap out", TEST_remap_out)
 			){
 
 		printf("Error adding Bridge remap CUnit tests.\n");
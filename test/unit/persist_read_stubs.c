@@ -32,16 +32,9 @@ struct mosquitto *context__init(mosq_sock_t sock)
 
 void db__msg_store_free(struct mosquitto_msg_store *store)
 {
-	int i;
-
 	mosquitto__free(store->source_id);
 	mosquitto__free(store->source_username);
-	if(store->dest_ids){
-		for(i=0; i<store->dest_id_count; i++){
-			mosquitto__free(store->dest_ids[i]);
-		}
-		mosquitto__free(store->dest_ids);
-	}
+	mosquitto__free(store->dest_ids);
 	mosquitto__free(store->topic);
 	mosquitto_property_free_all(&store->properties);
 	mosquitto__free(store->payload);
@@ -83,6 +76,7 @@ int db__message_store(const struct mosquitto *source, struct mosquitto_msg_store
 
     stored->dest_ids = NULL;
     stored->dest_id_count = 0;
+    stored->dest_id_size = 0;
     db.msg_store_count++;
     db.msg_store_bytes += stored->payloadlen;
 
@@ -148,6 +142,11 @@ int acl__find_acls(struct mosquitto *context)
 	return MOSQ_ERR_SUCCESS;
 }
 
+void acl__free_client(struct mosquitto *context)
+{
+	UNUSED(context);
+}
+
 
 int sub__add(struct mosquitto *context, const char *sub, uint8_t qos, uint32_t identifier, int options, struct mosquitto__subhier **root)
 {
@@ -212,3 +211,57 @@ int session_expiry__add_from_persistence(struct mosquitto *context, time_t expir
 	UNUSED(expiry_time);
 	return 0;
 }
+
+int db__message_remove_by_mid(struct mosquitto *context, enum mosquitto_msg_direction dir, uint16_t mid)
+{
+	UNUSED(context);
+	UNUSED(dir);
+	UNUSED(mid);
+	return 0;
+}
+
+void db__msg_store_compact(void)
+{
+}
+
+int sub__remove(struct mosquitto *context, const char *sub, struct mosquitto__subhier *root, uint8_t *reason)
+{
+	UNUSED(context);
+	UNUSED(sub);
+	UNUSED(root);
+	UNUSED(reason);
+	return 0;
+}
+
+void session_expiry__remove(struct mosquitto *context)
+{
+	UNUSED(context);
+}
+
+void context__add_to_disused(struct mosquitto *context)
+{
+	UNUSED(context);
+}
+
+void persist__journal_retain(struct mosquitto_msg_store *stored)
+{
+	UNUSED(stored);
+}
+
+bool db__ready_for_flight(struct mosquitto *context, enum mosquitto_msg_direction dir, int qos)
+{
+	UNUSED(context);
+	UNUSED(dir);
+	UNUSED(qos);
+
+	return true;
+}
+
+bool db__ready_for_queue(struct mosquitto *context, int qos, struct mosquitto_msg_data *msg_data)
+{
+	UNUSED(context);
+	UNUSED(qos);
+	UNUSED(msg_data);
+
+	return true;
+}
@@ -13,6 +13,8 @@ extern uint64_t last_retained;
 extern char *last_sub;
 extern int last_qos;
 
+bool flag_db_backup = false;
+
 struct mosquitto *context__init(mosq_sock_t sock)
 {
 	UNUSED(sock);
@@ -68,19 +70,21 @@ int acl__find_acls(struct mosquitto *context)
 	return MOSQ_ERR_SUCCESS;
 }
 
+void acl__free_client(struct mosquitto *context)
+{
+	UNUSED(context);
+}
 
-int send__publish(struct mosquitto *mosq, uint16_t mid, const char *topic, uint32_t payloadlen, const void *payload, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, const mosquitto_property *store_props, uint32_t expiry_interval)
+
+int send__publish_stored(struct mosquitto *mosq, uint16_t mid, struct mosquitto_msg_store *stored, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, uint32_t expiry_interval)
 {
 	UNUSED(mosq);
 	UNUSED(mid);
-	UNUSED(topic);
-	UNUSED(payloadlen);
-	UNUSED(payload);
+	UNUSED(stored);
 	UNUSED(qos);
 	UNUSED(retain);
 	UNUSED(dup);
 	UNUSED(cmsg_props);
-	UNUSED(store_props);
 	UNUSED(expiry_interval);
 
 	return MOSQ_ERR_SUCCESS;
@@ -128,3 +132,28 @@ int session_expiry__add_from_persistence(struct mosquitto *context, time_t expir
 	UNUSED(expiry_time);
 	return 0;
 }
+
+void session_expiry__remove(struct mosquitto *context)
+{
+	UNUSED(context);
+}
+
+void context__add_to_disused(struct mosquitto *context)
+{
+	UNUSED(context);
+}
+
+int spill__append(struct mosquitto *context, const struct mosquitto_msg_store *stored, uint8_t qos, bool retain, const mosquitto_property *properties)
+{
+	UNUSED(context);
+	UNUSED(stored);
+	UNUSED(qos);
+	UNUSED(retain);
+	UNUSED(properties);
+	return MOSQ_ERR_NOT_SUPPORTED;
+}
+
+void spill__free(struct mosquitto *context)
+{
+	UNUSED(context);
+}
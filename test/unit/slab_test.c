@@ -0,0 +1,175 @@
+#include "config.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CUnit/CUnit.h>
+#include <CUnit/Basic.h>
+
+#define WITH_BROKER
+
+#include "memory_mosq.h"
+
+#define OBJECT_COUNT 1000
+
+static void *objects[OBJECT_COUNT];
+
+
+static void slab_check(int class_index, unsigned long used_expected, unsigned long free_expected)
+{
+	size_t size;
+	unsigned long used, free_count;
+
+	memory__slab_stats(class_index, &size, &used, &free_count);
+	CU_ASSERT_EQUAL(used, used_expected);
+	CU_ASSERT_EQUAL(free_count, free_expected);
+}
+
+
+static void TEST_alloc_free(void)
+{
+	unsigned long free_count;
+	size_t size;
+	unsigned long used;
+	uint8_t *mem;
+	int i, j;
+
+	/* 100 bytes is in the second size class */
+	memory__slab_stats(1, &size, &used, &free_count);
+	CU_ASSERT_EQUAL(size, 128);
+	slab_check(1, 0, 0);
+
+	for(i=0; i<OBJECT_COUNT; i++){
+		objects[i] = mosquitto__slab_calloc(100);
+		CU_ASSERT_PTR_NOT_NULL(objects[i]);
+		if(objects[i] == NULL) return;
+
+		mem = objects[i];
+		for(j=0; j<100; j++){
+			CU_ASSERT_EQUAL(mem[j], 0);
+		}
+		memset(mem, 0xFF, 100);
+	}
+	memory__slab_stats(1, &size, &used, &free_count);
+	CU_ASSERT_EQUAL(used, OBJECT_COUNT);
+	CU_ASSERT(free_count < 64);
+
+	/* Freed objects are reused and zeroed again */
+	mosquitto__slab_free(objects[10]);
+	mem = mosquitto__slab_calloc(100);
+	CU_ASSERT_PTR_EQUAL(mem, objects[10]);
+	for(j=0; j<100; j++){
+		CU_ASSERT_EQUAL(mem[j], 0);
+	}
+
+	/* Everything but one empty slab is released */
+	for(i=0; i<OBJECT_COUNT; i++){
+		mosquitto__slab_free(objects[i]);
+	}
+	slab_check(1, 0, 64);
+
+	memory__slab_cleanup();
+	slab_check(1, 0, 0);
+}
+
+
+static void TEST_interleaved(void)
+{
+	int i;
+
+	for(i=0; i<OBJECT_COUNT; i++){
+		objects[i] = mosquitto__slab_calloc((size_t)(1 + i%(64*MEMORY_SLAB_CLASSES)));
+		CU_ASSERT_PTR_NOT_NULL(objects[i]);
+	}
+	for(i=0; i<OBJECT_COUNT; i+=2){
+		mosquitto__slab_free(objects[i]);
+	}
+	for(i=0; i<OBJECT_COUNT; i+=2){
+		objects[i] = mosquitto__slab_calloc((size_t)(1 + i%(64*MEMORY_SLAB_CLASSES)));
+		CU_ASSERT_PTR_NOT_NULL(objects[i]);
+	}
+	for(i=OBJECT_COUNT-1; i>=0; i--){
+		mosquitto__slab_free(objects[i]);
+	}
+	memory__slab_cleanup();
+	for(i=0; i<MEMORY_SLAB_CLASSES; i++){
+		slab_check(i, 0, 0);
+	}
+}
+
+
+static void TEST_large(void)
+{
+	uint8_t *mem;
+
+	/* Too large for a pool, and zero sized */
+	mem = mosquitto__slab_calloc(64*MEMORY_SLAB_CLASSES + 1);
+	CU_ASSERT_PTR_NOT_NULL(mem);
+	if(mem){
+		CU_ASSERT_EQUAL(mem[64*MEMORY_SLAB_CLASSES], 0);
+	}
+	mosquitto__slab_free(mem);
+
+	mem = mosquitto__slab_calloc(0);
+	CU_ASSERT_PTR_NOT_NULL(mem);
+	mosquitto__slab_free(mem);
+
+	mosquitto__slab_free(NULL);
+}
+
+
+/* ========================================================================
+ * TEST SUITE SETUP
+ * ======================================================================== */
+
+int init_slab_tests(void)
+{
+	CU_pSuite test_suite = NULL;
+
+	test_suite = CU_add_suite("Slab", NULL, NULL);
+	if(!test_suite){
+		printf("Error adding CUnit Slab test suite.\n");
+		return 1;
+	}
+
+	if(0
+			|| !CU_add_test(test_suite, "Alloc free", TEST_alloc_free)
+			|| !CU_add_test(test_suite, "Interleaved", TEST_interleaved)
+			|| !CU_add_test(test_suite, "Large", TEST_large)
+			){
+
+		printf("Error adding Slab CUnit tests.\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int fails;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	if(CU_initialize_registry() != CUE_SUCCESS){
+		printf("Error initializing CUnit registry.\n");
+		return 1;
+	}
+
+	if(0
+			|| init_slab_tests()
+			){
+
+		CU_cleanup_registry();
+		return 1;
+	}
+
+	CU_basic_set_mode(CU_BRM_VERBOSE);
+	CU_basic_run_tests();
+	fails = CU_get_number_of_failures();
+	CU_cleanup_registry();
+
+	return (int)fails;
+}
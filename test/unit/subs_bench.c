@@ -0,0 +1,145 @@
+/* Benchmark for subscription matching.
+ *
+ * Builds a subscription tree of literal and wildcard subscriptions, then
+ * times sub__messages_queue() for a set of random topics. Clients are
+ * offline and messages are QoS 0, so the time is dominated by finding the
+ * matching subscriptions rather than queuing messages.
+ *
+ * Usage: ./subs_bench [clients] [subscriptions per client] [publishes]
+ *
+ * Run against two builds to compare changes to the subscription tree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define WITH_BROKER
+#define WITH_PERSISTENCE
+
+#include "mosquitto_broker_internal.h"
+#include "memory_mosq.h"
+
+struct mosquitto_db db;
+
+#define SITES 100
+#define DEVICES 1000
+#define METRICS 10
+#define TOPICS 10000
+
+static double now_ms(void)
+{
+	struct timespec tp;
+
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return (double)tp.tv_sec*1000.0 + (double)tp.tv_nsec/1000000.0;
+}
+
+
+static void random_filter(char *buf, size_t len)
+{
+	int site = rand()%SITES;
+	int device = rand()%DEVICES;
+	int metric = rand()%METRICS;
+	int kind = rand()%20;
+
+	if(kind < 14){
+		snprintf(buf, len, "dev/%d/%d/%d", site, device, metric);
+	}else if(kind < 17){
+		snprintf(buf, len, "dev/%d/+/%d", site, metric);
+	}else if(kind < 19){
+		snprintf(buf, len, "dev/%d/%d/#", site, device);
+	}else{
+		snprintf(buf, len, "+/%d/%d/+", site, device);
+	}
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct mosquitto__config config;
+	struct mosquitto__listener listener;
+	struct mosquitto *contexts;
+	struct mosquitto_msg_store **stores;
+	char buf[100];
+	int client_count = 10000;
+	int subs_per_client = 20;
+	int publish_count = 200000;
+	int i, j;
+	double start, end;
+
+	if(argc > 1) client_count = atoi(argv[1]);
+	if(argc > 2) subs_per_client = atoi(argv[2]);
+	if(argc > 3) publish_count = atoi(argv[3]);
+	if(client_count < 1 || subs_per_client < 1 || publish_count < 1){
+		fprintf(stderr, "Usage: subs_bench [clients] [subscriptions per client] [publishes]\n");
+		return 1;
+	}
+
+	srand(1);
+	memset(&db, 0, sizeof(struct mosquitto_db));
+	memset(&config, 0, sizeof(struct mosquitto__config));
+	memset(&listener, 0, sizeof(struct mosquitto__listener));
+
+	db.config = &config;
+	listener.port = 1883;
+	config.listeners = &listener;
+	config.listener_count = 1;
+	db__open(&config);
+
+	contexts = mosquitto__calloc((size_t)client_count, sizeof(struct mosquitto));
+	stores = mosquitto__calloc(TOPICS, sizeof(struct mosquitto_msg_store *));
+	if(!contexts || !stores){
+		fprintf(stderr, "Error: Out of memory.\n");
+		return 1;
+	}
+
+	start = now_ms();
+	for(i=0; i<client_count; i++){
+		snprintf(buf, sizeof(buf), "client%d", i);
+		contexts[i].id = mosquitto__strdup(buf);
+		contexts[i].sock = INVALID_SOCKET;
+		contexts[i].protocol = mosq_p_mqtt5;
+		contexts[i].dest_id = (uint64_t)i+1;
+		for(j=0; j<subs_per_client; j++){
+			random_filter(buf, sizeof(buf));
+			sub__add(&contexts[i], buf, 0, 0, 0, &db.subs);
+		}
+	}
+	end = now_ms();
+	printf("Added %d subscriptions in %.1f ms\n", client_count*subs_per_client, end-start);
+
+	/* The topic is split when the message is received, not when matching */
+	for(i=0; i<TOPICS; i++){
+		snprintf(buf, sizeof(buf), "dev/%d/%d/%d", rand()%SITES, rand()%DEVICES, rand()%METRICS);
+		stores[i] = mosquitto__calloc(1, sizeof(struct mosquitto_msg_store));
+		if(!stores[i]){
+			fprintf(stderr, "Error: Out of memory.\n");
+			return 1;
+		}
+		stores[i]->topic = mosquitto__strdup(buf);
+		stores[i]->ref_count = 1;
+		sub__topic_levels(stores[i]);
+	}
+
+	start = now_ms();
+	for(i=0; i<publish_count; i++){
+		sub__messages_queue("source", stores[i%TOPICS]->topic, 0, 0, &stores[i%TOPICS]);
+	}
+	end = now_ms();
+	printf("Matched %d publishes in %.1f ms, %.0f publishes/s\n",
+			publish_count, end-start, (double)publish_count*1000.0/(end-start));
+
+	for(i=0; i<TOPICS; i++){
+		db__msg_store_ref_dec(&stores[i]);
+	}
+	for(i=0; i<client_count; i++){
+		mosquitto__free(contexts[i].subs);
+		mosquitto__free(contexts[i].id);
+	}
+	mosquitto__free(stores);
+	mosquitto__free(contexts);
+	db__close();
+
+	return 0;
+}
@@ -72,18 +72,15 @@ int acl__find_acls(struct mosquitto *context)
 #endif
 
 
-int send__publish(struct mosquitto *mosq, uint16_t mid, const char *topic, uint32_t payloadlen, const void *payload, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, const mosquitto_property *store_props, uint32_t expiry_interval)
+int send__publish_stored(struct mosquitto *mosq, uint16_t mid, struct mosquitto_msg_store *stored, uint8_t qos, bool retain, bool dup, const mosquitto_property *cmsg_props, uint32_t expiry_interval)
 {
 	UNUSED(mosq);
 	UNUSED(mid);
-	UNUSED(topic);
-	UNUSED(payloadlen);
-	UNUSED(payload);
+	UNUSED(stored);
 	UNUSED(qos);
 	UNUSED(retain);
 	UNUSED(dup);
 	UNUSED(cmsg_props);
-	UNUSED(store_props);
 	UNUSED(expiry_interval);
 
 	return MOSQ_ERR_SUCCESS;
@@ -160,6 +157,42 @@ int persist__restore(void)
 	return MOSQ_ERR_SUCCESS;
 }
 
+int persist__journal_open(void)
+{
+	return MOSQ_ERR_SUCCESS;
+}
+
+void persist__journal_close(void)
+{
+}
+
+void persist__journal_client_msg(struct mosquitto *context, struct mosquitto_client_msg *cmsg)
+{
+	UNUSED(context);
+	UNUSED(cmsg);
+}
+
+void persist__journal_client_msg_remove(struct mosquitto *context, struct mosquitto_client_msg *cmsg)
+{
+	UNUSED(context);
+	UNUSED(cmsg);
+}
+
+void persist__journal_sub(struct mosquitto *context, const char *sub, uint8_t qos, uint32_t identifier, int options)
+{
+	UNUSED(context);
+	UNUSED(sub);
+	UNUSED(qos);
+	UNUSED(identifier);
+	UNUSED(options);
+}
+
+void persist__journal_sub_remove(struct mosquitto *context, const char *sub)
+{
+	UNUSED(context);
+	UNUSED(sub);
+}
+
 void mosquitto_property_free_all(mosquitto_property **properties)
 {
 	UNUSED(properties);
@@ -185,15 +218,18 @@ int retain__queue(struct mosquitto *context, const char *sub, uint8_t sub_qos, u
 	return MOSQ_ERR_SUCCESS;
 }
 
-int retain__store(const char *topic, struct mosquitto_msg_store *stored, char **split_topics)
+int retain__store(struct mosquitto_msg_store *stored)
 {
-	UNUSED(topic);
 	UNUSED(stored);
-	UNUSED(split_topics);
 
 	return MOSQ_ERR_SUCCESS;
 }
 
+void retain__cursors_free(struct mosquitto *context)
+{
+	UNUSED(context);
+}
+
 
 void util__decrement_receive_quota(struct mosquitto *mosq)
 {
@@ -226,3 +262,18 @@ int session_expiry__add_from_persistence(struct mosquitto *context, time_t expir
 	UNUSED(expiry_time);
 	return 0;
 }
+
+int spill__append(struct mosquitto *context, const struct mosquitto_msg_store *stored, uint8_t qos, bool retain, const mosquitto_property *properties)
+{
+	UNUSED(context);
+	UNUSED(stored);
+	UNUSED(qos);
+	UNUSED(retain);
+	UNUSED(properties);
+	return MOSQ_ERR_NOT_SUPPORTED;
+}
+
+void spill__free(struct mosquitto *context)
+{
+	UNUSED(context);
+}
@@ -36,6 +36,87 @@ static void hier_quick_check(struct mosquitto__subhier **sub, struct mosquitto *
 }
 
 
+static int publish(const char *topic)
+{
+	struct mosquitto_msg_store *stored;
+	int rc;
+
+	stored = mosquitto__calloc(1, sizeof(struct mosquitto_msg_store));
+	if(stored == NULL) return MOSQ_ERR_NOMEM;
+	stored->topic = mosquitto__strdup(topic);
+	stored->ref_count = 1;
+	stored->qos = 1;
+
+	rc = sub__messages_queue("source", stored->topic, 1, 0, &stored);
+	db__msg_store_ref_dec(&stored);
+	return rc;
+}
+
+
+static void level_check(const struct mosquitto_msg_store *stored, int i, const char *level)
+{
+	CU_ASSERT_EQUAL(stored->topic_levels[i].len, strlen(level));
+	CU_ASSERT_NSTRING_EQUAL(&stored->topic[stored->topic_levels[i].offset], level, strlen(level));
+}
+
+
+static void TEST_topic_levels(void)
+{
+	struct mosquitto_msg_store stored;
+	char topic[100];
+	int i;
+	int rc;
+
+	memset(&stored, 0, sizeof(stored));
+	stored.topic = "a/bb//c";
+	rc = sub__topic_levels(&stored);
+	CU_ASSERT_EQUAL(rc, MOSQ_ERR_SUCCESS);
+	CU_ASSERT_PTR_EQUAL(stored.topic_levels, stored.topic_levels_static);
+	CU_ASSERT_EQUAL(stored.topic_level_count, 5);
+	if(stored.topic_level_count == 5){
+		level_check(&stored, 0, "");
+		level_check(&stored, 1, "a");
+		level_check(&stored, 2, "bb");
+		level_check(&stored, 3, "");
+		level_check(&stored, 4, "c");
+	}
+
+	memset(&stored, 0, sizeof(stored));
+	stored.topic = "$SYS/broker/";
+	rc = sub__topic_levels(&stored);
+	CU_ASSERT_EQUAL(rc, MOSQ_ERR_SUCCESS);
+	CU_ASSERT_EQUAL(stored.topic_level_count, 3);
+	if(stored.topic_level_count == 3){
+		level_check(&stored, 0, "$SYS");
+		level_check(&stored, 1, "broker");
+		level_check(&stored, 2, "");
+	}
+
+	memset(&stored, 0, sizeof(stored));
+	stored.topic = "";
+	rc = sub__topic_levels(&stored);
+	CU_ASSERT_EQUAL(rc, MOSQ_ERR_INVAL);
+	CU_ASSERT_PTR_NULL(stored.topic_levels);
+
+	/* Too many levels to fit in the message */
+	memset(&stored, 0, sizeof(stored));
+	snprintf(topic, sizeof(topic), "0/1/2/3/4/5/6/7/8/9");
+	stored.topic = topic;
+	rc = sub__topic_levels(&stored);
+	CU_ASSERT_EQUAL(rc, MOSQ_ERR_SUCCESS);
+	CU_ASSERT_PTR_NOT_EQUAL(stored.topic_levels, stored.topic_levels_static);
+	CU_ASSERT_EQUAL(stored.topic_level_count, 11);
+	if(stored.topic_level_count == 11){
+		level_check(&stored, 0, "");
+		for(i=0; i<10; i++){
+			CU_ASSERT_EQUAL(stored.topic_levels[i+1].len, 1);
+			CU_ASSERT_EQUAL(topic[stored.topic_levels[i+1].offset], '0'+i);
+		}
+	}
+	mosquitto__free(stored.topic_levels);
+}
+
+
 static void TEST_sub_add_single(void)
 {
 	struct mosquitto__config config;
@@ -78,6 +159,92 @@ static void TEST_sub_add_single(void)
 }
 
 
+static void TEST_sub_match(void)
+{
+	struct mosquitto__config config;
+	struct mosquitto__listener listener;
+	struct mosquitto context[7];
+	struct mosquitto__subhier *root, *branch;
+	const char *filters[7] = {"a/b/c", "a/+/c", "a/#", "+/+/+", "#", "a/b/#", "$SYS/#"};
+	const char *topics[6] = {"a/b/c", "a/x/c", "a/b", "a", "x/y/z", "$SYS/foo"};
+	const int expected[7] = {1, 2, 4, 3, 5, 2, 1};
+	char id[20];
+	uint8_t reason;
+	int i;
+	int rc;
+
+	memset(&db, 0, sizeof(struct mosquitto_db));
+	memset(&config, 0, sizeof(struct mosquitto__config));
+	memset(&listener, 0, sizeof(struct mosquitto__listener));
+	memset(context, 0, sizeof(context));
+
+	db.config = &config;
+	listener.port = 1883;
+	config.listeners = &listener;
+	config.listener_count = 1;
+
+	db__open(&config);
+
+	for(i=0; i<7; i++){
+		snprintf(id, sizeof(id), "client%d", i);
+		context[i].id = mosquitto__strdup(id);
+		context[i].sock = INVALID_SOCKET;
+		context[i].protocol = mosq_p_mqtt5;
+		context[i].max_qos = 2;
+		context[i].dest_id = (uint64_t)i+1;
+		rc = sub__add(&context[i], filters[i], 1, 0, 0, &db.subs);
+		CU_ASSERT_EQUAL(rc, MOSQ_ERR_SUCCESS);
+	}
+
+	for(i=0; i<6; i++){
+		rc = publish(topics[i]);
+		CU_ASSERT_EQUAL(rc, MOSQ_ERR_SUCCESS);
+	}
+	for(i=0; i<7; i++){
+		CU_ASSERT_EQUAL(context[i].msgs_out.queued_count, expected[i]);
+	}
+
+	/* Removing the + subscriptions must also remove the wildcard entries */
+	rc = sub__remove(&context[1], filters[1], db.subs, &reason);
+	CU_ASSERT_EQUAL(rc, MOSQ_ERR_SUCCESS);
+	rc = sub__remove(&context[3], filters[3], db.subs, &reason);
+	CU_ASSERT_EQUAL(rc, MOSQ_ERR_SUCCESS);
+
+	/* The tree for "a/b" is "" -> "" -> "a" -> "b" */
+	HASH_FIND(hh, db.subs, "", 0, branch);
+	CU_ASSERT_PTR_NOT_NULL(branch);
+	root = NULL;
+	if(branch){
+		HASH_FIND(hh, branch->children, "", 0, root);
+		CU_ASSERT_PTR_NOT_NULL(root);
+	}
+	if(root){
+		CU_ASSERT_PTR_NULL(root->child_plus);
+		CU_ASSERT_PTR_NOT_NULL(root->child_hash);
+		HASH_FIND(hh, root->children, "a", 1, branch);
+		CU_ASSERT_PTR_NOT_NULL(branch);
+		if(branch){
+			CU_ASSERT_PTR_NULL(branch->child_plus);
+			CU_ASSERT_PTR_NOT_NULL(branch->child_hash);
+		}
+	}
+
+	rc = publish("a/x/c");
+	CU_ASSERT_EQUAL(rc, MOSQ_ERR_SUCCESS);
+	CU_ASSERT_EQUAL(context[1].msgs_out.queued_count, expected[1]);
+	CU_ASSERT_EQUAL(context[2].msgs_out.queued_count, expected[2]+1);
+	CU_ASSERT_EQUAL(context[3].msgs_out.queued_count, expected[3]);
+	CU_ASSERT_EQUAL(context[4].msgs_out.queued_count, expected[4]+1);
+
+	for(i=0; i<7; i++){
+		db__messages_delete(&context[i], true);
+		mosquitto__free(context[i].subs);
+		mosquitto__free(context[i].id);
+	}
+	db__close();
+}
+
+
 /* ========================================================================
  * TEST SUITE SETUP
  * ======================================================================== */
@@ -105,6 +272,8 @@ int main(int argc, char *argv[])
 
 	if(0
 			|| !CU_add_test(test_suite, "Sub add single", TEST_sub_add_single)
+			|| !CU_add_test(test_suite, "Sub match", TEST_sub_match)
+			|| !CU_add_test(test_suite, "Topic levels", TEST_topic_levels)
 			){
 
 		printf("Error adding Subs CUnit tests.\n");
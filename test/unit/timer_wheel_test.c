@@ -0,0 +1,253 @@
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <CUnit/CUnit.h>
+#include <CUnit/Basic.h>
+
+#define WITH_BROKER
+
+#include "mosquitto_broker_internal.h"
+
+#define TIMER_COUNT 2000
+
+static struct mosquitto__timer timers[TIMER_COUNT];
+
+
+static int pop_all(struct mosquitto__timer_wheel *wheel, time_t prev_now, time_t now)
+{
+	struct mosquitto__timer *timer;
+	int count = 0;
+
+	while((timer = timer_wheel__pop_expired(wheel))){
+		/* Must be due now, and must not have been due at the previous check */
+		CU_ASSERT(timer->expiry < now);
+		CU_ASSERT(timer->expiry >= prev_now);
+		CU_ASSERT_PTR_NULL(timer->slot);
+		count++;
+	}
+	return count;
+}
+
+
+static void TEST_single(void)
+{
+	struct mosquitto__timer_wheel wheel;
+	struct mosquitto__timer timer;
+
+	memset(&timer, 0, sizeof(timer));
+	timer_wheel__init(&wheel, 1000);
+
+	timer_wheel__add(&wheel, &timer, 1010);
+	CU_ASSERT_EQUAL(wheel.count, 1);
+
+	timer_wheel__advance(&wheel, 1009);
+	CU_ASSERT_PTR_NULL(timer_wheel__pop_expired(&wheel));
+	timer_wheel__advance(&wheel, 1010);
+	CU_ASSERT_PTR_NULL(timer_wheel__pop_expired(&wheel));
+	timer_wheel__advance(&wheel, 1011);
+	CU_ASSERT_PTR_EQUAL(timer_wheel__pop_expired(&wheel), &timer);
+	CU_ASSERT_PTR_NULL(timer_wheel__pop_expired(&wheel));
+	CU_ASSERT_EQUAL(wheel.count, 0);
+
+	/* Overdue timers are expired at the next advance */
+	timer_wheel__add(&wheel, &timer, 10);
+	CU_ASSERT_EQUAL(wheel.count, 1);
+	CU_ASSERT_PTR_NULL(timer_wheel__pop_expired(&wheel));
+	timer_wheel__advance(&wheel, 1011);
+	CU_ASSERT_PTR_NULL(timer_wheel__pop_expired(&wheel));
+	timer_wheel__advance(&wheel, 1012);
+	CU_ASSERT_PTR_EQUAL(timer_wheel__pop_expired(&wheel), &timer);
+	CU_ASSERT_EQUAL(wheel.count, 0);
+}
+
+
+static void TEST_backwards(void)
+{
+	struct mosquitto__timer_wheel wheel;
+	struct mosquitto__timer t1, t2;
+
+	memset(&t1, 0, sizeof(t1));
+	memset(&t2, 0, sizeof(t2));
+	timer_wheel__init(&wheel, 1000);
+
+	timer_wheel__add(&wheel, &t1, 1100);
+	timer_wheel__advance(&wheel, 1050);
+	CU_ASSERT_PTR_NULL(timer_wheel__pop_expired(&wheel));
+
+	/* The clock goes back, and a timer is added before the next advance */
+	timer_wheel__add(&wheel, &t2, 510);
+	timer_wheel__advance(&wheel, 500);
+	CU_ASSERT_PTR_NULL(timer_wheel__pop_expired(&wheel));
+	CU_ASSERT_EQUAL(wheel.count, 2);
+
+	timer_wheel__advance(&wheel, 510);
+	CU_ASSERT_PTR_NULL(timer_wheel__pop_expired(&wheel));
+	timer_wheel__advance(&wheel, 511);
+	CU_ASSERT_PTR_EQUAL(timer_wheel__pop_expired(&wheel), &t2);
+	CU_ASSERT_PTR_NULL(timer_wheel__pop_expired(&wheel));
+
+	/* Earlier timers fire when the clock reaches their expiry again */
+	timer_wheel__advance(&wheel, 1100);
+	CU_ASSERT_PTR_NULL(timer_wheel__pop_expired(&wheel));
+	timer_wheel__advance(&wheel, 1101);
+	CU_ASSERT_PTR_EQUAL(timer_wheel__pop_expired(&wheel), &t1);
+	CU_ASSERT_EQUAL(wheel.count, 0);
+}
+
+
+static void TEST_remove(void)
+{
+	struct mosquitto__timer_wheel wheel;
+	struct mosquitto__timer t1, t2;
+
+	memset(&t1, 0, sizeof(t1));
+	memset(&t2, 0, sizeof(t2));
+	timer_wheel__init(&wheel, 0);
+
+	timer_wheel__add(&wheel, &t1, 5);
+	timer_wheel__add(&wheel, &t2, 50000);
+	timer_wheel__remove(&wheel, &t1);
+	timer_wheel__remove(&wheel, &t1);
+	CU_ASSERT_EQUAL(wheel.count, 1);
+
+	/* Re-adding moves the timer */
+	timer_wheel__add(&wheel, &t2, 7);
+	CU_ASSERT_EQUAL(wheel.count, 1);
+
+	timer_wheel__advance(&wheel, 100);
+	CU_ASSERT_PTR_EQUAL(timer_wheel__pop_expired(&wheel), &t2);
+	CU_ASSERT_PTR_NULL(timer_wheel__pop_expired(&wheel));
+
+	/* Removing from the expired list */
+	timer_wheel__add(&wheel, &t1, 101);
+	timer_wheel__add(&wheel, &t2, 101);
+	timer_wheel__advance(&wheel, 200);
+	timer_wheel__remove(&wheel, &t2);
+	CU_ASSERT_PTR_EQUAL(timer_wheel__pop_expired(&wheel), &t1);
+	CU_ASSERT_PTR_NULL(timer_wheel__pop_expired(&wheel));
+}
+
+
+static void TEST_random(void)
+{
+	struct mosquitto__timer_wheel wheel;
+	time_t now, prev_now;
+	time_t start = 1600000000;
+	int i, fired = 0;
+
+	srand(1);
+	memset(timers, 0, sizeof(timers));
+	timer_wheel__init(&wheel, start);
+
+	for(i=0; i<TIMER_COUNT; i++){
+		switch(i%4){
+			case 0:
+				timer_wheel__add(&wheel, &timers[i], start + rand()%300);
+				break;
+			case 1:
+				timer_wheel__add(&wheel, &timers[i], start + rand()%20000);
+				break;
+			case 2:
+				timer_wheel__add(&wheel, &timers[i], start + rand()%2000000);
+				break;
+			default:
+				timer_wheel__add(&wheel, &timers[i], start + 100000000 + rand()%1000);
+				break;
+		}
+	}
+	CU_ASSERT_EQUAL(wheel.count, TIMER_COUNT);
+
+	prev_now = start;
+	for(now=start; now<start+3000000; now+=1+rand()%3000){
+		timer_wheel__advance(&wheel, now);
+		fired += pop_all(&wheel, prev_now, now);
+		prev_now = now;
+	}
+	CU_ASSERT_EQUAL(fired, TIMER_COUNT*3/4);
+
+	/* Large jump */
+	now = start + 200000000;
+	timer_wheel__advance(&wheel, now);
+	fired += pop_all(&wheel, prev_now, now);
+	CU_ASSERT_EQUAL(fired, TIMER_COUNT);
+	CU_ASSERT_EQUAL(wheel.count, 0);
+}
+
+
+static void TEST_expire_all(void)
+{
+	struct mosquitto__timer_wheel wheel;
+	int i, count = 0;
+
+	memset(timers, 0, sizeof(timers));
+	timer_wheel__init(&wheel, 1000);
+
+	for(i=0; i<TIMER_COUNT; i++){
+		timer_wheel__add(&wheel, &timers[i], 1000 + i*i);
+	}
+	timer_wheel__expire_all(&wheel);
+	CU_ASSERT_EQUAL(wheel.count, 0);
+	while(timer_wheel__pop_expired(&wheel)){
+		count++;
+	}
+	CU_ASSERT_EQUAL(count, TIMER_COUNT);
+}
+
+
+/* ========================================================================
+ * TEST SUITE SETUP
+ * ======================================================================== */
+
+int init_timer_wheel_tests(void)
+{
+	CU_pSuite test_suite = NULL;
+
+	test_suite = CU_add_suite("Timer wheel", NULL, NULL);
+	if(!test_suite){
+		printf("Error adding CUnit Timer wheel test suite.\n");
+		return 1;
+	}
+
+	if(0
+			|| !CU_add_test(test_suite, "Single timer", TEST_single)
+			|| !CU_add_test(test_suite, "Remove", TEST_remove)
+			|| !CU_add_test(test_suite, "Clock going backwards", TEST_backwards)
+			|| !CU_add_test(test_suite, "Random", TEST_random)
+			|| !CU_add_test(test_suite, "Expire all", TEST_expire_all)
+			){
+
+		printf("Error adding Timer wheel CUnit tests.\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int fails;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	if(CU_initialize_registry() != CUE_SUCCESS){
+		printf("Error initializing CUnit registry.\n");
+		return 1;
+	}
+
+	if(0
+			|| init_timer_wheel_tests()
+			){
+
+		CU_cleanup_registry();
+		return 1;
+	}
+
+	CU_basic_set_mode(CU_BRM_VERBOSE);
+	CU_basic_run_tests();
+	fails = CU_get_number_of_failures();
+	CU_cleanup_registry();
+
+	return (int)fails;
+}